@@ -0,0 +1,169 @@
+// Бенчмарк файлов захвата со сжатием блоками (ws_writer.h, ws_capfile.h):
+// JSON в духе эхо-ответов test_server.py пишется через CaptureWriter без
+// сжатия (v2) и каждым собранным кодеком с 1, 2 и 4 потоками сжатия.
+// Для каждого случая - скорость append() в потоке сохранения и ожидания
+// свободного блока (если сжатие не успевает, захват тормозит), объем на
+// диске и степень сжатия, чтение всех сообщений подряд и одного
+// сообщения по случайному номеру.
+//
+// g++ -O2 -std=c++11 -pthread -o bench_compress bench/bench_compress.cpp -lz
+// (+ -DWS_WITH_ZSTD ... -lzstd, -DWS_WITH_LZ4 ... -llz4)
+// ./bench_compress [каталог для файлов, по умолчанию /tmp]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "../ws_writer.h"
+
+static const size_t MESSAGES = 2000000;
+static const size_t FLOWS = 1000;
+static const size_t RANDOM_READS = 2000;
+
+static const char* WORDS[] = {"hello", "test", "ping", "order", "price", "update", "status", "ok",
+                              "Сообщение", "JSON", "data", "subscribe", "ticker", "book", "trade", "ack"};
+
+// Сообщение number: запрос клиента или эхо-ответ сервера на него
+static std::string makePayload(size_t number, uint32_t& seed) {
+    char stamp[16];
+    snprintf(stamp, sizeof(stamp), "%02u:%02u:%02u", static_cast<unsigned>(number / 3600000 % 24),
+             static_cast<unsigned>(number / 60000 % 60), static_cast<unsigned>(number / 1000 % 60));
+    std::string original = "{\"action\": \"";
+    for (int i = 0; i < 3; i++) {
+        seed = seed * 1103515245 + 12345;
+        original += WORDS[(seed >> 16) % 16];
+        original += i < 2 ? " " : "\", \"id\": ";
+    }
+    seed = seed * 1103515245 + 12345;
+    original += std::to_string(number) + ", \"value\": " + std::to_string((seed >> 8) % 100000) + "}";
+    if (number % 2 == 0) return original;
+
+    std::string escaped;
+    for (size_t i = 0; i < original.size(); i++) {
+        if (original[i] == '"') escaped += '\\';
+        escaped += original[i];
+    }
+    return "{\"type\": \"echo\", \"original\": \"" + escaped + "\", \"timestamp\": \"" + stamp +
+           "\", \"client\": \"10.0.0." + std::to_string(number % FLOWS % 250) + ":" +
+           std::to_string(40000 + number % FLOWS) + "\", \"server\": \"Test WebSocket Server v1.0\"}";
+}
+
+static void makeMessage(size_t number, const std::string& payload, WebSocketMessage& msg) {
+    size_t flow = number / 2 % FLOWS;
+    msg.timestamp_ns = 1700000000000000000LL + static_cast<int64_t>(number) * 100000;
+    msg.is_masked = number % 2 == 0;
+    IpAddress client = ipv4Address(htonl(0x0a000000 + static_cast<uint32_t>(flow)));
+    IpAddress server = ipv4Address(htonl(0x0a0100fe));
+    uint16_t client_port = static_cast<uint16_t>(40000 + flow);
+    msg.src_ip = msg.is_masked ? client : server;
+    msg.dst_ip = msg.is_masked ? server : client;
+    msg.src_port = msg.is_masked ? client_port : 8765;
+    msg.dst_port = msg.is_masked ? 8765 : client_port;
+    msg.opcode = 0x1;
+    msg.payload = makeSpan(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+}
+
+static double since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void run(const char* name, const CompressionOptions& compression, const std::string& path,
+                const std::vector<std::string>& payloads) {
+    WriterOptions opts;
+    opts.path = path;
+    opts.compression = compression;
+    CaptureWriter writer;
+    std::string err;
+    if (!writer.open(opts, err)) {
+        std::cerr << err << std::endl;
+        return;
+    }
+    WebSocketMessage msg;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < MESSAGES; i++) {
+        makeMessage(i, payloads[i], msg);
+        writer.append(msg);
+    }
+    double append_s = since(t0);
+    writer.close();
+    double total_s = since(t0);
+
+    CaptureFile file;
+    if (!file.open(path, err)) {
+        std::cerr << err << std::endl;
+        return;
+    }
+    t0 = std::chrono::steady_clock::now();
+    uint64_t checksum = 0;
+    size_t read_ok = 0;
+    for (size_t i = 0; i < file.messageCount(); i++) {
+        if (!file.message(i, msg)) continue;
+        checksum += msg.payload.size() ? msg.payload[msg.payload.size() / 2] : 0;
+        read_ok++;
+    }
+    double read_s = since(t0);
+
+    uint32_t seed = 7;
+    t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < RANDOM_READS; i++) {
+        seed = seed * 1103515245 + 12345;
+        if (file.message(seed % file.messageCount(), msg)) checksum += msg.payload.size();
+    }
+    double random_s = since(t0);
+
+    if (read_ok != MESSAGES) {
+        std::cout << std::left << std::setw(16) << name << "ошибка чтения" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(16) << name << std::right << std::fixed
+              << std::setw(12) << std::setprecision(0) << MESSAGES / append_s
+              << std::setw(8) << writer.stalls()
+              << std::setw(10) << std::setprecision(2) << total_s
+              << std::setw(10) << std::setprecision(1) << file.fileSize() / (1024.0 * 1024.0)
+              << std::setw(8) << writer.rawBytes() / static_cast<double>(writer.bytesWritten())
+              << std::setw(12) << std::setprecision(0) << MESSAGES / read_s
+              << std::setw(12) << std::setprecision(1) << random_s / RANDOM_READS * 1e6
+              << (checksum == 0 ? " !" : "") << std::endl;
+    file.close();
+    unlink(path.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = std::string(argc > 1 ? argv[1] : "/tmp") + "/bench_compress.dat";
+    std::vector<std::string> payloads(MESSAGES);
+    uint32_t seed = 1;
+    uint64_t payload_bytes = 0;
+    for (size_t i = 0; i < MESSAGES; i++) {
+        payloads[i] = makePayload(i, seed);
+        payload_bytes += payloads[i].size();
+    }
+
+    std::cout << "Сообщений: " << MESSAGES << ", JSON в среднем " << payload_bytes / MESSAGES
+              << " байт, ядер: " << sysconf(_SC_NPROCESSORS_ONLN) << std::endl << std::endl;
+    std::cout << std::left << std::setw(16) << "case" << std::right << std::setw(12) << "append/s"
+              << std::setw(8) << "stalls" << std::setw(10) << "total s" << std::setw(10) << "file MB"
+              << std::setw(8) << "ratio" << std::setw(12) << "read/s" << std::setw(12) << "random us"
+              << std::endl;
+
+    CompressionOptions none;
+    none.codec = BLOCK_CODEC_NONE;
+    run("v2 none", none, path, payloads);
+
+    const char* specs[] = {"lz4", "zlib:1", "zlib:6", "zstd:1", "zstd:3"};
+    const unsigned threads[] = {1, 2, 4};
+    for (size_t s = 0; s < sizeof(specs) / sizeof(specs[0]); s++) {
+        CompressionOptions compression;
+        std::string err;
+        if (!parseCompression(specs[s], compression, err)) continue;  // кодек не собран
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            compression.threads = threads[t];
+            std::string name = std::string(specs[s]) + " x" + std::to_string(threads[t]);
+            run(name.c_str(), compression, path, payloads);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,545 @@
+// Микробенчмарк горячего пути декодера (ws_decoder.h) отдельно от
+// захвата: разбор фрейма, распаковка permessage-deflate, распознавание
+// Upgrade, поиск шаблонов (PatternMatcher) и полный путь processPacket.
+// Фреймы без маски и с маской, длина в 7, 16 и 64 бита, сжатые и нет,
+// payload от 8 Б до 8 МБ. Для каждого случая - ns/фрейм, GB/s payload
+// и аллокаций на фрейм.
+//
+// g++ -O2 -std=c++11 -o bench_decoder bench/bench_decoder.cpp -lz
+//
+// Нужны заголовки libpcap (struct pcap_pkthdr); сама библиотека не
+// линкуется - захвата здесь нет.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <zlib.h>
+#include "../ws_decoder.h"
+
+static size_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    g_allocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void* operator new[](size_t size) {
+    g_allocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete[](void* p) noexcept { free(p); }
+
+static const uint8_t MASK[4] = {0x37, 0xfa, 0x21, 0x3d};
+static const size_t MSS = 1448;
+
+// Текст из небольшого алфавита, как в JSON торговых сообщений: deflate
+// его сжимает, но не вырожденно
+static std::vector<uint8_t> makePayload(size_t len) {
+    static const char alphabet[] = "{\"id\":,\"price\":\"qty\":}0123456789.";
+    std::vector<uint8_t> p(len);
+    srand(static_cast<unsigned>(len));
+    for (size_t i = 0; i < len; i++) {
+        p[i] = static_cast<uint8_t>(alphabet[rand() % (sizeof(alphabet) - 1)]);
+    }
+    return p;
+}
+
+// permessage-deflate: raw deflate с Z_SYNC_FLUSH без хвоста 00 00 ff ff
+static std::vector<uint8_t> deflateMessage(const std::vector<uint8_t>& data) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    std::vector<uint8_t> out(deflateBound(&zs, data.size()) + 16);
+    zs.next_in = const_cast<Bytef*>(data.data());
+    zs.avail_in = static_cast<uInt>(data.size());
+    zs.next_out = out.data();
+    zs.avail_out = static_cast<uInt>(out.size());
+    deflate(&zs, Z_SYNC_FLUSH);
+    out.resize(out.size() - zs.avail_out - 4);
+    deflateEnd(&zs);
+    return out;
+}
+
+static std::vector<uint8_t> makeFrame(const std::vector<uint8_t>& payload, bool masked, bool compressed) {
+    std::vector<uint8_t> f;
+    f.push_back(static_cast<uint8_t>(0x80 | (compressed ? 0x40 : 0) | 0x1));
+    uint8_t m = masked ? 0x80 : 0;
+    uint64_t n = payload.size();
+    if (n < 126) {
+        f.push_back(static_cast<uint8_t>(m | n));
+    } else if (n < 65536) {
+        f.push_back(m | 126);
+        f.push_back(static_cast<uint8_t>(n >> 8));
+        f.push_back(static_cast<uint8_t>(n));
+    } else {
+        f.push_back(m | 127);
+        for (int i = 7; i >= 0; i--) f.push_back(static_cast<uint8_t>(n >> (8 * i)));
+    }
+    if (masked) f.insert(f.end(), MASK, MASK + 4);
+    for (size_t i = 0; i < payload.size(); i++) {
+        f.push_back(masked ? payload[i] ^ MASK[i % 4] : payload[i]);
+    }
+    return f;
+}
+
+static const char* lengthForm(size_t len) {
+    return len < 126 ? "7" : len < 65536 ? "16" : "64";
+}
+
+static std::string sizeLabel(size_t len) {
+    if (len >= (1 << 20) && len % (1 << 20) == 0) return std::to_string(len >> 20) + " MB";
+    if (len >= 1024 && len % 1024 == 0) return std::to_string(len >> 10) + " KB";
+    return std::to_string(len) + " B";
+}
+
+// Сколько фреймов прогнать: ~64 МБ payload, но не больше 1 млн и не меньше 8
+static size_t frameCount(size_t len) {
+    size_t n = (size_t(64) << 20) / len;
+    if (n > 1000000) n = 1000000;
+    if (n < 8) n = 8;
+    return n;
+}
+
+struct Result {
+    double ns;         // на фрейм
+    double allocs;     // на фрейм
+    size_t bytes;      // payload одного фрейма
+};
+
+static void printHeader(const char* title) {
+    std::cout << std::endl << title << std::endl;
+    std::cout << std::left << std::setw(12) << "case" << std::setw(10) << "size"
+              << std::right << std::setw(6) << "len" << std::setw(14) << "ns/frame"
+              << std::setw(10) << "GB/s" << std::setw(14) << "allocs/frame" << std::endl;
+}
+
+static void printRow(const char* name, size_t len, const Result& r) {
+    std::cout << std::left << std::setw(12) << name << std::setw(10) << sizeLabel(len)
+              << std::right << std::setw(6) << lengthForm(len)
+              << std::setw(14) << std::fixed << std::setprecision(1) << r.ns
+              << std::setw(10) << std::setprecision(2) << r.bytes / r.ns
+              << std::setw(14) << std::setprecision(3) << r.allocs << std::endl;
+}
+
+// parseWebSocketFrame на фрейме, целиком лежащем в буфере. Арены
+// переиспользуются (setRecycle), как при потоковой записи.
+static bool benchParse(size_t len, bool masked, Result& r) {
+    std::vector<uint8_t> payload = makePayload(len);
+    std::vector<uint8_t> wire = makeFrame(payload, masked, false);
+    WebSocketDecoder decoder;
+    decoder.setRecycle(true);
+    WebSocketMessage msg;
+    size_t consumed = 0;
+
+    if (decoder.parseWebSocketFrame(wire.data(), wire.size(), msg, consumed) != WebSocketDecoder::FRAME_OK ||
+        consumed != wire.size() || msg.payload.size() != len ||
+        memcmp(msg.payload.data(), payload.data(), len) != 0) {
+        return false;
+    }
+
+    size_t iters = frameCount(len);
+    size_t allocs0 = g_allocs;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; i++) {
+        decoder.parseWebSocketFrame(wire.data(), wire.size(), msg, consumed);
+        decoder.recycleArena();
+        __asm__ __volatile__("" : : "r"(msg.payload.data()) : "memory");
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    r.ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+    r.allocs = double(g_allocs - allocs0) / iters;
+    r.bytes = len;
+    return true;
+}
+
+// Распаковка одного сообщения и копия результата в арену - то, что
+// декодер делает со сжатым фреймом после разбора
+static bool benchInflate(size_t len, Result& r) {
+    std::vector<uint8_t> payload = makePayload(len);
+    std::vector<uint8_t> compressed = deflateMessage(payload);
+    InflatePool pool;
+    Inflater inflater;
+    inflater.no_context_takeover = true;
+    PayloadArena arena;
+    size_t out_len = 0;
+    size_t limit = static_cast<size_t>(-1);
+    uint64_t discarded = 0;
+
+    if (!inflater.decompress(pool, compressed.data(), compressed.size(), out_len, limit, discarded) ||
+        out_len != len || memcmp(pool.outputBuffer().data(), payload.data(), len) != 0) {
+        return false;
+    }
+
+    size_t iters = frameCount(len);
+    size_t allocs0 = g_allocs;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; i++) {
+        inflater.decompress(pool, compressed.data(), compressed.size(), out_len, limit, discarded);
+        arena.copy(pool.outputBuffer().data(), out_len);
+        if (arena.bytesReserved() >= (size_t(16) << 20)) arena.clear();
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    r.ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+    r.allocs = double(g_allocs - allocs0) / iters;
+    r.bytes = len;
+    return true;
+}
+
+// Смена соединений: FLOWS контекстов на одном пуле, каждый распаковывает
+// сообщение и сбрасывается (конец соединения), так что блоки zlib
+// переходят от соединения к соединению через пул. Результат каждой
+// распаковки сверяется с исходным payload.
+static bool benchInflateFlows(size_t len, Result& r) {
+    static const size_t FLOWS = 64;
+    std::vector<uint8_t> payload = makePayload(len);
+    std::vector<uint8_t> compressed = deflateMessage(payload);
+    InflatePool pool;
+    std::vector<Inflater> inflaters(FLOWS);
+    size_t out_len = 0;
+    size_t limit = static_cast<size_t>(-1);
+    uint64_t discarded = 0;
+
+    size_t rounds = frameCount(len) / FLOWS;
+    if (rounds < 1) rounds = 1;
+    size_t allocs0 = 0;
+    std::chrono::steady_clock::time_point t0;
+    for (size_t round = 0; round <= rounds; round++) {
+        if (round == 1) {  // первый круг наполняет пул
+            allocs0 = g_allocs;
+            t0 = std::chrono::steady_clock::now();
+        }
+        for (size_t f = 0; f < FLOWS; f++) {
+            if (!inflaters[f].decompress(pool, compressed.data(), compressed.size(), out_len, limit, discarded) ||
+                out_len != len || memcmp(pool.outputBuffer().data(), payload.data(), len) != 0) {
+                return false;
+            }
+            inflaters[f].reset();
+        }
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    r.ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / (rounds * FLOWS);
+    r.allocs = double(g_allocs - allocs0) / (rounds * FLOWS);
+    r.bytes = len;
+    return true;
+}
+
+// Поиск шаблонов по payload, как в декодере после распаковки: автомат
+// из patterns шаблонов - случайные слова и несколько кусков самого
+// payload, чтобы совпадения были, но редкие
+struct HitCounter {
+    size_t hits;
+    void operator()(uint32_t, uint64_t) { hits++; }
+};
+
+static bool buildMatcher(PatternMatcher& matcher, size_t patterns) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz_";
+    srand(42);
+    for (size_t i = 0; i < patterns; i++) {
+        std::string word;
+        size_t len = 5 + rand() % 12;
+        for (size_t j = 0; j < len; j++) word += letters[rand() % (sizeof(letters) - 1)];
+        matcher.addPattern(word);
+    }
+    std::vector<uint8_t> sample = makePayload(4096);
+    for (size_t i = 0; i < 16; i++) {
+        matcher.addPattern(std::string(reinterpret_cast<const char*>(&sample[i * 256]), 12));
+    }
+    std::string err;
+    return matcher.build(err);
+}
+
+static bool benchMatch(const PatternMatcher& matcher, size_t len, Result& r) {
+    std::vector<uint8_t> payload = makePayload(len);
+    HitCounter counter = {0};
+    matcher.scan(0, payload.data(), len, 0, counter);
+    size_t expected = counter.hits;
+
+    size_t iters = frameCount(len);
+    size_t allocs0 = g_allocs;
+    counter.hits = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; i++) {
+        matcher.scan(0, payload.data(), len, 0, counter);
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    if (counter.hits != expected * iters) return false;
+    r.ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+    r.allocs = double(g_allocs - allocs0) / iters;
+    r.bytes = len;
+    return true;
+}
+
+// Ethernet + IPv4 + TCP без опций
+static const size_t HEADERS_LEN = 14 + 20 + 20;
+
+struct PacketStream {
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+    std::vector<struct pcap_pkthdr> headers;
+    uint32_t seq[2];
+
+    PacketStream() {
+        seq[0] = 1000;
+        seq[1] = 5000;
+    }
+
+    // dir 0 - клиент 10.0.0.1:40000 -> сервер 10.0.0.2:8765
+    void add(int dir, uint8_t flags, const uint8_t* payload, size_t len) {
+        size_t off = data.size();
+        data.resize(off + HEADERS_LEN + len);
+        uint8_t* p = &data[off];
+        memset(p, 0, HEADERS_LEN);
+        p[12] = 0x08;
+        uint8_t* ip = p + 14;
+        ip[0] = 0x45;
+        uint16_t total = htons(static_cast<uint16_t>(40 + len));
+        memcpy(ip + 2, &total, 2);
+        ip[8] = 64;
+        ip[9] = IPPROTO_TCP;
+        uint32_t addr[2] = {htonl(0x0a000001), htonl(0x0a000002)};
+        memcpy(ip + 12, &addr[dir], 4);
+        memcpy(ip + 16, &addr[1 - dir], 4);
+        uint8_t* tcp = ip + 20;
+        uint16_t ports[2] = {htons(40000), htons(8765)};
+        memcpy(tcp, &ports[dir], 2);
+        memcpy(tcp + 2, &ports[1 - dir], 2);
+        uint32_t s = htonl(seq[dir]);
+        memcpy(tcp + 4, &s, 4);
+        tcp[12] = 0x50;
+        tcp[13] = flags;
+        if (len) memcpy(p + HEADERS_LEN, payload, len);
+
+        seq[dir] += static_cast<uint32_t>(len) + ((flags & TH_SYN) ? 1 : 0);
+        struct pcap_pkthdr h;
+        h.ts.tv_sec = 1700000000;
+        h.ts.tv_usec = static_cast<suseconds_t>(headers.size() % 1000000);
+        h.caplen = h.len = static_cast<bpf_u_int32>(HEADERS_LEN + len);
+        offsets.push_back(off);
+        headers.push_back(h);
+    }
+
+    // Сегменты по MSS; мелкие фреймы - по одному в сегменте
+    void addStream(int dir, const std::vector<uint8_t>& bytes) {
+        for (size_t off = 0; off < bytes.size(); off += MSS) {
+            size_t n = bytes.size() - off < MSS ? bytes.size() - off : MSS;
+            add(dir, TH_PUSH | TH_ACK, bytes.data() + off, n);
+        }
+    }
+
+    size_t size() const { return headers.size(); }
+    const u_char* packet(size_t i) const { return &data[offsets[i]]; }
+};
+
+// Полный путь: разбор заголовков, сборка TCP-потока, фреймы, распаковка.
+// Каждый проход - новый декодер и новое соединение (рукопожатие не
+// замеряется), сообщения забираются пачками, как в потоке-декодере.
+// С metrics декодер ведет счетчики и время разбора (--metrics-port).
+static bool benchPackets(size_t len, bool compressed, Result& r, DecoderMetrics* metrics = nullptr) {
+    std::vector<uint8_t> payload = makePayload(len);
+    std::vector<uint8_t> body = compressed ? deflateMessage(payload) : payload;
+    std::vector<uint8_t> wire = makeFrame(body, true, compressed);
+
+    std::string request = "GET /ws HTTP/1.1\r\nHost: bench\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                           "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGJzhZRbK+xOo=\r\n";
+    if (compressed) response += "Sec-WebSocket-Extensions: permessage-deflate\r\n";
+    response += "\r\n";
+
+    PacketStream handshake;
+    handshake.add(0, TH_SYN, nullptr, 0);
+    handshake.add(1, TH_SYN | TH_ACK, nullptr, 0);
+    handshake.add(0, TH_PUSH | TH_ACK, reinterpret_cast<const uint8_t*>(request.data()), request.size());
+    handshake.add(1, TH_PUSH | TH_ACK, reinterpret_cast<const uint8_t*>(response.data()), response.size());
+
+    // Кадры одного прохода - не больше ~16 МБ в памяти
+    size_t total = frameCount(len);
+    size_t per_pass = (size_t(16) << 20) / wire.size();
+    if (per_pass < 4) per_pass = 4;
+    if (per_pass > total) per_pass = total;
+    size_t passes = (total + per_pass - 1) / per_pass;
+
+    PacketStream frames;
+    frames.seq[0] = handshake.seq[0];
+    frames.seq[1] = handshake.seq[1];
+    for (size_t i = 0; i < per_pass; i++) frames.addStream(0, wire);
+
+    std::vector<WebSocketMessage> out;
+    double ns = 0;
+    size_t allocs = 0;
+    for (size_t pass = 0; pass < passes; pass++) {
+        WebSocketDecoder decoder;
+        decoder.setRecycle(true);
+        decoder.setMetrics(metrics);
+        for (size_t i = 0; i < handshake.size(); i++) {
+            decoder.processPacket(&handshake.headers[i], handshake.packet(i));
+        }
+
+        size_t messages = 0;
+        size_t allocs0 = g_allocs;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < frames.size(); i++) {
+            decoder.processPacket(&frames.headers[i], frames.packet(i));
+            if ((i & 63) == 63 || i + 1 == frames.size()) {
+                uint32_t gen = decoder.currentGeneration();
+                decoder.takeMessages(out);
+                messages += out.size();
+                decoder.acknowledge(gen, out.size());
+                decoder.recycleArena();
+            }
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+        allocs += g_allocs - allocs0;
+
+        if (messages != per_pass || out.empty() || out.back().payload.size() != len ||
+            memcmp(out.back().payload.data(), payload.data(), len) != 0) {
+            return false;
+        }
+    }
+    r.ns = ns / (per_pass * passes);
+    r.allocs = double(allocs) / (per_pass * passes);
+    r.bytes = len;
+    return true;
+}
+
+// Распознавание рукопожатия: начало HTTP, конец заголовка, Upgrade и
+// параметры расширений - то, что проходит каждый HTTP-сегмент
+static void benchUpgrade() {
+    const std::string samples[2] = {
+        "GET /ws HTTP/1.1\r\nHost: example.com\r\nUser-Agent: bench\r\nUpgrade: websocket\r\n"
+        "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n",
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGJzhZRbK+xOo=\r\n"
+        "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover\r\n\r\n"
+    };
+    const char* names[2] = {"request", "response"};
+
+    std::cout << std::endl << "isWebSocketUpgrade + Sec-WebSocket-Extensions" << std::endl;
+    std::cout << std::left << std::setw(12) << "case" << std::setw(10) << "size"
+              << std::right << std::setw(14) << "ns/op" << std::setw(14) << "allocs/op" << std::endl;
+
+    std::string ext;
+    for (int s = 0; s < 2; s++) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(samples[s].data());
+        size_t len = samples[s].size();
+        const size_t ITERS = 2000000;
+        size_t found = 0;
+        size_t allocs0 = g_allocs;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERS; i++) {
+            const void* end = memmem(data, len, "\r\n\r\n", 4);
+            if (end && isWebSocketUpgrade(data, len) &&
+                findHttpHeader(data, len, "Sec-WebSocket-Extensions", ext)) {
+                found++;
+            }
+            __asm__ __volatile__("" : : "r"(ext.data()) : "memory");
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        if (found != ITERS) {
+            std::cerr << "❌ " << names[s] << ": рукопожатие не распознано" << std::endl;
+            exit(1);
+        }
+        std::cout << std::left << std::setw(12) << names[s] << std::setw(10) << sizeLabel(len)
+                  << std::right << std::setw(14) << std::fixed << std::setprecision(1)
+                  << std::chrono::duration<double, std::nano>(t1 - t0).count() / ITERS
+                  << std::setw(14) << std::setprecision(3) << double(g_allocs - allocs0) / ITERS << std::endl;
+    }
+}
+
+int main() {
+    // Границы форм длины: 125 - последняя 7-битная, 65535 - 16-битная
+    const size_t sizes[] = {8, 125, 126, 1024, 16 * 1024, 65535, 65536,
+                            1024 * 1024, 8 * 1024 * 1024};
+    const size_t count = sizeof(sizes) / sizeof(sizes[0]);
+    Result r;
+
+    printHeader("parseWebSocketFrame (фрейм целиком в буфере)");
+    for (size_t i = 0; i < count; i++) {
+        for (int masked = 0; masked < 2; masked++) {
+            if (!benchParse(sizes[i], masked != 0, r)) {
+                std::cerr << "❌ parse " << sizeLabel(sizes[i]) << ": неверный результат" << std::endl;
+                return 1;
+            }
+            printRow(masked ? "masked" : "unmasked", sizes[i], r);
+        }
+    }
+
+    printHeader("Inflater::decompress (permessage-deflate, GB/s распакованных данных)");
+    for (size_t i = 0; i < count; i++) {
+        if (!benchInflate(sizes[i], r)) {
+            std::cerr << "❌ inflate " << sizeLabel(sizes[i]) << ": неверный результат" << std::endl;
+            return 1;
+        }
+        printRow("inflate", sizes[i], r);
+    }
+
+    printHeader("Inflater::decompress + reset, 64 соединения на одном пуле");
+    for (size_t i = 0; i < count; i++) {
+        if (!benchInflateFlows(sizes[i], r)) {
+            std::cerr << "❌ inflate flows " << sizeLabel(sizes[i]) << ": неверный результат" << std::endl;
+            return 1;
+        }
+        printRow("flows", sizes[i], r);
+    }
+
+    const size_t pattern_counts[] = {100, 2000, 10000};
+    for (size_t k = 0; k < sizeof(pattern_counts) / sizeof(pattern_counts[0]); k++) {
+        PatternMatcher matcher;
+        if (!buildMatcher(matcher, pattern_counts[k])) {
+            std::cerr << "❌ PatternMatcher: автомат не построен" << std::endl;
+            return 1;
+        }
+        std::string title = "PatternMatcher::scan (" + std::to_string(matcher.patternCount()) + " шаблонов, " +
+                            std::to_string(matcher.stateCount()) + " состояний, таблица " +
+                            std::to_string(matcher.tableBytes() / 1024) + " КБ)";
+        printHeader(title.c_str());
+        for (size_t i = 0; i < count; i++) {
+            if (!benchMatch(matcher, sizes[i], r)) {
+                std::cerr << "❌ scan " << sizeLabel(sizes[i]) << ": неверный результат" << std::endl;
+                return 1;
+            }
+            printRow("scan", sizes[i], r);
+        }
+    }
+
+    printHeader("processPacket (Ethernet/IPv4/TCP, MSS 1448, фреймы клиента с маской)");
+    for (size_t i = 0; i < count; i++) {
+        for (int compressed = 0; compressed < 2; compressed++) {
+            if (!benchPackets(sizes[i], compressed != 0, r)) {
+                std::cerr << "❌ processPacket " << sizeLabel(sizes[i]) << ": неверный результат" << std::endl;
+                return 1;
+            }
+            printRow(compressed ? "deflate" : "plain", sizes[i], r);
+        }
+    }
+
+    printHeader("processPacket со счетчиками и гистограммами (--metrics-port)");
+    for (size_t i = 0; i < count; i++) {
+        for (int compressed = 0; compressed < 2; compressed++) {
+            DecoderMetrics metrics;
+            bool ok = benchPackets(sizes[i], compressed != 0, r, &metrics) &&
+                      metrics.frames[0x1].get() > 0 && metrics.parse_time.count() > 0 &&
+                      (!compressed || metrics.inflate_time.count() == metrics.frames[0x1].get());
+            if (!ok) {
+                std::cerr << "❌ processPacket с метриками " << sizeLabel(sizes[i]) << ": неверный результат" << std::endl;
+                return 1;
+            }
+            printRow(compressed ? "deflate" : "plain", sizes[i], r);
+        }
+    }
+
+    benchUpgrade();
+    return 0;
+}
@@ -0,0 +1,179 @@
+// Бенчмарк экспорта в Apache Arrow IPC (ws_arrow.h): сообщения из памяти
+// (--arrow во время захвата) и из файла v2 через mmap (--export-arrow).
+// Для каждого случая - сообщений в секунду, МБ/с payload, размер файла и
+// прирост анонимной памяти (без страниц отображенного файла) к концу
+// экспорта: он не должен зависеть от числа сообщений.
+//
+// g++ -O2 -std=c++11 -pthread -o bench_export bench/bench_export.cpp -lz
+// ./bench_export [каталог для файлов, по умолчанию /tmp]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../ws_arrow.h"
+#include "../ws_writer.h"
+
+static long anonKb() {
+    long anon = 0;
+    FILE* f = fopen("/proc/self/status", "r");
+    char line[256];
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "RssAnon: %ld", &anon) == 1) break;
+    }
+    if (f) fclose(f);
+    return anon;
+}
+
+static const size_t FLOWS = 1000;
+
+// Сообщение number: 1000 соединений, payload 20-2000 байт из общего буфера
+static void makeMessage(size_t number, const std::vector<uint8_t>& text, WebSocketMessage& msg) {
+    size_t flow = (number * 7919) % FLOWS;
+    msg.timestamp_ns = 1700000000000000000LL + static_cast<int64_t>(number) * 1000;
+    msg.is_masked = number % 2 == 0;
+    IpAddress client = ipv4Address(htonl(0x0a000000 + static_cast<uint32_t>(flow)));
+    IpAddress server = ipv4Address(htonl(0x0a0100fe));
+    uint16_t client_port = static_cast<uint16_t>(40000 + flow);
+    msg.src_ip = msg.is_masked ? client : server;
+    msg.dst_ip = msg.is_masked ? server : client;
+    msg.src_port = msg.is_masked ? client_port : 8765;
+    msg.dst_port = msg.is_masked ? 8765 : client_port;
+    msg.opcode = number % 50 == 0 ? 0x9 : (number % 5 == 0 ? 0x2 : 0x1);
+    msg.is_compressed = number % 3 == 0;
+    size_t len = 20 + (number * 2654435761u) % 1981;
+    msg.payload = makeSpan(text.data() + number % 64, len);
+}
+
+struct Result {
+    double seconds;
+    uint64_t rows;
+    uint64_t payload_bytes;
+    uint64_t file_bytes;
+    long anon_kb;  // прирост к концу экспорта, до close
+};
+
+// Каждый случай - в отдельном процессе, чтобы память не смешивалась
+template <typename Fn>
+static void measure(const char* name, Fn fn) {
+    std::cout.flush();
+    int pipefd[2];
+    if (pipe(pipefd) != 0) return;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pipefd[0]);
+        Result r = fn(anonKb());
+        ssize_t n = write(pipefd[1], &r, sizeof(r));
+        _exit(n == sizeof(r) ? 0 : 1);
+    }
+    close(pipefd[1]);
+    Result r;
+    bool ok = read(pipefd[0], &r, sizeof(r)) == sizeof(r);
+    close(pipefd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!ok || r.rows == 0) {
+        std::cout << std::left << std::setw(22) << name << "ошибка" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(22) << name << std::right
+              << std::setw(10) << r.rows
+              << std::setw(14) << std::fixed << std::setprecision(0) << r.rows / r.seconds
+              << std::setw(10) << std::setprecision(0) << r.payload_bytes / r.seconds / (1024 * 1024)
+              << std::setw(12) << std::setprecision(1) << r.file_bytes / (1024.0 * 1024.0)
+              << std::setw(12) << r.anon_kb / 1024.0 << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string arrow_path = dir + "/bench_export.arrow";
+    std::vector<uint8_t> text(4096);
+    for (size_t i = 0; i < text.size(); i++) {
+        text[i] = static_cast<uint8_t>("{\"id\":,\"price\":\"qty\":}0123456789."[i % 34]);
+    }
+
+    std::cout << "Соединений: " << FLOWS << ", payload 20-2000 байт" << std::endl << std::endl;
+    std::cout << std::left << std::setw(22) << "case" << std::right << std::setw(10) << "messages"
+              << std::setw(14) << "msg/s" << std::setw(10) << "MB/s" << std::setw(12) << "file MB"
+              << std::setw(12) << "anon MB" << std::endl;
+
+    const size_t counts[] = {100000, 1000000, 4000000};
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        size_t count = counts[c];
+        std::string name = "memory " + std::to_string(count / 1000) + "K";
+        measure(name.c_str(), [&](long anon0) {
+            Result r = Result();
+            ArrowExportOptions opts;
+            opts.path = arrow_path;
+            ArrowExportWriter writer;
+            std::string err;
+            if (!writer.open(opts, err)) return r;
+            WebSocketMessage msg;
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; i++) {
+                makeMessage(i, text, msg);
+                writer.append(msg);
+                r.payload_bytes += msg.payload.size();
+            }
+            r.anon_kb = anonKb() - anon0;
+            if (!writer.close(err)) return r;
+            r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            r.rows = writer.rows();
+            r.file_bytes = writer.bytesWritten();
+            return r;
+        });
+    }
+
+    // Файл v2 для --export-arrow пишется заранее, вне замера
+    const size_t DAT_MESSAGES = 1000000;
+    WriterOptions wopts;
+    wopts.prefix = dir + "/bench_export";
+    wopts.rotate_bytes = 0;
+    wopts.rotate_seconds = 0;
+    CaptureWriter capture;
+    std::string err;
+    if (!capture.open(wopts, err)) {
+        std::cerr << err << std::endl;
+        return 1;
+    }
+    WebSocketMessage msg;
+    for (size_t i = 0; i < DAT_MESSAGES; i++) {
+        makeMessage(i, text, msg);
+        capture.append(msg);
+    }
+    capture.close();
+    std::string dat_path = capture.files().empty() ? "" : capture.files()[0];
+
+    measure(".dat 1000K (mmap)", [&](long anon0) {
+        Result r = Result();
+        CaptureFile file;
+        std::string err;
+        if (!file.open(dat_path, err)) return r;
+        ArrowExportOptions opts;
+        opts.path = arrow_path;
+        ArrowExportWriter writer;
+        if (!writer.open(opts, err)) return r;
+        WebSocketMessage m;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < file.messageCount(); i++) {
+            if (!file.message(i, m)) continue;
+            writer.append(m);
+            r.payload_bytes += m.payload.size();
+        }
+        r.anon_kb = anonKb() - anon0;
+        if (!writer.close(err)) return r;
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        r.rows = writer.rows();
+        r.file_bytes = writer.bytesWritten();
+        return r;
+    });
+
+    unlink(arrow_path.c_str());
+    unlink(dat_path.c_str());
+    return 0;
+}
@@ -0,0 +1,209 @@
+// Бенчмарк хранения перехваченных сообщений: аллокации на сообщение и
+// RSS на миллион сообщений для прежней схемы (строки + vector payload +
+// копирование структуры в push_back), для арены с записями фиксированного
+// размера (ws_message.h) и для MessageStore (ws_retention.h) без предела
+// и с --keep-mb 64.
+//
+// g++ -O2 -std=c++11 -pthread -o bench_storage bench/bench_storage.cpp -lz
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "../ws_message.h"
+#include "../ws_unmask.h"
+#include "../ws_retention.h"
+
+static size_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    g_allocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void* operator new[](size_t size) {
+    g_allocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete[](void* p) noexcept { free(p); }
+
+static long rssKb() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    long pages = 0, resident = 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Сообщение в том виде, в каком оно было до арены
+struct LegacyMessage {
+    std::string timestamp;
+    std::string src_ip;
+    std::string dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    std::vector<uint8_t> payload;
+    bool is_masked;
+    bool is_compressed;
+    uint8_t opcode;
+};
+
+static const size_t MESSAGES = 1000000;
+
+// Замаскированные фреймы чатового размера (20-200 байт payload)
+static std::vector<uint8_t> makeWire(std::vector<size_t>& sizes) {
+    std::vector<uint8_t> wire;
+    srand(1);
+    for (size_t i = 0; i < MESSAGES; i++) {
+        size_t n = 20 + rand() % 181;
+        sizes.push_back(n);
+        for (size_t j = 0; j < n; j++) wire.push_back(static_cast<uint8_t>('a' + j % 26));
+    }
+    return wire;
+}
+
+static void runLegacy(const std::vector<uint8_t>& wire, const std::vector<size_t>& sizes) {
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    std::vector<LegacyMessage> captured_messages;
+    struct in_addr addr;
+    addr.s_addr = htonl(0x7f000001);
+    size_t off = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        LegacyMessage msg;
+        std::vector<uint8_t> raw_payload(sizes[i]);
+        for (size_t j = 0; j < sizes[i]; j++) raw_payload[j] = wire[off + j] ^ mask[j % 4];
+        off += sizes[i];
+        msg.payload = raw_payload;
+        msg.src_ip = inet_ntoa(addr);
+        msg.dst_ip = inet_ntoa(addr);
+        msg.src_port = 40000;
+        msg.dst_port = 8765;
+        time_t now = time(nullptr);
+        msg.timestamp = ctime(&now);
+        msg.timestamp.pop_back();
+        msg.opcode = 1;
+        msg.is_masked = true;
+        msg.is_compressed = false;
+        captured_messages.push_back(msg);
+    }
+}
+
+static void runArena(const std::vector<uint8_t>& wire, const std::vector<size_t>& sizes) {
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    PayloadArena arena;
+    std::vector<WebSocketMessage> captured_messages;
+    size_t off = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        WebSocketMessage msg;
+        uint8_t* dst = arena.allocate(sizes[i]);
+        unmaskPayload(dst, wire.data() + off, sizes[i], mask, 0);
+        off += sizes[i];
+        msg.payload = makeSpan(dst, sizes[i]);
+        msg.src_ip = ipv4Address(htonl(0x7f000001));
+        msg.dst_ip = ipv4Address(htonl(0x7f000001));
+        msg.src_port = 40000;
+        msg.dst_port = 8765;
+        msg.timestamp_ns = 1700000000000000000LL + static_cast<int64_t>(i) * 1000;  // время из заголовка пакета
+        msg.opcode = 1;
+        msg.is_masked = true;
+        msg.is_compressed = false;
+        captured_messages.push_back(msg);
+    }
+}
+
+// Сообщение, как его отдает декодер: payload в арене декодера, которую
+// MessageStore копирует в свои куски
+static void runStore(const std::vector<uint8_t>& wire, const std::vector<size_t>& sizes, uint64_t max_bytes) {
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    RetentionOptions opts;
+    opts.max_bytes = max_bytes;
+    MessageStore captured_messages;
+    std::string err;
+    captured_messages.configure(opts, err);
+    std::vector<uint8_t> decoded(256);
+    size_t off = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        WebSocketMessage msg;
+        unmaskPayload(decoded.data(), wire.data() + off, sizes[i], mask, 0);
+        off += sizes[i];
+        msg.payload = makeSpan(decoded.data(), sizes[i]);
+        msg.src_ip = ipv4Address(htonl(0x7f000001));
+        msg.dst_ip = ipv4Address(htonl(0x7f000001));
+        msg.src_port = 40000;
+        msg.dst_port = 8765;
+        msg.timestamp_ns = 1700000000000000000LL + static_cast<int64_t>(i) * 1000;
+        msg.opcode = 1;
+        msg.is_masked = true;
+        msg.is_compressed = false;
+        captured_messages.add(msg);
+    }
+}
+
+static void runStoreUnbounded(const std::vector<uint8_t>& wire, const std::vector<size_t>& sizes) {
+    runStore(wire, sizes, 0);
+}
+
+static void runStoreRing(const std::vector<uint8_t>& wire, const std::vector<size_t>& sizes) {
+    runStore(wire, sizes, 64ull * 1024 * 1024);
+}
+
+// Каждый вариант - в отдельном процессе, чтобы RSS не смешивался
+static void measure(const char* name, void (*fn)(const std::vector<uint8_t>&, const std::vector<size_t>&),
+                    const std::vector<uint8_t>& wire, const std::vector<size_t>& sizes) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        long rss0 = rssKb();
+        size_t allocs0 = g_allocs;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        fn(wire, sizes);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        // fn уже все освободил; пик RSS виден в VmHWM
+        long hwm = 0;
+        FILE* f = fopen("/proc/self/status", "r");
+        char line[256];
+        while (f && fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmHWM: %ld", &hwm) == 1) break;
+        }
+        if (f) fclose(f);
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / MESSAGES;
+        std::cout << std::left << std::setw(10) << name << std::right
+                  << std::setw(14) << std::fixed << std::setprecision(2)
+                  << double(g_allocs - allocs0) / MESSAGES
+                  << std::setw(16) << (hwm - rss0) / 1024.0
+                  << std::setw(14) << ns << std::endl;
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+int main() {
+    std::vector<size_t> sizes;
+    std::vector<uint8_t> wire = makeWire(sizes);
+
+    std::cout << "Сообщений: " << MESSAGES << ", payload 20-200 байт" << std::endl;
+    std::cout << "Размер записи: " << sizeof(LegacyMessage) << " -> "
+              << sizeof(WebSocketMessage) << " байт" << std::endl << std::endl;
+    std::cout << std::left << std::setw(10) << "storage" << std::right
+              << std::setw(14) << "allocs/msg" << std::setw(16) << "RSS MB/1M msg"
+              << std::setw(14) << "ns/msg" << std::endl;
+    measure("legacy", runLegacy, wire, sizes);
+    measure("arena", runArena, wire, sizes);
+    measure("store", runStoreUnbounded, wire, sizes);
+    measure("ring 64MB", runStoreRing, wire, sizes);
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Микробенчмарк снятия маски WebSocket: исходный побайтовый цикл из
+// parseWebSocketFrame против ws_unmask.h на payload от 16 Б до 16 МБ.
+//
+// g++ -O2 -std=c++11 -o bench_unmask bench/bench_unmask.cpp
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "../ws_unmask.h"
+
+// Цикл в том виде, в каком он был в parseWebSocketFrame
+static void unmaskOriginal(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask, size_t) {
+    volatile bool is_masked = true;  // ветка внутри цикла, как в исходном коде
+    for (size_t i = 0; i < len; i++) {
+        if (is_masked) {
+            dst[i] = src[i] ^ mask[i % 4];
+        } else {
+            dst[i] = src[i];
+        }
+    }
+}
+
+struct Variant {
+    const char* name;
+    UnmaskFn fn;
+};
+
+static double runOne(UnmaskFn fn, uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask) {
+    // Столько повторов, чтобы прогнать ~256 МБ, но не меньше 3
+    size_t iters = (size_t(256) << 20) / len;
+    if (iters < 3) iters = 3;
+
+    fn(dst, src, len, mask, 0);  // прогрев
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; i++) {
+        fn(dst, src, len, mask, i & 3);
+        __asm__ __volatile__("" : : "r"(dst) : "memory");
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+}
+
+int main() {
+    const char* selected = "";
+    selectUnmask(&selected);
+
+    std::vector<Variant> variants;
+    Variant v;
+    v.name = "original"; v.fn = unmaskOriginal; variants.push_back(v);
+    v.name = "scalar";   v.fn = unmaskScalar;   variants.push_back(v);
+    v.name = "word";     v.fn = unmaskWord;     variants.push_back(v);
+#ifdef WS_UNMASK_X86
+    v.name = "sse2";     v.fn = unmaskSSE2;     variants.push_back(v);
+    if (__builtin_cpu_supports("avx2")) {
+        v.name = "avx2"; v.fn = unmaskAVX2;     variants.push_back(v);
+    }
+#endif
+    v.name = "dispatch"; v.fn = unmaskPayload;  variants.push_back(v);
+
+    const size_t MAX_LEN = size_t(16) << 20;
+    // +1: источник и приемник намеренно не выровнены, как в пакете
+    std::vector<uint8_t> src(MAX_LEN + 1), dst(MAX_LEN + 1), ref(MAX_LEN + 1);
+    srand(42);
+    for (size_t i = 0; i < src.size(); i++) src[i] = static_cast<uint8_t>(rand());
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+    std::cout << "Выбранная реализация: " << selected << std::endl << std::endl;
+    std::cout << std::left << std::setw(10) << "size";
+    for (size_t i = 0; i < variants.size(); i++) {
+        std::cout << std::right << std::setw(12) << variants[i].name;
+    }
+    std::cout << "   (GB/s)" << std::endl;
+
+    for (size_t len = 16; len <= MAX_LEN; len *= 4) {
+        std::string label = len >= (1 << 20) ? std::to_string(len >> 20) + " MB"
+                          : len >= 1024 ? std::to_string(len >> 10) + " KB"
+                          : std::to_string(len) + " B";
+        std::cout << std::left << std::setw(10) << label;
+
+        unmaskScalar(ref.data() + 1, src.data() + 1, len, mask, 0);
+        for (size_t i = 0; i < variants.size(); i++) {
+            double ns = runOne(variants[i].fn, dst.data() + 1, src.data() + 1, len, mask);
+
+            // Проверка результата против эталона
+            variants[i].fn(dst.data() + 1, src.data() + 1, len, mask, 0);
+            if (memcmp(dst.data() + 1, ref.data() + 1, len) != 0) {
+                std::cerr << "\n❌ " << variants[i].name << ": неверный результат" << std::endl;
+                return 1;
+            }
+            std::cout << std::right << std::setw(12) << std::fixed << std::setprecision(2) << len / ns;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef WS_ADDR_H
+#define WS_ADDR_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <arpa/inet.h>
+
+// IP-адрес в двоичном виде, одинаковый для IPv4 и IPv6: 16 байт в
+// network byte order, IPv4 хранится как ::ffff:a.b.c.d. Сравнивается
+// и хешируется как есть, строка получается только при выводе.
+struct IpAddress {
+    uint8_t bytes[16];
+
+    bool isV4() const {
+        static const uint8_t prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        return memcmp(bytes, prefix, sizeof(prefix)) == 0;
+    }
+
+    bool operator==(const IpAddress& o) const { return memcmp(bytes, o.bytes, sizeof(bytes)) == 0; }
+    bool operator!=(const IpAddress& o) const { return !(*this == o); }
+    bool operator<(const IpAddress& o) const { return memcmp(bytes, o.bytes, sizeof(bytes)) < 0; }
+};
+
+inline IpAddress ipv4Address(uint32_t addr) {  // addr в network byte order
+    IpAddress a;
+    memset(a.bytes, 0, 10);
+    a.bytes[10] = 0xff;
+    a.bytes[11] = 0xff;
+    memcpy(a.bytes + 12, &addr, 4);
+    return a;
+}
+
+inline IpAddress ipv6Address(const uint8_t* bytes) {
+    IpAddress a;
+    memcpy(a.bytes, bytes, sizeof(a.bytes));
+    return a;
+}
+
+// Строка адреса в buf (не меньше INET6_ADDRSTRLEN), возвращает длину
+inline size_t formatIpTo(const IpAddress& addr, char* buf, size_t size) {
+    const char* ok = addr.isV4() ? inet_ntop(AF_INET, addr.bytes + 12, buf, static_cast<socklen_t>(size))
+                                 : inet_ntop(AF_INET6, addr.bytes, buf, static_cast<socklen_t>(size));
+    if (!ok) {
+        snprintf(buf, size, "?");
+    }
+    return strlen(buf);
+}
+
+inline std::string formatIp(const IpAddress& addr) {
+    char buf[INET6_ADDRSTRLEN];
+    formatIpTo(addr, buf, sizeof(buf));
+    return buf;
+}
+
+// "a.b.c.d:port" или "[v6]:port"
+inline std::string formatEndpoint(const IpAddress& addr, uint16_t port) {
+    char buf[INET6_ADDRSTRLEN + 16];
+    size_t n = 0;
+    if (!addr.isV4()) buf[n++] = '[';
+    n += formatIpTo(addr, buf + n, sizeof(buf) - n);
+    if (!addr.isV4()) buf[n++] = ']';
+    snprintf(buf + n, sizeof(buf) - n, ":%u", port);
+    return buf;
+}
+
+// Разбор строки IPv4 или IPv6
+inline bool parseIp(const std::string& str, IpAddress& addr) {
+    uint32_t v4;
+    if (inet_pton(AF_INET, str.c_str(), &v4) == 1) {
+        addr = ipv4Address(v4);
+        return true;
+    }
+    return inet_pton(AF_INET6, str.c_str(), addr.bytes) == 1;
+}
+
+#endif // WS_ADDR_H
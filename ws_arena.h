@@ -0,0 +1,103 @@
+#ifndef WS_ARENA_H
+#define WS_ARENA_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Ссылка на байты в PayloadArena. Не владеет памятью: живет, пока жива
+// арена (или до ее clear()).
+struct ByteSpan {
+    const uint8_t* ptr;
+    uint32_t len;
+
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    const uint8_t* begin() const { return ptr; }
+    const uint8_t* end() const { return ptr + len; }
+    uint8_t operator[](size_t i) const { return ptr[i]; }
+};
+
+inline ByteSpan makeSpan(const uint8_t* ptr, size_t len) {
+    ByteSpan s;
+    s.ptr = ptr;
+    s.len = static_cast<uint32_t>(len);
+    return s;
+}
+
+// Арена для payload сообщений: память выделяется кусками по chunk_size
+// (по умолчанию 1 МБ) и раздается сдвигом указателя. Отдельных free нет - все освобождается
+// разом в clear() или деструкторе. Одна аллокация на ~1 МБ payload
+// вместо нескольких на каждое сообщение.
+class PayloadArena {
+private:
+    static const size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+    struct Chunk {
+        uint8_t* data;
+        size_t size;
+        size_t used;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t chunk_size;
+    size_t total_used;
+    size_t total_reserved;
+
+    PayloadArena(const PayloadArena&);
+    PayloadArena& operator=(const PayloadArena&);
+
+public:
+    explicit PayloadArena(size_t chunk = DEFAULT_CHUNK_SIZE)
+        : chunk_size(chunk), total_used(0), total_reserved(0) {}
+    ~PayloadArena() { clear(); }
+
+    // Память под len байт payload. Большие payload получают свой кусок,
+    // чтобы не оставлять хвосты в общих кусках.
+    uint8_t* allocate(size_t len) {
+        if (len == 0) return nullptr;
+        if (chunks.empty() || chunks.back().size - chunks.back().used < len) {
+            Chunk c;
+            c.size = len > chunk_size / 4 ? len : chunk_size;
+            c.data = new uint8_t[c.size];
+            c.used = 0;
+            total_reserved += c.size;
+            if (c.size == len && !chunks.empty()) {
+                // Отдельный кусок вставляем перед текущим, чтобы
+                // продолжать заполнять текущий мелкими payload
+                chunks.insert(chunks.end() - 1, c);
+                chunks[chunks.size() - 2].used = len;
+                total_used += len;
+                return c.data;
+            }
+            chunks.push_back(c);
+        }
+        Chunk& c = chunks.back();
+        uint8_t* p = c.data + c.used;
+        c.used += len;
+        total_used += len;
+        return p;
+    }
+
+    ByteSpan copy(const uint8_t* data, size_t len) {
+        uint8_t* p = allocate(len);
+        if (len) memcpy(p, data, len);
+        return makeSpan(p, len);
+    }
+
+    void clear() {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            delete[] chunks[i].data;
+        }
+        chunks.clear();
+        total_used = 0;
+        total_reserved = 0;
+    }
+
+    size_t bytesUsed() const { return total_used; }
+    size_t bytesReserved() const { return total_reserved; }
+};
+
+#endif // WS_ARENA_H
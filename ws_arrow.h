@@ -0,0 +1,603 @@
+#ifndef WS_ARROW_H
+#define WS_ARROW_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ws_message.h"
+#include "ws_flow.h"
+
+// Экспорт сообщений в файл Apache Arrow IPC (Feather v2) для pandas,
+// polars, DuckDB: pyarrow.ipc.open_file(path).read_pandas(). Сообщения
+// копятся в пакет (record batch) по столбцам и пишутся пакетами, так что
+// память постоянна при любой длине захвата. Метаданные Arrow - flatbuffers;
+// они собираются здесь же небольшим построителем, без библиотек Arrow.
+//
+// Столбцы: timestamp (наносекунды UTC), flow ("клиент -> сервер"),
+// direction (client/server), opcode, masked, compressed, truncated,
+// length, payload. flow, direction и opcode - словарные: в пакете только
+// номера, строки соединений дописываются дельтой словаря перед пакетом,
+// в котором они впервые встретились.
+
+// Построитель flatbuffers: буфер растет от конца к началу, как в
+// библиотеке flatbuffers, поэтому дочерние объекты пишутся раньше
+// родителя, а ссылки на них - положительные смещения вперед. Позиция
+// объекта (ref) - расстояние от его начала до конца буфера.
+class FlatBuilder {
+private:
+    struct FieldLoc {
+        uint16_t id;
+        uint32_t ref;
+    };
+
+    std::vector<uint8_t> buf;
+    size_t head;
+    size_t min_align;
+    std::vector<FieldLoc> fields;
+    uint32_t table_start;
+
+    void reserve(size_t n) {
+        if (head >= n) return;
+        size_t used = size();
+        size_t cap = buf.size() * 2;
+        if (cap < used + n + 64) cap = used + n + 64;
+        std::vector<uint8_t> grown(cap);
+        if (used) memcpy(&grown[cap - used], &buf[head], used);
+        buf.swap(grown);
+        head = cap - used;
+    }
+
+    uint8_t* push(size_t n) {
+        reserve(n);
+        head -= n;
+        return &buf[head];
+    }
+
+    // Выравнивание так, чтобы после следующих len байт размер был кратен a
+    void align(size_t len, size_t a) {
+        if (a > min_align) min_align = a;
+        size_t pad = (a - (size() + len) % a) % a;
+        if (pad) memset(push(pad), 0, pad);
+    }
+
+public:
+    FlatBuilder() : head(0), min_align(1), table_start(0) {}
+
+    void clear() {
+        head = buf.size();
+        min_align = 1;
+        fields.clear();
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(buf.size() - head); }
+    const uint8_t* data() const { return buf.data() + head; }
+
+    template <typename T>
+    void scalar(T v) {
+        align(sizeof(T), sizeof(T));
+        memcpy(push(sizeof(T)), &v, sizeof(T));
+    }
+
+    void offset(uint32_t ref) {
+        align(4, 4);
+        uint32_t v = size() + 4 - ref;
+        memcpy(push(4), &v, 4);
+    }
+
+    uint32_t string(const std::string& s) {
+        align(s.size() + 1, 4);
+        push(1)[0] = 0;
+        if (!s.empty()) memcpy(push(s.size()), s.data(), s.size());
+        scalar<uint32_t>(static_cast<uint32_t>(s.size()));
+        return size();
+    }
+
+    uint32_t offsetVector(const std::vector<uint32_t>& refs) {
+        align(refs.size() * 4, 4);
+        for (size_t i = refs.size(); i-- > 0;) offset(refs[i]);
+        scalar<uint32_t>(static_cast<uint32_t>(refs.size()));
+        return size();
+    }
+
+    // Вектор структур: элементы выровнены по 8 (у всех структур Arrow
+    // поля 64-битные)
+    uint32_t structVector(const void* elems, size_t elem_size, size_t count) {
+        align(elem_size * count, 8);
+        if (count) memcpy(push(elem_size * count), elems, elem_size * count);
+        scalar<uint32_t>(static_cast<uint32_t>(count));
+        return size();
+    }
+
+    void startTable() {
+        fields.clear();
+        table_start = size();
+    }
+
+    template <typename T>
+    void addScalar(uint16_t id, T v) {
+        scalar(v);
+        FieldLoc f = {id, size()};
+        fields.push_back(f);
+    }
+
+    void addOffset(uint16_t id, uint32_t ref) {
+        offset(ref);
+        FieldLoc f = {id, size()};
+        fields.push_back(f);
+    }
+
+    // Таблица: поля, перед ними soffset на vtable, перед ним сама vtable
+    uint32_t endTable() {
+        scalar<int32_t>(0);
+        uint32_t table = size();
+        uint16_t count = 0;
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (fields[i].id + 1 > count) count = static_cast<uint16_t>(fields[i].id + 1);
+        }
+        std::vector<uint16_t> slots(count, 0);
+        for (size_t i = 0; i < fields.size(); i++) {
+            slots[fields[i].id] = static_cast<uint16_t>(table - fields[i].ref);
+        }
+        for (size_t i = count; i-- > 0;) scalar<uint16_t>(slots[i]);
+        scalar<uint16_t>(static_cast<uint16_t>(table - table_start));
+        scalar<uint16_t>(static_cast<uint16_t>(4 + 2 * count));
+        int32_t to_vtable = static_cast<int32_t>(size() - table);
+        memcpy(&buf[buf.size() - table], &to_vtable, 4);
+        fields.clear();
+        return table;
+    }
+
+    void finish(uint32_t root) {
+        align(4, min_align < 8 ? 8 : min_align);
+        offset(root);
+    }
+};
+
+// Параметры экспорта
+struct ArrowExportOptions {
+    std::string path;      // пусто - экспорт выключен
+    uint32_t batch_rows;   // строк в пакете
+    uint64_t batch_bytes;  // payload в пакете, после него пакет закрывается раньше
+
+    ArrowExportOptions() : batch_rows(65536), batch_bytes(64ull * 1024 * 1024) {}
+
+    bool enabled() const { return !path.empty(); }
+};
+
+// Запись файла Arrow IPC: "ARROW1", схема, словари и пакеты в формате
+// потока, в конце footer со смещениями блоков. Вызывается из одного
+// потока (сохранения); пакет пишется тем же потоком при заполнении.
+class ArrowExportWriter {
+private:
+    // Типы и перечисления из Schema.fbs / Message.fbs / File.fbs
+    enum {
+        TYPE_INT = 2, TYPE_BINARY = 4, TYPE_UTF8 = 5, TYPE_BOOL = 6, TYPE_TIMESTAMP = 10
+    };
+    enum {
+        HEADER_SCHEMA = 1, HEADER_DICTIONARY = 2, HEADER_RECORD_BATCH = 3
+    };
+    static const int16_t METADATA_V5 = 4;
+    static const int16_t UNIT_NANOSECOND = 3;
+
+    enum {
+        DICT_FLOW = 0, DICT_DIRECTION = 1, DICT_OPCODE = 2
+    };
+
+    struct Block {
+        int64_t offset;
+        int32_t meta_length;
+        int32_t pad;
+        int64_t body_length;
+    };
+
+    struct BufferRef {
+        int64_t offset;
+        int64_t length;
+    };
+
+    struct FieldNode {
+        int64_t length;
+        int64_t null_count;
+    };
+
+    // Кусок тела сообщения; тело пишется прямо из столбцов, без копии
+    struct Segment {
+        const void* data;
+        size_t len;
+    };
+
+    struct FlowHash {
+        size_t operator()(const FlowKey& key) const { return hashFlowKey(key); }
+    };
+
+    ArrowExportOptions opts;
+    int fd;
+    bool failed;
+    uint64_t position;
+    std::vector<Block> dictionary_blocks;
+    std::vector<Block> batch_blocks;
+    FlatBuilder fb;
+
+    // Словарь соединений растет с числом соединений, а не сообщений
+    std::unordered_map<FlowKey, int32_t, FlowHash> flow_ids;
+    std::vector<std::string> new_flows;  // еще не записанные в файл
+    bool flows_written;
+
+    // Столбцы текущего пакета
+    std::vector<int64_t> timestamps;
+    std::vector<int32_t> flows;
+    std::vector<int8_t> directions;
+    std::vector<int8_t> opcodes;
+    std::vector<uint8_t> masked;
+    std::vector<uint8_t> compressed;
+    std::vector<uint8_t> truncated;
+    std::vector<uint32_t> lengths;
+    std::vector<int32_t> offsets;
+    std::vector<uint8_t> payload;
+
+    uint64_t total_rows;
+    uint64_t total_batches;
+
+    ArrowExportWriter(const ArrowExportWriter&);
+    ArrowExportWriter& operator=(const ArrowExportWriter&);
+
+    void reportError(const char* what, std::string* err) {
+        std::string text = std::string(what) + ": " + strerror(errno);
+        if (err) {
+            *err = text;
+        } else if (!failed) {
+            std::cerr << "❌ Ошибка экспорта Arrow (" << text << ")" << std::endl;
+        }
+        failed = true;
+    }
+
+    bool writeAll(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (len > 0) {
+            ssize_t n = ::write(fd, p, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += n;
+            len -= static_cast<size_t>(n);
+            position += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    bool writePadding(size_t len) {
+        static const uint8_t zeros[8] = {0};
+        size_t pad = (8 - len % 8) % 8;
+        return pad == 0 || writeAll(zeros, pad);
+    }
+
+    static void setBit(std::vector<uint8_t>& bits, size_t i, bool v) {
+        if (i % 8 == 0) bits.push_back(0);
+        if (v) bits.back() |= static_cast<uint8_t>(1u << (i % 8));
+    }
+
+    // ---- Схема ----
+
+    uint32_t intType(int bits, bool is_signed) {
+        fb.startTable();
+        fb.addScalar<int32_t>(0, bits);
+        fb.addScalar<uint8_t>(1, is_signed ? 1 : 0);
+        return fb.endTable();
+    }
+
+    uint32_t emptyTable() {
+        fb.startTable();
+        return fb.endTable();
+    }
+
+    uint32_t field(const char* name, uint8_t type_type, uint32_t type, int dictionary, int index_bits) {
+        uint32_t name_ref = fb.string(name);
+        uint32_t dict_ref = 0;
+        if (dictionary >= 0) {
+            uint32_t index = intType(index_bits, true);
+            fb.startTable();
+            fb.addScalar<int64_t>(0, dictionary);
+            fb.addOffset(1, index);
+            dict_ref = fb.endTable();
+        }
+        uint32_t children = fb.offsetVector(std::vector<uint32_t>());
+        fb.startTable();
+        fb.addOffset(0, name_ref);
+        fb.addOffset(3, type);
+        if (dict_ref) fb.addOffset(4, dict_ref);
+        fb.addOffset(5, children);
+        fb.addScalar<uint8_t>(1, 0);  // nullable: пропусков нет
+        fb.addScalar<uint8_t>(2, type_type);
+        return fb.endTable();
+    }
+
+    uint32_t schema() {
+        std::vector<uint32_t> f;
+        uint32_t tz = fb.string("UTC");
+        fb.startTable();
+        fb.addOffset(1, tz);
+        fb.addScalar<int16_t>(0, UNIT_NANOSECOND);
+        f.push_back(field("timestamp", TYPE_TIMESTAMP, fb.endTable(), -1, 0));
+        f.push_back(field("flow", TYPE_UTF8, emptyTable(), DICT_FLOW, 32));
+        f.push_back(field("direction", TYPE_UTF8, emptyTable(), DICT_DIRECTION, 8));
+        f.push_back(field("opcode", TYPE_UTF8, emptyTable(), DICT_OPCODE, 8));
+        f.push_back(field("masked", TYPE_BOOL, emptyTable(), -1, 0));
+        f.push_back(field("compressed", TYPE_BOOL, emptyTable(), -1, 0));
+        f.push_back(field("truncated", TYPE_BOOL, emptyTable(), -1, 0));
+        f.push_back(field("length", TYPE_INT, intType(32, false), -1, 0));
+        f.push_back(field("payload", TYPE_BINARY, emptyTable(), -1, 0));
+        uint32_t fields_ref = fb.offsetVector(f);
+        fb.startTable();
+        fb.addOffset(1, fields_ref);
+        fb.addScalar<int16_t>(0, 0);  // little endian
+        return fb.endTable();
+    }
+
+    // ---- Сообщения ----
+
+    // RecordBatch: узлы столбцов и буферы тела по порядку; смещения
+    // буферов считаются с выравниванием по 8
+    uint32_t recordBatch(int64_t rows, const std::vector<FieldNode>& nodes,
+                         const std::vector<Segment>& body, int64_t& body_length) {
+        std::vector<BufferRef> refs(body.size());
+        int64_t off = 0;
+        for (size_t i = 0; i < body.size(); i++) {
+            refs[i].offset = off;
+            refs[i].length = static_cast<int64_t>(body[i].len);
+            off += static_cast<int64_t>((body[i].len + 7) / 8 * 8);
+        }
+        body_length = off;
+        uint32_t buffers = fb.structVector(refs.data(), sizeof(BufferRef), refs.size());
+        uint32_t node_ref = fb.structVector(nodes.data(), sizeof(FieldNode), nodes.size());
+        fb.startTable();
+        fb.addScalar<int64_t>(0, rows);
+        fb.addOffset(1, node_ref);
+        fb.addOffset(2, buffers);
+        return fb.endTable();
+    }
+
+    // Message с готовым заголовком в fb, затем тело. Блок - для footer.
+    bool writeMessage(uint8_t header_type, uint32_t header, int64_t body_length,
+                      const std::vector<Segment>& body, std::vector<Block>* blocks) {
+        fb.startTable();
+        fb.addScalar<int64_t>(3, body_length);
+        fb.addOffset(2, header);
+        fb.addScalar<int16_t>(0, METADATA_V5);
+        fb.addScalar<uint8_t>(1, header_type);
+        fb.finish(fb.endTable());
+
+        Block block;
+        block.offset = static_cast<int64_t>(position);
+        block.pad = 0;
+        block.body_length = body_length;
+        uint32_t meta = (fb.size() + 7) / 8 * 8;
+        block.meta_length = static_cast<int32_t>(8 + meta);
+
+        uint32_t prefix[2] = {0xFFFFFFFFu, meta};
+        bool ok = writeAll(prefix, sizeof(prefix)) && writeAll(fb.data(), fb.size()) && writePadding(fb.size());
+        for (size_t i = 0; ok && i < body.size(); i++) {
+            ok = (body[i].len == 0 || writeAll(body[i].data, body[i].len)) && writePadding(body[i].len);
+        }
+        fb.clear();
+        if (ok && blocks) blocks->push_back(block);
+        return ok;
+    }
+
+    // Словарь строк: узел, пустой буфер валидности, смещения, байты
+    bool writeDictionary(int64_t id, const std::vector<std::string>& values, bool delta) {
+        std::vector<int32_t> offs(1, 0);
+        std::string bytes;
+        for (size_t i = 0; i < values.size(); i++) {
+            bytes += values[i];
+            offs.push_back(static_cast<int32_t>(bytes.size()));
+        }
+        std::vector<FieldNode> nodes(1);
+        nodes[0].length = static_cast<int64_t>(values.size());
+        nodes[0].null_count = 0;
+        std::vector<Segment> body;
+        Segment validity = {nullptr, 0};
+        Segment o = {offs.data(), offs.size() * 4};
+        Segment d = {bytes.data(), bytes.size()};
+        body.push_back(validity);
+        body.push_back(o);
+        body.push_back(d);
+
+        int64_t body_length = 0;
+        uint32_t data = recordBatch(static_cast<int64_t>(values.size()), nodes, body, body_length);
+        fb.startTable();
+        fb.addScalar<int64_t>(0, id);
+        fb.addOffset(1, data);
+        fb.addScalar<uint8_t>(2, delta ? 1 : 0);
+        return writeMessage(HEADER_DICTIONARY, fb.endTable(), body_length, body, &dictionary_blocks);
+    }
+
+    bool writeFixedDictionaries() {
+        std::vector<std::string> dirs;
+        dirs.push_back("client");
+        dirs.push_back("server");
+        std::vector<std::string> ops;
+        for (int op = 0; op < 16; op++) {
+            const char* name = opcodeToString(static_cast<uint8_t>(op));
+            char unknown[8];
+            if (strcmp(name, "Unknown") == 0) {
+                snprintf(unknown, sizeof(unknown), "0x%X", op);
+                name = unknown;
+            }
+            ops.push_back(name);
+        }
+        return writeDictionary(DICT_DIRECTION, dirs, false) && writeDictionary(DICT_OPCODE, ops, false);
+    }
+
+    bool writeBatch() {
+        if (timestamps.empty()) return true;
+        // Соединения, впервые встреченные в этом пакете, - дельтой словаря
+        if (!new_flows.empty() || !flows_written) {
+            if (!writeDictionary(DICT_FLOW, new_flows, flows_written)) return false;
+            flows_written = true;
+            new_flows.clear();
+        }
+
+        size_t rows = timestamps.size();
+        std::vector<FieldNode> nodes(9);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            nodes[i].length = static_cast<int64_t>(rows);
+            nodes[i].null_count = 0;
+        }
+        Segment none = {nullptr, 0};
+        Segment columns[] = {
+            none, {timestamps.data(), rows * 8},
+            none, {flows.data(), rows * 4},
+            none, {directions.data(), rows},
+            none, {opcodes.data(), rows},
+            none, {masked.data(), masked.size()},
+            none, {compressed.data(), compressed.size()},
+            none, {truncated.data(), truncated.size()},
+            none, {lengths.data(), rows * 4},
+            none, {offsets.data(), offsets.size() * 4}, {payload.data(), payload.size()},
+        };
+        std::vector<Segment> body(columns, columns + sizeof(columns) / sizeof(columns[0]));
+        int64_t body_length = 0;
+        uint32_t header = recordBatch(static_cast<int64_t>(rows), nodes, body, body_length);
+        if (!writeMessage(HEADER_RECORD_BATCH, header, body_length, body, &batch_blocks)) return false;
+
+        total_rows += rows;
+        total_batches++;
+        timestamps.clear();
+        flows.clear();
+        directions.clear();
+        opcodes.clear();
+        masked.clear();
+        compressed.clear();
+        truncated.clear();
+        lengths.clear();
+        offsets.assign(1, 0);
+        payload.clear();
+        return true;
+    }
+
+    bool writeFooter() {
+        uint32_t schema_ref = schema();
+        uint32_t batches = fb.structVector(batch_blocks.data(), sizeof(Block), batch_blocks.size());
+        uint32_t dicts = fb.structVector(dictionary_blocks.data(), sizeof(Block), dictionary_blocks.size());
+        fb.startTable();
+        fb.addOffset(1, schema_ref);
+        fb.addOffset(2, dicts);
+        fb.addOffset(3, batches);
+        fb.addScalar<int16_t>(0, METADATA_V5);
+        fb.finish(fb.endTable());
+
+        uint32_t end_of_stream[2] = {0xFFFFFFFFu, 0};
+        int32_t footer_len = static_cast<int32_t>(fb.size());
+        bool ok = writeAll(end_of_stream, sizeof(end_of_stream)) && writeAll(fb.data(), fb.size()) &&
+                  writeAll(&footer_len, 4) && writeAll("ARROW1", 6);
+        fb.clear();
+        return ok;
+    }
+
+    // "клиент -> сервер": клиент - тот, чьи фреймы замаскированы
+    static std::string flowName(const WebSocketMessage& msg) {
+        if (msg.is_masked) {
+            return formatEndpoint(msg.src_ip, msg.src_port) + " -> " + formatEndpoint(msg.dst_ip, msg.dst_port);
+        }
+        return formatEndpoint(msg.dst_ip, msg.dst_port) + " -> " + formatEndpoint(msg.src_ip, msg.src_port);
+    }
+
+public:
+    ArrowExportWriter() : fd(-1), failed(false), position(0), flows_written(false),
+                          total_rows(0), total_batches(0) {}
+
+    ~ArrowExportWriter() {
+        std::string err;
+        close(err);
+    }
+
+    bool open(const ArrowExportOptions& options, std::string& err) {
+        opts = options;
+        if (opts.batch_rows == 0) opts.batch_rows = 1;
+        fd = ::open(opts.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            err = opts.path + ": " + strerror(errno);
+            return false;
+        }
+        failed = false;
+        position = 0;
+        dictionary_blocks.clear();
+        batch_blocks.clear();
+        flow_ids.clear();
+        new_flows.clear();
+        flows_written = false;
+        total_rows = 0;
+        total_batches = 0;
+        offsets.assign(1, 0);
+
+        static const char magic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+        std::vector<Segment> no_body;
+        uint32_t header = schema();
+        if (!writeAll(magic, sizeof(magic)) || !writeMessage(HEADER_SCHEMA, header, 0, no_body, nullptr) ||
+            !writeFixedDictionaries()) {
+            reportError("запись заголовка", &err);
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    void append(const WebSocketMessage& msg) {
+        if (fd < 0 || failed) return;
+        FlowKey key;
+        makeFlowKey(msg.src_ip, msg.src_port, msg.dst_ip, msg.dst_port, key);
+        std::unordered_map<FlowKey, int32_t, FlowHash>::iterator it = flow_ids.find(key);
+        if (it == flow_ids.end()) {
+            it = flow_ids.insert(std::make_pair(key, static_cast<int32_t>(flow_ids.size()))).first;
+            new_flows.push_back(flowName(msg));
+        }
+
+        size_t row = timestamps.size();
+        timestamps.push_back(msg.timestamp_ns);
+        flows.push_back(it->second);
+        directions.push_back(msg.is_masked ? 0 : 1);
+        opcodes.push_back(static_cast<int8_t>(msg.opcode & 0x0F));
+        setBit(masked, row, msg.is_masked);
+        setBit(compressed, row, msg.is_compressed);
+        setBit(truncated, row, msg.is_truncated);
+        lengths.push_back(static_cast<uint32_t>(msg.payload.size()));
+        payload.insert(payload.end(), msg.payload.begin(), msg.payload.end());
+        offsets.push_back(static_cast<int32_t>(payload.size()));
+
+        if (timestamps.size() >= opts.batch_rows || payload.size() >= opts.batch_bytes) {
+            if (!writeBatch()) reportError("запись пакета", nullptr);
+        }
+    }
+
+    // Последний пакет и footer; без footer файл читается как поток
+    bool close(std::string& err) {
+        if (fd < 0) return true;
+        bool ok = !failed;
+        if (ok && !(writeBatch() && writeFooter())) {
+            reportError("завершение файла", &err);
+            ok = false;
+        } else if (!ok) {
+            err = "файл не дописан из-за прежней ошибки";
+        }
+        ::close(fd);
+        fd = -1;
+        return ok;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+    uint64_t rows() const { return total_rows; }
+    uint64_t batches() const { return total_batches; }
+    uint64_t bytesWritten() const { return position; }
+    size_t flowCount() const { return flow_ids.size(); }
+};
+
+#endif // WS_ARROW_H
@@ -0,0 +1,507 @@
+#ifndef WS_CAPFILE_H
+#define WS_CAPFILE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ws_message.h"
+#include "ws_codec.h"
+
+// Формат файла захвата v2:
+//
+//   CaptureFileHeader            64 байта
+//   CaptureRecord + payload      56 байт + payload, выравнивание до 8
+//   ...
+//   uint64_t offsets[count]      смещение каждой записи от начала файла
+//   индекс запросов              необязателен, до конца файла (ws_index.h)
+//
+// Все поля фиксированного размера в порядке байт машины; byte_order в
+// заголовке позволяет отличить файл с другой архитектуры. Счетчик и
+// смещение индекса проставляются при закрытии файла. Если их нет (файл
+// потоковой записи оборвался), индекс строится проходом по записям -
+// у каждой есть метка, и нули в хвосте блока O_DIRECT записью не считаются.
+//
+// Формат v3 - те же записи, сжатые блоками (ws_codec.h):
+//
+//   CaptureFileHeader            64 байта, version 3
+//   CaptureBlockHeader + данные  32 байта + сжатые записи, выравнивание до 8
+//   ...
+//   uint64_t block_count
+//   CaptureBlockEntry blocks[block_count]
+//   индекс запросов              как в v2
+//
+// Блоки сжимаются независимо, по ~256 КБ записей, так что сообщение по
+// номеру требует распаковать один блок. В блоке до сжатия сначала
+// заголовки CaptureRecord по столбцам (байт 0 всех записей, байт 1 и
+// т.д. - адреса, порты и старшие байты времени соседних записей
+// совпадают и сжимаются почти в ноль), потом payload подряд без
+// выравнивания. index_offset указывает на block_count, record_count -
+// по-прежнему число записей. У незакрытого файла индекс блоков строится
+// проходом по заголовкам блоков.
+
+static const char CAPTURE_MAGIC[8] = {'W', 'S', 'C', 'A', 'P', '\r', '\n', '\x1a'};
+static const uint32_t CAPTURE_VERSION = 2;
+static const uint32_t CAPTURE_VERSION_BLOCKS = 3;
+static const uint32_t CAPTURE_BYTE_ORDER = 0x01020304;
+static const uint16_t CAPTURE_RECORD_MARK = 0x5752;  // "RW"
+static const uint16_t CAPTURE_BLOCK_MARK = 0x4257;   // "WB"
+
+struct CaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t byte_order;
+    uint64_t record_count;     // 0 и index_offset 0 - файл не закрыт
+    uint64_t index_offset;
+    int64_t first_timestamp;   // наносекунды, для выбора файлов по времени
+    int64_t last_timestamp;
+    uint64_t query_index;      // смещение индекса запросов, 0 - его нет
+};
+
+struct CaptureRecord {
+    int64_t timestamp_ns;
+    IpAddress src_ip;     // IPv4 - как ::ffff:a.b.c.d
+    IpAddress dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t payload_len;
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t mark;        // CAPTURE_RECORD_MARK
+    uint32_t reserved;
+};
+
+struct CaptureBlockHeader {
+    uint16_t mark;          // CAPTURE_BLOCK_MARK
+    uint8_t codec;          // BLOCK_CODEC_*, NONE - записи как есть
+    uint8_t reserved;
+    uint32_t record_count;
+    uint64_t first_record;  // номер первой записи блока в файле
+    uint32_t raw_size;      // заголовки и payload до сжатия
+    uint32_t packed_size;   // байт после заголовка, без выравнивания
+    uint32_t checksum;      // crc32 сжатых байт
+    uint32_t reserved2;
+};
+
+struct CaptureBlockEntry {
+    uint64_t offset;        // заголовок блока от начала файла
+    uint64_t first_record;
+};
+
+static_assert(sizeof(CaptureFileHeader) == 64, "заголовок файла захвата - 64 байта");
+static_assert(sizeof(CaptureRecord) == 56, "запись файла захвата - 56 байт");
+static_assert(sizeof(CaptureBlockHeader) == 32, "заголовок блока - 32 байта");
+
+static const uint8_t CAPTURE_FLAG_MASKED = 0x01;
+static const uint8_t CAPTURE_FLAG_COMPRESSED = 0x02;
+static const uint8_t CAPTURE_FLAG_TRUNCATED = 0x04;
+
+inline void initCaptureHeader(CaptureFileHeader& h, uint32_t version = CAPTURE_VERSION) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+    h.version = version;
+    h.header_size = sizeof(CaptureFileHeader);
+    h.record_size = sizeof(CaptureRecord);
+    h.byte_order = CAPTURE_BYTE_ORDER;
+}
+
+inline void encodeCaptureRecord(const WebSocketMessage& msg, CaptureRecord& rec) {
+    memset(&rec, 0, sizeof(rec));
+    rec.timestamp_ns = msg.timestamp_ns;
+    rec.src_ip = msg.src_ip;
+    rec.dst_ip = msg.dst_ip;
+    rec.src_port = msg.src_port;
+    rec.dst_port = msg.dst_port;
+    rec.payload_len = static_cast<uint32_t>(msg.payload.size());
+    rec.opcode = msg.opcode;
+    rec.flags = (msg.is_masked ? CAPTURE_FLAG_MASKED : 0) |
+                (msg.is_compressed ? CAPTURE_FLAG_COMPRESSED : 0) |
+                (msg.is_truncated ? CAPTURE_FLAG_TRUNCATED : 0);
+    rec.mark = CAPTURE_RECORD_MARK;
+}
+
+// Нули после payload до границы 8 байт
+inline size_t capturePadding(size_t payload_len) {
+    return (8 - (payload_len & 7)) & 7;
+}
+
+// Полный размер записи в файле
+inline uint64_t captureRecordSize(size_t payload_len) {
+    return sizeof(CaptureRecord) + payload_len + capturePadding(payload_len);
+}
+
+// Полный размер блока v3 в файле
+inline uint64_t captureBlockSize(size_t packed_size) {
+    return sizeof(CaptureBlockHeader) + packed_size + capturePadding(packed_size);
+}
+
+// Заголовки n записей блока v3 - по столбцам и обратно
+inline void packBlockRecords(const CaptureRecord* records, size_t n, uint8_t* out) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(records);
+    for (size_t b = 0; b < sizeof(CaptureRecord); b++) {
+        for (size_t r = 0; r < n; r++) out[b * n + r] = in[r * sizeof(CaptureRecord) + b];
+    }
+}
+
+inline void unpackBlockRecords(const uint8_t* in, size_t n, CaptureRecord* records) {
+    uint8_t* out = reinterpret_cast<uint8_t*>(records);
+    for (size_t b = 0; b < sizeof(CaptureRecord); b++) {
+        for (size_t r = 0; r < n; r++) out[r * sizeof(CaptureRecord) + b] = in[b * n + r];
+    }
+}
+
+// Файл захвата v2 или v3, отображенный в память. Открытие не читает
+// записи: индекс берется прямо из отображения, payload подгружается ядром
+// страницами, когда к нему обращаются. Сообщения, которые отдает
+// message(), ссылаются на отображение и живут до close(). В файле v3
+// распаковывается только блок с нужной записью; последние CACHE_BLOCKS
+// блоков держатся в памяти, так что сообщение из сжатого блока живет до
+// обращения к CACHE_BLOCKS другим блокам - для чтения по одному
+// сообщению этого достаточно. Объект не потокобезопасен.
+class CaptureFile {
+private:
+    static const size_t CACHE_BLOCKS = 4;
+    static const size_t NO_BLOCK = static_cast<size_t>(-1);
+
+    // Распакованный блок: заголовки записей и начало payload каждой
+    struct CachedBlock {
+        size_t block;
+        const uint8_t* data;  // распакованный или прямо в отображении
+        std::vector<uint8_t> raw;
+        std::vector<CaptureRecord> records;
+        std::vector<uint32_t> payloads;
+        uint64_t used;
+
+        CachedBlock() : block(NO_BLOCK), data(nullptr), used(0) {}
+    };
+
+    int fd;
+    const uint8_t* base;
+    size_t size;
+    const uint64_t* offsets;
+    size_t count;
+    std::vector<uint64_t> scanned;  // индекс незакрытого файла
+    bool complete;
+    bool packed;                    // v3: записи в сжатых блоках
+    const CaptureBlockEntry* blocks;
+    size_t block_count;
+    std::vector<CaptureBlockEntry> scanned_blocks;
+    uint64_t index_end;             // конец индекса смещений или блоков
+
+    mutable CachedBlock cache[CACHE_BLOCKS];
+    mutable size_t last_slot;
+    mutable uint64_t cache_clock;
+    mutable uint64_t unpacked;
+    mutable BlockDecompressor decompressor;
+
+    CaptureFile(const CaptureFile&);
+    CaptureFile& operator=(const CaptureFile&);
+
+    // Запись по смещению целиком лежит в файле
+    const CaptureRecord* recordAt(uint64_t offset) const {
+        if (offset % 8 != 0 || offset < sizeof(CaptureFileHeader) ||
+            offset > size || size - offset < sizeof(CaptureRecord)) {
+            return nullptr;
+        }
+        const CaptureRecord* rec = reinterpret_cast<const CaptureRecord*>(base + offset);
+        if (rec->mark != CAPTURE_RECORD_MARK) return nullptr;
+        if (size - offset - sizeof(CaptureRecord) < rec->payload_len) return nullptr;
+        return rec;
+    }
+
+    // Блок по смещению целиком лежит в файле
+    const CaptureBlockHeader* blockAt(uint64_t offset) const {
+        if (offset % 8 != 0 || offset < sizeof(CaptureFileHeader) ||
+            offset > size || size - offset < sizeof(CaptureBlockHeader)) {
+            return nullptr;
+        }
+        const CaptureBlockHeader* h = reinterpret_cast<const CaptureBlockHeader*>(base + offset);
+        if (h->mark != CAPTURE_BLOCK_MARK) return nullptr;
+        if (size - offset - sizeof(CaptureBlockHeader) < h->packed_size) return nullptr;
+        return h;
+    }
+
+    void scanRecords() {
+        uint64_t offset = sizeof(CaptureFileHeader);
+        while (recordAt(offset)) {
+            scanned.push_back(offset);
+            offset += captureRecordSize(recordAt(offset)->payload_len);
+        }
+        offsets = scanned.empty() ? nullptr : &scanned[0];
+        count = scanned.size();
+    }
+
+    // Блоки незакрытого файла идут подряд и нумеруют записи без пропусков;
+    // целостность данных проверяется контрольной суммой при распаковке
+    void scanBlocks() {
+        uint64_t offset = sizeof(CaptureFileHeader);
+        count = 0;
+        while (const CaptureBlockHeader* h = blockAt(offset)) {
+            if (h->first_record != count || h->record_count == 0) break;
+            CaptureBlockEntry e = {offset, h->first_record};
+            scanned_blocks.push_back(e);
+            count += h->record_count;
+            offset += captureBlockSize(h->packed_size);
+        }
+        blocks = scanned_blocks.empty() ? nullptr : &scanned_blocks[0];
+        block_count = scanned_blocks.size();
+    }
+
+    // Запись и ее payload: в v2 - прямо в отображении, в v3 - в блоке из кэша
+    const CaptureRecord* locate(size_t i, const uint8_t*& payload) const {
+        if (i >= count) return nullptr;
+        if (!packed) {
+            const CaptureRecord* rec = recordAt(offsets[i]);
+            if (rec) payload = reinterpret_cast<const uint8_t*>(rec + 1);
+            return rec;
+        }
+        size_t b = findBlock(i);
+        const CachedBlock* c = loadBlock(b);
+        size_t k = i - static_cast<size_t>(blocks[b].first_record);
+        if (!c || k >= c->records.size()) return nullptr;
+        payload = c->data + c->payloads[k];
+        return &c->records[k];
+    }
+
+    // Блок с записью i: сначала последний прочитанный - чтение обычно идет подряд
+    size_t findBlock(size_t i) const {
+        size_t hint = cache[last_slot].block;
+        if (hint != NO_BLOCK && blocks[hint].first_record <= i &&
+            (hint + 1 == block_count || blocks[hint + 1].first_record > i)) {
+            return hint;
+        }
+        size_t lo = 0, hi = block_count - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi + 1) / 2;
+            if (blocks[mid].first_record <= i) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        return lo;
+    }
+
+    // Распакованный блок из кэша или с диска; nullptr - блок поврежден
+    // или сжат кодеком, которого нет в сборке
+    const CachedBlock* loadBlock(size_t b) const {
+        size_t slot = 0;
+        for (size_t s = 0; s < CACHE_BLOCKS; s++) {
+            if (cache[s].block == b) {
+                cache[s].used = ++cache_clock;
+                last_slot = s;
+                return &cache[s];
+            }
+            if (cache[s].used < cache[slot].used) slot = s;
+        }
+
+        const CaptureBlockHeader* h = blockAt(blocks[b].offset);
+        if (!h || h->first_record != blocks[b].first_record) return nullptr;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(h + 1);
+        if (blockChecksum(data, h->packed_size) != h->checksum) return nullptr;
+
+        size_t n = h->record_count;
+        if (h->raw_size / sizeof(CaptureRecord) < n) return nullptr;
+        CachedBlock& c = cache[slot];
+        c.block = NO_BLOCK;
+        if (h->codec == BLOCK_CODEC_NONE) {
+            if (h->packed_size != h->raw_size) return nullptr;
+            c.data = data;
+        } else {
+            c.raw.resize(h->raw_size);
+            if (!decompressor.decompress(h->codec, data, h->packed_size, c.raw.data(), h->raw_size)) {
+                return nullptr;
+            }
+            c.data = c.raw.data();
+            unpacked++;
+        }
+
+        // Payload записей идут подряд за заголовками и занимают блок до конца
+        c.records.resize(n);
+        unpackBlockRecords(c.data, n, c.records.data());
+        c.payloads.resize(n);
+        uint64_t offset = n * sizeof(CaptureRecord);
+        for (size_t r = 0; r < n; r++) {
+            if (c.records[r].mark != CAPTURE_RECORD_MARK) return nullptr;
+            c.payloads[r] = static_cast<uint32_t>(offset);
+            offset += c.records[r].payload_len;
+        }
+        if (offset != h->raw_size) return nullptr;
+        c.block = b;
+        c.used = ++cache_clock;
+        last_slot = slot;
+        return &c;
+    }
+
+public:
+    CaptureFile() : fd(-1), base(nullptr), size(0), offsets(nullptr), count(0), complete(false),
+                    packed(false), blocks(nullptr), block_count(0), index_end(0),
+                    last_slot(0), cache_clock(0), unpacked(0) {}
+    ~CaptureFile() { close(); }
+
+    // Файл начинается с магии v2 (иначе - прежний формат)
+    static bool isCaptureFile(const std::string& path) {
+        int f = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (f < 0) return false;
+        char magic[sizeof(CAPTURE_MAGIC)];
+        bool ok = ::read(f, magic, sizeof(magic)) == static_cast<ssize_t>(sizeof(magic)) &&
+                  memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0;
+        ::close(f);
+        return ok;
+    }
+
+    bool open(const std::string& path, std::string& err) {
+        close();
+        err.clear();
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            err = path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CaptureFileHeader)) {
+            err = path + ": нет заголовка";
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            err = path + ": mmap: " + strerror(errno);
+            close();
+            return false;
+        }
+        base = static_cast<const uint8_t*>(p);
+
+        const CaptureFileHeader* h = header();
+        if (memcmp(h->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+            err = path + ": не файл захвата v2";
+        } else if (h->byte_order != CAPTURE_BYTE_ORDER) {
+            err = path + ": файл записан на машине с другим порядком байт";
+        } else if ((h->version != CAPTURE_VERSION && h->version != CAPTURE_VERSION_BLOCKS) ||
+                   h->header_size != sizeof(CaptureFileHeader) || h->record_size != sizeof(CaptureRecord)) {
+            err = path + ": неподдерживаемая версия формата";
+        }
+        if (!err.empty()) {
+            close();
+            return false;
+        }
+        packed = h->version == CAPTURE_VERSION_BLOCKS;
+
+        bool index_ok = h->index_offset >= sizeof(CaptureFileHeader) && h->index_offset % 8 == 0 &&
+                        h->index_offset <= size;
+        if (!packed) {
+            complete = index_ok && h->record_count <= (size - h->index_offset) / sizeof(uint64_t);
+            if (complete) {
+                offsets = reinterpret_cast<const uint64_t*>(base + h->index_offset);
+                count = static_cast<size_t>(h->record_count);
+                index_end = h->index_offset + h->record_count * sizeof(uint64_t);
+            } else {
+                scanRecords();
+            }
+            return true;
+        }
+
+        complete = index_ok && size - h->index_offset >= sizeof(uint64_t);
+        uint64_t n = complete ? *reinterpret_cast<const uint64_t*>(base + h->index_offset) : 0;
+        complete = complete &&
+                   n <= (size - h->index_offset - sizeof(uint64_t)) / sizeof(CaptureBlockEntry) &&
+                   (n > 0 || h->record_count == 0);
+        if (complete) {
+            blocks = n > 0 ? reinterpret_cast<const CaptureBlockEntry*>(base + h->index_offset + sizeof(uint64_t))
+                           : nullptr;
+            block_count = static_cast<size_t>(n);
+            count = static_cast<size_t>(h->record_count);
+            index_end = h->index_offset + sizeof(uint64_t) + n * sizeof(CaptureBlockEntry);
+        } else {
+            scanBlocks();
+        }
+        return true;
+    }
+
+    void close() {
+        if (base) munmap(const_cast<uint8_t*>(base), size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        base = nullptr;
+        size = 0;
+        offsets = nullptr;
+        count = 0;
+        scanned.clear();
+        complete = false;
+        packed = false;
+        blocks = nullptr;
+        block_count = 0;
+        scanned_blocks.clear();
+        index_end = 0;
+        for (size_t s = 0; s < CACHE_BLOCKS; s++) {
+            cache[s].block = NO_BLOCK;
+            cache[s].data = nullptr;
+            cache[s].used = 0;
+        }
+        last_slot = 0;
+        unpacked = 0;
+    }
+
+    bool isOpen() const { return base != nullptr; }
+    const CaptureFileHeader* header() const { return reinterpret_cast<const CaptureFileHeader*>(base); }
+
+    size_t messageCount() const { return count; }
+
+    // false - файл не закрывался, индекс восстановлен по записям
+    bool isComplete() const { return complete; }
+
+    // v3: записи в сжатых блоках
+    bool isCompressed() const { return packed; }
+    size_t blockCount() const { return block_count; }
+    uint64_t blocksUnpacked() const { return unpacked; }
+    uint64_t fileSize() const { return size; }
+
+    // Конец индекса смещений (v2) или блоков (v3) закрытого файла -
+    // отсюда начинается индекс запросов
+    uint64_t indexEnd() const { return index_end; }
+
+    // Заголовок записи по номеру; nullptr - запись повреждена
+    const CaptureRecord* record(size_t i) const {
+        const uint8_t* payload;
+        return locate(i, payload);
+    }
+
+    // Индекс запросов из файла; false - его нет или он не в файле
+    bool queryIndex(const uint8_t*& data, size_t& len) const {
+        uint64_t off = complete ? header()->query_index : 0;
+        if (off == 0 || off % 8 != 0 || off < index_end || off >= size) return false;
+        data = base + off;
+        len = static_cast<size_t>(size - off);
+        return true;
+    }
+
+    // Сообщение по номеру: в v2 за O(1), в v3 - с распаковкой блока, если
+    // его нет в кэше; false - запись повреждена
+    bool message(size_t i, WebSocketMessage& msg) const {
+        const uint8_t* payload;
+        const CaptureRecord* rec = locate(i, payload);
+        if (!rec) return false;
+        msg.timestamp_ns = rec->timestamp_ns;
+        msg.src_ip = rec->src_ip;
+        msg.dst_ip = rec->dst_ip;
+        msg.src_port = rec->src_port;
+        msg.dst_port = rec->dst_port;
+        msg.payload = makeSpan(payload, rec->payload_len);
+        msg.opcode = rec->opcode;
+        msg.is_masked = (rec->flags & CAPTURE_FLAG_MASKED) != 0;
+        msg.is_compressed = (rec->flags & CAPTURE_FLAG_COMPRESSED) != 0;
+        msg.is_truncated = (rec->flags & CAPTURE_FLAG_TRUNCATED) != 0;
+        return true;
+    }
+};
+
+#endif // WS_CAPFILE_H
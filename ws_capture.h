@@ -0,0 +1,317 @@
+#ifndef WS_CAPTURE_H
+#define WS_CAPTURE_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <atomic>
+#include <pcap.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/if_arp.h>
+#include <linux/filter.h>
+
+// Параметры захвата. Значения по умолчанию рассчитаны на всплески
+// трафика: полный snaplen (GRO на lo склеивает сегменты до 64 КБ),
+// буфер ядра 64 МБ и короткий таймаут доставки.
+struct CaptureOptions {
+    int snaplen;          // байт на пакет
+    int buffer_size;      // байт, буфер/кольцо в ядре
+    int timeout_ms;       // таймаут доставки пакетов (таймаут блока TPACKET_V3)
+    bool immediate;       // доставлять каждый пакет сразу (libpcap перейдет на TPACKET_V2)
+    bool af_packet;       // читать кольцо TPACKET_V3 напрямую, без libpcap
+    int workers;          // потоков-декодеров, 0 - декодировать в потоке захвата
+    int fanout;           // сокетов AF_PACKET в группе PACKET_FANOUT, 0 - один сокет
+
+    CaptureOptions() : snaplen(262144), buffer_size(64 * 1024 * 1024), timeout_ms(100),
+                       immediate(false), af_packet(false), workers(1), fanout(0) {}
+};
+
+// Разбор сохраненных файлов pcap/pcapng вместо живого захвата
+struct OfflineOptions {
+    std::string path;  // файл или каталог с файлами, пусто - живой захват
+    int jobs;          // файлов, разбираемых параллельно; 0 - по числу ядер
+    int port;          // только TCP на этом порту, 0 - весь TCP
+
+    OfflineOptions() : jobs(0), port(0) {}
+};
+
+// Версия кольца, которую libpcap на самом деле выбрала для сокета
+// AF_PACKET (с immediate или на старом ядре - не V3); пусто, если handle
+// не на сокете AF_PACKET
+inline const char* pcapRingVersion(pcap_t* handle) {
+    int version = -1;
+    socklen_t len = sizeof(version);
+    int fd = pcap_fileno(handle);
+    if (fd < 0 || getsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, &len) != 0) return "";
+    switch (version) {
+        case TPACKET_V1: return "TPACKET_V1";
+        case TPACKET_V2: return "TPACKET_V2";
+        case TPACKET_V3: return "TPACKET_V3";
+        default: return "";
+    }
+}
+
+// Пакеты одного блока кольца, передаваемые декодеру пачкой
+struct PacketBatch {
+    std::vector<struct pcap_pkthdr> headers;
+    std::vector<const u_char*> packets;
+
+    size_t size() const { return packets.size(); }
+    void clear() {
+        headers.clear();
+        packets.clear();
+    }
+};
+
+// Прямое чтение кольца AF_PACKET/TPACKET_V3. Ядро складывает пакеты в
+// блоки, и обработчик получает блок целиком - один poll() на сотни
+// пакетов вместо вызова callback на каждый.
+class AfPacketRing {
+private:
+    int fd;
+    uint8_t* ring;
+    size_t ring_size;
+    struct tpacket_req3 req;
+    bool is_loopback;
+    int link_type;
+    int snaplen;
+    uint64_t total_packets;
+    uint64_t total_drops;
+    uint64_t total_freezes;
+
+    AfPacketRing(const AfPacketRing&);
+    AfPacketRing& operator=(const AfPacketRing&);
+
+    static bool fail(std::string& err, const char* what) {
+        err = std::string(what) + ": " + strerror(errno);
+        return false;
+    }
+
+    // Фильтр компилируется libpcap и вешается на сокет как classic BPF
+    bool attachFilter(const std::string& filter, std::string& err) {
+        pcap_t* dead = pcap_open_dead(link_type, snaplen);
+        if (!dead) {
+            err = "pcap_open_dead";
+            return false;
+        }
+        struct bpf_program prog;
+        if (pcap_compile(dead, &prog, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) == -1) {
+            err = std::string("Ошибка компиляции фильтра: ") + pcap_geterr(dead);
+            pcap_close(dead);
+            return false;
+        }
+        struct sock_fprog fprog;
+        fprog.len = static_cast<unsigned short>(prog.bf_len);
+        fprog.filter = reinterpret_cast<struct sock_filter*>(prog.bf_insns);
+        int rc = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+        pcap_freecode(&prog);
+        pcap_close(dead);
+        if (rc != 0) return fail(err, "SO_ATTACH_FILTER");
+        return true;
+    }
+
+public:
+    static const unsigned BLOCK_SIZE = 1 << 20;
+    static const unsigned FRAME_SIZE = 2048;
+
+    AfPacketRing() : fd(-1), ring(nullptr), ring_size(0), is_loopback(false), link_type(DLT_EN10MB), snaplen(0),
+                     total_packets(0), total_drops(0), total_freezes(0) {
+        memset(&req, 0, sizeof(req));
+    }
+
+    ~AfPacketRing() { close(); }
+
+    // Тип канала (DLT_*) пакетов, которые сокет SOCK_RAW отдает на
+    // интерфейсе: по типу устройства. -1 - интерфейса нет или тип не
+    // поддерживается.
+    static int linkTypeOf(const std::string& device) {
+        int s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (s < 0) return -1;
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, device.c_str(), IFNAMSIZ - 1);
+        int rc = ioctl(s, SIOCGIFHWADDR, &ifr);
+        ::close(s);
+        if (rc != 0) return -1;
+        switch (ifr.ifr_hwaddr.sa_family) {
+            case ARPHRD_ETHER:
+            case ARPHRD_LOOPBACK:
+                return DLT_EN10MB;
+            case ARPHRD_NONE:
+            case ARPHRD_PPP:
+                return DLT_RAW;
+            default:
+                return -1;
+        }
+    }
+
+    bool open(const std::string& device, const CaptureOptions& opts, const std::string& filter, std::string& err) {
+        link_type = linkTypeOf(device);
+        if (link_type < 0) {
+            err = device + ": тип интерфейса не поддерживается";
+            return false;
+        }
+
+        fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        if (fd < 0) return fail(err, "socket(AF_PACKET)");
+
+        int version = TPACKET_V3;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+            return fail(err, "PACKET_VERSION");
+        }
+
+        // Фильтр ставим до кольца, чтобы в него не попал лишний трафик
+        snaplen = opts.snaplen;
+        if (!attachFilter(filter, err)) return false;
+
+        unsigned blocks = static_cast<unsigned>(opts.buffer_size / BLOCK_SIZE);
+        if (blocks < 4) blocks = 4;
+        req.tp_block_size = BLOCK_SIZE;
+        req.tp_block_nr = blocks;
+        req.tp_frame_size = FRAME_SIZE;
+        req.tp_frame_nr = (BLOCK_SIZE / FRAME_SIZE) * blocks;
+        req.tp_retire_blk_tov = opts.timeout_ms > 0 ? opts.timeout_ms : 1;
+        req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+        if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+            return fail(err, "PACKET_RX_RING");
+        }
+
+        ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+        void* mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+        if (mem == MAP_FAILED) {
+            // MAP_LOCKED может упереться в RLIMIT_MEMLOCK
+            mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (mem == MAP_FAILED) return fail(err, "mmap");
+        ring = static_cast<uint8_t*>(mem);
+
+        struct sockaddr_ll sll;
+        memset(&sll, 0, sizeof(sll));
+        sll.sll_family = AF_PACKET;
+        sll.sll_protocol = htons(ETH_P_ALL);
+        sll.sll_ifindex = static_cast<int>(if_nametoindex(device.c_str()));
+        if (sll.sll_ifindex == 0) return fail(err, "if_nametoindex");
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&sll), sizeof(sll)) != 0) {
+            return fail(err, "bind");
+        }
+
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, device.c_str(), IFNAMSIZ - 1);
+        is_loopback = ioctl(fd, SIOCGIFFLAGS, &ifr) == 0 && (ifr.ifr_flags & IFF_LOOPBACK);
+        return true;
+    }
+
+    // Вступление в группу PACKET_FANOUT. Ядро раскладывает пакеты между
+    // сокетами группы по хешу потока; хеш симметричный, так что оба
+    // направления соединения попадают в один сокет.
+    bool joinFanout(int group_id, std::string& err) {
+        int arg = (group_id & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) != 0) {
+            return fail(err, "PACKET_FANOUT");
+        }
+        return true;
+    }
+
+    void close() {
+        if (ring) {
+            munmap(ring, ring_size);
+            ring = nullptr;
+        }
+        if (fd >= 0) {
+            readStats();
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Замена фильтра на ходу; ядро подменяет его атомарно, при ошибке
+    // остается прежний
+    bool updateFilter(const std::string& filter, std::string& err) {
+        return attachFilter(filter, err);
+    }
+
+    int linkType() const { return link_type; }
+    unsigned blockCount() const { return req.tp_block_nr; }
+    unsigned blockSize() const { return req.tp_block_size; }
+    unsigned blockTimeout() const { return req.tp_retire_blk_tov; }
+
+    // Цикл чтения: handler(batch) вызывается на каждый блок
+    // кольца, пока stop не станет true
+    template <typename Handler>
+    void run(Handler& handler, const std::atomic<bool>& stop) {
+        PacketBatch batch;
+        unsigned current = 0;
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            struct tpacket_block_desc* block = reinterpret_cast<struct tpacket_block_desc*>(
+                ring + static_cast<size_t>(current) * req.tp_block_size);
+
+            if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN | POLLERR;
+                pfd.revents = 0;
+                poll(&pfd, 1, static_cast<int>(req.tp_retire_blk_tov));
+                continue;
+            }
+            __sync_synchronize();
+
+            batch.clear();
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt;
+            for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++) {
+                const struct tpacket3_hdr* h = reinterpret_cast<const struct tpacket3_hdr*>(p);
+                const struct sockaddr_ll* sll = reinterpret_cast<const struct sockaddr_ll*>(
+                    p + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+                // На lo каждый пакет виден дважды: исходящим и входящим
+                if (!(is_loopback && sll->sll_pkttype == PACKET_OUTGOING)) {
+                    struct pcap_pkthdr hdr;
+                    hdr.ts.tv_sec = h->tp_sec;
+                    hdr.ts.tv_usec = h->tp_nsec;  // наносекунды, как у libpcap с PCAP_TSTAMP_PRECISION_NANO
+                    hdr.caplen = h->tp_snaplen;
+                    hdr.len = h->tp_len;
+                    batch.headers.push_back(hdr);
+                    batch.packets.push_back(p + h->tp_mac);
+                }
+                p += h->tp_next_offset;
+            }
+
+            if (batch.size()) handler(batch);
+
+            // Возвращаем блок ядру
+            __sync_synchronize();
+            block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            current = (current + 1) % req.tp_block_nr;
+        }
+        readStats();
+    }
+
+    // Забирает счетчики ядра в packets()/drops()/freezes(). Ядро обнуляет
+    // их при каждом чтении - копим сами. Вызывается из потока захвата.
+    void readStats() {
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+        if (fd >= 0 && getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+            total_packets += st.tp_packets;
+            total_drops += st.tp_drops;
+            total_freezes += st.tp_freeze_q_cnt;
+        }
+    }
+
+    uint64_t packets() const { return total_packets; }
+    uint64_t drops() const { return total_drops; }
+    uint64_t freezes() const { return total_freezes; }
+};
+
+#endif // WS_CAPTURE_H
@@ -0,0 +1,269 @@
+#ifndef WS_CODEC_H
+#define WS_CODEC_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+#ifdef WS_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WS_WITH_LZ4
+#include <lz4.h>
+#endif
+
+// Сжатие блоков файла захвата (ws_capfile.h). zlib есть всегда - им уже
+// распаковывается permessage-deflate; zstd и LZ4 подключаются при сборке:
+//   -DWS_WITH_ZSTD ... -lzstd
+//   -DWS_WITH_LZ4 ... -llz4
+// Файл, сжатый кодеком, которого нет в сборке, открывается, но его
+// блоки не читаются.
+
+static const uint8_t BLOCK_CODEC_NONE = 0;  // записи как есть
+static const uint8_t BLOCK_CODEC_ZLIB = 1;
+static const uint8_t BLOCK_CODEC_LZ4 = 2;
+static const uint8_t BLOCK_CODEC_ZSTD = 3;
+
+inline const char* blockCodecName(uint8_t codec) {
+    switch (codec) {
+        case BLOCK_CODEC_NONE: return "none";
+        case BLOCK_CODEC_ZLIB: return "zlib";
+        case BLOCK_CODEC_LZ4: return "lz4";
+        case BLOCK_CODEC_ZSTD: return "zstd";
+        default: return "?";
+    }
+}
+
+inline bool blockCodecAvailable(uint8_t codec) {
+    switch (codec) {
+        case BLOCK_CODEC_NONE:
+        case BLOCK_CODEC_ZLIB:
+            return true;
+#ifdef WS_WITH_LZ4
+        case BLOCK_CODEC_LZ4:
+            return true;
+#endif
+#ifdef WS_WITH_ZSTD
+        case BLOCK_CODEC_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+// Уровень 0 - свой для кодека: у zlib 1 (выше - втрое медленнее при
+// выигрыше в размере на десятки процентов), у zstd 3
+inline int blockCodecLevel(uint8_t codec, int level) {
+    if (level > 0) return level;
+    return codec == BLOCK_CODEC_ZSTD ? 3 : 1;
+}
+
+// Сжатие записей файла захвата. По умолчанию выключено: сжатие отнимает
+// ядра у декодеров, и на занятой машине поток сохранения начинает ждать
+// свободный блок - включается только явно (--compress).
+struct CompressionOptions {
+    uint8_t codec;     // BLOCK_CODEC_NONE - файл v2 без сжатия
+    int level;         // 0 - по умолчанию для кодека
+    unsigned threads;  // потоков сжатия у каждого писателя
+
+    CompressionOptions() : codec(BLOCK_CODEC_NONE), level(0), threads(2) {}
+
+    bool enabled() const { return codec != BLOCK_CODEC_NONE; }
+};
+
+// "zlib", "zstd:9", "lz4", "none"
+inline bool parseCompression(const std::string& spec, CompressionOptions& opts, std::string& err) {
+    std::string name = spec;
+    int level = 0;
+    size_t colon = spec.find(':');
+    if (colon != std::string::npos) {
+        name = spec.substr(0, colon);
+        char* end = nullptr;
+        long value = strtol(spec.c_str() + colon + 1, &end, 10);
+        if (end == spec.c_str() + colon + 1 || *end != '\0' || value < 1 || value > 22) {
+            err = "неверный уровень сжатия: " + spec;
+            return false;
+        }
+        level = static_cast<int>(value);
+    }
+    uint8_t codec;
+    if (name == "none") {
+        codec = BLOCK_CODEC_NONE;
+    } else if (name == "zlib") {
+        codec = BLOCK_CODEC_ZLIB;
+    } else if (name == "lz4") {
+        codec = BLOCK_CODEC_LZ4;
+    } else if (name == "zstd") {
+        codec = BLOCK_CODEC_ZSTD;
+    } else {
+        err = "неизвестный кодек: " + name;
+        return false;
+    }
+    if (!blockCodecAvailable(codec)) {
+        err = name + " не включен в сборку (-DWS_WITH_" + (codec == BLOCK_CODEC_LZ4 ? "LZ4" : "ZSTD") + ")";
+        return false;
+    }
+    if (codec == BLOCK_CODEC_ZLIB && level > 9) {
+        err = "уровень zlib - от 1 до 9";
+        return false;
+    }
+    opts.codec = codec;
+    opts.level = level;
+    return true;
+}
+
+inline uint32_t blockChecksum(const uint8_t* data, size_t len) {
+    return static_cast<uint32_t>(crc32(0, data, static_cast<uInt>(len)));
+}
+
+// Сжатие блоков одним потоком: состояние кодека создается один раз и
+// переиспользуется от блока к блоку
+class BlockCompressor {
+private:
+    uint8_t codec;
+    int level;
+    z_stream zs;
+    bool zs_ready;
+#ifdef WS_WITH_ZSTD
+    ZSTD_CCtx* cctx;
+#endif
+
+    BlockCompressor(const BlockCompressor&);
+    BlockCompressor& operator=(const BlockCompressor&);
+
+    size_t bound(size_t len) {
+        switch (codec) {
+#ifdef WS_WITH_LZ4
+            case BLOCK_CODEC_LZ4: return static_cast<size_t>(LZ4_compressBound(static_cast<int>(len)));
+#endif
+#ifdef WS_WITH_ZSTD
+            case BLOCK_CODEC_ZSTD: return ZSTD_compressBound(len);
+#endif
+            default: return deflateBound(zs_ready ? &zs : nullptr, static_cast<uLong>(len));
+        }
+    }
+
+public:
+    BlockCompressor(uint8_t c, int l) : codec(c), level(blockCodecLevel(c, l)), zs_ready(false) {
+        memset(&zs, 0, sizeof(zs));
+        if (codec == BLOCK_CODEC_ZLIB) zs_ready = deflateInit(&zs, level) == Z_OK;
+#ifdef WS_WITH_ZSTD
+        cctx = codec == BLOCK_CODEC_ZSTD ? ZSTD_createCCtx() : nullptr;
+#endif
+    }
+
+    ~BlockCompressor() {
+        if (zs_ready) deflateEnd(&zs);
+#ifdef WS_WITH_ZSTD
+        if (cctx) ZSTD_freeCCtx(cctx);
+#endif
+    }
+
+    // Сжимает len байт в out начиная с at; false - кодек не справился или
+    // не выиграл ни байта (тогда блок пишется как есть)
+    bool compress(const uint8_t* src, size_t len, std::vector<uint8_t>& out, size_t at) {
+        out.resize(at + bound(len));
+        uint8_t* dst = out.data() + at;
+        size_t room = out.size() - at;
+        size_t n = 0;
+        switch (codec) {
+            case BLOCK_CODEC_ZLIB:
+                if (!zs_ready || deflateReset(&zs) != Z_OK) return false;
+                zs.next_in = const_cast<Bytef*>(src);
+                zs.avail_in = static_cast<uInt>(len);
+                zs.next_out = dst;
+                zs.avail_out = static_cast<uInt>(room);
+                if (deflate(&zs, Z_FINISH) != Z_STREAM_END) return false;
+                n = room - zs.avail_out;
+                break;
+#ifdef WS_WITH_LZ4
+            case BLOCK_CODEC_LZ4: {
+                int r = LZ4_compress_default(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                             static_cast<int>(len), static_cast<int>(room));
+                if (r <= 0) return false;
+                n = static_cast<size_t>(r);
+                break;
+            }
+#endif
+#ifdef WS_WITH_ZSTD
+            case BLOCK_CODEC_ZSTD:
+                if (!cctx) return false;
+                n = ZSTD_compressCCtx(cctx, dst, room, src, len, level);
+                if (ZSTD_isError(n)) return false;
+                break;
+#endif
+            default:
+                return false;
+        }
+        if (n >= len) return false;
+        out.resize(at + n);
+        return true;
+    }
+};
+
+// Распаковка блоков одним потоком
+class BlockDecompressor {
+private:
+    z_stream zs;
+    bool zs_ready;
+#ifdef WS_WITH_ZSTD
+    ZSTD_DCtx* dctx;
+#endif
+
+    BlockDecompressor(const BlockDecompressor&);
+    BlockDecompressor& operator=(const BlockDecompressor&);
+
+public:
+    BlockDecompressor() : zs_ready(false) {
+        memset(&zs, 0, sizeof(zs));
+        zs_ready = inflateInit(&zs) == Z_OK;
+#ifdef WS_WITH_ZSTD
+        dctx = ZSTD_createDCtx();
+#endif
+    }
+
+    ~BlockDecompressor() {
+        if (zs_ready) inflateEnd(&zs);
+#ifdef WS_WITH_ZSTD
+        if (dctx) ZSTD_freeDCtx(dctx);
+#endif
+    }
+
+    // Ровно raw_len байт в dst; иначе блок поврежден
+    bool decompress(uint8_t codec, const uint8_t* src, size_t len, uint8_t* dst, size_t raw_len) {
+        switch (codec) {
+            case BLOCK_CODEC_NONE:
+                if (len != raw_len) return false;
+                memcpy(dst, src, len);
+                return true;
+            case BLOCK_CODEC_ZLIB: {
+                if (!zs_ready || inflateReset(&zs) != Z_OK) return false;
+                zs.next_in = const_cast<Bytef*>(src);
+                zs.avail_in = static_cast<uInt>(len);
+                zs.next_out = dst;
+                zs.avail_out = static_cast<uInt>(raw_len);
+                return inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.avail_out == 0;
+            }
+#ifdef WS_WITH_LZ4
+            case BLOCK_CODEC_LZ4:
+                return LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                           static_cast<int>(len), static_cast<int>(raw_len)) ==
+                       static_cast<int>(raw_len);
+#endif
+#ifdef WS_WITH_ZSTD
+            case BLOCK_CODEC_ZSTD: {
+                if (!dctx) return false;
+                size_t n = ZSTD_decompressDCtx(dctx, dst, raw_len, src, len);
+                return !ZSTD_isError(n) && n == raw_len;
+            }
+#endif
+            default:
+                return false;
+        }
+    }
+};
+
+#endif // WS_CODEC_H
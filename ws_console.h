@@ -0,0 +1,330 @@
+#ifndef WS_CONSOLE_H
+#define WS_CONSOLE_H
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include "ws_message.h"
+#include "ws_ring.h"
+
+// Что печатать во время захвата
+struct DisplayOptions {
+    enum Mode {
+        MODE_FULL,     // каждое сообщение (с ограничением частоты) + сводка при потерях
+        MODE_SUMMARY,  // только периодическая сводка
+        MODE_QUIET     // ничего, только счетчики
+    };
+
+    Mode mode;
+    unsigned print_rate;  // сообщений в секунду на экран, 0 - без ограничения
+
+    DisplayOptions() : mode(MODE_FULL), print_rate(100) {}
+};
+
+// Асинхронный вывод перехваченных сообщений. Поток, который сохраняет
+// сообщения, только кладет их в очередь; форматирование идет в фоновом
+// потоке в переиспользуемый буфер, который уходит в stdout одним
+// write() на десятки килобайт. Если экран не успевает или превышен
+// лимит частоты, сообщение не печатается (но захватывается и
+// сохраняется), такие считаются в сводке.
+class ConsoleOutput {
+private:
+    // Начало payload копируется в очередь: к моменту печати арена
+    // декодера уже может быть освобождена (потоковая запись)
+    static const size_t PREVIEW_SIZE = 200;
+    
+    struct Item {
+        uint64_t number;
+        WebSocketMessage msg;
+        bool printable;
+        uint8_t preview[PREVIEW_SIZE];
+    };
+
+    DisplayOptions opts;
+    SpscQueue<Item> queue;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    // Счетчики пишет только производитель
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> dropped;
+    int64_t rate_window;
+    unsigned rate_count;
+
+    // Служебные строки (заполненность очередей и т.п.), редкие
+    std::mutex lines_mutex;
+    std::string lines;
+
+    std::string buf;
+
+    static const size_t QUEUE_SIZE = 16384;
+    static const size_t FLUSH_SIZE = 64 * 1024;
+    static const int STATS_INTERVAL_MS = 1000;
+
+    ConsoleOutput(const ConsoleOutput&);
+    ConsoleOutput& operator=(const ConsoleOutput&);
+
+    static void appendNumber(std::string& out, uint64_t v) {
+        char tmp[24];
+        int n = snprintf(tmp, sizeof(tmp), "%llu", static_cast<unsigned long long>(v));
+        out.append(tmp, n);
+    }
+
+    static void appendEndpoint(std::string& out, const IpAddress& addr, uint16_t port) {
+        char tmp[INET6_ADDRSTRLEN];
+        bool v6 = !addr.isV4();
+        if (v6) out += '[';
+        out.append(tmp, formatIpTo(addr, tmp, sizeof(tmp)));
+        if (v6) out += ']';
+        out += ':';
+        appendNumber(out, port);
+    }
+
+    static void appendHex(std::string& out, const uint8_t* data, size_t len, size_t max_len) {
+        static const char digits[] = "0123456789abcdef";
+        size_t n = len < max_len ? len : max_len;
+        for (size_t i = 0; i < n; i++) {
+            out += digits[data[i] >> 4];
+            out += digits[data[i] & 0x0F];
+            out += ' ';
+        }
+        if (len > max_len) out += "...";
+        out += '\n';
+    }
+
+    static void appendMessage(std::string& out, const Item& item) {
+        const WebSocketMessage& msg = item.msg;
+        out += "📦 Перехвачено сообщение #";
+        appendNumber(out, item.number);
+        out += "\n   ";
+        appendEndpoint(out, msg.src_ip, msg.src_port);
+        out += " -> ";
+        appendEndpoint(out, msg.dst_ip, msg.dst_port);
+        out += "\n   Тип: ";
+        out += opcodeToString(msg.opcode);
+        char opcode_hex[8];
+        snprintf(opcode_hex, sizeof(opcode_hex), " (0x%x)", msg.opcode);
+        out += opcode_hex;
+        out += ", Маска: ";
+        out += msg.is_masked ? "Да" : "Нет";
+        out += ", Сжатие: ";
+        out += msg.is_compressed ? "Да" : "Нет";
+        out += ", Размер: ";
+        appendNumber(out, msg.payload.size());
+        out += msg.is_truncated ? " байт (обрезано)\n" : " байт\n";
+
+        const uint8_t* p = item.preview;
+        size_t len = msg.payload.size();
+
+        // Вывод содержимого
+        if (msg.opcode == 0x1 && len > 0) { // Text frame
+            out += "   📝 Текст: ";
+
+            if (item.printable) {
+                out.append(reinterpret_cast<const char*>(p), len < 200 ? len : 200);
+                if (len > 200) out += "...";
+            } else {
+                out += "[Содержит управляющие символы] ";
+                appendHex(out, p, len, 32);
+            }
+            out += '\n';
+        } else if (msg.opcode == 0x2) { // Binary frame
+            out += "   🔢 Бинарные данные: ";
+            appendHex(out, p, len, 32);
+        } else if (msg.opcode == 0x8) { // Close frame
+            out += "   👋 Закрытие соединения";
+            if (len >= 2) {
+                out += ", код: ";
+                appendNumber(out, (p[0] << 8) | p[1]);
+                if (len > 2) {
+                    // Управляющий фрейм не длиннее 125 байт - целиком в preview
+                    out += ", причина: ";
+                    out.append(reinterpret_cast<const char*>(p + 2), (len < PREVIEW_SIZE ? len : PREVIEW_SIZE) - 2);
+                }
+            }
+            out += '\n';
+        } else if (msg.opcode == 0x9) {
+            out += "   🏓 Ping\n";
+        } else if (msg.opcode == 0xA) {
+            out += "   🏓 Pong\n";
+        }
+
+        out += '\n';
+    }
+
+    void flush() {
+        size_t off = 0;
+        while (off < buf.size()) {
+            ssize_t n = ::write(STDOUT_FILENO, buf.data() + off, buf.size() - off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;  // stdout закрыт - выводить некуда
+            }
+            off += static_cast<size_t>(n);
+        }
+        buf.clear();
+    }
+
+    void appendStats(double seconds, uint64_t messages, uint64_t not_shown, uint64_t all) {
+        char line[128];
+        if (opts.mode == DisplayOptions::MODE_SUMMARY) {
+            snprintf(line, sizeof(line), "📊 %.0f сообщ/с, всего %llu\n",
+                     messages / seconds, static_cast<unsigned long long>(all));
+        } else {
+            snprintf(line, sizeof(line), "📊 %.0f сообщ/с, не показано: %llu\n",
+                     messages / seconds, static_cast<unsigned long long>(not_shown));
+        }
+        buf += line;
+    }
+
+    void run() {
+        Item item;
+        unsigned idle = 0;
+        std::chrono::steady_clock::time_point last_stats = std::chrono::steady_clock::now();
+        uint64_t last_total = 0;
+        uint64_t last_dropped = 0;
+
+        for (;;) {
+            bool stopping = !running.load(std::memory_order_acquire);
+
+            size_t n = 0;
+            while (n < QUEUE_SIZE && queue.pop(item)) {
+                appendMessage(buf, item);
+                n++;
+                if (buf.size() >= FLUSH_SIZE) flush();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(lines_mutex);
+                if (!lines.empty()) {
+                    buf += lines;
+                    lines.clear();
+                }
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_stats).count();
+            if (elapsed_ms >= STATS_INTERVAL_MS) {
+                uint64_t t = total.load(std::memory_order_relaxed);
+                uint64_t d = dropped.load(std::memory_order_relaxed);
+                // В полном режиме сводка нужна, только когда что-то не показали
+                if (opts.mode == DisplayOptions::MODE_SUMMARY || d != last_dropped) {
+                    appendStats(elapsed_ms / 1000.0, t - last_total, d - last_dropped, t);
+                }
+                last_total = t;
+                last_dropped = d;
+                last_stats = now;
+            }
+
+            // Очередь разобрана - отдаем накопленное
+            if (!buf.empty()) flush();
+            if (stopping) break;
+
+            if (n > 0) {
+                idle = 0;
+            } else if (++idle < 16) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+    }
+
+public:
+    ConsoleOutput() : queue(QUEUE_SIZE), running(false), total(0), dropped(0),
+                      rate_window(0), rate_count(0) {
+        buf.reserve(FLUSH_SIZE * 2);
+    }
+
+    ~ConsoleOutput() { stop(); }
+
+    void start(const DisplayOptions& display) {
+        opts = display;
+        total = 0;
+        dropped = 0;
+        rate_window = 0;
+        rate_count = 0;
+        if (opts.mode == DisplayOptions::MODE_QUIET) return;
+        // То, что уже лежит в буфере std::cout, должно выйти раньше
+        fflush(stdout);
+        std::cout.flush();
+        running = true;
+        thread = std::thread(&ConsoleOutput::run, this);
+    }
+
+    // Дожидается вывода всего, что уже в очереди
+    void stop() {
+        if (!thread.joinable()) return;
+        running.store(false, std::memory_order_release);
+        thread.join();
+    }
+
+    // Вызывается из потока, сохраняющего сообщения; никогда не ждет
+    void submit(uint64_t number, const WebSocketMessage& msg) {
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (opts.mode != DisplayOptions::MODE_FULL) return;
+
+        if (opts.print_rate > 0) {
+            int64_t now = static_cast<int64_t>(time(nullptr));
+            if (now != rate_window) {
+                rate_window = now;
+                rate_count = 0;
+            }
+            if (rate_count >= opts.print_rate) {
+                dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            rate_count++;
+        }
+
+        Item item;
+        item.number = number;
+        item.msg = msg;
+        item.msg.payload = makeSpan(nullptr, msg.payload.size());
+        size_t preview_len = msg.payload.size() < PREVIEW_SIZE ? msg.payload.size() : PREVIEW_SIZE;
+        if (preview_len) memcpy(item.preview, msg.payload.data(), preview_len);
+        
+        // Разрешаем: печатные ASCII (>= 32), табы, переводы строк, и все UTF-8 (>= 128)
+        item.printable = true;
+        if (msg.opcode == 0x1) {
+            const uint8_t* p = msg.payload.data();
+            for (size_t i = 0; i < msg.payload.size(); i++) {
+                if (p[i] < 32 && p[i] != '\n' && p[i] != '\r' && p[i] != '\t') {
+                    item.printable = false;
+                    break;
+                }
+            }
+        }
+        
+        if (!queue.push(item)) {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // Служебная строка (с переводом строки) в общий поток вывода
+    void printLine(const std::string& line) {
+        if (!thread.joinable()) {
+            if (opts.mode != DisplayOptions::MODE_QUIET) std::cout << line << std::flush;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        lines += line;
+    }
+
+    uint64_t totalCount() const { return total.load(std::memory_order_relaxed); }
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t shownCount() const {
+        if (opts.mode != DisplayOptions::MODE_FULL) return 0;
+        return totalCount() - droppedCount();
+    }
+};
+
+#endif // WS_CONSOLE_H
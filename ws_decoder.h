@@ -0,0 +1,1247 @@
+#ifndef WS_DECODER_H
+#define WS_DECODER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <strings.h>
+#include <pcap.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "ws_flow.h"
+#include "ws_message.h"
+#include "ws_unmask.h"
+#include "ws_filter.h"
+#include "ws_match.h"
+#include "ws_metrics.h"
+
+// Поля TCP-сегмента, нужные декодеру и диспетчеру потоков
+struct TcpSegmentInfo {
+    FlowKey key;
+    int dir;                 // направление пакета в канонической паре
+    uint32_t seq;
+    uint8_t flags;
+    const u_char* payload;
+    size_t payload_len;      // по заголовку IP
+    size_t captured_len;     // реально захвачено (может быть обрезано snaplen)
+};
+
+// Время пакета в наносекундах от эпохи. При PCAP_TSTAMP_PRECISION_NANO
+// (и в кольце AF_PACKET) в tv_usec лежат наносекунды.
+inline int64_t packetTimeNs(const struct pcap_pkthdr* header, bool nano) {
+    int64_t frac = static_cast<int64_t>(header->ts.tv_usec);
+    return static_cast<int64_t>(header->ts.tv_sec) * 1000000000LL + (nano ? frac : frac * 1000);
+}
+
+inline uint16_t loadBe16(const u_char* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+// Разбор заголовка канального уровня: смещение IP-пакета и его ethertype.
+// Выбирается один раз по типу канала захвата (pcap_datalink).
+typedef bool (*LinkParser)(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype);
+
+static const uint16_t ETHERTYPE_IPV4 = 0x0800;
+static const uint16_t ETHERTYPE_IPV6 = 0x86DD;
+
+// Теги 802.1Q/802.1ad (в том числе вложенные QinQ)
+inline bool skipVlanTags(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    while (ethertype == 0x8100 || ethertype == 0x88A8 || ethertype == 0x9100) {
+        if (caplen < offset + 4) return false;
+        ethertype = loadBe16(packet + offset + 2);
+        offset += 4;
+    }
+    return true;
+}
+
+inline bool parseEthernetLink(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    if (caplen < 14) return false;
+    ethertype = loadBe16(packet + 12);
+    offset = 14;
+    return skipVlanTags(packet, caplen, offset, ethertype);
+}
+
+// Захват на "any": псевдозаголовок Linux cooked v1 (16 байт) и v2 (20 байт)
+inline bool parseLinuxSllLink(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    if (caplen < 16) return false;
+    ethertype = loadBe16(packet + 14);
+    offset = 16;
+    return skipVlanTags(packet, caplen, offset, ethertype);
+}
+
+inline bool parseLinuxSll2Link(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    if (caplen < 20) return false;
+    ethertype = loadBe16(packet);
+    offset = 20;
+    return skipVlanTags(packet, caplen, offset, ethertype);
+}
+
+// Голый IP (tun и т.п.): версия из первого байта
+inline bool parseRawIpLink(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    if (caplen < 1) return false;
+    offset = 0;
+    ethertype = (packet[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IPV4;
+    return true;
+}
+
+// BSD loopback: 4 байта семейства адресов (в DLT_NULL - в порядке байт
+// машины, в DLT_LOOP - в сетевом). Номер AF_INET6 у разных систем свой.
+inline bool familyToEthertype(uint32_t family, uint16_t& ethertype) {
+    if (family == 2) {
+        ethertype = ETHERTYPE_IPV4;
+    } else if (family == 10 || family == 24 || family == 28 || family == 30) {
+        ethertype = ETHERTYPE_IPV6;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline bool parseNullLink(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    if (caplen < 4) return false;
+    uint32_t family;
+    memcpy(&family, packet, 4);
+    offset = 4;
+    return familyToEthertype(family, ethertype);
+}
+
+inline bool parseLoopLink(const u_char* packet, size_t caplen, size_t& offset, uint16_t& ethertype) {
+    if (caplen < 4) return false;
+    uint32_t family;
+    memcpy(&family, packet, 4);
+    offset = 4;
+    return familyToEthertype(ntohl(family), ethertype);
+}
+
+struct LinkLayer {
+    int dlt;
+    LinkParser parse;
+};
+
+static const LinkLayer LINK_LAYERS[] = {
+    {DLT_EN10MB, parseEthernetLink},
+    {DLT_LINUX_SLL, parseLinuxSllLink},
+#ifdef DLT_LINUX_SLL2
+    {DLT_LINUX_SLL2, parseLinuxSll2Link},
+#endif
+    {DLT_RAW, parseRawIpLink},
+#ifdef DLT_IPV4
+    {DLT_IPV4, parseRawIpLink},
+    {DLT_IPV6, parseRawIpLink},
+#endif
+    {DLT_NULL, parseNullLink},
+    {DLT_LOOP, parseLoopLink},
+};
+
+// nullptr - тип канала не поддерживается
+inline LinkParser linkParserFor(int dlt) {
+    for (size_t i = 0; i < sizeof(LINK_LAYERS) / sizeof(LINK_LAYERS[0]); i++) {
+        if (LINK_LAYERS[i].dlt == dlt) return LINK_LAYERS[i].parse;
+    }
+    return nullptr;
+}
+
+// Заголовок IPv6 и цепочка заголовков расширений до TCP. header_len -
+// длина всех заголовков, total_len - длина IP-пакета по заголовку.
+inline bool parseIpv6Header(const u_char* ip, size_t caplen, size_t& header_len, size_t& total_len) {
+    if (caplen < 40 || (ip[0] >> 4) != 6) return false;
+    size_t payload_len = loadBe16(ip + 4);
+    if (payload_len == 0) return false;  // jumbogram
+    total_len = 40 + payload_len;
+
+    uint8_t next = ip[6];
+    size_t pos = 40;
+    for (;;) {
+        if (next == IPPROTO_TCP) break;
+        if (next != 0 && next != 43 && next != 44 && next != 51 && next != 60) return false;
+        if (caplen < pos + 8) return false;
+        size_t len;
+        if (next == 44) {
+            // Фрагменты не собираем: берем только нефрагментированные
+            if ((loadBe16(ip + pos + 2) & 0xFFF9) != 0) return false;
+            len = 8;
+        } else if (next == 51) {
+            len = (static_cast<size_t>(ip[pos + 1]) + 2) * 4;  // AH
+        } else {
+            len = (static_cast<size_t>(ip[pos + 1]) + 1) * 8;
+        }
+        next = ip[pos];
+        pos += len;
+    }
+    header_len = pos;
+    return true;
+}
+
+// Разбор канального уровня, IPv4/IPv6 и TCP. false - пакет не TCP или поврежден.
+inline bool parseTcpSegment(LinkParser link, const struct pcap_pkthdr* header, const u_char* packet,
+                            TcpSegmentInfo& info) {
+    size_t caplen = header->caplen;
+    size_t offset;
+    uint16_t ethertype;
+    if (!link(packet, caplen, offset, ethertype)) return false;
+    
+    const u_char* ip = packet + offset;
+    size_t ip_caplen = caplen - offset;
+    size_t ip_header_len, ip_total_len;
+    IpAddress src, dst;
+    
+    if (ethertype == ETHERTYPE_IPV4) {
+        if (ip_caplen < sizeof(struct ip)) return false;
+        const struct ip* ip_header = reinterpret_cast<const struct ip*>(ip);
+        // IHL меньше 5 слов - заголовок короче обязательных 20 байт
+        if (ip_header->ip_v != 4 || ip_header->ip_hl < 5 || ip_header->ip_p != IPPROTO_TCP) return false;
+        ip_header_len = ip_header->ip_hl * 4;
+        ip_total_len = ntohs(ip_header->ip_len);
+        src = ipv4Address(ip_header->ip_src.s_addr);
+        dst = ipv4Address(ip_header->ip_dst.s_addr);
+    } else if (ethertype == ETHERTYPE_IPV6) {
+        if (!parseIpv6Header(ip, ip_caplen, ip_header_len, ip_total_len)) return false;
+        src = ipv6Address(ip + 8);
+        dst = ipv6Address(ip + 24);
+    } else {
+        return false;
+    }
+    
+    if (ip_caplen < ip_header_len + sizeof(struct tcphdr)) return false;
+    
+    const struct tcphdr* tcp_header = reinterpret_cast<const struct tcphdr*>(ip + ip_header_len);
+    size_t tcp_header_len = tcp_header->th_off * 4;
+    if (tcp_header_len < sizeof(struct tcphdr)) return false;
+    size_t headers_len = offset + ip_header_len + tcp_header_len;
+    
+    if (ip_total_len < ip_header_len + tcp_header_len) return false;
+    
+    info.payload = packet + headers_len;
+    info.payload_len = ip_total_len - ip_header_len - tcp_header_len;
+    info.captured_len = caplen > headers_len ? caplen - headers_len : 0;
+    if (info.captured_len > info.payload_len) info.captured_len = info.payload_len;  // Ethernet padding
+    
+    info.flags = tcp_header->th_flags;
+    info.seq = ntohl(tcp_header->th_seq);
+    info.dir = makeFlowKey(src, ntohs(tcp_header->th_sport), dst, ntohs(tcp_header->th_dport), info.key);
+    return true;
+}
+
+// Начинается ли поток с HTTP (Upgrade запрос или ответ 101)
+inline bool isHttpStart(const uint8_t* data, size_t len) {
+    return (len >= 4 && memcmp(data, "GET ", 4) == 0) ||
+           (len >= 5 && memcmp(data, "HTTP/", 5) == 0);
+}
+
+// Поиск значения HTTP-заголовка (имя без учета регистра)
+inline bool findHttpHeader(const uint8_t* data, size_t len, const char* name, std::string& value) {
+    size_t name_len = strlen(name);
+    const char* p = reinterpret_cast<const char*>(data);
+    const char* end = p + len;
+    
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        if (static_cast<size_t>(eol - p) > name_len && p[name_len] == ':' &&
+            strncasecmp(p, name, name_len) == 0) {
+            const char* v = p + name_len + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) v++;
+            const char* v_end = eol;
+            while (v_end > v && (v_end[-1] == '\r' || v_end[-1] == ' ')) v_end--;
+            value.assign(v, v_end);
+            return true;
+        }
+        p = eol + 1;
+    }
+    return false;
+}
+
+// Запрос или ответ с "Upgrade: websocket" (HTTP-заголовок целиком в data)
+inline bool isWebSocketUpgrade(const uint8_t* data, size_t len) {
+    if (!isHttpStart(data, len)) return false;
+    std::string value;
+    return findHttpHeader(data, len, "Upgrade", value) && strcasecmp(value.c_str(), "websocket") == 0;
+}
+
+// Значение из "токен" или "\"токен\"" без пробелов по краям
+inline std::string trimHttpToken(const std::string& s, size_t begin, size_t end) {
+    while (begin < end && (s[begin] == ' ' || s[begin] == '\t')) begin++;
+    while (end > begin && (s[end - 1] == ' ' || s[end - 1] == '\t')) end--;
+    if (end - begin >= 2 && s[begin] == '"' && s[end - 1] == '"') {
+        begin++;
+        end--;
+    }
+    return s.substr(begin, end - begin);
+}
+
+// Параметры permessage-deflate из Sec-WebSocket-Extensions ответа
+// (RFC 7692): "permessage-deflate; client_max_window_bits=10, ...".
+// false - расширение не согласовано.
+inline bool parseDeflateExtension(const std::string& value, WebSocketHandshake& hs) {
+    size_t pos = 0;
+    while (pos < value.size()) {
+        size_t ext_end = value.find(',', pos);
+        if (ext_end == std::string::npos) ext_end = value.size();
+        
+        size_t param_end = value.find(';', pos);
+        if (param_end == std::string::npos || param_end > ext_end) param_end = ext_end;
+        if (trimHttpToken(value, pos, param_end) == "permessage-deflate") {
+            hs.deflate = true;
+            while (param_end < ext_end) {
+                size_t begin = param_end + 1;
+                param_end = value.find(';', begin);
+                if (param_end == std::string::npos || param_end > ext_end) param_end = ext_end;
+                
+                size_t eq = value.find('=', begin);
+                bool has_value = eq != std::string::npos && eq < param_end;
+                std::string name = trimHttpToken(value, begin, has_value ? eq : param_end);
+                int bits = has_value ? atoi(trimHttpToken(value, eq + 1, param_end).c_str()) : 0;
+                
+                if (name == "server_no_context_takeover") {
+                    hs.server_no_context_takeover = true;
+                } else if (name == "client_no_context_takeover") {
+                    hs.client_no_context_takeover = true;
+                } else if (name == "server_max_window_bits" && bits >= 8 && bits <= 15) {
+                    hs.server_max_window_bits = static_cast<uint8_t>(bits);
+                } else if (name == "client_max_window_bits" && bits >= 8 && bits <= 15) {
+                    hs.client_max_window_bits = static_cast<uint8_t>(bits);
+                }
+            }
+            return true;
+        }
+        pos = ext_end + 1;
+    }
+    return false;
+}
+
+// Пределы памяти на сборку сообщения из фрагментов (и на распаковку
+// сжатого фрейма по кускам): на одно сообщение и на все собираемые
+// сообщения соединения в обе стороны
+struct MessageLimits {
+    size_t max_message;
+    size_t max_flow;
+
+    MessageLimits() : max_message(64 * 1024 * 1024), max_flow(128 * 1024 * 1024) {}
+};
+
+// Декодер WebSocket трафика: сборка TCP потоков, разбор фреймов,
+// распаковка. Все состояние (соединения, контексты inflate, арена
+// payload) принадлежит одному экземпляру, поэтому в многопоточном
+// режиме у каждого потока-декодера свой WebSocketDecoder.
+class WebSocketDecoder {
+public:
+    static const uint64_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+    
+    enum FrameStatus {
+        FRAME_OK,          // фрейм разобран целиком
+        FRAME_INCOMPLETE,  // нужно больше данных из потока
+        FRAME_INVALID      // данные не похожи на WebSocket фрейм
+    };
+    
+private:
+    // Payload декодированных сообщений. На арену ссылаются сообщения,
+    // отданные через takeMessages, поэтому по умолчанию она живет столько
+    // же, сколько декодер. Если потребитель пишет или копирует payload
+    // (setRecycle), арен несколько: заполненная уходит в отставку и
+    // очищается, когда потребитель подтвердил (acknowledge) все ее
+    // сообщения.
+    static const unsigned ARENA_GENERATIONS = 4;
+    static const size_t ARENA_GENERATION_SIZE = 16 * 1024 * 1024;
+    
+    PayloadArena arenas[ARENA_GENERATIONS];
+    uint64_t produced[ARENA_GENERATIONS];
+    std::atomic<uint64_t> consumed[ARENA_GENERATIONS];
+    uint32_t generation;
+    bool recycle;
+    
+    PayloadArena& arena() { return arenas[generation % ARENA_GENERATIONS]; }
+    
+    // Сжатый payload и фрагменты до распаковки/сборки (в арену попадает
+    // только готовое сообщение)
+    std::vector<uint8_t> compressed_scratch;
+    
+    // Размаскированный кусок сжатого фрейма перед inflate
+    std::vector<uint8_t> chunk_scratch;
+    
+    // Пределы сборки сообщений из фрагментов
+    MessageLimits limits;
+    
+    // Пул памяти zlib должен пережить контексты inflate в flows
+    InflatePool inflate_pool;
+    
+    // Отслеживаемые TCP-соединения и сборка потоков
+    FlowTable flows;
+    uint64_t packet_count;
+    
+    // Соединения, опознанные как WebSocket и отброшенные как не WebSocket
+    uint64_t websocket_flows;
+    uint64_t ignored_flows;
+    
+    // Фильтр фреймов (--filter) и общий с другими декодерами список не
+    // WebSocket соединений для фильтра ядра
+    FrameFilter frame_filter;
+    uint64_t filtered_frames;
+    IgnoredFlowSet* ignored_set;
+    std::vector<FlowKey> expired;
+    
+    // Поиск шаблонов (--patterns) в payload после распаковки; автомат
+    // общий для всех декодеров и только читается
+    const PatternMatcher* matcher;
+    std::vector<PatternHit> hit_scratch;
+    uint64_t pattern_hits;
+    
+    // Больше совпадений одного сообщения не хранится (только считается)
+    static const size_t MAX_HITS_PER_MESSAGE = 16;
+    
+    // Счетчики для --metrics-port/--metrics-interval; nullptr - не считать.
+    // Причина последнего FRAME_INVALID из parseFrameHeader.
+    DecoderMetrics* metrics;
+    uint8_t invalid_reason;
+    
+    // Время текущего пакета - оно же время сообщений, которые он завершил
+    bool nano_timestamps;
+    int64_t packet_time;
+    
+    LinkParser link;
+    
+    // Декодированные сообщения, еще не забранные вызывающим кодом
+    std::vector<WebSocketMessage> messages;
+    
+    static const uint32_t FLOW_IDLE_TIMEOUT = 300;      // секунд
+    static const uint64_t FLOW_EXPIRE_INTERVAL = 65536; // пакетов
+    static const size_t MAX_HTTP_HEADER = 16 * 1024;
+    
+    // Соединение без рукопожатия (захват начат посреди него) считается
+    // не WebSocket после стольких сегментов подряд без единого фрейма
+    static const uint8_t MAX_BAD_SEGMENTS = 4;
+    
+    // Декомпрессия данных (permessage-deflate) в контексте направления
+    // потока; больше limit байт не сохраняется, тогда truncated
+    bool decompressData(Inflater& inflater, const uint8_t* compressed, size_t len, size_t limit,
+                        ByteSpan& decompressed, bool& truncated) {
+        size_t out_len = 0;
+        uint64_t discarded = 0;
+        if (!inflater.decompress(inflate_pool, compressed, len, out_len, limit, discarded)) {
+            return false;
+        }
+        decompressed = arena().copy(inflate_pool.outputBuffer().data(), out_len);
+        truncated = discarded > 0;
+        return true;
+    }
+    
+    FrameStatus invalidFrame(ParseFailure reason) {
+        invalid_reason = static_cast<uint8_t>(reason);
+        return FRAME_INVALID;
+    }
+    
+    // Текст и бинарные данные со сжатием сначала распаковываются
+    static bool needsInflate(const WebSocketMessage& msg) {
+        return msg.is_compressed && (msg.opcode == 0x1 || msg.opcode == 0x2);
+    }
+    
+    // Фрейм от клиента: по рукопожатию, а без него - по маске (клиент
+    // маскирует всегда, сервер никогда)
+    static bool fromClient(const Flow& flow, int dir, bool masked) {
+        return flow.client_dir >= 0 ? dir == flow.client_dir : masked;
+    }
+    
+    bool acceptsFrame(const Flow& flow, int dir, const WebSocketMessage& msg) const {
+        return frame_filter.acceptsOpcode(msg.opcode) &&
+               frame_filter.acceptsDirection(fromClient(flow, dir, msg.is_masked));
+    }
+    
+    // Решение фильтра по одному заголовку, до снятия маски. Сжатые данные
+    // с context takeover распаковываются все равно: без них не разобрать
+    // следующие сообщения; их размер известен только после распаковки.
+    bool skipFrame(const Flow& flow, int dir, const WebSocketMessage& msg, uint8_t first_byte, uint64_t payload_len) {
+        // Фрагменты решаются целым сообщением - по первому фрагменту
+        // и итоговому размеру (beginAssembly, completeAssembly)
+        if (isFragment(first_byte)) return false;
+        bool inflate = needsInflate(msg);
+        if (inflate && !flow.inflater[dir].no_context_takeover) return false;
+        if (acceptsFrame(flow, dir, msg) && (inflate || frame_filter.acceptsSize(payload_len))) return false;
+        filtered_frames++;
+        if (metrics) metrics->frames[msg.opcode].add();
+        return true;
+    }
+    
+    // Удаление соединения (RST, FIN с обеих сторон, простой): собираемые
+    // сообщения отдаются обрезанными, как при разрыве потока; не
+    // WebSocket соединение уходит и из фильтра ядра
+    void eraseFlow(const FlowKey& key) {
+        Flow* flow = flows.find(key);
+        if (!flow) return;
+        abandonAssembly(*flow, 0);
+        abandonAssembly(*flow, 1);
+        if (ignored_set && flow->state == FLOW_IGNORED) ignored_set->remove(key);
+        flows.erase(key);
+    }
+    
+    // Переход по HTTP-заголовку рукопожатия: запрос Upgrade, затем
+    // ответ 101 сервера с параметрами расширений. Любой другой HTTP на
+    // порту - не WebSocket.
+    void parseHandshake(Flow& flow, int dir, const uint8_t* data, size_t len) {
+        if (!isWebSocketUpgrade(data, len)) {
+            flow.state = FLOW_IGNORED;
+            return;
+        }
+        if (memcmp(data, "GET ", 4) == 0) {
+            flow.client_dir = dir;
+            flow.state = FLOW_UPGRADE_SENT;
+            return;
+        }
+        
+        // "HTTP/1.1 101 ..." от сервера (запрос мог не попасть в захват)
+        if (len < 12 || memcmp(data + 8, " 101", 4) != 0 || flow.client_dir == dir) {
+            flow.state = FLOW_IGNORED;
+            return;
+        }
+        flow.client_dir = 1 - dir;
+        
+        WebSocketHandshake& hs = flow.handshake;
+        hs.reset();
+        std::string ext;
+        if (findHttpHeader(data, len, "Sec-WebSocket-Extensions", ext)) {
+            parseDeflateExtension(ext, hs);
+        }
+        findHttpHeader(data, len, "Sec-WebSocket-Protocol", hs.subprotocol);
+        
+        // server_* относится к сообщениям сервера, client_* - клиента
+        Inflater& server = flow.inflater[dir];
+        Inflater& client = flow.inflater[1 - dir];
+        server.reset();
+        client.reset();
+        if (hs.deflate) {
+            server.no_context_takeover = hs.server_no_context_takeover;
+            server.window_bits = hs.server_max_window_bits;
+            client.no_context_takeover = hs.client_no_context_takeover;
+            client.window_bits = hs.client_max_window_bits;
+        }
+        flow.state = FLOW_WEBSOCKET;
+        websocket_flows++;
+    }
+    
+    // Получатель собранных байт потока для TcpStream::push
+    struct StreamSink {
+        WebSocketDecoder* decoder;
+        Flow* flow;
+        int dir;
+        
+        void operator()(const uint8_t* data, size_t len) {
+            decoder->consumeStream(*flow, dir, data, len);
+        }
+    };
+    
+    // Переносит payload незавершенных фреймов соединения в другую арену
+    struct FrameRelocator {
+        PayloadArena* target;
+        
+        void operator()(Flow& flow) {
+            for (int d = 0; d < 2; d++) {
+                PartialFrame& f = flow.dir[d].frame;
+                if (!f.active || f.skip || !f.dst) continue;
+                uint8_t* dst = target->allocate(f.size);
+                memcpy(dst, f.dst, f.filled);
+                f.dst = dst;
+            }
+        }
+    };
+    
+    // Разбирает все фреймы, целиком лежащие в data. Возвращает число
+    // использованных байт; остаток - начало незавершенного фрейма.
+    size_t drainFrames(Flow& flow, int dir, const uint8_t* data, size_t len, bool& invalid) {
+        size_t pos = 0;
+        invalid = false;
+        
+        TcpStream& s = flow.dir[dir];
+        
+        while (pos < len) {
+            const uint8_t* p = data + pos;
+            size_t n = len - pos;
+            
+            // Продолжение фрейма из предыдущих сегментов
+            if (s.frame.active) {
+                PartialFrame& f = s.frame;
+                size_t take = std::min(n, f.size - f.filled);
+                if (f.skip) {
+                    // Отброшен фильтром: только отсчитываем байты
+                } else if (!f.dst) {
+                    feedAssembly(flow, dir, p, take, f.masked ? f.mask : nullptr, f.filled);
+                } else if (f.masked) {
+                    unmaskPayload(f.dst + f.filled, p, take, f.mask, f.filled);
+                } else {
+                    memcpy(f.dst + f.filled, p, take);
+                }
+                f.filled += take;
+                pos += take;
+                
+                if (f.filled < f.size) break;
+                if (f.skip) {
+                    f.reset();
+                    continue;
+                }
+                if (!f.dst) {
+                    uint8_t header = f.header;
+                    f.reset();
+                    endAssemblyFrame(flow, dir, header);
+                    continue;
+                }
+                
+                WebSocketMessage msg;
+                msg.opcode = f.header & 0x0F;
+                msg.is_compressed = (f.header & 0x40) != 0;
+                msg.is_masked = f.masked;
+                msg.payload = makeSpan(f.dst, f.size);
+                finishFrame(flow, dir, msg);
+                f.reset();
+                continue;
+            }
+            
+            // До конца рукопожатия ищем HTTP Upgrade запрос/ответ (они не
+            // WebSocket фреймы); после него HTTP в потоке не бывает
+            if (flow.state != FLOW_WEBSOCKET) {
+                if (isHttpStart(p, n) || (n < 5 && (p[0] == 'G' || p[0] == 'H'))) {
+                    const uint8_t* end = static_cast<const uint8_t*>(memmem(p, n, "\r\n\r\n", 4));
+                    if (end) {
+                        size_t header_len = (end - p) + 4;
+                        parseHandshake(flow, dir, p, header_len);
+                        if (flow.state == FLOW_IGNORED) break;
+                        pos += header_len;
+                        continue;
+                    }
+                    if (n > MAX_HTTP_HEADER) {
+                        flow.state = FLOW_IGNORED;
+                        if (metrics) metrics->parse_failures[PARSE_HTTP_HEADER].add();
+                    }
+                    break;
+                }
+                // Соединение видно с SYN, а первые данные - не рукопожатие
+                if (flow.state == FLOW_NEW && flow.from_start) {
+                    flow.state = FLOW_IGNORED;
+                    break;
+                }
+            }
+            
+            WebSocketMessage msg;
+            if (frame_filter.active()) {
+                uint8_t mask[4];
+                uint64_t payload_len = 0;
+                size_t header_len = 0;
+                FrameStatus status = parseFrameHeader(p, n, msg, mask, payload_len, header_len);
+                if (status == FRAME_INVALID) {
+                    invalid = true;
+                    break;
+                }
+                if (status == FRAME_INCOMPLETE) break;
+                if (skipFrame(flow, dir, msg, p[0], payload_len)) {
+                    if (n - header_len >= payload_len) {
+                        pos += header_len + payload_len;
+                        continue;
+                    }
+                    PartialFrame& f = s.frame;
+                    f.active = true;
+                    f.skip = true;
+                    f.header = p[0];
+                    f.size = payload_len;
+                    f.filled = 0;
+                    pos += header_len;
+                    continue;
+                }
+            }
+            
+            size_t consumed = 0;
+            FrameStatus status = parseWebSocketFrame(p, n, msg, consumed);
+            if (status == FRAME_INVALID) {
+                invalid = true;
+                break;
+            }
+            if (status == FRAME_INCOMPLETE) {
+                // Если заголовок уже целиком здесь, начинаем собирать
+                // payload прямо в итоговый буфер
+                uint8_t mask[4] = {0, 0, 0, 0};
+                uint64_t payload_len = 0;
+                size_t header_len = 0;
+                if (parseFrameHeader(p, n, msg, mask, payload_len, header_len) != FRAME_OK) break;
+                
+                PartialFrame& f = s.frame;
+                f.active = true;
+                f.header = p[0];
+                f.masked = msg.is_masked;
+                memcpy(f.mask, mask, 4);
+                f.size = payload_len;
+                f.filled = 0;
+                if (msg.opcode & 0x8) {
+                    // Управляющий фрейм - не длиннее 125 байт
+                    f.dst = arena().allocate(payload_len);
+                } else {
+                    // Фрейм данных копится в сборке по мере прихода
+                    // сегментов (сжатый - распаковывается): память растет
+                    // с пришедшими данными и ограничена assemblyLimit, а
+                    // не длиной из заголовка
+                    beginAssembly(flow, dir, msg);
+                    f.dst = nullptr;
+                }
+                pos += header_len;
+                continue;
+            }
+            
+            pos += consumed;
+            if (isFragment(p[0])) {
+                beginAssembly(flow, dir, msg);
+                feedAssembly(flow, dir, msg.payload.data(), msg.payload.size(), nullptr, 0);
+                endAssemblyFrame(flow, dir, p[0]);
+            } else {
+                finishFrame(flow, dir, msg);
+            }
+        }
+        return pos;
+    }
+    
+    // Фрейм данных - часть фрагментированного сообщения: первый (FIN=0)
+    // или продолжение (0x0). Управляющие фреймы не фрагментируются.
+    static bool isFragment(uint8_t first_byte) {
+        uint8_t opcode = first_byte & 0x0F;
+        return opcode == 0x0 || (opcode <= 0x2 && !(first_byte & 0x80));
+    }
+    
+    // Сколько байт может занять собираемое сообщение направления dir:
+    // предел на сообщение и остаток предела соединения после другого
+    // направления
+    size_t assemblyLimit(const Flow& flow, int dir) const {
+        size_t other = flow.dir[1 - dir].message.data.size();
+        size_t flow_room = limits.max_flow > other ? limits.max_flow - other : 0;
+        return std::min(limits.max_message, flow_room);
+    }
+    
+    // Заголовок очередного фрейма, идущего в сборку. Новый фрейм данных
+    // (не 0x0) при незаконченном сообщении значит, что конец прежнего
+    // потерян: оно отдается обрезанным.
+    void beginAssembly(Flow& flow, int dir, const WebSocketMessage& msg) {
+        MessageAssembly& a = flow.dir[dir].message;
+        if (metrics) metrics->frames[msg.opcode].add();
+        if (msg.opcode != 0x0) {
+            if (a.active) abandonAssembly(flow, dir);
+            bool inflate = needsInflate(msg);
+            a.start(msg.opcode, inflate, msg.is_masked);
+            // Фильтр решает по первому фрагменту; сжатое сообщение с
+            // общим контекстом все равно распаковывается (в никуда)
+            a.discard = frame_filter.active() && !acceptsFrame(flow, dir, msg);
+            if (inflate && !flow.inflater[dir].beginMessage(inflate_pool)) {
+                a.inflate_failed = true;
+                a.truncated = true;
+            }
+        } else if (!a.active) {
+            // Начала сообщения не видели: захват начат посреди него или
+            // поток разорван. Сжатое так не распаковать - отдаем как есть.
+            a.start(0x0, false, msg.is_masked);
+            a.truncated = true;
+            a.discard = frame_filter.active() && !acceptsFrame(flow, dir, msg);
+        }
+        a.fragments++;
+    }
+    
+    // Кусок payload фрейма из сборки (mask - если еще не размаскирован,
+    // mask_offset - позиция куска во фрейме)
+    void feedAssembly(Flow& flow, int dir, const uint8_t* data, size_t len,
+                      const uint8_t* mask, uint64_t mask_offset) {
+        MessageAssembly& a = flow.dir[dir].message;
+        if (!a.active || len == 0) return;
+        if (a.discard && !a.compressed) {
+            a.dropped += len;
+            return;
+        }
+        size_t limit = a.discard ? 0 : assemblyLimit(flow, dir);
+        
+        if (a.compressed) {
+            if (a.inflate_failed) return;
+            if (mask) {
+                if (chunk_scratch.size() < len) chunk_scratch.resize(len);
+                unmaskPayload(chunk_scratch.data(), data, len, mask, mask_offset);
+                data = chunk_scratch.data();
+            }
+            uint64_t start = metrics ? metricNowNs() : 0;
+            bool ok = flow.inflater[dir].inflateChunk(inflate_pool, data, len, a.data, a.filled, limit, a.dropped);
+            if (metrics) a.inflate_ns += metricNowNs() - start;
+            if (!ok) {
+                a.inflate_failed = true;
+                a.truncated = true;
+                if (metrics) metrics->inflate_failures.add();
+            }
+            return;
+        }
+        
+        size_t room = a.filled < limit ? limit - a.filled : 0;
+        size_t take = std::min(len, room);
+        if (take > 0) {
+            if (a.data.size() < a.filled + take) {
+                size_t grow = std::max(a.filled + take, a.data.size() * 2);
+                a.data.resize(std::min(grow, limit));
+            }
+            if (mask) {
+                unmaskPayload(a.data.data() + a.filled, data, take, mask, mask_offset);
+            } else {
+                memcpy(a.data.data() + a.filled, data, take);
+            }
+            a.filled += take;
+        }
+        a.dropped += len - take;
+    }
+    
+    // Конец фрейма из сборки: на FIN сообщение готово
+    void endAssemblyFrame(Flow& flow, int dir, uint8_t first_byte) {
+        if ((first_byte & 0x80) && flow.dir[dir].message.active) completeAssembly(flow, dir, false);
+    }
+    
+    // Готовое сообщение копируется в арену одним куском. cut - конец не
+    // придет (разрыв или мусор в потоке).
+    void completeAssembly(Flow& flow, int dir, bool cut) {
+        MessageAssembly& a = flow.dir[dir].message;
+        if (a.compressed && !a.inflate_failed) {
+            if (cut) {
+                flow.inflater[dir].abortMessage();
+            } else {
+                uint64_t start = metrics ? metricNowNs() : 0;
+                size_t limit = a.discard ? 0 : assemblyLimit(flow, dir);
+                if (!flow.inflater[dir].finishMessage(inflate_pool, a.data, a.filled, limit, a.dropped)) {
+                    a.inflate_failed = true;
+                    a.truncated = true;
+                    if (metrics) metrics->inflate_failures.add();
+                }
+                if (metrics) a.inflate_ns += metricNowNs() - start;
+            }
+            if (metrics) metrics->inflate_time.record(a.inflate_ns);
+        }
+        
+        bool filtered = a.discard || (frame_filter.active() && !frame_filter.acceptsSize(a.size()));
+        if (filtered) {
+            filtered_frames++;
+            a.reset();
+            return;
+        }
+        
+        WebSocketMessage msg;
+        msg.opcode = a.opcode;
+        msg.is_compressed = a.compressed;
+        msg.is_masked = a.masked;
+        msg.is_truncated = cut || a.truncated || a.dropped > 0;
+        msg.payload = arena().copy(a.data.data(), a.filled);
+        a.reset();
+        handleMessage(flow, dir, msg);
+    }
+    
+    // Незаконченное сообщение отдается обрезанным
+    void abandonAssembly(Flow& flow, int dir) {
+        if (flow.dir[dir].message.active) completeAssembly(flow, dir, true);
+    }
+    
+    // Распаковка (если нужна) и передача готового фрейма дальше
+    void finishFrame(Flow& flow, int dir, WebSocketMessage& msg) {
+        if (metrics) metrics->frames[msg.opcode].add();
+        // Целое сообщение посреди фрагментированного: конец того потерян.
+        // Управляющие фреймы между фрагментами сборку не трогают.
+        if (msg.opcode <= 0x2 && flow.dir[dir].message.active) abandonAssembly(flow, dir);
+        if (needsInflate(msg)) {
+            // Фрейм целиком в одном куске потока распаковывается с тем же
+            // пределом, что и собираемые сообщения
+            ByteSpan decompressed;
+            bool cut = false;
+            uint64_t start = metrics ? metricNowNs() : 0;
+            bool ok = decompressData(flow.inflater[dir], msg.payload.data(), msg.payload.size(),
+                                     assemblyLimit(flow, dir), decompressed, cut);
+            if (metrics) {
+                metrics->inflate_time.record(metricNowNs() - start);
+                if (!ok) metrics->inflate_failures.add();
+            }
+            if (ok) {
+                msg.payload = decompressed;
+                if (cut) msg.is_truncated = true;
+            } else {
+                // Если декомпрессия не удалась, используем сырые данные
+                msg.payload = arena().copy(msg.payload.data(), msg.payload.size());
+                msg.is_compressed = false;
+            }
+        }
+        
+        // Сжатые фреймы фильтр проверяет здесь, по распакованным данным
+        if (frame_filter.active() &&
+            !(acceptsFrame(flow, dir, msg) && frame_filter.acceptsSize(msg.payload.size()))) {
+            filtered_frames++;
+            return;
+        }
+        
+        handleMessage(flow, dir, msg);
+    }
+    
+    // Принимает очередной непрерывный кусок потока одного направления
+    void consumeStream(Flow& flow, int dir, const uint8_t* data, size_t len) {
+        if (flow.state == FLOW_IGNORED) return;
+        TcpStream& s = flow.dir[dir];
+        size_t decoded_before = messages.size();
+        
+        if (s.desync) {
+            // После разрыва незавершенный фрейм уже не собрать, а
+            // собранная часть сообщения отдается обрезанной
+            s.buf.clear();
+            s.head = 0;
+            s.frame.reset();
+            abandonAssembly(flow, dir);
+            s.desync = false;
+            if (metrics) metrics->reassembly_gaps.add();
+        }
+        
+        bool invalid = false;
+        if (s.head == s.buf.size()) {
+            // Быстрый путь: разбираем прямо из пакета, копируем только хвост
+            s.buf.clear();
+            s.head = 0;
+            size_t used = drainFrames(flow, dir, data, len, invalid);
+            if (!invalid && used < len) {
+                s.buf.assign(data + used, data + len);
+            }
+        } else {
+            s.buf.insert(s.buf.end(), data, data + len);
+            size_t used = drainFrames(flow, dir, s.buf.data() + s.head, s.buf.size() - s.head, invalid);
+            s.head += used;
+            if (s.head == s.buf.size()) {
+                s.buf.clear();
+                s.head = 0;
+            } else if (s.head > s.buf.size() / 2) {
+                s.buf.erase(s.buf.begin(), s.buf.begin() + s.head);
+                s.head = 0;
+            }
+        }
+        
+        if (invalid) {
+            // Мусор в потоке: сбрасываем буфер и ищем границу фрейма
+            // с начала следующего сегмента
+            if (metrics) metrics->parse_failures[invalid_reason].add();
+            s.buf.clear();
+            s.head = 0;
+            s.frame.reset();
+            abandonAssembly(flow, dir);
+        }
+        
+        // Соединение без рукопожатия: WebSocket, если сегмент разобрался
+        // во фреймы без ошибок, иначе после нескольких попыток бросаем
+        if (flow.state == FLOW_NEW) {
+            if (invalid) {
+                if (++flow.bad_segments >= MAX_BAD_SEGMENTS) flow.state = FLOW_IGNORED;
+            } else if (messages.size() > decoded_before) {
+                flow.state = FLOW_WEBSOCKET;
+                websocket_flows++;
+            }
+        }
+    }
+    
+    // Получатель совпадений PatternMatcher::scan
+    struct HitCollector {
+        std::vector<PatternHit>* hits;
+        uint64_t* total;
+        
+        void operator()(uint32_t pattern, uint64_t offset) {
+            (*total)++;
+            if (hits->size() >= MAX_HITS_PER_MESSAGE) return;
+            PatternHit hit = {pattern, offset};
+            hits->push_back(hit);
+        }
+    };
+    
+    // Фрагментированное сообщение к этому моменту собрано целиком, так
+    // что находятся и шаблоны на границе фрагментов
+    void scanPayload(WebSocketMessage& msg) {
+        hit_scratch.clear();
+        HitCollector collect = {&hit_scratch, &pattern_hits};
+        matcher->scan(0, msg.payload.data(), msg.payload.size(), 0, collect);
+        if (hit_scratch.empty()) return;
+        
+        // Совпадения живут в арене рядом с payload - до acknowledge
+        size_t bytes = hit_scratch.size() * sizeof(PatternHit);
+        uint8_t* raw = arena().allocate(bytes + alignof(PatternHit) - 1);
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + alignof(PatternHit) - 1) &
+                            ~static_cast<uintptr_t>(alignof(PatternHit) - 1);
+        PatternHit* hits = reinterpret_cast<PatternHit*>(aligned);
+        memcpy(hits, hit_scratch.data(), bytes);
+        msg.hits = hits;
+        msg.hit_count = static_cast<uint32_t>(hit_scratch.size());
+    }
+    
+    void handleMessage(Flow& flow, int dir, WebSocketMessage& msg) {
+        if (matcher) scanPayload(msg);
+        
+        msg.src_ip = flow.key.addr[dir];
+        msg.dst_ip = flow.key.addr[1 - dir];
+        msg.src_port = flow.key.port[dir];
+        msg.dst_port = flow.key.port[1 - dir];
+        msg.timestamp_ns = packet_time;
+        
+        produced[generation % ARENA_GENERATIONS]++;
+        messages.push_back(msg);
+    }
+    
+public:
+    WebSocketDecoder() : generation(0), recycle(false),
+                         packet_count(0),
+                         websocket_flows(0), ignored_flows(0), filtered_frames(0), ignored_set(nullptr),
+                         matcher(nullptr), pattern_hits(0), metrics(nullptr), invalid_reason(PARSE_RSV),
+                         nano_timestamps(false), packet_time(0), link(parseEthernetLink) {
+        for (unsigned i = 0; i < ARENA_GENERATIONS; i++) {
+            produced[i] = 0;
+            consumed[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    // Разбор заголовка WebSocket фрейма. При FRAME_OK заполняет флаги
+    // msg, маску, длину payload и размер самого заголовка.
+    FrameStatus parseFrameHeader(const uint8_t* data, size_t len, WebSocketMessage& msg,
+                                 uint8_t mask[4], uint64_t& payload_len, size_t& header_len) {
+        if (len < 2) return FRAME_INCOMPLETE;
+        
+        // Первый байт: FIN, RSV1-3, Opcode
+        bool fin = (data[0] & 0x80) != 0;
+        msg.is_compressed = (data[0] & 0x40) != 0;  // RSV1 бит указывает на сжатие
+        msg.opcode = data[0] & 0x0F;
+        
+        // RSV2/RSV3 не используются ни одним известным расширением
+        if (data[0] & 0x30) return invalidFrame(PARSE_RSV);
+        if ((msg.opcode > 0x2 && msg.opcode < 0x8) || msg.opcode > 0xA) return invalidFrame(PARSE_OPCODE);
+        
+        // Второй байт: MASK, Payload length
+        msg.is_masked = (data[1] & 0x80) != 0;
+        payload_len = data[1] & 0x7F;
+        size_t offset = 2;
+        
+        // Управляющие фреймы не фрагментируются и не длиннее 125 байт
+        if ((msg.opcode & 0x8) && (!fin || payload_len > 125)) return invalidFrame(PARSE_CONTROL);
+        
+        // Расширенная длина payload
+        if (payload_len == 126) {
+            if (len < 4) return FRAME_INCOMPLETE;
+            payload_len = (static_cast<uint64_t>(data[2]) << 8) | data[3];
+            offset = 4;
+        } else if (payload_len == 127) {
+            if (len < 10) return FRAME_INCOMPLETE;
+            payload_len = 0;
+            for (int i = 0; i < 8; i++) {
+                payload_len = (payload_len << 8) | data[2 + i];
+            }
+            offset = 10;
+        }
+        
+        if (payload_len > MAX_FRAME_SIZE) return invalidFrame(PARSE_TOO_LARGE);
+        
+        // Маска (4 байта, если MASK=1)
+        if (msg.is_masked) {
+            if (len < offset + 4) return FRAME_INCOMPLETE;
+            memcpy(mask, data + offset, 4);
+            offset += 4;
+        }
+        
+        header_len = offset;
+        return FRAME_OK;
+    }
+    
+    // Парсинг WebSocket фрейма, целиком лежащего в data. При FRAME_OK
+    // в consumed записывается полный размер фрейма (заголовок + payload).
+    FrameStatus parseWebSocketFrame(const uint8_t* data, size_t len, WebSocketMessage& msg, size_t& consumed) {
+        uint8_t mask[4];
+        uint64_t payload_len = 0;
+        size_t offset = 0;
+        
+        FrameStatus status = parseFrameHeader(data, len, msg, mask, payload_len, offset);
+        if (status != FRAME_OK) return status;
+        
+        // Фрейм продолжается в следующих сегментах
+        if (len < offset + payload_len) {
+            return FRAME_INCOMPLETE;
+        }
+        
+        // Декодирование payload за один проход сразу в арену. Сжатые
+        // данные и фрагменты идут во временный буфер: распаковку и сборку
+        // делает вызывающий код, у которого есть состояние соединения.
+        uint8_t* dst;
+        if (needsInflate(msg) || isFragment(data[0])) {
+            if (compressed_scratch.size() < payload_len) compressed_scratch.resize(payload_len);
+            dst = compressed_scratch.data();
+        } else {
+            dst = arena().allocate(payload_len);
+        }
+        if (msg.is_masked) {
+            unmaskPayload(dst, data + offset, payload_len, mask, 0);
+        } else if (payload_len > 0) {
+            memcpy(dst, data + offset, payload_len);
+        }
+        msg.payload = makeSpan(dst, payload_len);
+        
+        consumed = offset + payload_len;
+        return FRAME_OK;
+    }
+    
+    // Обработка одного захваченного пакета
+    void processPacket(const struct pcap_pkthdr* header, const u_char* packet) {
+        if (metrics) {
+            processTimed(header, packet);
+            return;
+        }
+        TcpSegmentInfo seg;
+        if (!parseTcpSegment(link, header, packet, seg)) return;
+        processSegment(header, seg);
+    }
+    
+    // То же со счетчиками и временем разбора (пакеты без TCP тоже в счет)
+    void processTimed(const struct pcap_pkthdr* header, const u_char* packet) {
+        uint64_t start = metricNowNs();
+        TcpSegmentInfo seg;
+        if (parseTcpSegment(link, header, packet, seg)) processSegment(header, seg);
+        metrics->packets.add();
+        metrics->bytes.add(header->caplen);
+        metrics->parse_time.record(metricNowNs() - start);
+    }
+    
+    // То же для уже разобранного сегмента (диспетчер потоков разбирает
+    // заголовки сам, чтобы выбрать декодер)
+    void processSegment(const struct pcap_pkthdr* header, const TcpSegmentInfo& seg) {
+        uint8_t flags = seg.flags;
+        size_t payload_len = seg.payload_len;
+        size_t captured_len = seg.captured_len;
+        const FlowKey& key = seg.key;
+        int dir = seg.dir;
+        
+        // Чистые ACK не меняют состояние потока
+        if (payload_len == 0 && !(flags & (TH_SYN | TH_FIN | TH_RST))) return;
+        packet_time = packetTimeNs(header, nano_timestamps);
+        
+        if (flags & TH_RST) {
+            eraseFlow(key);
+            return;
+        }
+        
+        Flow& flow = flows.findOrInsert(key);
+        flow.last_seen = static_cast<uint32_t>(header->ts.tv_sec);
+        
+        TcpStream& stream = flow.dir[dir];
+        uint32_t seq = seg.seq;
+        
+        if (flags & TH_SYN) {
+            // Новое соединение (в том числе с переиспользованным 4-tuple):
+            // рукопожатие заново
+            if (!(flags & TH_ACK)) {
+                if (flow.state == FLOW_IGNORED && ignored_set) ignored_set->remove(key);
+                flow.state = FLOW_NEW;
+                flow.client_dir = -1;
+                flow.bad_segments = 0;
+                flow.handshake.reset();
+            }
+            flow.from_start = true;
+            abandonAssembly(flow, dir);
+            stream = TcpStream();
+            flow.inflater[dir].reset();
+            stream.seq_known = true;
+            stream.next_seq = seq + 1;
+            seq++;
+        }
+        
+        // Не WebSocket соединения дальше не разбираются
+        if (payload_len > 0 && flow.state != FLOW_IGNORED) {
+            StreamSink sink = {this, &flow, dir};
+            stream.push(seq, seg.payload, captured_len, sink);
+            
+            // Пакет обрезан snaplen: хвост сегмента потерян
+            if (captured_len < payload_len && stream.next_seq == seq + captured_len) {
+                stream.next_seq = seq + static_cast<uint32_t>(payload_len);
+                stream.desync = true;
+            }
+            
+            // Опознано только что - буферы сборки больше не нужны
+            if (flow.state == FLOW_IGNORED) {
+                flow.ignore();
+                ignored_flows++;
+                if (ignored_set) ignored_set->add(key);
+            }
+        }
+        
+        if (flags & TH_FIN) {
+            stream.fin = true;
+            if (flow.dir[0].fin && flow.dir[1].fin) {
+                eraseFlow(key);
+            }
+        }
+        
+        if (++packet_count % FLOW_EXPIRE_INTERVAL == 0) {
+            flows.idleFlows(static_cast<uint32_t>(header->ts.tv_sec), FLOW_IDLE_TIMEOUT, expired);
+            for (size_t i = 0; i < expired.size(); i++) eraseFlow(expired[i]);
+            expired.clear();
+        }
+    }
+    
+    // Забирает декодированные сообщения. Их payload остается в арене
+    // декодера и действителен, пока жив декодер.
+    void takeMessages(std::vector<WebSocketMessage>& out) {
+        out.clear();
+        out.swap(messages);
+    }
+    
+    size_t flowCount() const { return flows.size(); }
+    
+    // Соединений, опознанных как WebSocket / отброшенных как не WebSocket
+    uint64_t websocketFlows() const { return websocket_flows; }
+    uint64_t ignoredFlows() const { return ignored_flows; }
+    
+    // Фильтр фреймов --filter; отброшенные им фреймы не распаковываются
+    // (кроме сжатых с общим контекстом) и не попадают в сообщения
+    void setFrameFilter(const FrameFilter& filter) { frame_filter = filter; }
+    uint64_t filteredFrames() const { return filtered_frames; }
+    
+    // Куда сообщать о соединениях, опознанных как не WebSocket (для
+    // фильтра ядра); nullptr - никуда
+    void setIgnoredFlowSet(IgnoredFlowSet* set) { ignored_set = set; }
+    
+    // Автомат шаблонов (построенный); nullptr - не искать
+    void setMatcher(const PatternMatcher* m) { matcher = m; }
+    uint64_t patternHits() const { return pattern_hits; }
+    
+    // Пределы памяти на сборку фрагментированных сообщений; лишнее
+    // отбрасывается, сообщение помечается обрезанным (is_truncated)
+    void setMessageLimits(const MessageLimits& l) { limits = l; }
+    
+    // Блок счетчиков этого декодера; пишется только из потока декодера
+    void setMetrics(DecoderMetrics* m) { metrics = m; }
+    bool hasMetrics() const { return metrics != nullptr; }
+    
+    // Поколение арены, в котором лежат сообщения текущего takeMessages
+    uint32_t currentGeneration() const { return generation; }
+    
+    void setRecycle(bool enable) { recycle = enable; }
+    
+    // В pcap_pkthdr::ts.tv_usec наносекунды, а не микросекунды
+    void setNanoTimestamps(bool enable) { nano_timestamps = enable; }
+    
+    // Разбор канального уровня для processPacket (по умолчанию Ethernet)
+    void setLinkParser(LinkParser parser) { link = parser; }
+    
+    // Потребитель закончил с count сообщениями поколения gen (может
+    // вызываться из другого потока)
+    void acknowledge(uint32_t gen, uint64_t count = 1) {
+        consumed[gen % ARENA_GENERATIONS].fetch_add(count, std::memory_order_release);
+    }
+    
+    // Смена поколения арены, если текущая заполнена. Вызывается владельцем
+    // декодера между пакетами, после takeMessages.
+    void recycleArena() {
+        if (!recycle || !messages.empty() || arena().bytesReserved() < ARENA_GENERATION_SIZE) return;
+        
+        unsigned next = (generation + 1) % ARENA_GENERATIONS;
+        // Самое старое поколение еще читают - пока растем в текущей арене
+        if (consumed[next].load(std::memory_order_acquire) != produced[next]) return;
+        
+        arenas[next].clear();
+        produced[next] = 0;
+        consumed[next].store(0, std::memory_order_relaxed);
+        generation++;
+        
+        // Незавершенные фреймы переезжают в новую арену
+        FrameRelocator relocate = {&arena()};
+        flows.forEach(relocate);
+    }
+};
+
+#endif // WS_DECODER_H
@@ -0,0 +1,256 @@
+#ifndef WS_FILTER_H
+#define WS_FILTER_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <pcap.h>
+#include "ws_addr.h"
+#include "ws_flow.h"
+
+// Фильтр --filter, например "host 10.0.0.5 port 8765,8080 opcode text
+// from client min-size 64". Адреса и порты компилируются в BPF вместе с
+// отбрасыванием пустых TCP-сегментов и соединений, которые декодер
+// опознал как не WebSocket. Опкод, направление и размер проверяет
+// декодер по заголовку фрейма, до снятия маски и распаковки.
+
+enum FrameDirection {
+    FRAME_ANY_DIRECTION,
+    FRAME_FROM_CLIENT,
+    FRAME_FROM_SERVER
+};
+
+// Часть фильтра, которую проверяет декодер
+struct FrameFilter {
+    uint32_t opcodes;       // бит на опкод, 0 - любые
+    FrameDirection direction;
+    uint32_t min_size;      // байт payload (после распаковки)
+
+    FrameFilter() : opcodes(0), direction(FRAME_ANY_DIRECTION), min_size(0) {}
+
+    bool active() const {
+        return opcodes != 0 || direction != FRAME_ANY_DIRECTION || min_size != 0;
+    }
+
+    // Продолжения фрагментированных сообщений (0x0) проходят вместе с
+    // текстом и бинарными данными
+    bool acceptsOpcode(uint8_t opcode) const {
+        if (opcodes == 0) return true;
+        if (opcode == 0x0) return (opcodes & ((1u << 0x1) | (1u << 0x2))) != 0;
+        return (opcodes & (1u << opcode)) != 0;
+    }
+
+    bool acceptsDirection(bool from_client) const {
+        return direction == FRAME_ANY_DIRECTION || (direction == FRAME_FROM_CLIENT) == from_client;
+    }
+
+    bool acceptsSize(uint64_t size) const { return size >= min_size; }
+};
+
+struct CaptureFilterSpec {
+    std::vector<IpAddress> hosts;   // любой из концов соединения
+    std::vector<uint16_t> ports;
+    FrameFilter frames;
+};
+
+inline bool parseOpcodeName(const std::string& name, uint8_t& opcode) {
+    static const struct {
+        const char* name;
+        uint8_t opcode;
+    } NAMES[] = {
+        {"continuation", 0x0}, {"text", 0x1}, {"binary", 0x2},
+        {"close", 0x8}, {"ping", 0x9}, {"pong", 0xA}
+    };
+    for (size_t i = 0; i < sizeof(NAMES) / sizeof(NAMES[0]); i++) {
+        if (name == NAMES[i].name) {
+            opcode = NAMES[i].opcode;
+            return true;
+        }
+    }
+    char* end = nullptr;
+    unsigned long v = strtoul(name.c_str(), &end, 0);
+    if (name.empty() || *end != '\0' || v > 0xF) return false;
+    opcode = static_cast<uint8_t>(v);
+    return true;
+}
+
+// Список через запятую
+inline std::vector<std::string> splitFilterList(const std::string& list) {
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        if (end > pos) items.push_back(list.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return items;
+}
+
+// Разбор выражения --filter; при ошибке err - что не так
+inline bool parseFilterExpression(const std::string& expr, CaptureFilterSpec& spec, std::string& err) {
+    std::istringstream in(expr);
+    std::string word, value;
+    while (in >> word) {
+        if (!(in >> value)) {
+            err = "после '" + word + "' нужно значение";
+            return false;
+        }
+        std::vector<std::string> items = splitFilterList(value);
+        if (word == "host") {
+            for (size_t i = 0; i < items.size(); i++) {
+                IpAddress addr;
+                if (!parseIp(items[i], addr)) {
+                    err = "неверный адрес: " + items[i];
+                    return false;
+                }
+                spec.hosts.push_back(addr);
+            }
+        } else if (word == "port") {
+            for (size_t i = 0; i < items.size(); i++) {
+                int port = atoi(items[i].c_str());
+                if (port <= 0 || port > 65535) {
+                    err = "неверный порт: " + items[i];
+                    return false;
+                }
+                spec.ports.push_back(static_cast<uint16_t>(port));
+            }
+        } else if (word == "opcode") {
+            for (size_t i = 0; i < items.size(); i++) {
+                uint8_t opcode;
+                if (!parseOpcodeName(items[i], opcode)) {
+                    err = "неверный опкод: " + items[i];
+                    return false;
+                }
+                spec.frames.opcodes |= 1u << opcode;
+            }
+        } else if (word == "from") {
+            if (value == "client") {
+                spec.frames.direction = FRAME_FROM_CLIENT;
+            } else if (value == "server") {
+                spec.frames.direction = FRAME_FROM_SERVER;
+            } else {
+                err = "направление - client или server: " + value;
+                return false;
+            }
+        } else if (word == "min-size") {
+            char* end = nullptr;
+            unsigned long size = strtoul(value.c_str(), &end, 10);
+            if (*end != '\0' || size > 0xFFFFFFFFul) {
+                err = "неверный размер: " + value;
+                return false;
+            }
+            spec.frames.min_size = static_cast<uint32_t>(size);
+        } else {
+            err = "неизвестное условие: " + word;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Соединения, которые декодеры опознали как не WebSocket. Декодеры
+// добавляют и убирают их (редко - раз на соединение), поток захвата
+// по версии замечает изменения и перекомпилирует фильтр ядра.
+class IgnoredFlowSet {
+private:
+    std::mutex mutex;
+    std::vector<FlowKey> keys;    // в порядке добавления
+    std::atomic<uint64_t> changes;
+
+public:
+    IgnoredFlowSet() : changes(0) {}
+
+    void add(const FlowKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        keys.push_back(key);
+        changes.fetch_add(1, std::memory_order_release);
+    }
+
+    void remove(const FlowKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = keys.size(); i-- > 0;) {
+            if (keys[i] == key) {
+                keys.erase(keys.begin() + i);
+                changes.fetch_add(1, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        keys.clear();
+        changes.fetch_add(1, std::memory_order_release);
+    }
+
+    uint64_t version() const { return changes.load(std::memory_order_acquire); }
+
+    // Последние max соединений; возвращает версию снимка
+    uint64_t snapshot(std::vector<FlowKey>& out, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t first = keys.size() > max ? keys.size() - max : 0;
+        out.assign(keys.begin() + first, keys.end());
+        return changes.load(std::memory_order_relaxed);
+    }
+};
+
+// Столько соединений-исключений помещается в BPF (предел ядра - 4096
+// инструкций, каждое исключение - пара десятков, и все удваивается для VLAN)
+static const size_t MAX_IGNORED_IN_FILTER = 32;
+
+inline std::string bpfFlowMatch(const FlowKey& key, const char* proto) {
+    return std::string("(") + proto + " host " + formatIp(key.addr[0]) + " and " + proto + " host " +
+           formatIp(key.addr[1]) + " and tcp port " + std::to_string(key.port[0]) +
+           " and tcp port " + std::to_string(key.port[1]) + ")";
+}
+
+// Выражение BPF: TCP на нужных адресах и портах; SYN/FIN/RST проходят
+// всегда (по ним декодер ведет соединения), сегменты без данных и данные
+// соединений из ignored отбрасываются в ядре. На Ethernet кадры с тегом
+// 802.1Q выражение "tcp" не пропускает - их добавляем отдельно.
+inline std::string captureFilter(const CaptureFilterSpec& spec, int dlt,
+                                 const std::vector<FlowKey>& ignored = std::vector<FlowKey>()) {
+    std::string expr = "tcp";
+    if (!spec.ports.empty()) {
+        expr += " and (";
+        for (size_t i = 0; i < spec.ports.size(); i++) {
+            if (i) expr += " or ";
+            expr += "port " + std::to_string(spec.ports[i]);
+        }
+        expr += ")";
+    }
+    if (!spec.hosts.empty()) {
+        expr += " and (";
+        for (size_t i = 0; i < spec.hosts.size(); i++) {
+            if (i) expr += " or ";
+            expr += (spec.hosts[i].isV4() ? "ip host " : "ip6 host ") + formatIp(spec.hosts[i]);
+        }
+        expr += ")";
+    }
+
+    std::string skip4, skip6;
+    for (size_t i = 0; i < ignored.size(); i++) {
+        std::string& skip = ignored[i].addr[0].isV4() ? skip4 : skip6;
+        if (!skip.empty()) skip += " or ";
+        skip += bpfFlowMatch(ignored[i], ignored[i].addr[0].isV4() ? "ip" : "ip6");
+    }
+
+    // Длина данных TCP = длина IP - заголовок IP - заголовок TCP. Для IPv6
+    // TCP сразу за фиксированным заголовком ("tcp" других не пропускает).
+    std::string data4 = "ip[2:2] - ((ip[0] & 0xf) << 2) - ((tcp[12] & 0xf0) >> 2) != 0";
+    std::string data6 = "ip6[4:2] - ((ip6[52] & 0xf0) >> 2) != 0";
+    if (!skip4.empty()) data4 += " and not (" + skip4 + ")";
+    if (!skip6.empty()) data6 += " and not (" + skip6 + ")";
+    expr += " and ((ip and (tcp[13] & 7 != 0 or (" + data4 + ")))"
+            " or (ip6 and (ip6[53] & 7 != 0 or (" + data6 + "))))";
+
+    if (dlt == DLT_EN10MB) return expr + " or (vlan and " + expr + ")";
+    return expr;
+}
+
+#endif // WS_FILTER_H
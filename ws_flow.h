@@ -0,0 +1,439 @@
+#ifndef WS_FLOW_H
+#define WS_FLOW_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "ws_inflate.h"
+#include "ws_addr.h"
+
+// Ключ TCP-соединения (4-tuple, IPv4 или IPv6). Хранится в каноническом
+// виде: endpoint 0 всегда "меньше" endpoint 1, поэтому оба направления
+// соединения попадают в одну запись таблицы.
+struct FlowKey {
+    IpAddress addr[2];
+    uint16_t port[2];  // host byte order
+
+    bool operator==(const FlowKey& o) const {
+        return addr[0] == o.addr[0] && addr[1] == o.addr[1] &&
+               port[0] == o.port[0] && port[1] == o.port[1];
+    }
+};
+
+// Строит канонический ключ и возвращает направление пакета:
+// 0 - от endpoint 0 к endpoint 1, 1 - обратно
+inline int makeFlowKey(const IpAddress& src, uint16_t sport, const IpAddress& dst, uint16_t dport, FlowKey& key) {
+    int cmp = memcmp(src.bytes, dst.bytes, sizeof(src.bytes));
+    bool swap = cmp > 0 || (cmp == 0 && sport > dport);
+    key.addr[0] = swap ? dst : src;
+    key.port[0] = swap ? dport : sport;
+    key.addr[1] = swap ? src : dst;
+    key.port[1] = swap ? sport : dport;
+    return swap ? 1 : 0;
+}
+
+inline uint32_t hashFlowKey(const FlowKey& key) {
+    // Адреса - четыре 64-битных слова (у IPv4 первое всегда нулевое)
+    uint64_t w[4];
+    memcpy(w, key.addr, sizeof(w));
+    uint64_t h = (static_cast<uint64_t>(key.port[0]) << 16 | key.port[1]) * 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ w[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    // Финализатор murmur3 - хорошо перемешивает соседние адреса/порты
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<uint32_t>(h);
+}
+
+// Сравнение номеров последовательности с учетом переполнения (RFC 1982)
+inline bool seqBefore(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+// Фрейм, payload которого еще приходит в следующих сегментах. Байты
+// размаскируются сразу в итоговый буфер по мере поступления, поэтому
+// большие фреймы не копируются через буфер сборки. Фрагменты и сжатые
+// фреймы идут не в буфер, а кусками в сборку сообщения (MessageAssembly).
+struct PartialFrame {
+    bool active;
+    bool skip;        // отброшен фильтром: байты пропускаются без копирования
+    uint8_t header;   // первый байт фрейма: FIN, RSV1-3, opcode
+    bool masked;
+    uint8_t mask[4];
+    uint8_t* dst;     // память в арене снифера; nullptr - в сборку сообщения
+    size_t size;
+    size_t filled;
+
+    PartialFrame() : active(false), skip(false), header(0), masked(false), dst(nullptr), size(0), filled(0) {
+        memset(mask, 0, sizeof(mask));
+    }
+
+    void reset() {
+        active = false;
+        skip = false;
+        header = 0;
+        masked = false;
+        memset(mask, 0, sizeof(mask));
+        dst = nullptr;
+        size = 0;
+        filled = 0;
+    }
+};
+
+// Сообщение, которое собирается из фрагментов (FIN=0, затем фреймы
+// продолжения 0x0) или из кусков большого сжатого фрейма. Сжатые данные
+// распаковываются по мере прихода, в data копится только результат -
+// не больше предела на сообщение и на соединение, остальное считается
+// в dropped, а сообщение помечается обрезанным.
+struct MessageAssembly {
+    // Буфер больше этого после сообщения освобождается, меньший остается
+    // для следующего
+    static const size_t RETAIN_BYTES = 256 * 1024;
+
+    bool active;
+    uint8_t opcode;       // первого фрагмента; 0x0 - начало сообщения не видели
+    bool compressed;      // RSV1 первого фрагмента: распаковывается потоково
+    bool masked;
+    bool discard;         // отброшено фильтром: данные не хранятся
+    bool truncated;       // не хватает начала, середины или конца
+    bool inflate_failed;
+    uint32_t fragments;
+    uint64_t inflate_ns;  // время распаковки всех кусков (для метрик)
+    std::vector<uint8_t> data;  // data.size() - выделено, filled - занято
+    size_t filled;
+    uint64_t dropped;     // байт сверх предела (после распаковки)
+
+    MessageAssembly() : active(false), opcode(0), compressed(false), masked(false), discard(false),
+                        truncated(false), inflate_failed(false), fragments(0), inflate_ns(0),
+                        filled(0), dropped(0) {}
+
+    void start(uint8_t op, bool deflate, bool mask) {
+        active = true;
+        opcode = op;
+        compressed = deflate;
+        masked = mask;
+        discard = false;
+        truncated = false;
+        inflate_failed = false;
+        fragments = 0;
+        inflate_ns = 0;
+        filled = 0;
+        dropped = 0;
+    }
+
+    void reset() {
+        active = false;
+        filled = 0;
+        if (data.size() > RETAIN_BYTES) std::vector<uint8_t>().swap(data);
+    }
+
+    uint64_t size() const { return filled + dropped; }
+};
+
+// Одно направление TCP-соединения: сборка потока байт по seq
+struct TcpStream {
+    struct Segment {
+        uint32_t seq;
+        std::vector<uint8_t> data;
+    };
+
+    // Предел для сегментов, пришедших не по порядку. При превышении
+    // считаем, что пропущенные данные потеряны, и перескакиваем разрыв.
+    static const size_t MAX_PENDING_BYTES = 4 * 1024 * 1024;
+
+    bool seq_known;
+    bool fin;
+    bool desync;               // граница фрейма потеряна (разрыв в потоке)
+    uint32_t next_seq;
+
+    std::vector<uint8_t> buf;  // собранные, но еще не разобранные байты
+    size_t head;
+
+    std::vector<Segment> pending;  // отсортированы по seq
+    size_t pending_bytes;
+
+    PartialFrame frame;
+    MessageAssembly message;
+
+    TcpStream() : seq_known(false), fin(false), desync(false), next_seq(0),
+                  head(0), pending_bytes(0) {}
+
+    // Передает sink(data, len) все байты, ставшие непрерывными после
+    // прихода сегмента. Ретрансмиссии и перекрытия отбрасываются.
+    template <typename Sink>
+    void push(uint32_t seq, const uint8_t* data, size_t len, Sink& sink) {
+        if (!seq_known) {
+            next_seq = seq;
+            seq_known = true;
+        }
+
+        int32_t diff = static_cast<int32_t>(seq - next_seq);
+        if (diff < 0) {
+            // Ретрансмиссия или частичное перекрытие
+            size_t overlap = static_cast<size_t>(-static_cast<int64_t>(diff));
+            if (overlap >= len) return;
+            data += overlap;
+            len -= overlap;
+            seq = next_seq;
+            diff = 0;
+        }
+
+        if (diff > 0) {
+            storePending(seq, data, len);
+            if (pending_bytes > MAX_PENDING_BYTES) {
+                // Недостающий сегмент так и не пришел - прыгаем через разрыв
+                next_seq = pending.front().seq;
+                desync = true;
+                drainPending(sink);
+            }
+            return;
+        }
+
+        next_seq += static_cast<uint32_t>(len);
+        sink(data, len);
+        drainPending(sink);
+    }
+
+private:
+    void storePending(uint32_t seq, const uint8_t* data, size_t len) {
+        size_t i = 0;
+        while (i < pending.size() && seqBefore(pending[i].seq, seq)) i++;
+        if (i < pending.size() && pending[i].seq == seq) {
+            // Дубликат: оставляем более длинную копию
+            if (pending[i].data.size() >= len) return;
+            pending_bytes -= pending[i].data.size();
+            pending[i].data.assign(data, data + len);
+            pending_bytes += len;
+            return;
+        }
+        pending.insert(pending.begin() + i, Segment());
+        pending[i].seq = seq;
+        pending[i].data.assign(data, data + len);
+        pending_bytes += len;
+    }
+
+    template <typename Sink>
+    void drainPending(Sink& sink) {
+        size_t done = 0;
+        while (done < pending.size()) {
+            Segment& seg = pending[done];
+            if (seqBefore(next_seq, seg.seq)) break;
+
+            size_t overlap = next_seq - seg.seq;
+            if (overlap < seg.data.size()) {
+                size_t n = seg.data.size() - overlap;
+                next_seq += static_cast<uint32_t>(n);
+                sink(seg.data.data() + overlap, n);
+            }
+            pending_bytes -= seg.data.size();
+            done++;
+        }
+        if (done) pending.erase(pending.begin(), pending.begin() + done);
+    }
+};
+
+// Стадия рукопожатия соединения. Заголовки HTTP разбираются один раз,
+// дальше решение принимается по одному полю.
+enum FlowState {
+    FLOW_NEW,           // данных еще не было
+    FLOW_UPGRADE_SENT,  // клиент отправил Upgrade: websocket, ждем 101
+    FLOW_WEBSOCKET,     // рукопожатие завершено (или фреймы без рукопожатия)
+    FLOW_IGNORED        // не WebSocket: данные больше не разбираются
+};
+
+// Параметры из ответа 101 сервера
+struct WebSocketHandshake {
+    bool deflate;                      // согласован permessage-deflate
+    bool server_no_context_takeover;
+    bool client_no_context_takeover;
+    uint8_t server_max_window_bits;    // 8..15
+    uint8_t client_max_window_bits;
+    std::string subprotocol;           // Sec-WebSocket-Protocol
+
+    WebSocketHandshake() { reset(); }
+
+    void reset() {
+        deflate = false;
+        server_no_context_takeover = false;
+        client_no_context_takeover = false;
+        server_max_window_bits = 15;
+        client_max_window_bits = 15;
+        subprotocol.clear();
+    }
+};
+
+// Состояние отслеживаемого соединения
+struct Flow {
+    FlowKey key;
+    TcpStream dir[2];     // индекс - направление из makeFlowKey
+    Inflater inflater[2]; // permessage-deflate, по направлениям
+    int client_dir;       // направление, отправившее Upgrade запрос (-1 - неизвестно)
+    uint32_t last_seen;   // время последнего пакета (секунды)
+    FlowState state;
+    bool from_start;      // видели SYN: рукопожатие не могло пройти мимо
+    uint8_t bad_segments; // сегменты без единого фрейма, пока соединение не опознано
+    WebSocketHandshake handshake;
+
+    Flow() : client_dir(-1), last_seen(0), state(FLOW_NEW), from_start(false), bad_segments(0) {
+        memset(&key, 0, sizeof(key));
+    }
+
+    // Возвращает запись в исходное состояние для повторного использования
+    void reset() {
+        memset(&key, 0, sizeof(key));
+        for (int i = 0; i < 2; i++) {
+            dir[i] = TcpStream();
+            inflater[i].reset();
+        }
+        client_dir = -1;
+        last_seen = 0;
+        state = FLOW_NEW;
+        from_start = false;
+        bad_segments = 0;
+        handshake.reset();
+    }
+
+    // Соединение не WebSocket: буферы сборки больше не нужны. Флаги FIN
+    // остаются, чтобы запись удалилась по завершении соединения.
+    void ignore() {
+        for (int i = 0; i < 2; i++) {
+            bool fin = dir[i].fin;
+            dir[i] = TcpStream();
+            dir[i].fin = fin;
+            inflater[i].reset();
+        }
+        state = FLOW_IGNORED;
+    }
+
+private:
+    Flow(const Flow&);
+    Flow& operator=(const Flow&);
+};
+
+// Таблица соединений с открытой адресацией (linear probing).
+// Массив слотов хранит только хэш и индекс записи - 8 байт на слот,
+// так что проба обычно укладывается в одну кэш-линию. Сами Flow живут
+// в deque и не перемещаются при росте таблицы.
+class FlowTable {
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t index;  // индекс в entries + 1, 0 - пустой слот
+    };
+
+    std::vector<Slot> slots;
+    std::deque<Flow> entries;
+    std::vector<uint32_t> free_list;
+    size_t count;
+
+    size_t mask() const { return slots.size() - 1; }
+
+    void rehash(size_t new_size) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(new_size, Slot());
+        for (size_t i = 0; i < old.size(); i++) {
+            if (!old[i].index) continue;
+            size_t pos = old[i].hash & mask();
+            while (slots[pos].index) pos = (pos + 1) & mask();
+            slots[pos] = old[i];
+        }
+    }
+
+public:
+    FlowTable() : count(0) {
+        slots.assign(1024, Slot());
+    }
+
+    // Обход всех соединений (освобожденные записи сброшены и не мешают)
+    template <typename Fn>
+    void forEach(Fn& fn) {
+        for (size_t i = 0; i < entries.size(); i++) fn(entries[i]);
+    }
+
+    size_t size() const { return count; }
+
+    Flow* find(const FlowKey& key) {
+        uint32_t h = hashFlowKey(key);
+        for (size_t pos = h & mask(); slots[pos].index; pos = (pos + 1) & mask()) {
+            if (slots[pos].hash == h && entries[slots[pos].index - 1].key == key) {
+                return &entries[slots[pos].index - 1];
+            }
+        }
+        return nullptr;
+    }
+
+    Flow& findOrInsert(const FlowKey& key) {
+        uint32_t h = hashFlowKey(key);
+        size_t pos = h & mask();
+        for (; slots[pos].index; pos = (pos + 1) & mask()) {
+            if (slots[pos].hash == h && entries[slots[pos].index - 1].key == key) {
+                return entries[slots[pos].index - 1];
+            }
+        }
+
+        uint32_t index;
+        if (!free_list.empty()) {
+            index = free_list.back();
+            free_list.pop_back();
+        } else {
+            index = static_cast<uint32_t>(entries.size());
+            entries.emplace_back();
+        }
+        entries[index].key = key;
+        slots[pos].hash = h;
+        slots[pos].index = index + 1;
+        count++;
+
+        // Держим загрузку не выше 1/2, чтобы цепочки проб были короткими
+        if (count * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+        }
+        return entries[index];
+    }
+
+    void erase(const FlowKey& key) {
+        uint32_t h = hashFlowKey(key);
+        size_t pos = h & mask();
+        for (; slots[pos].index; pos = (pos + 1) & mask()) {
+            if (slots[pos].hash == h && entries[slots[pos].index - 1].key == key) break;
+        }
+        if (!slots[pos].index) return;
+
+        uint32_t index = slots[pos].index - 1;
+        entries[index].reset();  // освобождаем буферы сборки и inflate
+        free_list.push_back(index);
+        count--;
+
+        // Backward-shift deletion: сдвигаем хвост кластера без tombstone
+        size_t hole = pos;
+        for (size_t next = (hole + 1) & mask(); slots[next].index; next = (next + 1) & mask()) {
+            size_t ideal = slots[next].hash & mask();
+            if (((next - ideal) & mask()) >= ((next - hole) & mask())) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+        }
+        slots[hole] = Slot();
+    }
+
+    // Ключи соединений, неактивных дольше idle_sec секунд. Удаляет их
+    // вызывающий - сначала отдав то, что в них не досказано.
+    void idleFlows(uint32_t now, uint32_t idle_sec, std::vector<FlowKey>& stale) const {
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (!slots[i].index) continue;
+            const Flow& f = entries[slots[i].index - 1];
+            if (now - f.last_seen > idle_sec) stale.push_back(f.key);
+        }
+    }
+};
+
+#endif // WS_FLOW_H
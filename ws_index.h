@@ -0,0 +1,710 @@
+#ifndef WS_INDEX_H
+#define WS_INDEX_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "ws_capfile.h"
+#include "ws_flow.h"
+#include "ws_filter.h"
+
+// Индекс запросов к файлу захвата v2/v3. Пишется после индекса смещений
+// или блоков, его смещение - в CaptureFileHeader::query_index (0 - индекса нет):
+//
+//   QueryIndexHeader                       80 байт
+//   QueryFlowEntry flows[flow_count]       соединения, по возрастанию ключа
+//   uint32_t postings[record_count]        номера записей по соединениям
+//   uint32_t record_flows[record_count]    соединение каждой записи
+//   QueryTimeEntry times[record_count]     (время, номер) по возрастанию времени
+//   uint64_t bitmaps[][words]              по битмапу на каждый опкод из opcode_mask
+//
+// Смещения секций - от начала индекса, каждая выровнена до 8 байт.
+// Номера записей - 32-битные: ротация делит файлы задолго до 4 млрд записей.
+
+static const char QUERY_INDEX_MAGIC[8] = {'W', 'S', 'Q', 'I', 'D', 'X', '\r', '\n'};
+static const uint32_t QUERY_INDEX_VERSION = 1;
+
+struct QueryIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t opcode_mask;      // бит на опкод, у которого есть битмап
+    uint64_t record_count;
+    uint64_t flow_count;
+    uint64_t flows_offset;
+    uint64_t postings_offset;
+    uint64_t record_flows_offset;
+    uint64_t times_offset;
+    uint64_t bitmaps_offset;
+    uint64_t reserved;
+};
+
+struct QueryFlowEntry {
+    IpAddress addr[2];         // канонический ключ, как FlowKey
+    uint16_t port[2];
+    uint32_t count;            // записей соединения
+    uint64_t first;            // начало его номеров в postings
+};
+
+struct QueryTimeEntry {
+    int64_t timestamp_ns;
+    uint32_t record;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(QueryIndexHeader) == 80, "заголовок индекса запросов - 80 байт");
+static_assert(sizeof(QueryFlowEntry) == 48, "соединение в индексе - 48 байт");
+static_assert(sizeof(QueryTimeEntry) == 16, "элемент индекса времени - 16 байт");
+
+inline bool flowKeyLess(const FlowKey& a, const FlowKey& b) {
+    for (int i = 0; i < 2; i++) {
+        int cmp = memcmp(a.addr[i].bytes, b.addr[i].bytes, sizeof(a.addr[i].bytes));
+        if (cmp != 0) return cmp < 0;
+    }
+    if (a.port[0] != b.port[0]) return a.port[0] < b.port[0];
+    return a.port[1] < b.port[1];
+}
+
+// Индекс, который копится по мере записи сообщений (при сохранении или
+// во время потоковой записи) и превращается в байты при закрытии файла.
+// На запись - около 25 байт памяти.
+class QueryIndexBuilder {
+private:
+    struct FlowHash {
+        size_t operator()(const FlowKey& key) const { return hashFlowKey(key); }
+    };
+
+    std::unordered_map<FlowKey, uint32_t, FlowHash> flow_ids;
+    std::vector<FlowKey> flows;
+    std::vector<uint32_t> flow_counts;
+    std::vector<uint32_t> record_flows;
+    std::vector<QueryTimeEntry> times;
+    std::vector<uint8_t> opcodes;
+
+    static void pad(std::vector<uint8_t>& out) {
+        out.resize((out.size() + 7) & ~static_cast<size_t>(7), 0);
+    }
+
+    template <typename T>
+    static void append(std::vector<uint8_t>& out, const T* data, size_t count) {
+        size_t off = out.size();
+        out.resize(off + count * sizeof(T));
+        if (count) memcpy(&out[off], data, count * sizeof(T));
+        pad(out);
+    }
+
+public:
+    // Записи добавляются по порядку: номер записи - их число до нее
+    void add(const CaptureRecord& rec) {
+        FlowKey key;
+        makeFlowKey(rec.src_ip, rec.src_port, rec.dst_ip, rec.dst_port, key);
+        std::unordered_map<FlowKey, uint32_t, FlowHash>::iterator it = flow_ids.find(key);
+        uint32_t id;
+        if (it == flow_ids.end()) {
+            id = static_cast<uint32_t>(flows.size());
+            flow_ids[key] = id;
+            flows.push_back(key);
+            flow_counts.push_back(0);
+        } else {
+            id = it->second;
+        }
+        flow_counts[id]++;
+
+        QueryTimeEntry t = {rec.timestamp_ns, static_cast<uint32_t>(record_flows.size()), 0};
+        times.push_back(t);
+        record_flows.push_back(id);
+        opcodes.push_back(rec.opcode & 0x0F);
+    }
+
+    size_t size() const { return record_flows.size(); }
+
+    // Номер записи не помещается в 32 бита - индекс не строится
+    bool full() const { return record_flows.size() >= 0xFFFFFFFFu; }
+
+    void clear() {
+        flow_ids.clear();
+        flows.clear();
+        flow_counts.clear();
+        record_flows.clear();
+        times.clear();
+        opcodes.clear();
+    }
+
+    void swap(QueryIndexBuilder& o) {
+        flow_ids.swap(o.flow_ids);
+        flows.swap(o.flows);
+        flow_counts.swap(o.flow_counts);
+        record_flows.swap(o.record_flows);
+        times.swap(o.times);
+        opcodes.swap(o.opcodes);
+    }
+
+    // Индекс целиком; сортирует время (обычно уже почти по порядку)
+    void serialize(std::vector<uint8_t>& out) {
+        out.clear();
+        size_t n = record_flows.size();
+
+        QueryIndexHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, QUERY_INDEX_MAGIC, sizeof(h.magic));
+        h.version = QUERY_INDEX_VERSION;
+        h.record_count = n;
+        h.flow_count = flows.size();
+        append(out, &h, 1);
+
+        // Соединения в порядке ключа: поиск по ключу - двоичный
+        std::vector<uint32_t> order(flows.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = static_cast<uint32_t>(i);
+        struct ByKey {
+            const std::vector<FlowKey>* flows;
+            bool operator()(uint32_t a, uint32_t b) const { return flowKeyLess((*flows)[a], (*flows)[b]); }
+        };
+        ByKey by_key = {&flows};
+        std::sort(order.begin(), order.end(), by_key);
+        std::vector<uint32_t> rank(flows.size());
+        std::vector<uint64_t> first(flows.size());
+        std::vector<QueryFlowEntry> entries(flows.size());
+        uint64_t pos = 0;
+        for (size_t r = 0; r < order.size(); r++) {
+            uint32_t id = order[r];
+            rank[id] = static_cast<uint32_t>(r);
+            QueryFlowEntry& e = entries[r];
+            memset(&e, 0, sizeof(e));
+            e.addr[0] = flows[id].addr[0];
+            e.addr[1] = flows[id].addr[1];
+            e.port[0] = flows[id].port[0];
+            e.port[1] = flows[id].port[1];
+            e.count = flow_counts[id];
+            e.first = pos;
+            first[id] = pos;
+            pos += flow_counts[id];
+        }
+        h.flows_offset = out.size();
+        append(out, entries.empty() ? nullptr : &entries[0], entries.size());
+
+        // Номера записей по соединениям, внутри соединения - по возрастанию
+        std::vector<uint32_t> postings(n);
+        std::vector<uint32_t> flows_by_record(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t id = record_flows[i];
+            postings[first[id]++] = static_cast<uint32_t>(i);
+            flows_by_record[i] = rank[id];
+        }
+        h.postings_offset = out.size();
+        append(out, postings.empty() ? nullptr : &postings[0], n);
+        h.record_flows_offset = out.size();
+        append(out, flows_by_record.empty() ? nullptr : &flows_by_record[0], n);
+
+        struct ByTime {
+            bool operator()(const QueryTimeEntry& a, const QueryTimeEntry& b) const {
+                return a.timestamp_ns < b.timestamp_ns ||
+                       (a.timestamp_ns == b.timestamp_ns && a.record < b.record);
+            }
+        };
+        ByTime by_time;
+        if (!std::is_sorted(times.begin(), times.end(), by_time)) {
+            std::sort(times.begin(), times.end(), by_time);
+        }
+        h.times_offset = out.size();
+        append(out, times.empty() ? nullptr : &times[0], n);
+
+        size_t words = (n + 63) / 64;
+        std::vector<uint64_t> bitmap(words);
+        h.bitmaps_offset = out.size();
+        for (unsigned op = 0; op < 16; op++) {
+            std::fill(bitmap.begin(), bitmap.end(), 0);
+            bool any = false;
+            for (size_t i = 0; i < n; i++) {
+                if (opcodes[i] != op) continue;
+                bitmap[i / 64] |= 1ull << (i % 64);
+                any = true;
+            }
+            if (!any) continue;
+            h.opcode_mask |= 1u << op;
+            append(out, &bitmap[0], words);
+        }
+        memcpy(&out[0], &h, sizeof(h));
+    }
+};
+
+// Индекс запросов поверх байт - отображения файла или собственной
+// копии (индекс, построенный проходом по файлу без индекса)
+class QueryIndex {
+private:
+    std::vector<uint8_t> owned;
+    const QueryIndexHeader* hdr;
+    const QueryFlowEntry* flow_entries;
+    const uint32_t* posting_list;
+    const uint32_t* record_flow;
+    const QueryTimeEntry* time_entries;
+    const uint64_t* bitmap[16];
+
+    static bool section(uint64_t offset, uint64_t bytes, size_t len) {
+        return offset % 8 == 0 && offset <= len && bytes <= len - offset;
+    }
+
+public:
+    QueryIndex() : hdr(nullptr), flow_entries(nullptr), posting_list(nullptr), record_flow(nullptr),
+                   time_entries(nullptr) {
+        memset(bitmap, 0, sizeof(bitmap));
+    }
+
+    // data выровнен до 8 байт и живет, пока используется индекс
+    bool attach(const uint8_t* data, size_t len, std::string& err) {
+        hdr = nullptr;
+        if (len < sizeof(QueryIndexHeader)) {
+            err = "индекс запросов обрезан";
+            return false;
+        }
+        const QueryIndexHeader* h = reinterpret_cast<const QueryIndexHeader*>(data);
+        if (memcmp(h->magic, QUERY_INDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != QUERY_INDEX_VERSION) {
+            err = "неизвестный формат индекса запросов";
+            return false;
+        }
+        uint64_t n = h->record_count;
+        uint64_t words = (n + 63) / 64;
+        unsigned bitmaps = __builtin_popcount(h->opcode_mask & 0xFFFF);
+        if (n >= 0xFFFFFFFFu || h->flow_count > n ||
+            !section(h->flows_offset, h->flow_count * sizeof(QueryFlowEntry), len) ||
+            !section(h->postings_offset, n * sizeof(uint32_t), len) ||
+            !section(h->record_flows_offset, n * sizeof(uint32_t), len) ||
+            !section(h->times_offset, n * sizeof(QueryTimeEntry), len) ||
+            !section(h->bitmaps_offset, words * 8 * bitmaps, len)) {
+            err = "индекс запросов поврежден";
+            return false;
+        }
+        flow_entries = reinterpret_cast<const QueryFlowEntry*>(data + h->flows_offset);
+        for (uint64_t i = 0; i < h->flow_count; i++) {
+            if (flow_entries[i].first > n || flow_entries[i].count > n - flow_entries[i].first) {
+                err = "индекс запросов поврежден";
+                return false;
+            }
+        }
+        posting_list = reinterpret_cast<const uint32_t*>(data + h->postings_offset);
+        // Номер соединения записи сразу идет индексом в массивы по
+        // соединениям - проверяется один раз здесь, а не при каждом запросе
+        record_flow = reinterpret_cast<const uint32_t*>(data + h->record_flows_offset);
+        for (uint64_t i = 0; i < n; i++) {
+            if (record_flow[i] >= h->flow_count) {
+                err = "индекс запросов поврежден";
+                return false;
+            }
+        }
+        time_entries = reinterpret_cast<const QueryTimeEntry*>(data + h->times_offset);
+        const uint64_t* next = reinterpret_cast<const uint64_t*>(data + h->bitmaps_offset);
+        for (unsigned op = 0; op < 16; op++) {
+            bitmap[op] = nullptr;
+            if (!(h->opcode_mask & (1u << op))) continue;
+            bitmap[op] = next;
+            next += words;
+        }
+        hdr = h;
+        return true;
+    }
+
+    // Индекс, построенный в памяти
+    bool adopt(std::vector<uint8_t>& bytes, std::string& err) {
+        owned.swap(bytes);
+        return attach(owned.empty() ? nullptr : &owned[0], owned.size(), err);
+    }
+
+    void close() {
+        hdr = nullptr;
+        owned.clear();
+    }
+
+    bool isOpen() const { return hdr != nullptr; }
+    size_t recordCount() const { return static_cast<size_t>(hdr->record_count); }
+    size_t flowCount() const { return static_cast<size_t>(hdr->flow_count); }
+    const QueryFlowEntry& flow(size_t i) const { return flow_entries[i]; }
+    const uint32_t* postings() const { return posting_list; }
+    uint32_t recordFlow(size_t record) const { return record_flow[record]; }
+    const QueryTimeEntry* times() const { return time_entries; }
+    const uint64_t* opcodeBitmap(unsigned opcode) const { return opcode < 16 ? bitmap[opcode] : nullptr; }
+
+    // Соединение по ключу (двоичный поиск); -1 - нет
+    long findFlow(const FlowKey& key) const {
+        size_t lo = 0, hi = flowCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            FlowKey k;
+            k.addr[0] = flow_entries[mid].addr[0];
+            k.addr[1] = flow_entries[mid].addr[1];
+            k.port[0] = flow_entries[mid].port[0];
+            k.port[1] = flow_entries[mid].port[1];
+            if (k == key) return static_cast<long>(mid);
+            if (flowKeyLess(k, key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return -1;
+    }
+};
+
+// Индекс для файла без него - один проход по заголовкам записей
+inline void buildQueryIndexBytes(const CaptureFile& file, std::vector<uint8_t>& bytes) {
+    QueryIndexBuilder builder;
+    for (size_t i = 0; i < file.messageCount(); i++) {
+        const CaptureRecord* rec = file.record(i);
+        if (!rec) {
+            CaptureRecord empty;
+            memset(&empty, 0, sizeof(empty));
+            builder.add(empty);  // поврежденная запись: номер сохраняется
+            continue;
+        }
+        builder.add(*rec);
+    }
+    builder.serialize(bytes);
+}
+
+inline bool buildQueryIndex(const CaptureFile& file, QueryIndex& index, std::string& err) {
+    if (file.messageCount() >= 0xFFFFFFFFu) {
+        err = "слишком много записей для индекса запросов";
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    buildQueryIndexBytes(file, bytes);
+    return index.adopt(bytes, err);
+}
+
+// Условия запроса (--query)
+struct CaptureQuerySpec {
+    std::vector<IpAddress> hosts;    // любой из концов
+    std::vector<uint16_t> ports;
+    std::vector<FlowKey> flows;      // соединение целиком
+    uint32_t opcodes;                // бит на опкод, 0 - любые
+    int64_t since_ns;
+    int64_t until_ns;                // включительно
+    uint64_t min_size;
+    uint64_t max_size;
+
+    CaptureQuerySpec() : opcodes(0), since_ns(INT64_MIN), until_ns(INT64_MAX),
+                         min_size(0), max_size(UINT64_MAX) {}
+
+    bool hasTime() const { return since_ns != INT64_MIN || until_ns != INT64_MAX; }
+    bool hasSize() const { return min_size != 0 || max_size != UINT64_MAX; }
+    bool hasFlow() const { return !hosts.empty() || !ports.empty() || !flows.empty(); }
+};
+
+// "a.b.c.d:port" или "[v6]:port"
+inline bool parseEndpoint(const std::string& str, IpAddress& addr, uint16_t& port) {
+    size_t colon;
+    std::string host;
+    if (!str.empty() && str[0] == '[') {
+        size_t close = str.find("]:");
+        if (close == std::string::npos) return false;
+        host = str.substr(1, close - 1);
+        colon = close + 1;
+    } else {
+        colon = str.rfind(':');
+        if (colon == std::string::npos) return false;
+        host = str.substr(0, colon);
+    }
+    int p = atoi(str.c_str() + colon + 1);
+    if (p <= 0 || p > 65535 || !parseIp(host, addr)) return false;
+    port = static_cast<uint16_t>(p);
+    return true;
+}
+
+// Время: секунды от эпохи ("1700000000.25") или местное
+// "2026-10-16T10:22:48[.123]"
+inline bool parseQueryTime(const std::string& str, int64_t& ns) {
+    std::string whole = str, frac;
+    size_t dot = str.find('.');
+    if (dot != std::string::npos) {
+        whole = str.substr(0, dot);
+        frac = str.substr(dot + 1);
+        if (frac.empty() || frac.size() > 9 || frac.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        frac.resize(9, '0');
+    }
+    int64_t sec;
+    if (!whole.empty() && whole.find_first_not_of("0123456789") == std::string::npos) {
+        sec = strtoll(whole.c_str(), nullptr, 10);
+    } else {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(whole.c_str(), "%Y-%m-%dT%H:%M:%S", &tm);
+        if (!end || *end != '\0') return false;
+        tm.tm_isdst = -1;
+        sec = static_cast<int64_t>(mktime(&tm));
+    }
+    ns = sec * 1000000000LL + (frac.empty() ? 0 : strtoll(frac.c_str(), nullptr, 10));
+    return true;
+}
+
+// Разбор выражения запроса, например "host 10.0.0.5 port 8765 opcode text
+// since 2026-10-16T10:00:00 until 2026-10-16T11:00:00 min-size 100"
+inline bool parseQueryExpression(const std::string& expr, CaptureQuerySpec& spec, std::string& err) {
+    std::istringstream in(expr);
+    std::string word, value;
+    while (in >> word) {
+        if (!(in >> value)) {
+            err = "после '" + word + "' нужно значение";
+            return false;
+        }
+        std::vector<std::string> items = splitFilterList(value);
+        if (word == "host") {
+            for (size_t i = 0; i < items.size(); i++) {
+                IpAddress addr;
+                if (!parseIp(items[i], addr)) {
+                    err = "неверный адрес: " + items[i];
+                    return false;
+                }
+                spec.hosts.push_back(addr);
+            }
+        } else if (word == "port") {
+            for (size_t i = 0; i < items.size(); i++) {
+                int port = atoi(items[i].c_str());
+                if (port <= 0 || port > 65535) {
+                    err = "неверный порт: " + items[i];
+                    return false;
+                }
+                spec.ports.push_back(static_cast<uint16_t>(port));
+            }
+        } else if (word == "flow") {
+            IpAddress a, b;
+            uint16_t pa, pb;
+            if (items.size() != 2 || !parseEndpoint(items[0], a, pa) || !parseEndpoint(items[1], b, pb)) {
+                err = "соединение - два конца через запятую: " + value;
+                return false;
+            }
+            FlowKey key;
+            makeFlowKey(a, pa, b, pb, key);
+            spec.flows.push_back(key);
+        } else if (word == "opcode") {
+            for (size_t i = 0; i < items.size(); i++) {
+                uint8_t opcode;
+                if (!parseOpcodeName(items[i], opcode)) {
+                    err = "неверный опкод: " + items[i];
+                    return false;
+                }
+                spec.opcodes |= 1u << opcode;
+            }
+        } else if (word == "since" || word == "until") {
+            int64_t ns;
+            if (!parseQueryTime(value, ns)) {
+                err = "неверное время: " + value;
+                return false;
+            }
+            (word == "since" ? spec.since_ns : spec.until_ns) = ns;
+        } else if (word == "min-size" || word == "max-size") {
+            char* end = nullptr;
+            unsigned long long size = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0') {
+                err = "неверный размер: " + value;
+                return false;
+            }
+            (word == "min-size" ? spec.min_size : spec.max_size) = size;
+        } else {
+            err = "неизвестное условие: " + word;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Выполнение запроса по индексу. Результаты выдаются лениво, порциями
+// next(): ведущим берется самый короткий список кандидатов - номера
+// записей подходящих соединений (слиянием их списков, по порядку
+// записи), отрезок индекса времени (по порядку времени) или битмапы
+// опкодов, - остальные условия проверяются для
+// каждого кандидата. Заголовок записи читается, только если нужно
+// проверить время или размер, которые не покрыты ведущим списком.
+class CaptureQuery {
+private:
+    enum Driver {
+        DRIVE_ALL,       // все записи (по битмапам опкодов, если заданы)
+        DRIVE_FLOWS,     // номера записей выбранных соединений
+        DRIVE_TIME       // отрезок индекса времени
+    };
+
+    const CaptureFile* file;
+    const QueryIndex* index;
+    CaptureQuerySpec spec;
+    Driver driver;
+
+    std::vector<bool> flow_selected;
+    uint64_t candidates;
+
+    // DRIVE_FLOWS: слияние списков по возрастанию номера записи
+    struct Cursor {
+        const uint32_t* pos;
+        const uint32_t* end;
+    };
+    struct LaterCursor {
+        bool operator()(const Cursor& a, const Cursor& b) const { return *a.pos > *b.pos; }
+    };
+    std::vector<Cursor> heap;
+
+    // DRIVE_TIME: [time_pos, time_end); DRIVE_ALL: следующая запись
+    size_t time_pos;
+    size_t time_end;
+    size_t record_pos;
+
+    bool flowMatches(const QueryFlowEntry& f) const {
+        for (size_t i = 0; i < spec.flows.size(); i++) {
+            const FlowKey& k = spec.flows[i];
+            if (k.addr[0] == f.addr[0] && k.addr[1] == f.addr[1] && k.port[0] == f.port[0] && k.port[1] == f.port[1]) {
+                return true;
+            }
+        }
+        if (!spec.flows.empty()) return false;
+        bool host = spec.hosts.empty();
+        for (size_t i = 0; i < spec.hosts.size() && !host; i++) {
+            host = spec.hosts[i] == f.addr[0] || spec.hosts[i] == f.addr[1];
+        }
+        bool port = spec.ports.empty();
+        for (size_t i = 0; i < spec.ports.size() && !port; i++) {
+            port = spec.ports[i] == f.port[0] || spec.ports[i] == f.port[1];
+        }
+        return host && port;
+    }
+
+    bool opcodeMatches(size_t record) const {
+        if (spec.opcodes == 0) return true;
+        for (unsigned op = 0; op < 16; op++) {
+            if (!(spec.opcodes & (1u << op))) continue;
+            const uint64_t* bits = index->opcodeBitmap(op);
+            if (bits && (bits[record / 64] >> (record % 64) & 1)) return true;
+        }
+        return false;
+    }
+
+    bool accept(size_t record) const {
+        if (record >= index->recordCount()) return false;
+        if (driver != DRIVE_FLOWS && spec.hasFlow() && !flow_selected[index->recordFlow(record)]) return false;
+        if (!opcodeMatches(record)) return false;
+        bool check_time = driver != DRIVE_TIME && spec.hasTime();
+        if (!check_time && !spec.hasSize()) return true;
+        const CaptureRecord* rec = file->record(record);
+        if (!rec) return false;
+        if (check_time && (rec->timestamp_ns < spec.since_ns || rec->timestamp_ns > spec.until_ns)) return false;
+        return rec->payload_len >= spec.min_size && rec->payload_len <= spec.max_size;
+    }
+
+    // Следующая запись с битом хотя бы одного выбранного опкода
+    bool nextByBitmap(size_t& record) {
+        size_t n = index->recordCount();
+        while (record_pos < n) {
+            size_t w = record_pos / 64;
+            uint64_t word = 0;
+            for (unsigned op = 0; op < 16; op++) {
+                const uint64_t* bits = (spec.opcodes & (1u << op)) ? index->opcodeBitmap(op) : nullptr;
+                if (bits) word |= bits[w];
+            }
+            word &= ~0ull << (record_pos % 64);
+            if (word) {
+                record = w * 64 + __builtin_ctzll(word);
+                record_pos = record + 1;
+                return record < n;
+            }
+            record_pos = (w + 1) * 64;
+        }
+        return false;
+    }
+
+    bool nextCandidate(size_t& record) {
+        if (driver == DRIVE_FLOWS) {
+            if (heap.empty()) return false;
+            LaterCursor later;
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Cursor& c = heap.back();
+            record = *c.pos++;
+            if (c.pos == c.end) {
+                heap.pop_back();
+            } else {
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+            return true;
+        }
+        if (driver == DRIVE_TIME) {
+            if (time_pos >= time_end) return false;
+            record = index->times()[time_pos++].record;
+            return true;
+        }
+        if (spec.opcodes != 0) return nextByBitmap(record);
+        if (record_pos >= index->recordCount()) return false;
+        record = record_pos++;
+        return true;
+    }
+
+public:
+    CaptureQuery(const CaptureFile& f, const QueryIndex& idx, const CaptureQuerySpec& s)
+        : file(&f), index(&idx), spec(s), driver(DRIVE_ALL), candidates(idx.recordCount()),
+          time_pos(0), time_end(0), record_pos(0) {
+        // Оценка длины каждого ведущего списка
+        uint64_t flow_records = 0;
+        if (spec.hasFlow()) {
+            flow_selected.assign(index->flowCount(), false);
+            for (size_t i = 0; i < index->flowCount(); i++) {
+                if (!flowMatches(index->flow(i))) continue;
+                flow_selected[i] = true;
+                flow_records += index->flow(i).count;
+            }
+        }
+
+        const QueryTimeEntry* t = index->times();
+        size_t n = index->recordCount();
+        if (spec.hasTime()) {
+            struct Before {
+                bool operator()(const QueryTimeEntry& e, int64_t ns) const { return e.timestamp_ns < ns; }
+                bool operator()(int64_t ns, const QueryTimeEntry& e) const { return ns < e.timestamp_ns; }
+            };
+            Before before;
+            time_pos = std::lower_bound(t, t + n, spec.since_ns, before) - t;
+            time_end = std::upper_bound(t, t + n, spec.until_ns, before) - t;
+            if (time_end < time_pos) time_end = time_pos;
+        }
+
+        if (spec.hasFlow() && flow_records <= candidates &&
+            (!spec.hasTime() || flow_records <= time_end - time_pos)) {
+            driver = DRIVE_FLOWS;
+            candidates = flow_records;
+            for (size_t i = 0; i < index->flowCount(); i++) {
+                const QueryFlowEntry& f = index->flow(i);
+                if (!flow_selected[i] || f.count == 0) continue;
+                Cursor c = {index->postings() + f.first, index->postings() + f.first + f.count};
+                heap.push_back(c);
+            }
+            std::make_heap(heap.begin(), heap.end(), LaterCursor());
+        } else if (spec.hasTime()) {
+            driver = DRIVE_TIME;
+            candidates = time_end - time_pos;
+        } else if (spec.opcodes != 0) {
+            candidates = 0;
+            for (unsigned op = 0; op < 16; op++) {
+                const uint64_t* bits = (spec.opcodes & (1u << op)) ? index->opcodeBitmap(op) : nullptr;
+                for (size_t w = 0; bits && w < (n + 63) / 64; w++) candidates += __builtin_popcountll(bits[w]);
+            }
+        }
+    }
+
+    // Кандидатов в ведущем списке - верхняя граница числа результатов
+    uint64_t candidateCount() const { return candidates; }
+
+    const char* driverName() const {
+        return driver == DRIVE_FLOWS ? "соединения" : driver == DRIVE_TIME ? "время" :
+               spec.opcodes ? "битмапы опкодов" : "все записи";
+    }
+
+    // До max следующих номеров записей; 0 - результаты кончились
+    size_t next(std::vector<size_t>& out, size_t max) {
+        out.clear();
+        size_t record;
+        while (out.size() < max && nextCandidate(record)) {
+            if (accept(record)) out.push_back(record);
+        }
+        return out.size();
+    }
+};
+
+#endif // WS_INDEX_H
@@ -0,0 +1,235 @@
+#ifndef WS_INFLATE_H
+#define WS_INFLATE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <zlib.h>
+
+// Пул блоков памяти для внутренних структур zlib (состояние inflate
+// и окно 32 КБ). zlib запрашивает всего пару разных размеров, поэтому
+// при смене соединений блоки просто переиспользуются без malloc/free.
+class InflatePool {
+private:
+    struct Bucket {
+        size_t size;
+        std::vector<void*> blocks;
+    };
+    std::vector<Bucket> buckets;
+
+    // Выходной буфер, общий для всех распаковок: растет до размера
+    // самого большого сообщения и больше не перевыделяется
+    std::vector<uint8_t> scratch;
+
+public:
+    InflatePool() {}
+    // В корзинах - блоки в том виде, в каком их получил zlib; начало
+    // выделенной памяти - на sizeof(std::max_align_t) раньше
+    ~InflatePool() {
+        for (size_t i = 0; i < buckets.size(); i++) {
+            for (size_t j = 0; j < buckets[i].blocks.size(); j++) {
+                free(static_cast<uint8_t*>(buckets[i].blocks[j]) - sizeof(std::max_align_t));
+            }
+        }
+    }
+
+    void* acquire(size_t size) {
+        for (size_t i = 0; i < buckets.size(); i++) {
+            if (buckets[i].size == size && !buckets[i].blocks.empty()) {
+                void* p = buckets[i].blocks.back();
+                buckets[i].blocks.pop_back();
+                return p;
+            }
+        }
+        // Размер блока храним перед ним, чтобы release знал корзину
+        size_t* p = static_cast<size_t*>(malloc(size + sizeof(std::max_align_t)));
+        if (!p) return nullptr;
+        *p = size;
+        return reinterpret_cast<uint8_t*>(p) + sizeof(std::max_align_t);
+    }
+
+    void release(void* block) {
+        if (!block) return;
+        size_t size = *reinterpret_cast<size_t*>(static_cast<uint8_t*>(block) - sizeof(std::max_align_t));
+        for (size_t i = 0; i < buckets.size(); i++) {
+            if (buckets[i].size == size) {
+                buckets[i].blocks.push_back(block);
+                return;
+            }
+        }
+        Bucket b;
+        b.size = size;
+        b.blocks.push_back(block);
+        buckets.push_back(b);
+    }
+
+    std::vector<uint8_t>& outputBuffer() { return scratch; }
+
+    static voidpf zalloc(voidpf opaque, uInt items, uInt size) {
+        return static_cast<InflatePool*>(opaque)->acquire(static_cast<size_t>(items) * size);
+    }
+
+    static void zfree(voidpf opaque, voidpf address) {
+        static_cast<InflatePool*>(opaque)->release(address);
+    }
+};
+
+// Долгоживущий контекст inflate одного направления соединения.
+// permessage-deflate по умолчанию работает с context takeover: окно
+// сжатия переходит из сообщения в сообщение, поэтому z_stream нельзя
+// пересоздавать на каждое сообщение.
+class Inflater {
+private:
+    z_stream stream;
+    bool initialized;
+    bool message_ended;  // в текущем сообщении уже был BFINAL - остаток игнорируется
+
+    Inflater(const Inflater&);
+    Inflater& operator=(const Inflater&);
+
+    bool init(InflatePool& pool) {
+        if (initialized) return true;
+        stream.zalloc = InflatePool::zalloc;
+        stream.zfree = InflatePool::zfree;
+        stream.opaque = &pool;
+        stream.next_in = Z_NULL;
+        stream.avail_in = 0;
+        // zlib не умеет сжимать с окном 2^8 и молча берет 2^9,
+        // поэтому меньше 9 бит окно не делаем
+        if (inflateInit2(&stream, -(window_bits < 9 ? 9 : window_bits)) != Z_OK) {
+            return false;
+        }
+        initialized = true;
+        return true;
+    }
+
+    // Прогоняет data через inflate, дописывая результат в out с позиции
+    // out_len. Больше limit байт в out не попадает: остальное
+    // распаковывается в буфер пула и отбрасывается (discarded) - окно
+    // context takeover должно увидеть все данные сообщения.
+    bool run(InflatePool& pool, const uint8_t* data, size_t len,
+             std::vector<uint8_t>& out, size_t& out_len, size_t limit, uint64_t& discarded) {
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.avail_in = static_cast<uInt>(len);
+
+        for (;;) {
+            bool discard = out_len >= limit;
+            uint8_t* dst;
+            size_t room;
+            if (!discard) {
+                if (out_len == out.size()) {
+                    size_t grow = out.size() < 16384 ? 16384 : out.size() * 2;
+                    out.resize(grow < limit ? grow : limit);
+                }
+                dst = out.data() + out_len;
+                room = out.size() - out_len;
+            } else {
+                std::vector<uint8_t>& sink = pool.outputBuffer();
+                if (sink.size() < 16384) sink.resize(16384);
+                dst = sink.data();
+                room = sink.size();
+            }
+            stream.next_out = dst;
+            stream.avail_out = static_cast<uInt>(room);
+
+            int ret = inflate(&stream, Z_SYNC_FLUSH);
+            size_t produced = room - stream.avail_out;
+            if (discard) {
+                discarded += produced;
+            } else {
+                out_len += produced;
+            }
+
+            if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR ||
+                ret == Z_MEM_ERROR || ret == Z_NEED_DICT) {
+                // Состояние испорчено - следующее сообщение начнем заново
+                inflateReset(&stream);
+                message_ended = false;
+                return false;
+            }
+            if (ret == Z_STREAM_END) {
+                // Сообщение с BFINAL=1: следующий deflate-поток с чистым окном
+                inflateReset(&stream);
+                message_ended = true;
+                return true;
+            }
+            // Весь вход съеден и выходной буфер не заполнен до конца
+            if (stream.avail_in == 0 && stream.avail_out != 0) break;
+            if (ret == Z_BUF_ERROR && stream.avail_out != 0) break;
+        }
+        return true;
+    }
+
+public:
+    // Согласовано *_no_context_takeover - окно сбрасывается после сообщения
+    bool no_context_takeover;
+
+    // Согласованный *_max_window_bits: окно 2^bits вместо 32 КБ на контекст
+    int window_bits;
+
+    Inflater() : initialized(false), message_ended(false), no_context_takeover(false), window_bits(15) {}
+    ~Inflater() { reset(); }
+
+    // Полностью освобождает контекст (конец соединения)
+    void reset() {
+        if (initialized) {
+            inflateEnd(&stream);
+            initialized = false;
+        }
+        message_ended = false;
+        no_context_takeover = false;
+        window_bits = 15;
+    }
+
+    // Потоковая распаковка сообщения по кускам (фрагменты, сегменты
+    // большого фрейма): beginMessage, inflateChunk на каждый кусок по
+    // мере прихода, finishMessage в конце. Результат копится в out[0,
+    // out_len); out растет не больше limit, лишнее только считается.
+    bool beginMessage(InflatePool& pool) {
+        message_ended = false;
+        return init(pool);
+    }
+
+    bool inflateChunk(InflatePool& pool, const uint8_t* data, size_t len,
+                      std::vector<uint8_t>& out, size_t& out_len, size_t limit, uint64_t& discarded) {
+        if (message_ended || len == 0) return true;
+        return run(pool, data, len, out, out_len, limit, discarded);
+    }
+
+    bool finishMessage(InflatePool& pool, std::vector<uint8_t>& out, size_t& out_len,
+                       size_t limit, uint64_t& discarded) {
+        // WebSocket permessage-deflate отрезает 0x00 0x00 0xff 0xff в конце
+        // сообщения - подаем его отдельным куском, не копируя payload
+        static const uint8_t TRAILER[4] = {0x00, 0x00, 0xff, 0xff};
+
+        bool ok = message_ended || run(pool, TRAILER, sizeof(TRAILER), out, out_len, limit, discarded);
+        if (ok && !message_ended && no_context_takeover) {
+            inflateReset(&stream);
+        }
+        message_ended = false;
+        return ok;
+    }
+
+    // Сообщение оборвано (разрыв потока): окно уже не восстановить,
+    // следующее сообщение начинаем с чистого
+    void abortMessage() {
+        if (initialized) inflateReset(&stream);
+        message_ended = false;
+    }
+
+    // Распаковывает одно сообщение целиком в pool.outputBuffer() и
+    // возвращает размер результата через out_len. Больше limit байт в
+    // буфер не попадает, остальное только считается в discarded.
+    bool decompress(InflatePool& pool, const uint8_t* data, size_t len, size_t& out_len,
+                    size_t limit, uint64_t& discarded) {
+        if (!beginMessage(pool)) return false;
+        std::vector<uint8_t>& out = pool.outputBuffer();
+        out_len = 0;
+        discarded = 0;
+        return inflateChunk(pool, data, len, out, out_len, limit, discarded) &&
+               finishMessage(pool, out, out_len, limit, discarded);
+    }
+};
+
+#endif // WS_INFLATE_H
@@ -0,0 +1,454 @@
+#ifndef WS_LATENCY_H
+#define WS_LATENCY_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "ws_message.h"
+#include "ws_flow.h"
+
+// Гистограмма задержек в стиле HDR: значения (наносекунды) раскладываются
+// по степеням двойки, каждая степень делится на 2^(SubBits-1) равных
+// частей. Относительная ошибка - не больше 2^-(SubBits-1) при любом
+// значении, память фиксирована: счетчики - массив внутри объекта.
+// Значения больше 2^MAX_BITS нс (~73 минуты) считаются равными ему.
+template <unsigned SubBits, typename Count>
+class HdrHistogram {
+public:
+    static const unsigned MAX_BITS = 42;
+    static const size_t SUB_COUNT = size_t(1) << SubBits;
+    static const size_t HALF = SUB_COUNT / 2;
+    static const size_t SIZE = (MAX_BITS - SubBits + 2) * HALF;
+
+private:
+    Count counts[SIZE];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min_value;
+    uint64_t max_value;
+
+    static size_t indexOf(uint64_t v) {
+        unsigned msb = 63 - __builtin_clzll(v | (SUB_COUNT - 1));
+        unsigned shift = msb - (SubBits - 1);
+        return (static_cast<size_t>(shift) << (SubBits - 1)) + static_cast<size_t>(v >> shift);
+    }
+
+    // Наибольшее значение, попадающее в ячейку
+    static uint64_t highestAt(size_t i) {
+        if (i < SUB_COUNT) return i;
+        unsigned shift = static_cast<unsigned>(i >> (SubBits - 1)) - 1;
+        uint64_t low = static_cast<uint64_t>(i - (static_cast<size_t>(shift) << (SubBits - 1))) << shift;
+        return low + (uint64_t(1) << shift) - 1;
+    }
+
+public:
+    HdrHistogram() { reset(); }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        sum = 0;
+        min_value = UINT64_MAX;
+        max_value = 0;
+    }
+
+    void record(int64_t ns) {
+        uint64_t v = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+        if (v >> MAX_BITS) v = (uint64_t(1) << MAX_BITS) - 1;
+        counts[indexOf(v)]++;
+        total++;
+        sum += v;
+        if (v < min_value) min_value = v;
+        if (v > max_value) max_value = v;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? min_value : 0; }
+    uint64_t max() const { return max_value; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0; }
+
+    // Значение, не меньше которого percent процентов записей
+    uint64_t percentile(double percent) const {
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(percent / 100.0 * total + 0.5);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < SIZE; i++) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(highestAt(i), max_value);
+        }
+        return max_value;
+    }
+};
+
+// Значение поля верхнего уровня JSON-объекта: строка - без кавычек (escape
+// не раскрываются), число и литералы - как есть. Вложенные объекты и
+// строки (например, эхо запроса внутри ответа) не просматриваются.
+inline bool findJsonField(const uint8_t* data, size_t len, const std::string& field,
+                          const uint8_t*& value, size_t& value_len) {
+    size_t i = 0;
+    while (i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n')) i++;
+    if (i == len || data[i] != '{') return false;
+    int depth = 0;
+    bool expect_key = false;
+    for (; i < len; i++) {
+        uint8_t c = data[i];
+        if (c == '"') {
+            size_t start = ++i;
+            while (i < len && data[i] != '"') i += data[i] == '\\' ? 2 : 1;
+            if (i >= len) return false;
+            if (depth != 1 || !expect_key) continue;
+            expect_key = false;
+            bool match = i - start == field.size() && memcmp(data + start, field.data(), field.size()) == 0;
+            size_t j = i + 1;
+            while (j < len && (data[j] == ' ' || data[j] == '\t' || data[j] == '\r' || data[j] == '\n')) j++;
+            if (!match || j >= len || data[j] != ':') continue;
+            j++;
+            while (j < len && (data[j] == ' ' || data[j] == '\t' || data[j] == '\r' || data[j] == '\n')) j++;
+            if (j >= len || data[j] == '{' || data[j] == '[') return false;
+            if (data[j] == '"') {
+                size_t end = ++j;
+                while (end < len && data[end] != '"') end += data[end] == '\\' ? 2 : 1;
+                if (end > len) return false;
+                value = data + j;
+                value_len = std::min(end, len) - j;
+                return true;
+            }
+            size_t end = j;
+            while (end < len && data[end] != ',' && data[end] != '}' && data[end] != ' ' && data[end] != '\r' &&
+                   data[end] != '\n' && data[end] != '\t') {
+                end++;
+            }
+            value = data + j;
+            value_len = end - j;
+            return true;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+            expect_key = c == '{' && depth == 1;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == ',' && depth == 1) {
+            expect_key = true;
+        }
+    }
+    return false;
+}
+
+// Параметры --latency
+struct LatencyOptions {
+    bool enabled;
+    unsigned interval;       // секунд времени пакетов между отчетами, 0 - только в конце
+    std::string field;       // --latency-pair ПОЛЕ или ПОЛЕ=ЗНАЧЕНИЕ
+    std::string value;
+    size_t max_flows;
+    size_t top_flows;        // соединений в отчете
+
+    LatencyOptions() : enabled(false), interval(10), max_flows(4096), top_flows(10) {}
+
+    // "type=echo" - ответы только с таким полем; "id" - ответ к запросу
+    // с тем же значением поля
+    void setPairing(const std::string& spec) {
+        size_t eq = spec.find('=');
+        field = spec.substr(0, eq);
+        value = eq == std::string::npos ? std::string() : spec.substr(eq + 1);
+    }
+};
+
+inline std::string formatLatency(uint64_t ns) {
+    std::ostringstream out;
+    out << std::fixed;
+    if (ns < 1000000) {
+        out << std::setprecision(0) << ns / 1e3 << " мкс";
+    } else if (ns < 1000000000) {
+        out << std::setprecision(2) << ns / 1e6 << " мс";
+    } else {
+        out << std::setprecision(2) << ns / 1e9 << " с";
+    }
+    return out.str();
+}
+
+// Задержка ответа сервера по трафику: сообщение клиента (с маской) -
+// запрос, следующее сообщение сервера в том же соединении - ответ к
+// самому старому неотвеченному запросу. С --latency-pair запросы и
+// ответы сопоставляются по полю JSON. Время - метки пакетов, поэтому
+// разбор файлов (--read) дает те же задержки, что и живой захват.
+//
+// На соединение - фиксированная запись: очередь из PENDING запросов,
+// небольшая гистограмма и счетчики; соединений не больше max_flows
+// (давно молчащие вытесняются). Вызывается из одного потока - того, что
+// сохраняет сообщения.
+class LatencyTracker {
+public:
+    typedef HdrHistogram<8, uint64_t> GlobalHistogram;   // ошибка < 1%
+    typedef HdrHistogram<4, uint32_t> FlowHistogram;     // ошибка < 12.5%, 1.3 КБ
+
+private:
+    static const size_t PENDING = 32;
+    static const int64_t IDLE_NS = 60LL * 1000000000;
+
+    struct Pending {
+        int64_t ts;
+        uint64_t key;            // хеш значения поля (с --latency-pair ПОЛЕ)
+    };
+
+    struct FlowLatency {
+        IpAddress client_ip;
+        IpAddress server_ip;
+        uint16_t client_port;
+        uint16_t server_port;
+        Pending pending[PENDING];
+        uint32_t pending_head;
+        uint32_t pending_count;
+        FlowHistogram histogram;
+        uint64_t messages[2];    // 0 - от клиента, 1 - от сервера
+        uint64_t bytes[2];
+        uint64_t reported_messages[2];
+        uint64_t reported_bytes[2];
+        int64_t first_ts;
+        int64_t last_ts;
+    };
+
+    struct FlowHash {
+        size_t operator()(const FlowKey& key) const { return hashFlowKey(key); }
+    };
+
+    LatencyOptions opts;
+    std::unordered_map<FlowKey, FlowLatency, FlowHash> flows;
+    GlobalHistogram total;
+    GlobalHistogram interval;
+    uint64_t unmatched;          // ответы без запроса
+    uint64_t overflowed;         // запросы, вытесненные из полной очереди
+    uint64_t untracked;          // сообщения соединений сверх max_flows
+    uint64_t evicted;
+    int64_t first_ts;
+    int64_t last_ts;
+    int64_t next_report;
+    int64_t reported_at;
+
+    static uint64_t hashBytes(const uint8_t* data, size_t len) {
+        uint64_t h = 1469598103934665603ULL;
+        for (size_t i = 0; i < len; i++) h = (h ^ data[i]) * 1099511628211ULL;
+        return h;
+    }
+
+    FlowLatency* flowFor(const WebSocketMessage& msg, bool from_client) {
+        FlowKey key;
+        makeFlowKey(msg.src_ip, msg.src_port, msg.dst_ip, msg.dst_port, key);
+        std::unordered_map<FlowKey, FlowLatency, FlowHash>::iterator it = flows.find(key);
+        if (it != flows.end()) return &it->second;
+        if (flows.size() >= opts.max_flows) {
+            evictIdle(msg.timestamp_ns);
+            if (flows.size() >= opts.max_flows) return nullptr;
+        }
+        FlowLatency& f = flows[key];
+        memset(f.pending, 0, sizeof(f.pending));
+        f.pending_head = 0;
+        f.pending_count = 0;
+        f.client_ip = from_client ? msg.src_ip : msg.dst_ip;
+        f.server_ip = from_client ? msg.dst_ip : msg.src_ip;
+        f.client_port = from_client ? msg.src_port : msg.dst_port;
+        f.server_port = from_client ? msg.dst_port : msg.src_port;
+        memset(f.messages, 0, sizeof(f.messages));
+        memset(f.bytes, 0, sizeof(f.bytes));
+        memset(f.reported_messages, 0, sizeof(f.reported_messages));
+        memset(f.reported_bytes, 0, sizeof(f.reported_bytes));
+        f.first_ts = msg.timestamp_ns;
+        f.last_ts = msg.timestamp_ns;
+        return &f;
+    }
+
+    void evictIdle(int64_t now) {
+        for (std::unordered_map<FlowKey, FlowLatency, FlowHash>::iterator it = flows.begin(); it != flows.end();) {
+            if (now - it->second.last_ts > IDLE_NS) {
+                evicted++;
+                it = flows.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void addPending(FlowLatency& f, int64_t ts, uint64_t key) {
+        if (f.pending_count == PENDING) {
+            overflowed++;
+            f.pending_head = (f.pending_head + 1) % PENDING;
+            f.pending_count--;
+        }
+        Pending& p = f.pending[(f.pending_head + f.pending_count) % PENDING];
+        p.ts = ts;
+        p.key = key;
+        f.pending_count++;
+    }
+
+    // Самый старый запрос (или с тем же ключом); -1 - нет
+    int64_t takePending(FlowLatency& f, bool by_key, uint64_t key) {
+        for (uint32_t n = 0; n < f.pending_count; n++) {
+            uint32_t i = (f.pending_head + n) % PENDING;
+            if (by_key && f.pending[i].key != key) continue;
+            int64_t ts = f.pending[i].ts;
+            // Сдвигаем более старые на место найденного
+            for (uint32_t m = n; m > 0; m--) {
+                f.pending[(f.pending_head + m) % PENDING] = f.pending[(f.pending_head + m - 1) % PENDING];
+            }
+            f.pending_head = (f.pending_head + 1) % PENDING;
+            f.pending_count--;
+            return ts;
+        }
+        return -1;
+    }
+
+    struct Busiest {
+        bool operator()(const FlowLatency* a, const FlowLatency* b) const {
+            return a->messages[0] + a->messages[1] - a->reported_messages[0] - a->reported_messages[1] >
+                   b->messages[0] + b->messages[1] - b->reported_messages[0] - b->reported_messages[1];
+        }
+    };
+
+    void formatHistogram(std::ostringstream& out, const GlobalHistogram& h) const {
+        out << h.count() << " пар, p50 " << formatLatency(h.percentile(50))
+            << ", p90 " << formatLatency(h.percentile(90))
+            << ", p99 " << formatLatency(h.percentile(99))
+            << ", p99.9 " << formatLatency(h.percentile(99.9))
+            << ", max " << formatLatency(h.max());
+    }
+
+    // Самые активные соединения за период (seconds - его длина)
+    void formatFlows(std::ostringstream& out, double seconds, bool since_report) {
+        std::vector<FlowLatency*> top;
+        for (std::unordered_map<FlowKey, FlowLatency, FlowHash>::iterator it = flows.begin(); it != flows.end(); ++it) {
+            if (!since_report) {
+                memset(it->second.reported_messages, 0, sizeof(it->second.reported_messages));
+                memset(it->second.reported_bytes, 0, sizeof(it->second.reported_bytes));
+            }
+            top.push_back(&it->second);
+        }
+        size_t shown = std::min(top.size(), opts.top_flows);
+        std::partial_sort(top.begin(), top.begin() + shown, top.end(), Busiest());
+        if (seconds <= 0) seconds = 1;
+        for (size_t i = 0; i < shown; i++) {
+            FlowLatency& f = *top[i];
+            double in = (f.messages[0] - f.reported_messages[0]) / seconds;
+            double outgoing = (f.messages[1] - f.reported_messages[1]) / seconds;
+            if (in == 0 && outgoing == 0) break;
+            out << "   " << formatEndpoint(f.client_ip, f.client_port) << " -> "
+                << formatEndpoint(f.server_ip, f.server_port) << ": " << std::fixed << std::setprecision(1)
+                << in << "/" << outgoing << " сообщ/с, "
+                << (f.bytes[0] - f.reported_bytes[0]) / seconds / 1024 << "/"
+                << (f.bytes[1] - f.reported_bytes[1]) / seconds / 1024 << " КБ/с";
+            if (f.histogram.count() > 0) {
+                out << ", p50 " << formatLatency(f.histogram.percentile(50))
+                    << ", p99 " << formatLatency(f.histogram.percentile(99))
+                    << " (пар " << f.histogram.count() << ")";
+            }
+            out << "\n";
+        }
+        for (size_t i = 0; i < top.size(); i++) {
+            memcpy(top[i]->reported_messages, top[i]->messages, sizeof(top[i]->messages));
+            memcpy(top[i]->reported_bytes, top[i]->bytes, sizeof(top[i]->bytes));
+        }
+    }
+
+public:
+    LatencyTracker() : unmatched(0), overflowed(0), untracked(0), evicted(0),
+                       first_ts(0), last_ts(0), next_report(0), reported_at(0) {}
+
+    void setOptions(const LatencyOptions& options) {
+        opts = options;
+        if (opts.max_flows == 0) opts.max_flows = 1;
+        flows.reserve(std::min<size_t>(opts.max_flows, 4096));
+    }
+
+    bool enabled() const { return opts.enabled; }
+
+    // Учитывает сообщение; report - текст периодического отчета, если
+    // по времени пакетов пришла его пора
+    void add(const WebSocketMessage& msg, std::string& report) {
+        if (msg.opcode >= 0x8) return;  // служебные фреймы - не запросы и не ответы
+        int64_t ts = msg.timestamp_ns;
+        if (first_ts == 0) {
+            first_ts = ts;
+            reported_at = ts;
+            next_report = ts + static_cast<int64_t>(opts.interval) * 1000000000;
+        }
+        if (ts > last_ts) last_ts = ts;
+
+        bool from_client = msg.is_masked;
+        FlowLatency* f = flowFor(msg, from_client);
+        if (!f) {
+            untracked++;
+        } else {
+            int dir = from_client ? 0 : 1;
+            f->messages[dir]++;
+            f->bytes[dir] += msg.payload.size();
+            if (ts > f->last_ts) f->last_ts = ts;
+
+            const uint8_t* value = nullptr;
+            size_t value_len = 0;
+            bool json = !opts.field.empty() && msg.opcode == 0x1 &&
+                        findJsonField(msg.payload.data(), msg.payload.size(), opts.field, value, value_len);
+            bool by_key = !opts.field.empty() && opts.value.empty();
+            if (from_client) {
+                if (opts.field.empty() || !opts.value.empty() || json) {
+                    addPending(*f, ts, json && by_key ? hashBytes(value, value_len) : 0);
+                }
+            } else {
+                bool response = opts.field.empty() ||
+                                (json && (by_key || (value_len == opts.value.size() &&
+                                                     memcmp(value, opts.value.data(), value_len) == 0)));
+                if (response) {
+                    int64_t request = takePending(*f, by_key, json ? hashBytes(value, value_len) : 0);
+                    if (request < 0) {
+                        unmatched++;
+                    } else {
+                        f->histogram.record(ts - request);
+                        total.record(ts - request);
+                        interval.record(ts - request);
+                    }
+                }
+            }
+        }
+
+        if (opts.interval > 0 && ts >= next_report) {
+            report = intervalReport();
+            next_report = ts + static_cast<int64_t>(opts.interval) * 1000000000;
+        }
+    }
+
+    std::string intervalReport() {
+        std::ostringstream out;
+        double seconds = (last_ts - reported_at) / 1e9;
+        out << "⏱  Задержка ответа за " << std::fixed << std::setprecision(0) << seconds << " с: ";
+        formatHistogram(out, interval);
+        out << ", соединений " << flows.size() << "\n";
+        formatFlows(out, seconds, true);
+        interval.reset();
+        reported_at = last_ts;
+        return out.str();
+    }
+
+    // Итог за все время: глобальная гистограмма и соединения со средним темпом
+    std::string summary() {
+        std::ostringstream out;
+        if (total.count() == 0 && flows.empty()) return "   ⏱  Задержка ответа: пар запрос/ответ не найдено\n";
+        out << "   ⏱  Задержка ответа: ";
+        formatHistogram(out, total);
+        out << ", среднее " << formatLatency(static_cast<uint64_t>(total.mean())) << "\n";
+        if (unmatched || overflowed || untracked || evicted) {
+            out << "      ответов без запроса: " << unmatched << ", запросов без ответа (очередь полна): "
+                << overflowed << ", сообщений вне таблицы соединений: " << untracked
+                << ", вытеснено соединений: " << evicted << "\n";
+        }
+        formatFlows(out, (last_ts - first_ts) / 1e9, false);
+        return out.str();
+    }
+
+    const GlobalHistogram& histogram() const { return total; }
+};
+
+#endif // WS_LATENCY_H
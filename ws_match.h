@@ -0,0 +1,266 @@
+#ifndef WS_MATCH_H
+#define WS_MATCH_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "ws_message.h"
+
+// Поиск тысяч шаблонов (ключи, строки ошибок, имена RPC) в payload за
+// один проход: автомат Ахо-Корасик, достроенный до полного DFA. Байты,
+// которых нет ни в одном шаблоне, сводятся в один класс, поэтому строка
+// переходов состояния - десятки, а не 256 элементов, и таблица тысяч
+// шаблонов помещается в кэш. На байт - одна загрузка из таблицы.
+class PatternMatcher {
+private:
+    static const uint32_t NONE = 0xFFFFFFFFu;
+
+    uint8_t classes[256];
+    uint32_t class_count;
+
+    // Переходы: delta[состояние * class_count + класс]. После build()
+    // значение - сразу начало строки целевого состояния, а состояния, в
+    // которых кончается шаблон, перенумерованы в конец: проверка на
+    // совпадение - одно сравнение с first_match вне цепочки загрузок.
+    std::vector<uint32_t> delta;
+    uint32_t first_match;
+    std::vector<uint32_t> pattern_at;  // шаблон, кончающийся в состоянии, или NONE
+    std::vector<uint32_t> dict_link;   // ближайший суффикс с шаблоном или NONE
+    std::vector<std::string> patterns;
+    bool built;
+
+    uint32_t addState() {
+        uint32_t none = NONE;  // по значению: NONE не определен вне класса
+        delta.resize(delta.size() + class_count, none);
+        pattern_at.push_back(none);
+        dict_link.push_back(none);
+        return static_cast<uint32_t>(pattern_at.size() - 1);
+    }
+
+    template <typename Report>
+    void reportAt(uint32_t s, uint64_t end, Report& report) const {
+        uint32_t state = s / class_count;
+        if (pattern_at[state] == NONE) state = dict_link[state];
+        while (state != NONE) {
+            uint32_t p = pattern_at[state];
+            report(p, end - patterns[p].size());
+            state = dict_link[state];
+        }
+    }
+
+    static int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Строка файла шаблонов: \xNN, \n, \r, \t, \\; "\#" - решетка в начале
+    static bool unescape(const std::string& line, std::string& out) {
+        out.clear();
+        for (size_t i = 0; i < line.size(); i++) {
+            if (line[i] != '\\') {
+                out += line[i];
+                continue;
+            }
+            if (++i == line.size()) return false;
+            char c = line[i];
+            if (c == 'x') {
+                if (i + 2 >= line.size()) return false;
+                int hi = hexDigit(line[i + 1]);
+                int lo = hexDigit(line[i + 2]);
+                if (hi < 0 || lo < 0) return false;
+                out += static_cast<char>((hi << 4) | lo);
+                i += 2;
+            } else if (c == 'n') {
+                out += '\n';
+            } else if (c == 'r') {
+                out += '\r';
+            } else if (c == 't') {
+                out += '\t';
+            } else {
+                out += c;
+            }
+        }
+        return true;
+    }
+
+public:
+    PatternMatcher() : class_count(1), first_match(0), built(false) {
+        memset(classes, 0, sizeof(classes));
+    }
+
+    // Шаблоны добавляются до build(); пустые и повторы не добавляются
+    void addPattern(const std::string& pattern) {
+        if (pattern.empty()) return;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (patterns[i] == pattern) return;
+        }
+        patterns.push_back(pattern);
+        built = false;
+    }
+
+    // Файл: шаблон на строку, пустые строки и строки с '#' пропускаются
+    bool loadFile(const std::string& path, std::string& err) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            err = "не удалось открыть " + path;
+            return false;
+        }
+        std::string line, pattern;
+        for (size_t n = 1; std::getline(in, line); n++) {
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            if (line.empty() || line[0] == '#') continue;
+            if (!unescape(line, pattern)) {
+                err = path + ":" + std::to_string(n) + ": неверная escape-последовательность";
+                return false;
+            }
+            addPattern(pattern);
+        }
+        return true;
+    }
+
+    // Построение DFA; после него автомат только читается и может
+    // использоваться из нескольких потоков одновременно
+    bool build(std::string& err) {
+        bool used[256] = {false};
+        for (size_t i = 0; i < patterns.size(); i++) {
+            for (size_t j = 0; j < patterns[i].size(); j++) {
+                used[static_cast<uint8_t>(patterns[i][j])] = true;
+            }
+        }
+        // Класс 0 - байты не из шаблонов. Если в шаблонах все 256 байт,
+        // он пуст и достается последнему байту.
+        memset(classes, 0, sizeof(classes));
+        class_count = 1;
+        for (int b = 0; b < 256; b++) {
+            if (used[b]) classes[b] = static_cast<uint8_t>(class_count++);
+        }
+        if (class_count > 256) class_count = 256;
+
+        delta.clear();
+        pattern_at.clear();
+        dict_link.clear();
+        addState();
+
+        // Бор
+        for (size_t i = 0; i < patterns.size(); i++) {
+            uint32_t s = 0;
+            for (size_t j = 0; j < patterns[i].size(); j++) {
+                uint32_t c = classes[static_cast<uint8_t>(patterns[i][j])];
+                if (delta[s * class_count + c] == NONE) {
+                    uint32_t next = addState();
+                    delta[s * class_count + c] = next;
+                }
+                s = delta[s * class_count + c];
+            }
+            pattern_at[s] = static_cast<uint32_t>(i);
+        }
+
+        uint64_t cells = static_cast<uint64_t>(pattern_at.size()) * class_count;
+        if (cells >= NONE) {
+            err = "слишком много шаблонов: " + std::to_string(pattern_at.size()) + " состояний";
+            return false;
+        }
+
+        // Суффиксные ссылки обходом в ширину; недостающие переходы берутся
+        // у суффикса, который уже достроен
+        std::vector<uint32_t> fail(pattern_at.size(), 0);
+        std::vector<uint32_t> queue;
+        queue.reserve(pattern_at.size());
+        for (uint32_t c = 0; c < class_count; c++) {
+            uint32_t& next = delta[c];
+            if (next == NONE) {
+                next = 0;
+            } else {
+                queue.push_back(next);
+            }
+        }
+        for (size_t q = 0; q < queue.size(); q++) {
+            uint32_t u = queue[q];
+            for (uint32_t c = 0; c < class_count; c++) {
+                uint32_t& next = delta[u * class_count + c];
+                uint32_t via_fail = delta[fail[u] * class_count + c];
+                if (next == NONE) {
+                    next = via_fail;
+                    continue;
+                }
+                fail[next] = via_fail;
+                dict_link[next] = pattern_at[via_fail] != NONE ? via_fail : dict_link[via_fail];
+                queue.push_back(next);
+            }
+        }
+
+        // Перенумерация: сначала состояния без совпадений (корень остается 0)
+        size_t states = pattern_at.size();
+        std::vector<uint32_t> order(states), rank(states);
+        size_t n = 0;
+        for (int output = 0; output < 2; output++) {
+            for (size_t i = 0; i < states; i++) {
+                bool has = pattern_at[i] != NONE || dict_link[i] != NONE;
+                if (has != (output != 0)) continue;
+                rank[i] = static_cast<uint32_t>(n);
+                order[n++] = static_cast<uint32_t>(i);
+            }
+            if (!output) first_match = static_cast<uint32_t>(n);
+        }
+        std::vector<uint32_t> new_delta(delta.size()), new_pattern(states), new_link(states);
+        for (size_t r = 0; r < states; r++) {
+            uint32_t old = order[r];
+            for (uint32_t c = 0; c < class_count; c++) {
+                new_delta[r * class_count + c] = rank[delta[old * class_count + c]] * class_count;
+            }
+            new_pattern[r] = pattern_at[old];
+            new_link[r] = dict_link[old] == NONE ? NONE : rank[dict_link[old]];
+        }
+        delta.swap(new_delta);
+        pattern_at.swap(new_pattern);
+        dict_link.swap(new_link);
+        first_match *= class_count;
+        built = true;
+        return true;
+    }
+
+    // Проход по data из состояния state (0 - начало сообщения).
+    // report(шаблон, смещение начала совпадения), смещения считаются от
+    // offset - позиции data в сообщении. Возвращает состояние, с
+    // которого продолжать следующий фрагмент того же сообщения.
+    template <typename Report>
+    uint32_t scan(uint32_t state, const uint8_t* data, size_t len, uint64_t offset, Report& report) const {
+        const uint32_t* d = delta.data();
+        uint32_t s = state;
+        for (size_t i = 0; i < len; i++) {
+            s = d[s + classes[data[i]]];
+            if (s >= first_match) reportAt(s, offset + i + 1, report);
+        }
+        return s;
+    }
+
+    bool empty() const { return !built || patterns.empty(); }
+    size_t patternCount() const { return patterns.size(); }
+    size_t stateCount() const { return pattern_at.size(); }
+    size_t tableBytes() const { return delta.size() * sizeof(uint32_t); }
+    const std::string& pattern(uint32_t i) const { return patterns[i]; }
+};
+
+// Шаблон для вывода: непечатные байты в виде \xNN
+inline std::string formatPattern(const std::string& pattern) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        uint8_t b = static_cast<uint8_t>(pattern[i]);
+        if (b >= 32 && b < 127 && b != '\\') {
+            out += static_cast<char>(b);
+        } else {
+            out += "\\x";
+            out += digits[b >> 4];
+            out += digits[b & 0x0F];
+        }
+    }
+    return out;
+}
+
+#endif // WS_MATCH_H
@@ -0,0 +1,77 @@
+#ifndef WS_MESSAGE_H
+#define WS_MESSAGE_H
+
+#include <cstdint>
+#include <string>
+#include <ctime>
+#include <cstdio>
+#include "ws_arena.h"
+#include "ws_addr.h"
+
+// Совпадение шаблона (ws_match.h) в payload сообщения
+struct PatternHit {
+    uint32_t pattern;   // номер шаблона в PatternMatcher
+    uint64_t offset;    // начало совпадения от начала собранного сообщения
+};
+
+// Запись о перехваченном сообщении фиксированного размера. Payload
+// лежит в PayloadArena снифера, адреса и время хранятся в двоичном
+// виде и превращаются в строки только при выводе.
+struct WebSocketMessage {
+    int64_t timestamp_ns;  // время пакета, завершившего сообщение, нс от эпохи
+    IpAddress src_ip;
+    IpAddress dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    ByteSpan payload;
+    bool is_masked;
+    bool is_compressed;
+    uint8_t opcode;
+    bool is_truncated;     // часть payload потеряна или не влезла в предел
+    uint32_t hit_count;
+    const PatternHit* hits;  // в той же арене, что и payload; в файл не пишутся
+
+    WebSocketMessage() : timestamp_ns(0), src_port(0), dst_port(0), is_masked(false),
+                         is_compressed(false), opcode(0), is_truncated(false), hit_count(0), hits(nullptr) {
+        payload = makeSpan(nullptr, 0);
+    }
+};
+
+inline const char* opcodeToString(uint8_t opcode) {
+    switch(opcode) {
+        case 0x0: return "Continuation";
+        case 0x1: return "Text";
+        case 0x2: return "Binary";
+        case 0x8: return "Close";
+        case 0x9: return "Ping";
+        case 0xA: return "Pong";
+        default: return "Unknown";
+    }
+}
+
+// Время в виде ctime(); доли секунды выводятся, только если они есть
+// (у файлов прежнего формата время с точностью до секунды)
+inline std::string formatTimestamp(int64_t ts_ns) {
+    int64_t sec = ts_ns / 1000000000LL;
+    int64_t frac = ts_ns % 1000000000LL;
+    if (frac < 0) {
+        sec--;
+        frac += 1000000000LL;
+    }
+    time_t t = static_cast<time_t>(sec);
+    struct tm tm;
+    if (!localtime_r(&t, &tm)) return "?";
+    
+    char date[32], year[16];
+    strftime(date, sizeof(date), "%a %b %e %H:%M:%S", &tm);
+    strftime(year, sizeof(year), "%Y", &tm);
+    char buf[64];
+    if (frac != 0) {
+        snprintf(buf, sizeof(buf), "%s.%09lld %s", date, static_cast<long long>(frac), year);
+    } else {
+        snprintf(buf, sizeof(buf), "%s %s", date, year);
+    }
+    return buf;
+}
+
+#endif // WS_MESSAGE_H
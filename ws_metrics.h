@@ -0,0 +1,532 @@
+#ifndef WS_METRICS_H
+#define WS_METRICS_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Метрики работы декодеров и захвата (--metrics-port, --metrics-interval).
+// У каждого потока свой блок счетчиков, выровненный по строке кэша:
+// пишет его только владелец, обычными load/store без lock-префикса, а
+// экспорт суммирует блоки всех потоков relaxed-чтением. Горячий путь не
+// берет блокировок и не делит строки кэша с соседями.
+
+// Текущее время монотонных часов, нс (vDSO, без системного вызова)
+inline uint64_t metricNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Счетчик с одним писателем: атомарность нужна только для того, чтобы
+// читатель видел значение целиком
+class MetricCounter {
+private:
+    std::atomic<uint64_t> value;
+
+public:
+    MetricCounter() : value(0) {}
+
+    void add(uint64_t n = 1) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void set(uint64_t v) { value.store(v, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Гистограмма длительностей по степеням двойки: корзина b - значения до
+// 2^(b + MIN_SHIFT) нс, от 128 нс до ~1 с, последняя - все, что дольше.
+// Точности хватает, чтобы увидеть сдвиг распределения, а запись - пара
+// инструкций и один счетчик.
+class MetricHistogram {
+public:
+    static const unsigned MIN_SHIFT = 7;
+    static const unsigned BUCKETS = 24;
+
+private:
+    MetricCounter buckets[BUCKETS + 1];
+    MetricCounter total;
+    MetricCounter sum_ns;
+
+public:
+    void record(uint64_t ns) {
+        unsigned b = 0;
+        if (ns > (1ull << MIN_SHIFT)) {
+            b = 64 - __builtin_clzll(ns - 1) - MIN_SHIFT;
+            if (b > BUCKETS) b = BUCKETS;
+        }
+        buckets[b].add();
+        total.add();
+        sum_ns.add(ns);
+    }
+
+    // Верхняя граница корзины b, нс (для b == BUCKETS - бесконечность)
+    static uint64_t upperBound(unsigned b) { return 1ull << (b + MIN_SHIFT); }
+
+    uint64_t bucket(unsigned b) const { return buckets[b].get(); }
+    uint64_t count() const { return total.get(); }
+    uint64_t sumNs() const { return sum_ns.get(); }
+};
+
+// Причины, по которым поток не разобрался во фреймы
+enum ParseFailure {
+    PARSE_RSV,          // RSV2/RSV3 выставлены
+    PARSE_OPCODE,       // зарезервированный opcode
+    PARSE_CONTROL,      // управляющий фрейм фрагментирован или длиннее 125 байт
+    PARSE_TOO_LARGE,    // payload больше MAX_FRAME_SIZE
+    PARSE_HTTP_HEADER,  // HTTP-заголовок рукопожатия без конца
+    PARSE_FAILURE_COUNT
+};
+
+inline const char* parseFailureName(unsigned reason) {
+    static const char* const NAMES[PARSE_FAILURE_COUNT] = {
+        "rsv", "opcode", "control", "too_large", "http_header"
+    };
+    return reason < PARSE_FAILURE_COUNT ? NAMES[reason] : "unknown";
+}
+
+// Счетчики одного декодера (его пишет только поток декодера)
+struct alignas(64) DecoderMetrics {
+    MetricCounter packets;
+    MetricCounter bytes;
+    MetricCounter frames[16];        // по opcode
+    MetricCounter parse_failures[PARSE_FAILURE_COUNT];
+    MetricCounter inflate_failures;
+    MetricCounter reassembly_gaps;
+    MetricHistogram parse_time;      // пакет целиком, включая распаковку
+    MetricHistogram inflate_time;    // одно сообщение permessage-deflate
+};
+
+// Счетчики источника пакетов: копия статистики ядра, которую поток
+// захвата обновляет не чаще раза в секунду
+struct alignas(64) CaptureMetrics {
+    MetricCounter received;
+    MetricCounter dropped;
+    MetricCounter if_dropped;
+    MetricCounter freezes;
+};
+
+// Владелец блоков метрик. Блоки выделяются с выравниванием по строке
+// кэша (new в C++11 выравнивание больше 16 не гарантирует) и живут до
+// конца процесса: потоки получают указатель один раз. Мьютекс защищает
+// только список блоков, не счетчики.
+class MetricsRegistry {
+private:
+    std::mutex mutex;
+    std::vector<DecoderMetrics*> decoders;
+    std::vector<CaptureMetrics*> captures;
+    uint64_t started_ns;
+
+    template <typename T>
+    static T* allocate() {
+        void* p = nullptr;
+        if (posix_memalign(&p, 64, sizeof(T)) != 0) throw std::bad_alloc();
+        return new (p) T();
+    }
+
+    template <typename T>
+    static void release(std::vector<T*>& blocks) {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            blocks[i]->~T();
+            free(blocks[i]);
+        }
+        blocks.clear();
+    }
+
+public:
+    // Сумма по всем блокам на момент чтения
+    struct Totals {
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t frames[16];
+        uint64_t parse_failures[PARSE_FAILURE_COUNT];
+        uint64_t inflate_failures;
+        uint64_t reassembly_gaps;
+        uint64_t parse_buckets[MetricHistogram::BUCKETS + 1];
+        uint64_t parse_count;
+        uint64_t parse_sum_ns;
+        uint64_t inflate_buckets[MetricHistogram::BUCKETS + 1];
+        uint64_t inflate_count;
+        uint64_t inflate_sum_ns;
+        uint64_t received;
+        uint64_t dropped;
+        uint64_t if_dropped;
+        uint64_t freezes;
+        size_t decoders;
+        size_t captures;
+    };
+
+    MetricsRegistry() : started_ns(metricNowNs()) {}
+
+    ~MetricsRegistry() {
+        release(decoders);
+        release(captures);
+    }
+
+    DecoderMetrics* addDecoder() {
+        DecoderMetrics* m = allocate<DecoderMetrics>();
+        std::lock_guard<std::mutex> lock(mutex);
+        decoders.push_back(m);
+        return m;
+    }
+
+    CaptureMetrics* addCapture() {
+        CaptureMetrics* m = allocate<CaptureMetrics>();
+        std::lock_guard<std::mutex> lock(mutex);
+        captures.push_back(m);
+        return m;
+    }
+
+    void collect(Totals& t) {
+        memset(&t, 0, sizeof(t));
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < decoders.size(); i++) {
+            const DecoderMetrics& m = *decoders[i];
+            t.packets += m.packets.get();
+            t.bytes += m.bytes.get();
+            for (unsigned op = 0; op < 16; op++) t.frames[op] += m.frames[op].get();
+            for (unsigned r = 0; r < PARSE_FAILURE_COUNT; r++) t.parse_failures[r] += m.parse_failures[r].get();
+            t.inflate_failures += m.inflate_failures.get();
+            t.reassembly_gaps += m.reassembly_gaps.get();
+            for (unsigned b = 0; b <= MetricHistogram::BUCKETS; b++) {
+                t.parse_buckets[b] += m.parse_time.bucket(b);
+                t.inflate_buckets[b] += m.inflate_time.bucket(b);
+            }
+            t.parse_count += m.parse_time.count();
+            t.parse_sum_ns += m.parse_time.sumNs();
+            t.inflate_count += m.inflate_time.count();
+            t.inflate_sum_ns += m.inflate_time.sumNs();
+        }
+        for (size_t i = 0; i < captures.size(); i++) {
+            const CaptureMetrics& m = *captures[i];
+            t.received += m.received.get();
+            t.dropped += m.dropped.get();
+            t.if_dropped += m.if_dropped.get();
+            t.freezes += m.freezes.get();
+        }
+        t.decoders = decoders.size();
+        t.captures = captures.size();
+    }
+
+    double uptimeSeconds() const { return (metricNowNs() - started_ns) / 1e9; }
+};
+
+// Перцентиль по корзинам гистограммы: верхняя граница корзины, нс
+inline uint64_t bucketPercentile(const uint64_t* buckets, uint64_t count, double p) {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * count);
+    if (rank >= count) rank = count - 1;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < MetricHistogram::BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > rank) return MetricHistogram::upperBound(b);
+    }
+    return MetricHistogram::upperBound(MetricHistogram::BUCKETS);
+}
+
+// Текстовый формат Prometheus (version 0.0.4)
+inline std::string renderPrometheus(const MetricsRegistry::Totals& t, double uptime) {
+    static const char* const OPCODES[16] = {
+        "continuation", "text", "binary", "0x3", "0x4", "0x5", "0x6", "0x7",
+        "close", "ping", "pong", "0xb", "0xc", "0xd", "0xe", "0xf"
+    };
+    std::ostringstream out;
+    out << std::setprecision(10);  // границы корзин - точные степени двойки
+
+    out << "# HELP ws_packets_total Packets handed to decoders.\n"
+        << "# TYPE ws_packets_total counter\n"
+        << "ws_packets_total " << t.packets << "\n"
+        << "# HELP ws_bytes_total Captured bytes handed to decoders.\n"
+        << "# TYPE ws_bytes_total counter\n"
+        << "ws_bytes_total " << t.bytes << "\n";
+
+    out << "# HELP ws_frames_total Decoded WebSocket frames by opcode.\n"
+        << "# TYPE ws_frames_total counter\n";
+    for (unsigned op = 0; op < 16; op++) {
+        // Недопустимые opcode разбор отвергает - их строки всегда нулевые
+        if (op > 0x2 && op < 0x8) continue;
+        if (op > 0xA) continue;
+        out << "ws_frames_total{opcode=\"" << OPCODES[op] << "\"} " << t.frames[op] << "\n";
+    }
+
+    out << "# HELP ws_parse_failures_total Streams that failed to parse as WebSocket frames.\n"
+        << "# TYPE ws_parse_failures_total counter\n";
+    for (unsigned r = 0; r < PARSE_FAILURE_COUNT; r++) {
+        out << "ws_parse_failures_total{reason=\"" << parseFailureName(r) << "\"} " << t.parse_failures[r] << "\n";
+    }
+
+    out << "# HELP ws_inflate_failures_total permessage-deflate payloads that failed to inflate.\n"
+        << "# TYPE ws_inflate_failures_total counter\n"
+        << "ws_inflate_failures_total " << t.inflate_failures << "\n"
+        << "# HELP ws_reassembly_gaps_total TCP stream gaps skipped during reassembly.\n"
+        << "# TYPE ws_reassembly_gaps_total counter\n"
+        << "ws_reassembly_gaps_total " << t.reassembly_gaps << "\n";
+
+    struct Histogram {
+        const char* name;
+        const char* help;
+        const uint64_t* buckets;
+        uint64_t count;
+        uint64_t sum_ns;
+    };
+    const Histogram histograms[2] = {
+        {"ws_parse_seconds", "Time to decode one packet, inflate included.",
+         t.parse_buckets, t.parse_count, t.parse_sum_ns},
+        {"ws_inflate_seconds", "Time to inflate one permessage-deflate payload.",
+         t.inflate_buckets, t.inflate_count, t.inflate_sum_ns},
+    };
+    for (size_t h = 0; h < 2; h++) {
+        const Histogram& hg = histograms[h];
+        out << "# HELP " << hg.name << " " << hg.help << "\n"
+            << "# TYPE " << hg.name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (unsigned b = 0; b < MetricHistogram::BUCKETS; b++) {
+            cumulative += hg.buckets[b];
+            out << hg.name << "_bucket{le=\"" << MetricHistogram::upperBound(b) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        out << hg.name << "_bucket{le=\"+Inf\"} " << hg.count << "\n"
+            << hg.name << "_sum " << hg.sum_ns / 1e9 << "\n"
+            << hg.name << "_count " << hg.count << "\n";
+    }
+
+    out << "# HELP ws_capture_received_total Packets received by the kernel capture (pcap_stats ps_recv).\n"
+        << "# TYPE ws_capture_received_total counter\n"
+        << "ws_capture_received_total " << t.received << "\n"
+        << "# HELP ws_capture_dropped_total Packets dropped by the kernel for lack of buffer space.\n"
+        << "# TYPE ws_capture_dropped_total counter\n"
+        << "ws_capture_dropped_total " << t.dropped << "\n"
+        << "# HELP ws_capture_if_dropped_total Packets dropped by the network interface (pcap_stats ps_ifdrop).\n"
+        << "# TYPE ws_capture_if_dropped_total counter\n"
+        << "ws_capture_if_dropped_total " << t.if_dropped << "\n"
+        << "# HELP ws_capture_queue_freezes_total AF_PACKET ring queue freezes.\n"
+        << "# TYPE ws_capture_queue_freezes_total counter\n"
+        << "ws_capture_queue_freezes_total " << t.freezes << "\n"
+        << "# HELP ws_decoders Decoder threads reporting metrics.\n"
+        << "# TYPE ws_decoders gauge\n"
+        << "ws_decoders " << t.decoders << "\n"
+        << "# HELP ws_uptime_seconds Seconds since metrics were enabled.\n"
+        << "# TYPE ws_uptime_seconds gauge\n"
+        << "ws_uptime_seconds " << std::fixed << std::setprecision(3) << uptime << "\n";
+    return out.str();
+}
+
+// Строка для stderr: итог и прирост с прошлой строки
+inline std::string formatMetricsSummary(const MetricsRegistry::Totals& t, const MetricsRegistry::Totals& prev,
+                                        double seconds) {
+    uint64_t frames = 0, prev_frames = 0, failures = 0;
+    for (unsigned op = 0; op < 16; op++) {
+        frames += t.frames[op];
+        prev_frames += prev.frames[op];
+    }
+    for (unsigned r = 0; r < PARSE_FAILURE_COUNT; r++) failures += t.parse_failures[r];
+    if (seconds <= 0) seconds = 1;
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(0)
+        << "📈 Метрики: пакетов " << t.packets << " (" << (t.packets - prev.packets) / seconds << "/с)"
+        << ", " << std::setprecision(1) << (t.bytes - prev.bytes) / seconds / (1024 * 1024) << " МБ/с"
+        << ", фреймов " << frames << " (" << std::setprecision(0) << (frames - prev_frames) / seconds << "/с)"
+        << ", ошибок разбора " << failures
+        << ", распаковки " << t.inflate_failures
+        << ", разрывов " << t.reassembly_gaps
+        << ", отброшено ядром " << t.dropped;
+    if (t.if_dropped) out << ", интерфейсом " << t.if_dropped;
+    out << ", разбор пакета p50/p99 ≤ " << bucketPercentile(t.parse_buckets, t.parse_count, 50)
+        << "/" << bucketPercentile(t.parse_buckets, t.parse_count, 99) << " нс";
+    if (t.inflate_count) {
+        out << ", распаковка p99 ≤ " << bucketPercentile(t.inflate_buckets, t.inflate_count, 99) << " нс";
+    }
+    out << "\n";
+    return out.str();
+}
+
+struct MetricsOptions {
+    int port;            // 0 - без HTTP; слушается только 127.0.0.1
+    unsigned interval;   // секунд между строками в stderr, 0 - без них
+
+    MetricsOptions() : port(0), interval(0) {}
+
+    bool enabled() const { return port > 0 || interval > 0; }
+};
+
+// Фоновый поток экспорта: крошечный HTTP-сервер с единственным путем
+// /metrics на localhost и/или периодическая строка в stderr. Запросы
+// обслуживаются по одному: scrape раз в несколько секунд, ответ -
+// несколько килобайт.
+class MetricsExporter {
+private:
+    MetricsRegistry* registry;
+    MetricsOptions opts;
+    int listen_fd;
+    std::thread thread;
+    std::atomic<bool> stop;
+
+    static const int POLL_MS = 200;
+    static const int CLIENT_TIMEOUT_MS = 1000;
+    static const size_t MAX_REQUEST = 4096;
+
+    static bool fail(std::string& err, const char* what) {
+        err = std::string(what) + ": " + strerror(errno);
+        return false;
+    }
+
+    static void sendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    static std::string response(const char* status, const char* type, const std::string& body) {
+        std::ostringstream out;
+        out << "HTTP/1.1 " << status << "\r\n"
+            << "Content-Type: " << type << "\r\n"
+            << "Content-Length: " << body.size() << "\r\n"
+            << "Connection: close\r\n\r\n"
+            << body;
+        return out.str();
+    }
+
+    // Читает заголовок запроса и отвечает; медленный клиент не держит
+    // поток дольше CLIENT_TIMEOUT_MS
+    void serveClient(int fd) {
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST) {
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, CLIENT_TIMEOUT_MS) <= 0) return;
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            request.append(buf, static_cast<size_t>(n));
+        }
+
+        size_t line_end = request.find("\r\n");
+        std::string line = request.substr(0, line_end);
+        std::string method = line.substr(0, line.find(' '));
+        size_t path_start = line.find(' ');
+        std::string path;
+        if (path_start != std::string::npos) {
+            size_t path_end = line.find(' ', path_start + 1);
+            path = line.substr(path_start + 1, path_end == std::string::npos ? std::string::npos
+                                                                             : path_end - path_start - 1);
+        }
+        size_t query = path.find('?');
+        if (query != std::string::npos) path.erase(query);
+
+        if (method != "GET" && method != "HEAD") {
+            sendAll(fd, response("405 Method Not Allowed", "text/plain", "GET only\n"));
+        } else if (path != "/metrics") {
+            sendAll(fd, response("404 Not Found", "text/plain", "see /metrics\n"));
+        } else {
+            MetricsRegistry::Totals t;
+            registry->collect(t);
+            std::string out = response("200 OK", "text/plain; version=0.0.4; charset=utf-8",
+                                       renderPrometheus(t, registry->uptimeSeconds()));
+            // HEAD: только заголовок
+            if (method == "HEAD") out.erase(out.find("\r\n\r\n") + 4);
+            sendAll(fd, out);
+        }
+    }
+
+    void run() {
+        MetricsRegistry::Totals prev, now;
+        memset(&prev, 0, sizeof(prev));
+        uint64_t last_ns = metricNowNs();
+        uint64_t interval_ns = static_cast<uint64_t>(opts.interval) * 1000000000ull;
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (listen_fd >= 0) {
+                struct pollfd pfd;
+                pfd.fd = listen_fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, POLL_MS) > 0) {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd >= 0) {
+                        serveClient(fd);
+                        ::close(fd);
+                    }
+                }
+            } else {
+                usleep(POLL_MS * 1000);
+            }
+
+            if (interval_ns == 0) continue;
+            uint64_t ns = metricNowNs();
+            if (ns - last_ns < interval_ns) continue;
+            registry->collect(now);
+            std::cerr << formatMetricsSummary(now, prev, (ns - last_ns) / 1e9);
+            prev = now;
+            last_ns = ns;
+        }
+    }
+
+public:
+    MetricsExporter() : registry(nullptr), listen_fd(-1), stop(false) {}
+
+    ~MetricsExporter() { close(); }
+
+    bool start(MetricsRegistry& reg, const MetricsOptions& options, std::string& err) {
+        registry = &reg;
+        opts = options;
+        if (opts.port > 0) {
+            listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (listen_fd < 0) return fail(err, "socket");
+            int one = 1;
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+            // Только localhost: метрики раскрывают объем и состав трафика
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(opts.port));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+                listen(listen_fd, 16) != 0) {
+                err = "127.0.0.1:" + std::to_string(opts.port) + ": " + strerror(errno);
+                ::close(listen_fd);
+                listen_fd = -1;
+                return false;
+            }
+        }
+        stop = false;
+        thread = std::thread(&MetricsExporter::run, this);
+        return true;
+    }
+
+    void close() {
+        if (thread.joinable()) {
+            stop = true;
+            thread.join();
+        }
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+        }
+    }
+};
+
+#endif // WS_METRICS_H
@@ -0,0 +1,724 @@
+#ifndef WS_REPLAY_H
+#define WS_REPLAY_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <zlib.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "ws_message.h"
+#include "ws_unmask.h"
+#include "ws_flow.h"
+#include "ws_decoder.h"
+
+// Параметры повтора (--replay)
+struct ReplayOptions {
+    enum Pacing {
+        PACE_FAST,       // как можно быстрее
+        PACE_ORIGINAL,   // исходные интервалы, деленные на speed
+        PACE_RATE        // rate сообщений в секунду
+    };
+
+    std::string host;
+    uint16_t port;
+    std::string path;          // путь запроса Upgrade
+    Pacing pacing;
+    double speed;
+    double rate;
+    bool client_only;          // только сообщения клиента (с маской)
+    bool deflate;              // предлагать permessage-deflate
+    size_t max_connections;    // больше соединений в записи - по кругу
+    bool progress;             // строка прогресса раз в секунду
+
+    ReplayOptions() : port(0), path("/"), pacing(PACE_ORIGINAL), speed(1.0), rate(0),
+                      client_only(true), deflate(true), max_connections(1024), progress(true) {}
+};
+
+struct ReplayStats {
+    uint64_t messages;         // отправлено (поставлено в очередь соединения)
+    uint64_t skipped;          // не того направления, close и продолжения
+    uint64_t dropped;          // соединение не открылось или оборвалось
+    uint64_t payload_bytes;
+    uint64_t wire_bytes;       // с заголовками, после сжатия
+    uint64_t compressed;
+    uint64_t writes;           // вызовов sendmsg
+    uint64_t connections;
+    uint64_t failed_connections;
+    uint64_t received_frames;  // фреймов от сервера
+    uint64_t received_bytes;
+    int64_t max_lag_ns;        // наибольшее отставание от расписания
+    double seconds;
+
+    ReplayStats() { memset(this, 0, sizeof(*this)); }
+};
+
+// "host:port" или "[v6]:port"
+inline bool parseReplayTarget(const std::string& target, std::string& host, uint16_t& port) {
+    size_t colon;
+    if (!target.empty() && target[0] == '[') {
+        size_t close = target.find("]:");
+        if (close == std::string::npos) return false;
+        host = target.substr(1, close - 1);
+        colon = close + 1;
+    } else {
+        colon = target.rfind(':');
+        if (colon == std::string::npos) return false;
+        host = target.substr(0, colon);
+    }
+    int p = atoi(target.c_str() + colon + 1);
+    if (host.empty() || p <= 0 || p > 65535) return false;
+    port = static_cast<uint16_t>(p);
+    return true;
+}
+
+// Повтор записанных сообщений на сервер. Каждое записанное соединение
+// получает свое постоянное соединение с сервером (рукопожатие с
+// проверкой 101 и согласованием permessage-deflate), сообщения заново
+// оформляются во фреймы клиента: новая маска на каждый фрейм, сжатие,
+// если оно было в записи и сервер его принял. Все соединения
+// неблокирующие и обслуживаются одним epoll; фреймы складываются в
+// сегменты исходящей очереди соединения и уходят одним sendmsg на
+// несколько сегментов. Ответы сервера читаются и отбрасываются (на
+// ping отвечается pong), так что сервер не упирается в полный буфер.
+//
+// Сообщения подаются по одному через send() в порядке записи - память
+// ограничена очередями соединений, а не размером записи.
+class ReplayEngine {
+private:
+    enum ConnState {
+        CONN_CONNECTING,
+        CONN_HANDSHAKE,    // запрос отправлен, ждем 101
+        CONN_OPEN,
+        CONN_CLOSED
+    };
+
+    static const size_t SEGMENT_SIZE = 64 * 1024;
+    static const size_t MAX_BUFFERED = 4 * 1024 * 1024;  // исходящая очередь соединения
+    static const size_t MAX_IOV = 64;
+    static const size_t MAX_RESPONSE = 16 * 1024;
+
+    struct Segment {
+        std::vector<uint8_t> data;
+        size_t pos;        // уже отправлено
+    };
+
+    struct Connection {
+        int fd;
+        ConnState state;
+        std::string request;
+        size_t request_sent;
+        std::string response;
+        WebSocketHandshake hs;
+        bool deflate;              // сжимать сообщения, сжатые в записи
+        z_stream zs;
+        bool zs_ready;
+        std::deque<Segment> out;
+        size_t buffered;
+        size_t queued;             // сообщений в out (для dropped)
+        bool dirty;
+        bool want_write;
+        std::vector<uint8_t> in;   // неразобранные байты от сервера
+        uint64_t skip;             // пропустить payload фрейма данных
+        bool close_sent;
+
+        Connection() : fd(-1), state(CONN_CONNECTING), request_sent(0), deflate(false), zs_ready(false),
+                       buffered(0), queued(0), dirty(false), want_write(false), skip(0),
+                       close_sent(false) {
+            memset(&zs, 0, sizeof(zs));
+        }
+        ~Connection() {
+            if (zs_ready) deflateEnd(&zs);
+            if (fd >= 0) ::close(fd);
+        }
+    };
+
+    struct FlowHash {
+        size_t operator()(const FlowKey& key) const { return hashFlowKey(key); }
+    };
+
+    ReplayOptions opts;
+    const std::atomic<bool>* stop;
+    sockaddr_storage target;
+    socklen_t target_len;
+    int epoll_fd;
+    std::vector<std::unique_ptr<Connection>> conns;
+    std::unordered_map<FlowKey, size_t, FlowHash> flow_conn;
+    size_t flow_count;
+    std::vector<Connection*> dirty;
+    std::vector<std::vector<uint8_t>> spare;   // сегменты для повторного использования
+    std::vector<uint8_t> deflated;
+    std::vector<uint8_t> scratch;              // чтение ответов
+    uint64_t rng;
+    ReplayStats stats;
+
+    int64_t start_ns;
+    int64_t first_ts;
+    uint64_t scheduled;
+    int64_t last_progress_ns;
+    uint64_t last_progress_messages;
+
+    ReplayEngine(const ReplayEngine&);
+    ReplayEngine& operator=(const ReplayEngine&);
+
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Маски и ключ рукопожатия: xorshift64*, засеянный из /dev/urandom
+    uint32_t random32() {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        return static_cast<uint32_t>((rng * 0x2545F4914F6CDD1DULL) >> 32);
+    }
+
+    static std::string base64(const uint8_t* data, size_t len) {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for (size_t i = 0; i < len; i += 3) {
+            uint32_t v = static_cast<uint32_t>(data[i]) << 16;
+            if (i + 1 < len) v |= static_cast<uint32_t>(data[i + 1]) << 8;
+            if (i + 2 < len) v |= data[i + 2];
+            out += table[(v >> 18) & 63];
+            out += table[(v >> 12) & 63];
+            out += i + 1 < len ? table[(v >> 6) & 63] : '=';
+            out += i + 2 < len ? table[v & 63] : '=';
+        }
+        return out;
+    }
+
+    void watch(Connection& c, bool write) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | (write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        ev.data.ptr = &c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+        c.want_write = write;
+    }
+
+    void fail(Connection& c, const char* what, int error) {
+        if (c.state == CONN_CLOSED) return;
+        if (c.state != CONN_OPEN) {
+            stats.failed_connections++;
+            std::cerr << "❌ Повтор: соединение с " << opts.host << ":" << opts.port << " - " << what;
+            if (error) std::cerr << ": " << strerror(error);
+            std::cerr << std::endl;
+        }
+        stats.dropped += c.queued;
+        c.state = CONN_CLOSED;
+        for (size_t i = 0; i < c.out.size(); i++) recycle(c.out[i].data);
+        c.out.clear();
+        c.buffered = 0;
+        c.queued = 0;
+        if (c.fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+            ::close(c.fd);
+            c.fd = -1;
+        }
+    }
+
+    void recycle(std::vector<uint8_t>& data) {
+        if (data.capacity() != SEGMENT_SIZE || spare.size() >= 256) return;
+        spare.push_back(std::vector<uint8_t>());
+        spare.back().swap(data);
+        spare.back().clear();
+    }
+
+    Connection* connect() {
+        conns.push_back(std::unique_ptr<Connection>(new Connection()));
+        Connection& c = *conns.back();
+        stats.connections++;
+
+        c.fd = socket(target.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (c.fd < 0) {
+            fail(c, "socket", errno);
+            return &c;
+        }
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (::connect(c.fd, reinterpret_cast<const sockaddr*>(&target), target_len) != 0 && errno != EINPROGRESS) {
+            fail(c, "connect", errno);
+            return &c;
+        }
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.ptr = &c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &ev);
+        c.want_write = true;
+
+        uint8_t key[16];
+        for (int i = 0; i < 16; i += 4) {
+            uint32_t r = random32();
+            memcpy(key + i, &r, 4);
+        }
+        std::string host = opts.host.find(':') != std::string::npos ? "[" + opts.host + "]" : opts.host;
+        c.request = "GET " + opts.path + " HTTP/1.1\r\n"
+                    "Host: " + host + ":" + std::to_string(opts.port) + "\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Key: " + base64(key, sizeof(key)) + "\r\n"
+                    "Sec-WebSocket-Version: 13\r\n";
+        if (opts.deflate) {
+            c.request += "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n";
+        }
+        c.request += "\r\n";
+        return &c;
+    }
+
+    // Соединение для записанного: одно на соединение записи, сверх
+    // max_connections - по кругу (порядок внутри соединения сохраняется)
+    Connection* connectionFor(const WebSocketMessage& msg) {
+        FlowKey key;
+        makeFlowKey(msg.src_ip, msg.src_port, msg.dst_ip, msg.dst_port, key);
+        std::unordered_map<FlowKey, size_t, FlowHash>::iterator it = flow_conn.find(key);
+        if (it != flow_conn.end()) return conns[it->second].get();
+        size_t index = flow_count++ % opts.max_connections;
+        flow_conn[key] = index;
+        if (index < conns.size()) return conns[index].get();
+        return connect();
+    }
+
+    uint8_t* reserve(Connection& c, size_t len) {
+        if (c.out.empty() || c.out.back().data.size() + len > c.out.back().data.capacity()) {
+            c.out.push_back(Segment());
+            Segment& s = c.out.back();
+            s.pos = 0;
+            if (len <= SEGMENT_SIZE && !spare.empty()) {
+                s.data.swap(spare.back());
+                spare.pop_back();
+            } else {
+                s.data.reserve(len > SEGMENT_SIZE ? len : SEGMENT_SIZE);
+            }
+        }
+        std::vector<uint8_t>& d = c.out.back().data;
+        size_t off = d.size();
+        d.resize(off + len);
+        c.buffered += len;
+        return &d[off];
+    }
+
+    // Фрейм клиента: FIN, RSV1 для сжатого, маска - новая на каждый фрейм
+    void appendFrame(Connection& c, uint8_t opcode, bool compressed, const uint8_t* payload, size_t len) {
+        uint8_t header[14];
+        size_t h = 0;
+        header[h++] = 0x80 | (compressed ? 0x40 : 0) | (opcode & 0x0F);
+        if (len < 126) {
+            header[h++] = 0x80 | static_cast<uint8_t>(len);
+        } else if (len <= 0xFFFF) {
+            header[h++] = 0x80 | 126;
+            header[h++] = static_cast<uint8_t>(len >> 8);
+            header[h++] = static_cast<uint8_t>(len);
+        } else {
+            header[h++] = 0x80 | 127;
+            for (int i = 7; i >= 0; i--) header[h++] = static_cast<uint8_t>(static_cast<uint64_t>(len) >> (i * 8));
+        }
+        uint32_t key = random32();
+        memcpy(header + h, &key, 4);
+        h += 4;
+
+        uint8_t* dst = reserve(c, h + len);
+        memcpy(dst, header, h);
+        // Маскирование - тот же XOR, что и снятие маски
+        if (len) unmaskPayload(dst + h, payload, len, dst + h - 4, 0);
+        stats.wire_bytes += h + len;
+        if (!c.dirty) {
+            c.dirty = true;
+            dirty.push_back(&c);
+        }
+    }
+
+    // permessage-deflate: сжатие с Z_SYNC_FLUSH без хвоста 00 00 ff ff
+    bool compress(Connection& c, const uint8_t* data, size_t len) {
+        if (!c.zs_ready) {
+            int bits = c.hs.client_max_window_bits;
+            if (deflateInit2(&c.zs, Z_BEST_SPEED, Z_DEFLATED, -bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+            c.zs_ready = true;
+        }
+        deflated.resize(deflateBound(&c.zs, len) + 16);
+        c.zs.next_in = const_cast<uint8_t*>(data);
+        c.zs.avail_in = static_cast<uInt>(len);
+        c.zs.next_out = &deflated[0];
+        c.zs.avail_out = static_cast<uInt>(deflated.size());
+        if (deflate(&c.zs, Z_SYNC_FLUSH) != Z_OK || c.zs.avail_in != 0) return false;
+        size_t out = deflated.size() - c.zs.avail_out;
+        if (out < 4) return false;
+        deflated.resize(out - 4);
+        if (c.hs.client_no_context_takeover) deflateReset(&c.zs);
+        return true;
+    }
+
+    // sendmsg по сегментам очереди, пока сокет принимает. MSG_NOSIGNAL,
+    // как и при рукопожатии: закрытый сервером сокет дает EPIPE, а не
+    // SIGPIPE, и соединение считается оборванным, а не весь процесс
+    void flush(Connection& c) {
+        while (c.state == CONN_OPEN && !c.out.empty()) {
+            iovec iov[MAX_IOV];
+            size_t n = 0;
+            for (size_t i = 0; i < c.out.size() && n < MAX_IOV; i++, n++) {
+                iov[n].iov_base = &c.out[i].data[c.out[i].pos];
+                iov[n].iov_len = c.out[i].data.size() - c.out[i].pos;
+            }
+            msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = n;
+            ssize_t written = sendmsg(c.fd, &mh, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                fail(c, "write", errno);
+                return;
+            }
+            stats.writes++;
+            size_t left = static_cast<size_t>(written);
+            c.buffered -= left;
+            while (left > 0) {
+                Segment& s = c.out.front();
+                size_t take = std::min(left, s.data.size() - s.pos);
+                s.pos += take;
+                left -= take;
+                if (s.pos == s.data.size()) {
+                    recycle(s.data);
+                    c.out.pop_front();
+                }
+            }
+        }
+        if (c.out.empty()) c.queued = 0;
+        if (c.state == CONN_OPEN && c.want_write != !c.out.empty()) watch(c, !c.out.empty());
+    }
+
+    void flushDirty() {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            dirty[i]->dirty = false;
+            flush(*dirty[i]);
+        }
+        dirty.clear();
+    }
+
+    // Фреймы сервера: данные пропускаются, на ping - pong, на close - close
+    void consume(Connection& c) {
+        size_t pos = 0;
+        while (pos < c.in.size()) {
+            if (c.skip) {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(c.skip, c.in.size() - pos));
+                c.skip -= take;
+                pos += take;
+                continue;
+            }
+            const uint8_t* p = &c.in[pos];
+            size_t avail = c.in.size() - pos;
+            if (avail < 2) break;
+            size_t h = 2;
+            uint64_t len = p[1] & 0x7F;
+            if (len == 126) h = 4;
+            if (len == 127) h = 10;
+            if (p[1] & 0x80) h += 4;
+            if (avail < h) break;
+            if (len == 126) len = static_cast<uint64_t>(p[2]) << 8 | p[3];
+            if (len == 127) {
+                len = 0;
+                for (int i = 0; i < 8; i++) len = len << 8 | p[2 + i];
+            }
+            uint8_t opcode = p[0] & 0x0F;
+            stats.received_frames++;
+            if (opcode < 0x8) {
+                pos += h;
+                c.skip = len;
+                continue;
+            }
+            if (avail - h < len) break;
+            if (opcode == 0x9 && !c.close_sent) {
+                std::vector<uint8_t> ping(p + h, p + h + len);
+                if (p[1] & 0x80) unmaskPayload(&ping[0], &ping[0], ping.size(), p + h - 4, 0);
+                appendFrame(c, 0xA, false, ping.empty() ? nullptr : &ping[0], ping.size());
+            } else if (opcode == 0x8) {
+                if (!c.close_sent) {
+                    static const uint8_t normal[2] = {0x03, 0xE8};
+                    appendFrame(c, 0x8, false, normal, sizeof(normal));
+                    c.close_sent = true;
+                }
+            }
+            pos += h + static_cast<size_t>(len);
+        }
+        c.in.erase(c.in.begin(), c.in.begin() + pos);
+    }
+
+    // Ответ на Upgrade: нужен 101; расширения - из Sec-WebSocket-Extensions
+    void handshake(Connection& c) {
+        size_t end = c.response.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (c.response.size() > MAX_RESPONSE) fail(c, "слишком длинный ответ на Upgrade", 0);
+            return;
+        }
+        const uint8_t* head = reinterpret_cast<const uint8_t*>(c.response.data());
+        if (c.response.compare(0, 12, "HTTP/1.1 101") != 0 || !isWebSocketUpgrade(head, end + 2)) {
+            std::string status = c.response.substr(0, c.response.find("\r\n"));
+            fail(c, ("сервер не перешел на WebSocket (" + status + ")").c_str(), 0);
+            return;
+        }
+        std::string ext;
+        if (findHttpHeader(head, end + 2, "Sec-WebSocket-Extensions", ext)) parseDeflateExtension(ext, c.hs);
+        // Окно 8 бит zlib не поддерживает - такие сообщения уходят без сжатия
+        c.deflate = c.hs.deflate && c.hs.client_max_window_bits > 8;
+        c.in.assign(c.response.begin() + end + 4, c.response.end());
+        c.response.clear();
+        c.state = CONN_OPEN;
+        consume(c);
+        flush(c);
+    }
+
+    void onEvent(Connection& c, uint32_t events) {
+        if (c.state == CONN_CLOSED) return;
+        if (c.state == CONN_CONNECTING && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error) {
+                fail(c, "connect", error);
+                return;
+            }
+            c.state = CONN_HANDSHAKE;
+        }
+        if (c.state == CONN_HANDSHAKE && c.request_sent < c.request.size()) {
+            ssize_t n = ::send(c.fd, c.request.data() + c.request_sent, c.request.size() - c.request_sent,
+                               MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                fail(c, "send", errno);
+                return;
+            }
+            if (n > 0) c.request_sent += static_cast<size_t>(n);
+            if (c.request_sent == c.request.size()) watch(c, false);
+        }
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            for (;;) {
+                ssize_t n = ::recv(c.fd, &scratch[0], scratch.size(), 0);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) fail(c, "recv", errno);
+                    break;
+                }
+                if (n == 0) {
+                    if (c.state != CONN_OPEN || !c.out.empty()) {
+                        fail(c, "сервер закрыл соединение", 0);
+                    } else {
+                        fail(c, "", 0);
+                    }
+                    return;
+                }
+                stats.received_bytes += static_cast<uint64_t>(n);
+                if (c.state == CONN_HANDSHAKE) {
+                    c.response.append(reinterpret_cast<const char*>(&scratch[0]), static_cast<size_t>(n));
+                    handshake(c);
+                    if (c.state == CONN_CLOSED) return;
+                } else {
+                    c.in.insert(c.in.end(), &scratch[0], &scratch[0] + n);
+                    consume(c);
+                }
+            }
+        }
+        if (c.state == CONN_OPEN && (events & EPOLLOUT)) flush(c);
+    }
+
+    // Отправка накопленного и обработка событий до timeout_ms
+    void poll(int timeout_ms) {
+        flushDirty();
+        epoll_event events[64];
+        int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            onEvent(*static_cast<Connection*>(events[i].data.ptr), events[i].events);
+        }
+        flushDirty();
+    }
+
+    bool stopped() const { return stop && stop->load(std::memory_order_relaxed); }
+
+    // Ждет времени сообщения, обслуживая соединения
+    void waitUntil(int64_t due) {
+        for (;;) {
+            int64_t left = due - nowNs();
+            if (left <= 0 || stopped()) return;
+            if (left >= 1000000) {
+                poll(static_cast<int>(left / 1000000));
+            } else {
+                flushDirty();
+                struct timespec ts = {0, static_cast<long>(left)};
+                nanosleep(&ts, nullptr);
+            }
+        }
+    }
+
+    void printProgress(int64_t now) {
+        double dt = (now - last_progress_ns) / 1e9;
+        std::cout << "🔁 " << stats.messages << " сообщ. ("
+                  << static_cast<uint64_t>((stats.messages - last_progress_messages) / dt) << "/с), соединений "
+                  << conns.size() << ", отставание до " << std::fixed << std::setprecision(1)
+                  << stats.max_lag_ns / 1e6 << " мс" << std::endl;
+        last_progress_ns = now;
+        last_progress_messages = stats.messages;
+    }
+
+public:
+    ReplayEngine() : stop(nullptr), target_len(0), epoll_fd(-1), flow_count(0), rng(0),
+                     start_ns(0), first_ts(0), scheduled(0), last_progress_ns(0), last_progress_messages(0) {
+        memset(&target, 0, sizeof(target));
+    }
+
+    ~ReplayEngine() {
+        conns.clear();
+        if (epoll_fd >= 0) ::close(epoll_fd);
+    }
+
+    bool open(const ReplayOptions& options, const std::atomic<bool>* stop_flag, std::string& err) {
+        opts = options;
+        stop = stop_flag;
+        if (opts.max_connections == 0) opts.max_connections = 1;
+        if ((opts.pacing == ReplayOptions::PACE_ORIGINAL && opts.speed <= 0) ||
+            (opts.pacing == ReplayOptions::PACE_RATE && opts.rate <= 0)) {
+            err = "неверная скорость повтора";
+            return false;
+        }
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        int rc = getaddrinfo(opts.host.c_str(), std::to_string(opts.port).c_str(), &hints, &res);
+        if (rc != 0 || !res) {
+            err = opts.host + ": " + gai_strerror(rc);
+            return false;
+        }
+        memcpy(&target, res->ai_addr, res->ai_addrlen);
+        target_len = res->ai_addrlen;
+        freeaddrinfo(res);
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            err = std::string("epoll: ") + strerror(errno);
+            return false;
+        }
+        int urandom = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if (urandom >= 0) {
+            if (::read(urandom, &rng, sizeof(rng)) != static_cast<ssize_t>(sizeof(rng))) rng = 0;
+            ::close(urandom);
+        }
+        rng ^= static_cast<uint64_t>(nowNs()) | 1;
+        scratch.resize(SEGMENT_SIZE);
+        stats = ReplayStats();
+        start_ns = nowNs();
+        last_progress_ns = start_ns;
+        return true;
+    }
+
+    // Следующее сообщение записи. Ждет своего времени по выбранному
+    // темпу; false - повтор прерван.
+    bool send(const WebSocketMessage& msg) {
+        if (stopped()) return false;
+        size_t len = msg.payload.size();
+        if ((opts.client_only && !msg.is_masked) || msg.opcode == 0x0 || msg.opcode == 0x8 ||
+            (msg.opcode > 0x8 && len > 125)) {
+            stats.skipped++;
+            return true;
+        }
+
+        int64_t due = 0;
+        if (opts.pacing == ReplayOptions::PACE_ORIGINAL) {
+            if (scheduled == 0) first_ts = msg.timestamp_ns;
+            int64_t offset = msg.timestamp_ns > first_ts ? msg.timestamp_ns - first_ts : 0;
+            due = start_ns + static_cast<int64_t>(offset / opts.speed);
+        } else if (opts.pacing == ReplayOptions::PACE_RATE) {
+            due = start_ns + static_cast<int64_t>(scheduled * 1e9 / opts.rate);
+        }
+        scheduled++;
+        if (due) waitUntil(due);
+        int64_t now = nowNs();
+        if (due && now - due > stats.max_lag_ns) stats.max_lag_ns = now - due;
+
+        Connection* c = connectionFor(msg);
+        // Сервер не успевает читать - ждем, а не копим очередь
+        while (c->state != CONN_CLOSED && c->buffered > MAX_BUFFERED && !stopped()) poll(100);
+        if (c->state == CONN_CLOSED) {
+            stats.dropped++;
+            return !stopped();
+        }
+
+        bool compress_wanted = msg.is_compressed && msg.opcode < 0x8 && opts.deflate;
+        if (compress_wanted && c->state != CONN_OPEN) {
+            // Сжимать можно, только когда расширения согласованы
+            while (c->state != CONN_OPEN && c->state != CONN_CLOSED && !stopped()) poll(100);
+            if (c->state != CONN_OPEN) {
+                stats.dropped++;
+                return !stopped();
+            }
+        }
+
+        bool compressed = compress_wanted && c->deflate && compress(*c, msg.payload.data(), len);
+        const uint8_t* data = msg.payload.data();
+        if (compressed) {
+            data = deflated.empty() ? nullptr : &deflated[0];
+            len = deflated.size();
+            stats.compressed++;
+        }
+        appendFrame(*c, msg.opcode, compressed, data, len);
+        c->queued++;
+        stats.messages++;
+        stats.payload_bytes += msg.payload.size();
+        if (c->buffered >= SEGMENT_SIZE) flush(*c);
+
+        if ((stats.messages & 63) == 0) poll(0);
+        if (opts.progress && now - last_progress_ns >= 1000000000LL) printProgress(now);
+        return true;
+    }
+
+    // Отправляет оставшееся, закрывает соединения (close 1000) и ждет
+    // ответного close не дольше timeout_ms
+    const ReplayStats& finish(int timeout_ms = 5000) {
+        static const uint8_t normal[2] = {0x03, 0xE8};
+        for (size_t i = 0; i < conns.size(); i++) {
+            Connection& c = *conns[i];
+            if (c.state == CONN_CLOSED || c.close_sent) continue;
+            appendFrame(c, 0x8, false, normal, sizeof(normal));
+            c.close_sent = true;
+        }
+        int64_t deadline = nowNs() + static_cast<int64_t>(timeout_ms) * 1000000;
+        for (;;) {
+            bool busy = false;
+            for (size_t i = 0; i < conns.size() && !busy; i++) busy = conns[i]->state != CONN_CLOSED;
+            if (!busy || nowNs() >= deadline) break;
+            poll(50);
+        }
+        for (size_t i = 0; i < conns.size(); i++) {
+            Connection& c = *conns[i];
+            if (c.state == CONN_CLOSED) continue;
+            if (!c.out.empty() || c.state != CONN_OPEN) {
+                fail(c, "не завершилось вовремя", 0);
+            } else {
+                fail(c, "", 0);
+            }
+        }
+        stats.seconds = (nowNs() - start_ns) / 1e9;
+        return stats;
+    }
+
+    const ReplayStats& statistics() const { return stats; }
+};
+
+#endif // WS_REPLAY_H
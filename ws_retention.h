@@ -0,0 +1,200 @@
+#ifndef WS_RETENTION_H
+#define WS_RETENTION_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "ws_message.h"
+#include "ws_arena.h"
+#include "ws_writer.h"
+
+// Что и сколько хранить в памяти во время захвата без --write
+struct RetentionOptions {
+    uint64_t max_messages;    // последние N сообщений, 0 - без предела
+    uint64_t max_bytes;       // бюджет памяти на записи и payload, 0 - без предела
+    uint32_t max_payload;     // хранить только первые K байт payload, 0 - целиком
+    std::string spill_prefix; // вытесненные куски - в файлы захвата, пусто - выбросить
+    CompressionOptions spill_compression;
+
+    RetentionOptions() : max_messages(0), max_bytes(0), max_payload(0) {}
+
+    bool bounded() const { return max_messages > 0 || max_bytes > 0; }
+};
+
+// Сообщения, сохраненные в памяти. Хранятся кусками: у куска свой
+// массив записей (до CHUNK_MESSAGES) и своя арена с копиями payload,
+// так что добавление не переносит больше одного куска записей, а арены
+// декодеров освобождаются сразу после сохранения. С пределом по числу
+// или байтам это кольцо: самый старый кусок вытесняется целиком (при
+// spill_prefix - дописывается в файлы захвата) и идет под новые
+// сообщения. Память ограничена пределом плюс один кусок.
+//
+// Пишется и читается одним потоком (вывода), после захвата - главным.
+class MessageStore {
+private:
+    static const size_t CHUNK_MESSAGES = 4096;
+    static const uint64_t CHUNK_BYTES = 4 * 1024 * 1024;
+    static const uint64_t MIN_CHUNK_BYTES = 64 * 1024;
+
+    struct Chunk {
+        std::vector<WebSocketMessage> messages;
+        PayloadArena payload;
+        uint64_t first;  // сквозной номер первого сообщения куска
+        uint64_t bytes;  // массив записей и занятое в арене
+
+        explicit Chunk(size_t arena_chunk) : payload(arena_chunk), first(0), bytes(0) {}
+
+        // Нетронутый хвост куска арены страниц не занимает - считается
+        // только выданное
+        uint64_t footprint() const {
+            return messages.capacity() * sizeof(WebSocketMessage) + payload.bytesUsed();
+        }
+    };
+
+    RetentionOptions opts;
+    std::deque<std::unique_ptr<Chunk>> chunks;
+    std::unique_ptr<Chunk> spare;  // вытесненный кусок для повторного использования
+    uint64_t chunk_bytes;          // payload куска и размер куска его арены
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t evicted;
+    uint64_t truncated;
+    CaptureWriter spill;
+    bool spilling;
+
+    MessageStore(const MessageStore&);
+    MessageStore& operator=(const MessageStore&);
+
+    // Кусок для сообщения с len байт payload: новый, если текущий полон
+    Chunk& writable(size_t len) {
+        if (chunks.empty() || chunks.back()->messages.size() == CHUNK_MESSAGES ||
+            (chunks.back()->payload.bytesUsed() > 0 && chunks.back()->payload.bytesUsed() + len > chunk_bytes)) {
+            if (spare) {
+                chunks.push_back(std::move(spare));
+            } else {
+                chunks.push_back(std::unique_ptr<Chunk>(new Chunk(static_cast<size_t>(chunk_bytes))));
+            }
+            chunks.back()->first = evicted + count;
+        }
+        return *chunks.back();
+    }
+
+    // Самый старый кусок лишний, если и без него предел соблюден (по
+    // числу - остается не меньше N последних) или если он превышен по
+    // байтам. Текущий кусок не вытесняется.
+    bool overLimit() const {
+        if (chunks.size() < 2) return false;
+        const Chunk& oldest = *chunks.front();
+        if (opts.max_messages > 0 && count - oldest.messages.size() >= opts.max_messages) return true;
+        return opts.max_bytes > 0 && bytes > opts.max_bytes;
+    }
+
+    void evictOldest() {
+        std::unique_ptr<Chunk> c = std::move(chunks.front());
+        chunks.pop_front();
+        if (spilling) {
+            for (size_t i = 0; i < c->messages.size(); i++) spill.append(c->messages[i]);
+        }
+        count -= c->messages.size();
+        bytes -= c->bytes;
+        evicted += c->messages.size();
+        c->messages.clear();
+        c->payload.clear();
+        c->bytes = c->footprint();
+        bytes += c->bytes;  // емкость массива записей остается за запасным куском
+        spare = std::move(c);
+    }
+
+public:
+    MessageStore() : chunk_bytes(CHUNK_BYTES), count(0), bytes(0), evicted(0), truncated(0), spilling(false) {}
+
+    // Новые пределы; сохраненное выбрасывается. Файлы вытеснения
+    // открываются здесь, до захвата, чтобы ошибка была видна сразу.
+    bool configure(const RetentionOptions& options, std::string& err) {
+        close();
+        clear();
+        opts = options;
+        // Кусок - не больше восьмой части бюджета, чтобы вытеснение
+        // целыми кусками держало память близко к пределу
+        chunk_bytes = CHUNK_BYTES;
+        if (opts.max_bytes > 0 && opts.max_bytes / 8 < chunk_bytes) {
+            chunk_bytes = opts.max_bytes / 8 < MIN_CHUNK_BYTES ? MIN_CHUNK_BYTES : opts.max_bytes / 8;
+        }
+        if (!opts.spill_prefix.empty() && opts.bounded()) {
+            WriterOptions w;
+            w.prefix = opts.spill_prefix;
+            w.compression = opts.spill_compression;
+            if (!spill.open(w, err)) return false;
+            spilling = true;
+        }
+        return true;
+    }
+
+    // Копия сообщения с payload (не длиннее max_payload); совпадения
+    // шаблонов не сохраняются - они в арене декодера
+    void add(const WebSocketMessage& msg) {
+        WebSocketMessage stored = msg;
+        size_t len = msg.payload.size();
+        if (opts.max_payload > 0 && len > opts.max_payload) {
+            len = opts.max_payload;
+            stored.is_truncated = true;
+            truncated++;
+        }
+        Chunk& c = writable(len);
+        stored.payload = c.payload.copy(msg.payload.data(), len);
+        stored.hit_count = 0;
+        stored.hits = nullptr;
+        c.messages.push_back(stored);
+        count++;
+
+        uint64_t footprint = c.footprint();
+        bytes += footprint - c.bytes;
+        c.bytes = footprint;
+        while (overLimit()) evictOldest();
+    }
+
+    // Дописывает и закрывает файлы вытеснения
+    void close() {
+        if (!spilling) return;
+        spill.close();
+        spilling = false;
+    }
+
+    void clear() {
+        chunks.clear();
+        spare.reset();
+        count = 0;
+        bytes = 0;
+        evicted = 0;
+        truncated = 0;
+    }
+
+    // Номер от самого старого сохраненного сообщения; кусок ищется
+    // двоичным поиском по номеру первого сообщения
+    const WebSocketMessage& at(size_t index) const {
+        uint64_t n = evicted + index;
+        size_t lo = 0, hi = chunks.size() - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi + 1) / 2;
+            if (chunks[mid]->first <= n) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        return chunks[lo]->messages[static_cast<size_t>(n - chunks[lo]->first)];
+    }
+
+    size_t size() const { return static_cast<size_t>(count); }
+    uint64_t bytesUsed() const { return bytes; }
+    uint64_t evictedCount() const { return evicted; }
+    uint64_t truncatedCount() const { return truncated; }
+    uint64_t spilledCount() const { return spill.records(); }
+    const std::vector<std::string>& spillFiles() const { return spill.files(); }
+    const RetentionOptions& options() const { return opts; }
+};
+
+#endif // WS_RETENTION_H
@@ -0,0 +1,199 @@
+#ifndef WS_RING_H
+#define WS_RING_H
+
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <pcap.h>
+
+// Lock-free очереди один писатель / один читатель между стадиями
+// конвейера. Индексы растут монотонно, позиция в буфере - index & mask.
+// Индексы писателя и читателя лежат в разных кэш-линиях, плюс каждая
+// сторона кэширует чужой индекс, чтобы не дергать его линию на каждой
+// операции.
+
+static const size_t WS_CACHE_LINE = 64;
+
+// Кольцо пакетов переменной длины: заголовок pcap + байты пакета
+class PacketRing {
+public:
+    struct Record {
+        uint32_t size;  // полный размер записи с выравниванием, 0 - переход в начало
+        uint32_t pad;
+        struct pcap_pkthdr header;
+
+        const u_char* data() const { return reinterpret_cast<const u_char*>(this + 1); }
+    };
+
+private:
+    std::vector<uint8_t> buf;
+    size_t mask;
+
+    // Поля производителя и потребителя разнесены отступами в кэш-линию.
+    // alignas здесь не подходит: до C++17 new не выравнивает больше 16.
+    char pad0[WS_CACHE_LINE];
+    std::atomic<size_t> head;  // пишет только производитель
+    size_t cached_tail;
+    size_t high_water;
+    char pad1[WS_CACHE_LINE];
+    std::atomic<size_t> tail;  // пишет только потребитель
+    size_t cached_head;
+    char pad2[WS_CACHE_LINE];
+
+    PacketRing(const PacketRing&);
+    PacketRing& operator=(const PacketRing&);
+
+    static size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+public:
+    // capacity округляется вверх до степени двойки
+    explicit PacketRing(size_t capacity) : mask(0), head(0), cached_tail(0), high_water(0),
+                                           tail(0), cached_head(0) {
+        size_t cap = 4096;
+        while (cap < capacity) cap <<= 1;
+        buf.assign(cap, 0);
+        mask = cap - 1;
+    }
+
+    size_t capacity() const { return buf.size(); }
+
+    // Копирует пакет в кольцо. false - места нет (или пакет больше
+    // половины кольца и не поместится никогда).
+    bool push(const struct pcap_pkthdr* header, const u_char* packet) {
+        size_t need = align8(sizeof(Record) + header->caplen);
+        size_t cap = buf.size();
+        if (need > cap / 2) return false;
+
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t pos = h & mask;
+        size_t contiguous = cap - pos;
+        size_t total = contiguous < need ? contiguous + need : need;
+
+        if (h + total - cached_tail > cap) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h + total - cached_tail > cap) return false;
+        }
+
+        if (contiguous < need) {
+            // Хвост буфера мал - метка перехода и запись с начала
+            reinterpret_cast<Record*>(&buf[pos])->size = 0;
+            h += contiguous;
+            pos = 0;
+        }
+
+        Record* rec = reinterpret_cast<Record*>(&buf[pos]);
+        rec->size = static_cast<uint32_t>(need);
+        rec->header = *header;
+        memcpy(rec + 1, packet, header->caplen);
+
+        h += need;
+        head.store(h, std::memory_order_release);
+
+        size_t used = h - cached_tail;
+        if (used > high_water) high_water = used;
+        return true;
+    }
+
+    // Первая непрочитанная запись или nullptr
+    const Record* front() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            if (t == cached_head) {
+                cached_head = head.load(std::memory_order_acquire);
+                if (t == cached_head) return nullptr;
+            }
+            const Record* rec = reinterpret_cast<const Record*>(&buf[t & mask]);
+            if (rec->size != 0) return rec;
+            // Метка перехода: пропускаем хвост буфера
+            t += buf.size() - (t & mask);
+            tail.store(t, std::memory_order_release);
+        }
+    }
+
+    void pop(const Record* rec) {
+        tail.store(tail.load(std::memory_order_relaxed) + rec->size, std::memory_order_release);
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    // Заполненность в процентах (приблизительно - читается из другого потока)
+    unsigned fillPercent() const {
+        size_t used = head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+        return static_cast<unsigned>(used * 100 / buf.size());
+    }
+
+    unsigned highWaterPercent() const {
+        return static_cast<unsigned>(high_water * 100 / buf.size());
+    }
+};
+
+// Очередь элементов фиксированного размера (декодированные сообщения)
+template <typename T>
+class SpscQueue {
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    char pad0[WS_CACHE_LINE];
+    std::atomic<size_t> head;
+    size_t cached_tail;
+    size_t high_water;
+    char pad1[WS_CACHE_LINE];
+    std::atomic<size_t> tail;
+    size_t cached_head;
+    char pad2[WS_CACHE_LINE];
+
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+
+public:
+    explicit SpscQueue(size_t capacity) : mask(0), head(0), cached_tail(0), high_water(0),
+                                          tail(0), cached_head(0) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        slots.resize(cap);
+        mask = cap - 1;
+    }
+
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cached_tail == slots.size()) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h - cached_tail == slots.size()) return false;
+        }
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        if (h + 1 - cached_tail > high_water) high_water = h + 1 - cached_tail;
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == cached_head) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t == cached_head) return false;
+        }
+        item = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    unsigned fillPercent() const {
+        size_t used = head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+        return static_cast<unsigned>(used * 100 / slots.size());
+    }
+
+    unsigned highWaterPercent() const {
+        return static_cast<unsigned>(high_water * 100 / slots.size());
+    }
+};
+
+#endif // WS_RING_H
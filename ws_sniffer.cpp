@@ -10,389 +10,1375 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <iomanip>
+#include <sstream>
 #include <zlib.h>
 #include <csignal>
+#include <cstdlib>
+#include <climits>
+#include <atomic>
+#include <strings.h>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <queue>
+#include <mutex>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "ws_decoder.h"
+#include "ws_ring.h"
+#include "ws_capture.h"
+#include "ws_filter.h"
+#include "ws_console.h"
+#include "ws_writer.h"
+#include "ws_retention.h"
+#include "ws_arrow.h"
+#include "ws_capfile.h"
+#include "ws_match.h"
+#include "ws_index.h"
+#include "ws_replay.h"
+#include "ws_latency.h"
+#include "ws_metrics.h"
 
 // Forward declaration
 class WebSocketSniffer;
 
-struct WebSocketMessage {
-    std::string timestamp;
-    std::string src_ip;
-    std::string dst_ip;
-    uint16_t src_port;
-    uint16_t dst_port;
-    std::vector<uint8_t> payload;
-    bool is_masked;
-    bool is_compressed;
-    uint8_t opcode;
-};
-
 class WebSocketSniffer {
 private:
-    std::vector<WebSocketMessage> captured_messages;
+    // Сообщения в памяти (без --write) с копиями payload; пределы и
+    // вытеснение на диск - --keep-messages, --keep-mb, --spill
+    MessageStore captured_messages;
+    RetentionOptions retention_opts;
     pcap_t* handle;
+    std::atomic<bool> stop_requested;
+    
+    // Файл v2/v3, открытый через mmap: сообщения читаются по номеру прямо
+    // из отображения, в captured_messages не копируются
+    CaptureFile capture_file;
+    
+    // Режим без потоков (--workers 0): декодирование прямо в callback захвата
+    WebSocketDecoder decoder;
+    std::vector<WebSocketMessage> decoded;
+    
+    // Сообщение на пути от декодера к сохранению. Поколение арены
+    // возвращается декодеру (acknowledge) после сохранения - по нему
+    // декодер понимает, когда арену можно освободить.
+    struct QueuedMessage {
+        uint32_t generation;
+        uint32_t source;      // номер сокета fanout
+        WebSocketMessage msg;
+    };
+    
+    // Конвейер: поток захвата раскладывает пакеты по кольцам декодеров
+    // (по хешу соединения, так что порядок и состояние потока живут в
+    // одном декодере), декодеры отдают сообщения в свои очереди, а
+    // отдельный поток вывода печатает и сохраняет их.
+    struct DecodeWorker {
+        WebSocketDecoder decoder;
+        PacketRing packets;
+        SpscQueue<QueuedMessage> output;
+        std::thread thread;
+        std::atomic<bool> finished;
+        
+        explicit DecodeWorker(size_t ring_size)
+            : packets(ring_size), output(MESSAGE_QUEUE_SIZE), finished(false) {}
+    };
+    
+    // Декодеры переиспользуются между захватами; payload сохраненных
+    // сообщений скопирован, так что их арены освобождаются по поколениям
+    std::vector<std::unique_ptr<DecodeWorker>> workers;
+    std::thread output_thread;
+    std::atomic<bool> capture_done;
+    uint64_t dispatch_stalls;  // сколько раз поток захвата ждал места в кольце
+    
+    // Режим fanout: несколько сокетов AF_PACKET в одной группе, у каждого
+    // свой поток захвата и свой декодер. Сообщения сливаются в общий
+    // вывод в порядке времени пакета.
+    struct LaterMessage {
+        bool operator()(const QueuedMessage& a, const QueuedMessage& b) const {
+            return a.msg.timestamp_ns > b.msg.timestamp_ns;
+        }
+    };
+    
+    struct FanoutShard {
+        AfPacketRing ring;
+        WebSocketDecoder decoder;
+        SpscQueue<QueuedMessage> output;
+        std::thread thread;
+        std::atomic<bool> finished;
+        std::vector<WebSocketMessage> decoded;
+        uint64_t message_count;
+        
+        FanoutShard() : output(MESSAGE_QUEUE_SIZE), finished(false), message_count(0) {}
+    };
+    
+    std::vector<std::unique_ptr<FanoutShard>> shards;
+    
+    // Разбор файлов (--read): каждый поток берет следующий файл из списка
+    // и декодирует его своим декодером, сообщения уходят в общий вывод.
+    // Файлы независимы, поэтому общего состояния у потоков нет.
+    struct OfflineJob {
+        WebSocketDecoder decoder;
+        SpscQueue<QueuedMessage> output;
+        std::thread thread;
+        std::atomic<bool> finished;
+        std::vector<WebSocketMessage> decoded;
+        
+        OfflineJob() : output(MESSAGE_QUEUE_SIZE), finished(false) {}
+    };
+    
+    struct OfflineFile {
+        std::string path;
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t messages;
+        bool opened;
+    };
+    
+    std::vector<std::unique_ptr<OfflineJob>> offline_jobs;
+    std::vector<OfflineFile> offline_files;
+    std::atomic<size_t> next_offline_file;
+    std::mutex filter_mutex;  // pcap_compile до libpcap 1.8 не потокобезопасен
+    
+    // Фильтр --filter (вместе с портом захвата). Соединения, которые
+    // декодеры опознали как не WebSocket, исключаются из фильтра ядра:
+    // поток захвата перекомпилирует его не чаще раза в секунду.
+    CaptureFilterSpec filter_spec;
+    CaptureFilterSpec capture_spec;
+    IgnoredFlowSet ignored_flow_set;
     
-    // Декомпрессия данных (permessage-deflate)
-    bool decompressData(const std::vector<uint8_t>& compressed, std::vector<uint8_t>& decompressed) {
-        // WebSocket permessage-deflate требует добавления 0x00 0x00 0xff 0xff в конец
-        std::vector<uint8_t> data = compressed;
-        data.push_back(0x00);
-        data.push_back(0x00);
-        data.push_back(0xff);
-        data.push_back(0xff);
+    struct FilterRefresh {
+        uint64_t version;   // версия ignored_flow_set в фильтре ядра
+        int64_t updated;    // секунда последней замены
         
-        z_stream stream;
-        stream.zalloc = Z_NULL;
-        stream.zfree = Z_NULL;
-        stream.opaque = Z_NULL;
-        stream.avail_in = data.size();
-        stream.next_in = const_cast<Bytef*>(data.data());
+        FilterRefresh() : version(0), updated(0) {}
+    };
+    FilterRefresh pcap_refresh;
+    
+    // Пределы сборки фрагментированных сообщений (--max-message-mb, --max-flow-mb)
+    MessageLimits message_limits;
+    
+    // Шаблоны --patterns: автомат строится один раз и только читается
+    // декодерами. Совпадения приходят вместе с сообщением и печатаются
+    // при его сохранении (не чаще --print-rate строк в секунду).
+    PatternMatcher matcher;
+    uint64_t alert_count;
+    uint64_t alerts_suppressed;
+    int64_t alert_window;
+    unsigned alert_window_count;
+    
+    // Задержка ответа сервера (--latency) - в потоке сохранения
+    LatencyTracker latency;
+    
+    // Метрики (--metrics-port, --metrics-interval): у каждого декодера и
+    // источника пакетов свой блок счетчиков, экспорт - в фоновом потоке
+    MetricsRegistry metrics;
+    MetricsOptions metrics_opts;
+    MetricsExporter metrics_exporter;
+    
+    // Печать сообщений в фоновом потоке
+    ConsoleOutput console;
+    DisplayOptions display_opts;
+    
+    // Потоковая запись (--write): сообщения не копятся в captured_messages,
+    // а сразу уходят в файлы, арены декодеров переиспользуются
+    CaptureWriter writer;
+    WriterOptions writer_opts;
+    bool streaming;
+    
+    // Экспорт в Arrow IPC (--arrow) - вдобавок к файлам или памяти
+    ArrowExportWriter arrow;
+    ArrowExportOptions arrow_opts;
+    uint64_t stored_count;
+    
+    // В заголовках пакетов наносекунды (libpcap с PCAP_TSTAMP_PRECISION_NANO, AF_PACKET)
+    bool nano_timestamps;
+    
+    // Разбор канального уровня по типу канала захвата (pcap_datalink)
+    LinkParser link_parser;
+    
+    static const size_t PACKET_RING_SIZE = 16 * 1024 * 1024;
+    static const size_t MESSAGE_QUEUE_SIZE = 65536;
+    static const size_t WORKER_BATCH = 256;
+    static const int QUEUE_REPORT_INTERVAL = 5;  // секунд
+    static const size_t MAX_FIELD_LEN = 256;     // строки времени и адресов в файле
+    
+    // Счетчик в файле прежнего формата, который писался потоково и не был
+    // закрыт: читать записи до конца файла
+    static const size_t LEGACY_COUNT_STREAMING = static_cast<size_t>(-1);
+    
+    static void packetHandler(u_char* user, const struct pcap_pkthdr* header, const u_char* packet) {
+        WebSocketSniffer* sniffer = reinterpret_cast<WebSocketSniffer*>(user);
+        sniffer->handlePacket(header, packet);
+    }
+    
+    // Получатель блоков кольца AF_PACKET
+    struct BatchHandler {
+        WebSocketSniffer* sniffer;
+        AfPacketRing* ring;
+        FilterRefresh refresh;
+        CaptureMetrics* stats;
+        int64_t stats_updated;
         
-        if (inflateInit2(&stream, -15) != Z_OK) {
+        void operator()(const PacketBatch& batch) {
+            sniffer->processBatch(batch);
+            if (sniffer->filterOutdated(refresh)) sniffer->refreshRingFilter(*ring, refresh);
+            publishRingStats(*ring, stats, stats_updated);
+        }
+    };
+    
+    // Статистика ядра для метрик - из потока захвата, не чаще раза в
+    // секунду (force - итог после остановки)
+    static bool statsDue(int64_t& updated, bool force) {
+        int64_t now = static_cast<int64_t>(time(nullptr));
+        if (!force && now == updated) return false;
+        updated = now;
+        return true;
+    }
+    
+    static void publishRingStats(AfPacketRing& ring, CaptureMetrics* stats, int64_t& updated, bool force = false) {
+        if (!stats || !statsDue(updated, force)) return;
+        if (!force) ring.readStats();
+        stats->received.set(ring.packets());
+        stats->dropped.set(ring.drops());
+        stats->freezes.set(ring.freezes());
+    }
+    
+    void publishPcapStats(CaptureMetrics* stats, int64_t& updated, bool force = false) {
+        if (!stats || !statsDue(updated, force)) return;
+        struct pcap_stat ps;
+        if (pcap_stats(handle, &ps) != 0) return;
+        stats->received.set(ps.ps_recv);
+        stats->dropped.set(ps.ps_drop);
+        stats->if_dropped.set(ps.ps_ifdrop);
+    }
+    
+    // Блок счетчиков для декодера или источника пакетов; nullptr, если
+    // метрики не включены
+    void attachMetrics(WebSocketDecoder& d) {
+        if (metrics_opts.enabled() && !d.hasMetrics()) d.setMetrics(metrics.addDecoder());
+    }
+    
+    CaptureMetrics* captureMetrics() {
+        return metrics_opts.enabled() ? metrics.addCapture() : nullptr;
+    }
+    
+    // Выражение фильтра ядра с текущими исключениями
+    std::string kernelFilter(int dlt, FilterRefresh& refresh) {
+        std::vector<FlowKey> skip;
+        refresh.version = ignored_flow_set.snapshot(skip, MAX_IGNORED_IN_FILTER);
+        return captureFilter(capture_spec, dlt, skip);
+    }
+    
+    // Набор исключений изменился, и с прошлой замены фильтра прошла секунда
+    bool filterOutdated(FilterRefresh& refresh) {
+        if (ignored_flow_set.version() == refresh.version) return false;
+        int64_t now = static_cast<int64_t>(time(nullptr));
+        if (now == refresh.updated) return false;
+        refresh.updated = now;
+        return true;
+    }
+    
+    // Компиляция и установка фильтра libpcap; при ошибке остается прежний
+    bool setPcapFilter(const std::string& filter_exp) {
+        struct bpf_program fp;
+        if (pcap_compile(handle, &fp, filter_exp.c_str(), 1, PCAP_NETMASK_UNKNOWN) == -1) {
+            std::cerr << "Ошибка компиляции фильтра: " << pcap_geterr(handle) << std::endl;
             return false;
         }
         
-        const size_t CHUNK = 16384;
-        decompressed.clear();
+        if (pcap_setfilter(handle, &fp) == -1) {
+            std::cerr << "Ошибка установки фильтра: " << pcap_geterr(handle) << std::endl;
+            pcap_freecode(&fp);
+            return false;
+        }
+        pcap_freecode(&fp);
+        return true;
+    }
+    
+    void refreshRingFilter(AfPacketRing& ring, FilterRefresh& refresh) {
+        std::lock_guard<std::mutex> lock(filter_mutex);
+        std::string err;
+        if (!ring.updateFilter(kernelFilter(ring.linkType(), refresh), err)) {
+            std::cerr << "⚠️  Фильтр не обновлен: " + err + "\n";
+        }
+    }
+    
+    // Все декодеры отбрасывают фреймы по --filter и сообщают о не
+    // WebSocket соединениях для фильтра ядра
+    void setupDecoder(WebSocketDecoder& d) {
+        d.setFrameFilter(filter_spec.frames);
+        d.setIgnoredFlowSet(&ignored_flow_set);
+        d.setMatcher(matcher.empty() ? nullptr : &matcher);
+        d.setMessageLimits(message_limits);
+        attachMetrics(d);
+    }
+    
+    void processBatch(const PacketBatch& batch) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            handlePacket(&batch.headers[i], batch.packets[i]);
+        }
+    }
+    
+    void handlePacket(const struct pcap_pkthdr* header, const u_char* packet) {
+        if (workers.empty()) {
+            decoder.processPacket(header, packet);
+            uint32_t gen = decoder.currentGeneration();
+            decoder.takeMessages(decoded);
+            for (size_t i = 0; i < decoded.size(); i++) {
+                storeMessage(decoded[i]);
+            }
+            decoder.acknowledge(gen, decoded.size());
+            decoder.recycleArena();
+        } else {
+            dispatchPacket(header, packet);
+        }
+    }
+    
+    // Поток захвата: только разбор заголовков и копирование пакета в
+    // кольцо нужного декодера
+    void dispatchPacket(const struct pcap_pkthdr* header, const u_char* packet) {
+        TcpSegmentInfo seg;
+        if (!parseTcpSegment(link_parser, header, packet, seg)) return;
+        
+        // Чистые ACK не меняют состояние потока
+        if (seg.payload_len == 0 && !(seg.flags & (TH_SYN | TH_FIN | TH_RST))) return;
+        
+        // Старшие биты хеша: младшие выбирают слот в FlowTable декодера
+        uint64_t h = hashFlowKey(seg.key);
+        DecodeWorker& w = *workers[(h * workers.size()) >> 32];
+        
+        if (!w.packets.push(header, packet)) {
+            // Декодер не успевает - ждем, пока освободится место
+            dispatch_stalls++;
+            while (!w.packets.push(header, packet)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    
+    // Ожидание без работы: сначала yield, потом короткий сон
+    static void backoff(unsigned& idle) {
+        if (++idle < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+    
+    void workerLoop(DecodeWorker* w) {
+        std::vector<WebSocketMessage> batch;
+        QueuedMessage item;
+        item.source = 0;
+        unsigned idle = 0;
+        
+        for (;;) {
+            size_t n = 0;
+            const PacketRing::Record* rec;
+            while (n < WORKER_BATCH && (rec = w->packets.front()) != nullptr) {
+                w->decoder.processPacket(&rec->header, rec->data());
+                w->packets.pop(rec);
+                n++;
+            }
+            
+            item.generation = w->decoder.currentGeneration();
+            w->decoder.takeMessages(batch);
+            for (size_t i = 0; i < batch.size(); i++) {
+                item.msg = batch[i];
+                while (!w->output.push(item)) {
+                    std::this_thread::yield();
+                }
+            }
+            w->decoder.recycleArena();
+            
+            if (n > 0) {
+                idle = 0;
+                continue;
+            }
+            if (capture_done.load(std::memory_order_acquire) && w->packets.empty()) break;
+            backoff(idle);
+        }
+        
+        w->finished.store(true, std::memory_order_release);
+    }
+    
+    void outputLoop() {
+        QueuedMessage item;
+        unsigned idle = 0;
+        time_t last_report = time(nullptr);
         
-        do {
-            decompressed.resize(decompressed.size() + CHUNK);
-            stream.avail_out = CHUNK;
-            stream.next_out = decompressed.data() + decompressed.size() - CHUNK;
+        for (;;) {
+            bool any = false;
+            for (size_t i = 0; i < workers.size(); i++) {
+                for (size_t n = 0; n < WORKER_BATCH && workers[i]->output.pop(item); n++) {
+                    storeMessage(item.msg);
+                    workers[i]->decoder.acknowledge(item.generation);
+                    any = true;
+                }
+            }
             
-            int ret = inflate(&stream, Z_NO_FLUSH);
+            time_t now = time(nullptr);
+            if (now - last_report >= QUEUE_REPORT_INTERVAL) {
+                console.printLine(formatQueueFill(false));
+                last_report = now;
+            }
             
-            if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
-                inflateEnd(&stream);
-                return false;
+            if (any) {
+                idle = 0;
+                continue;
             }
             
-            if (ret == Z_STREAM_END) {
-                decompressed.resize(decompressed.size() - stream.avail_out);
-                break;
+            bool all_done = true;
+            for (size_t i = 0; i < workers.size(); i++) {
+                if (!workers[i]->finished.load(std::memory_order_acquire) || !workers[i]->output.empty()) {
+                    all_done = false;
+                    break;
+                }
             }
-        } while (stream.avail_out == 0);
+            if (all_done) break;
+            backoff(idle);
+        }
+    }
+    
+    // Заполненность очередей: текущая или максимальная за время захвата
+    std::string formatQueueFill(bool high_water) {
+        std::ostringstream out;
+        out << (high_water ? "   Пик заполнения очередей" : "📊 Очереди")
+            << " (пакеты/сообщения):";
+        for (size_t i = 0; i < workers.size(); i++) {
+            const DecodeWorker& w = *workers[i];
+            out << " [" << i << "] "
+                << (high_water ? w.packets.highWaterPercent() : w.packets.fillPercent()) << "%/"
+                << (high_water ? w.output.highWaterPercent() : w.output.fillPercent()) << "%";
+        }
+        out << "\n";
+        return out.str();
+    }
+    
+    void startPipeline(const CaptureOptions& opts) {
+        capture_done = false;
+        dispatch_stalls = 0;
+        if (workers.empty()) {
+            // Запись в кольце - целый пакет, кольцо вмещает хотя бы несколько
+            size_t ring_size = PACKET_RING_SIZE;
+            if (ring_size < static_cast<size_t>(opts.snaplen) * 4) ring_size = static_cast<size_t>(opts.snaplen) * 4;
+            for (int i = 0; i < opts.workers; i++) {
+                workers.push_back(std::unique_ptr<DecodeWorker>(new DecodeWorker(ring_size)));
+            }
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->finished = false;
+            workers[i]->decoder.setRecycle(true);
+            workers[i]->decoder.setNanoTimestamps(nano_timestamps);
+            workers[i]->decoder.setLinkParser(link_parser);
+            setupDecoder(workers[i]->decoder);
+            workers[i]->thread = std::thread(&WebSocketSniffer::workerLoop, this, workers[i].get());
+        }
+        output_thread = std::thread(&WebSocketSniffer::outputLoop, this);
+    }
+    
+    // Дожидается, пока декодеры и вывод разберут все, что уже захвачено
+    void stopPipeline() {
+        if (workers.empty()) return;
+        capture_done.store(true, std::memory_order_release);
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->thread.join();
+        }
+        output_thread.join();
+    }
+    
+    // Итог рукопожатий во всех декодерах
+    void printFlowStats() {
+        uint64_t websocket = decoder.websocketFlows();
+        uint64_t ignored = decoder.ignoredFlows();
+        uint64_t filtered = decoder.filteredFrames();
+        uint64_t hits = decoder.patternHits();
+        for (size_t i = 0; i < workers.size(); i++) {
+            websocket += workers[i]->decoder.websocketFlows();
+            ignored += workers[i]->decoder.ignoredFlows();
+            filtered += workers[i]->decoder.filteredFrames();
+            hits += workers[i]->decoder.patternHits();
+        }
+        for (size_t i = 0; i < shards.size(); i++) {
+            websocket += shards[i]->decoder.websocketFlows();
+            ignored += shards[i]->decoder.ignoredFlows();
+            filtered += shards[i]->decoder.filteredFrames();
+            hits += shards[i]->decoder.patternHits();
+        }
+        for (size_t i = 0; i < offline_jobs.size(); i++) {
+            websocket += offline_jobs[i]->decoder.websocketFlows();
+            ignored += offline_jobs[i]->decoder.ignoredFlows();
+            filtered += offline_jobs[i]->decoder.filteredFrames();
+            hits += offline_jobs[i]->decoder.patternHits();
+        }
+        std::cout << "   Соединений WebSocket: " << websocket
+                  << ", пропущено не WebSocket: " << ignored << std::endl;
+        if (filter_spec.frames.active()) {
+            std::cout << "   Фреймов отброшено фильтром: " << filtered << std::endl;
+        }
+        if (!matcher.empty()) {
+            std::cout << "   🚨 Совпадений шаблонов: " << hits << ", показано: " << alert_count - alerts_suppressed;
+            if (alerts_suppressed > 0) std::cout << " (лимит " << display_opts.print_rate << "/с)";
+            std::cout << std::endl;
+        }
+        if (latency.enabled()) std::cout << latency.summary();
+    }
+    
+    void printPipelineStats() {
+        if (workers.empty()) return;
+        std::cout << "   Потоков-декодеров: " << workers.size()
+                  << ", ожиданий места в кольце: " << dispatch_stalls << std::endl;
+        std::cout << formatQueueFill(true);
+    }
+    
+    // Получатель блоков кольца одного сокета fanout
+    struct ShardHandler {
+        WebSocketSniffer* sniffer;
+        FanoutShard* shard;
+        uint32_t source;
+        FilterRefresh refresh;
+        CaptureMetrics* stats;
+        int64_t stats_updated;
         
-        inflateEnd(&stream);
+        void operator()(const PacketBatch& batch) {
+            FanoutShard& sh = *shard;
+            for (size_t i = 0; i < batch.size(); i++) {
+                sh.decoder.processPacket(&batch.headers[i], batch.packets[i]);
+                
+                QueuedMessage item;
+                item.generation = sh.decoder.currentGeneration();
+                item.source = source;
+                sh.decoder.takeMessages(sh.decoded);
+                for (size_t j = 0; j < sh.decoded.size(); j++) {
+                    item.msg = sh.decoded[j];
+                    while (!sh.output.push(item)) {
+                        std::this_thread::yield();
+                    }
+                }
+                sh.message_count += sh.decoded.size();
+            }
+            sh.decoder.recycleArena();
+            if (sniffer->filterOutdated(refresh)) sniffer->refreshRingFilter(sh.ring, refresh);
+            publishRingStats(sh.ring, stats, stats_updated);
+        }
+    };
+    
+    void shardLoop(FanoutShard* shard, uint32_t source) {
+        ShardHandler handler = {this, shard, source, FilterRefresh(), captureMetrics(), 0};
+        shard->ring.run(handler, stop_requested);
+        shard->ring.close();
+        publishRingStats(shard->ring, handler.stats, handler.stats_updated, true);
+        shard->finished.store(true, std::memory_order_release);
+    }
+    
+    static int64_t nowNanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+    
+    // Слияние сообщений всех сокетов fanout. Сообщение выводится, когда
+    // оно старше окна переупорядочивания: за это время ядро гарантированно
+    // отдает блоки остальных сокетов (таймаут блока) и они успевают
+    // декодироваться.
+    void mergeLoop(int64_t window_ns) {
+        std::priority_queue<QueuedMessage, std::vector<QueuedMessage>, LaterMessage> pending;
+        QueuedMessage tm;
+        unsigned idle = 0;
+        time_t last_report = time(nullptr);
+        
+        for (;;) {
+            bool any = false;
+            for (size_t i = 0; i < shards.size(); i++) {
+                for (size_t n = 0; n < WORKER_BATCH && shards[i]->output.pop(tm); n++) {
+                    pending.push(tm);
+                    any = true;
+                }
+            }
+            
+            bool all_done = true;
+            for (size_t i = 0; i < shards.size(); i++) {
+                if (!shards[i]->finished.load(std::memory_order_acquire) || !shards[i]->output.empty()) {
+                    all_done = false;
+                    break;
+                }
+            }
+            
+            // После остановки захвата ждать больше нечего
+            int64_t horizon = all_done ? INT64_MAX : nowNanos() - window_ns;
+            while (!pending.empty() && pending.top().msg.timestamp_ns <= horizon) {
+                const QueuedMessage& top = pending.top();
+                storeMessage(top.msg);
+                shards[top.source]->decoder.acknowledge(top.generation);
+                pending.pop();
+            }
+            if (all_done) break;
+            
+            time_t now = time(nullptr);
+            if (now - last_report >= QUEUE_REPORT_INTERVAL) {
+                printShardFill(pending.size());
+                last_report = now;
+            }
+            
+            if (any) {
+                idle = 0;
+            } else {
+                backoff(idle);
+            }
+        }
+    }
+    
+    void printShardFill(size_t reorder_size) {
+        std::ostringstream out;
+        out << "📊 Очереди сокетов fanout:";
+        for (size_t i = 0; i < shards.size(); i++) {
+            out << " [" << i << "] " << shards[i]->output.fillPercent() << "%";
+        }
+        out << ", ждут упорядочивания: " << reorder_size << "\n";
+        console.printLine(out.str());
+    }
+    
+    void printDisplayStats() {
+        if (display_opts.mode != DisplayOptions::MODE_FULL || console.droppedCount() == 0) return;
+        std::cout << "   Показано на экране: " << console.shownCount()
+                  << ", не показано (лимит " << display_opts.print_rate << "/с или переполнение): "
+                  << console.droppedCount() << std::endl;
+    }
+    
+    // Строка на каждое совпадение: соединение, шаблон и смещение в сообщении
+    void reportHits(const WebSocketMessage& msg) {
+        std::string lines;
+        for (uint32_t i = 0; i < msg.hit_count; i++) {
+            alert_count++;
+            if (display_opts.print_rate > 0) {
+                int64_t now = static_cast<int64_t>(time(nullptr));
+                if (now != alert_window) {
+                    alert_window = now;
+                    alert_window_count = 0;
+                }
+                if (alert_window_count >= display_opts.print_rate) {
+                    alerts_suppressed++;
+                    continue;
+                }
+                alert_window_count++;
+            }
+            const PatternHit& hit = msg.hits[i];
+            lines += "🚨 #" + std::to_string(stored_count) + " " + formatEndpoint(msg.src_ip, msg.src_port) +
+                     " -> " + formatEndpoint(msg.dst_ip, msg.dst_port) + ": \"" +
+                     formatPattern(matcher.pattern(hit.pattern)) + "\" на байте " +
+                     std::to_string(hit.offset) + "\n";
+        }
+        if (!lines.empty()) console.printLine(lines);
+    }
+    
+    void storeMessage(const WebSocketMessage& msg) {
+        stored_count++;
+        if (msg.hit_count > 0) reportHits(msg);
+        if (latency.enabled()) {
+            std::string report;
+            latency.add(msg, report);
+            if (!report.empty()) console.printLine(report);
+        }
+        if (streaming) {
+            writer.append(msg);
+        } else {
+            captured_messages.add(msg);
+        }
+        if (arrow.isOpen()) arrow.append(msg);
+        console.submit(stored_count, msg);
+    }
+    
+    // Сообщения уходят в файлы (--write) или в память с пределами
+    bool openStorage() {
+        std::string err;
+        if (streaming) {
+            if (!writer.open(writer_opts, err)) {
+                std::cerr << "Ошибка открытия файла записи: " << err << std::endl;
+                return false;
+            }
+        } else if (!captured_messages.configure(retention_opts, err)) {
+            std::cerr << "Ошибка открытия файла вытеснения: " << err << std::endl;
+            return false;
+        }
+        if (arrow_opts.enabled() && !arrow.open(arrow_opts, err)) {
+            std::cerr << "Ошибка открытия файла Arrow: " << err << std::endl;
+            return false;
+        }
         return true;
     }
     
-    // Проверка, является ли это WebSocket upgrade
-    bool isWebSocketUpgrade(const uint8_t* data, size_t len) {
-        std::string str(reinterpret_cast<const char*>(data), std::min(len, size_t(200)));
-        return str.find("Upgrade: websocket") != std::string::npos ||
-               str.find("Sec-WebSocket") != std::string::npos;
+    void closeStorage() {
+        writer.close();
+        captured_messages.close();
+        std::string err;
+        if (!arrow.close(err)) std::cerr << "❌ Ошибка экспорта Arrow: " << err << std::endl;
+    }
+    
+    void printArrowStats() {
+        if (!arrow_opts.enabled()) return;
+        std::cout << "   📦 Arrow: " << arrow.rows() << " строк в " << arrow.batches() << " пакетах, "
+                  << arrow.flowCount() << " соединений, " << std::fixed << std::setprecision(1)
+                  << arrow.bytesWritten() / (1024.0 * 1024.0) << " МБ -> " << arrow_opts.path << std::endl;
     }
     
-    // Парсинг WebSocket фрейма
-    bool parseWebSocketFrame(const uint8_t* data, size_t len, WebSocketMessage& msg) {
-        if (len < 2) return false;
+    void printRetentionStats() {
+        if (streaming) return;
+        std::cout << "   🗃️  В памяти: " << captured_messages.size() << " сообщений, "
+                  << std::fixed << std::setprecision(1) << captured_messages.bytesUsed() / (1024.0 * 1024.0) << " МБ";
+        if (captured_messages.truncatedCount() > 0) {
+            std::cout << ", payload обрезан у " << captured_messages.truncatedCount();
+        }
+        std::cout << std::endl;
+        if (captured_messages.evictedCount() == 0) return;
+        std::cout << "   Вытеснено старых: " << captured_messages.evictedCount();
+        if (!captured_messages.spillFiles().empty()) {
+            std::cout << ", на диск: " << captured_messages.spilledCount() << " в " 
+                      << captured_messages.spillFiles().size() << " файл(ах)";
+        }
+        std::cout << std::endl;
+        for (size_t i = 0; i < captured_messages.spillFiles().size(); i++) {
+            std::cout << "      " << captured_messages.spillFiles()[i] << std::endl;
+        }
+    }
+    
+    void printWriterStats() {
+        printRetentionStats();
+        printArrowStats();
+        if (!streaming) return;
+        std::cout << "   💾 Записано: " << writer.records() << " сообщений, "
+                  << std::fixed << std::setprecision(1) << writer.bytesWritten() / (1024.0 * 1024.0)
+                  << " МБ в " << writer.files().size() << " файл(ах)";
+        if (writer.stalls() > 0) std::cout << ", ожиданий диска: " << writer.stalls();
+        std::cout << std::endl;
+        if (writer_opts.compression.enabled()) printCompression(writer, writer_opts.compression);
+        for (size_t i = 0; i < writer.files().size(); i++) {
+            std::cout << "      " << writer.files()[i] << std::endl;
+        }
+    }
+    
+    static int64_t parseTimestamp(const std::string& str) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (!strptime(str.c_str(), "%a %b %d %H:%M:%S %Y", &tm)) return 0;
+        tm.tm_isdst = -1;
+        return static_cast<int64_t>(mktime(&tm));
+    }
+    
+public:
+    WebSocketSniffer() : handle(nullptr), stop_requested(false), capture_done(false), dispatch_stalls(0),
+                         next_offline_file(0),
+                         alert_count(0), alerts_suppressed(0), alert_window(0), alert_window_count(0),
+                         streaming(false), stored_count(0), nano_timestamps(false),
+                         link_parser(parseEthernetLink) {}
+    
+    ~WebSocketSniffer() {
+        if (handle) {
+            pcap_close(handle);
+        }
+    }
+    
+    void setDisplayOptions(const DisplayOptions& opts) {
+        display_opts = opts;
+    }
+    
+    void setFilter(const CaptureFilterSpec& spec) {
+        filter_spec = spec;
+    }
+    
+    void setMessageLimits(const MessageLimits& limits) {
+        message_limits = limits;
+    }
+    
+    void setRetentionOptions(const RetentionOptions& opts) {
+        retention_opts = opts;
+    }
+    
+    void setArrowOptions(const ArrowExportOptions& opts) {
+        arrow_opts = opts;
+    }
+    
+    void setLatencyOptions(const LatencyOptions& opts) {
+        latency.setOptions(opts);
+    }
+    
+    // Метрики включаются до захвата: декодеры получают блоки счетчиков
+    // при настройке, экспорт работает до конца процесса
+    bool setMetricsOptions(const MetricsOptions& opts) {
+        metrics_opts = opts;
+        if (!opts.enabled()) return true;
+        std::string err;
+        if (!metrics_exporter.start(metrics, opts, err)) {
+            std::cerr << "Ошибка запуска метрик: " << err << std::endl;
+            return false;
+        }
+        if (opts.port > 0) {
+            std::cout << "📈 Метрики: http://127.0.0.1:" << opts.port << "/metrics" << std::endl;
+        }
+        return true;
+    }
+    
+    // Шаблоны для поиска в payload; автомат строится здесь, до захвата
+    bool loadPatterns(const std::string& path) {
+        std::string err;
+        if (!matcher.loadFile(path, err) || !matcher.build(err)) {
+            std::cerr << "Ошибка загрузки шаблонов: " << err << std::endl;
+            return false;
+        }
+        std::cout << "🔎 Шаблонов: " << matcher.patternCount() << ", состояний автомата: "
+                  << matcher.stateCount() << ", таблица " << matcher.tableBytes() / 1024 << " КБ" << std::endl;
+        return true;
+    }
+    
+    void setWriterOptions(const WriterOptions& opts) {
+        writer_opts = opts;
+        streaming = !opts.prefix.empty();
+    }
+    
+    bool isStreaming() const { return streaming; }
+    
+    bool useLinkType(int dlt) {
+        LinkParser parser = linkParserFor(dlt);
+        if (!parser) {
+            const char* name = pcap_datalink_val_to_name(dlt);
+            std::cerr << "Канальный уровень " << (name ? name : std::to_string(dlt))
+                      << " не поддерживается" << std::endl;
+            return false;
+        }
+        link_parser = parser;
+        decoder.setLinkParser(parser);
+        return true;
+    }
+    
+    // Открытие устройства через pcap_create: в отличие от pcap_open_live
+    // позволяет задать буфер ядра и immediate mode. На Linux libpcap
+    // читает пакеты из mmap-кольца TPACKET_V3.
+    pcap_t* openCapture(const char* dev, const CaptureOptions& opts) {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        pcap_t* h = pcap_create(dev, errbuf);
+        if (h == nullptr) {
+            std::cerr << "Ошибка открытия устройства: " << errbuf << std::endl;
+            return nullptr;
+        }
         
-        // Первый байт: FIN, RSV1-3, Opcode
-        bool fin = (data[0] & 0x80) != 0;
-        msg.is_compressed = (data[0] & 0x40) != 0;  // RSV1 бит указывает на сжатие
-        msg.opcode = data[0] & 0x0F;
+        pcap_set_snaplen(h, opts.snaplen);
+        pcap_set_promisc(h, 1);
+        pcap_set_timeout(h, opts.timeout_ms);
+        pcap_set_buffer_size(h, opts.buffer_size);
+        if (opts.immediate) {
+            pcap_set_immediate_mode(h, 1);
+        }
+        // Время пакетов с точностью до наносекунд, если libpcap и ядро умеют
+        pcap_set_tstamp_precision(h, PCAP_TSTAMP_PRECISION_NANO);
         
-        // Второй байт: MASK, Payload length
-        msg.is_masked = (data[1] & 0x80) != 0;
-        uint64_t payload_len = data[1] & 0x7F;
-        size_t offset = 2;
+        int rc = pcap_activate(h);
+        if (rc < 0) {
+            std::cerr << "Ошибка открытия устройства: " << pcap_statustostr(rc)
+                      << " (" << pcap_geterr(h) << ")" << std::endl;
+            pcap_close(h);
+            return nullptr;
+        }
+        if (rc > 0) {
+            std::cerr << "⚠️  " << pcap_statustostr(rc) << ": " << pcap_geterr(h) << std::endl;
+        }
+        nano_timestamps = pcap_get_tstamp_precision(h) == PCAP_TSTAMP_PRECISION_NANO;
+        return h;
+    }
+    
+    bool startCapture(const std::string& interface = "", int port = 0,
+                      const CaptureOptions& opts = CaptureOptions()) {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        std::string dev = interface;
         
-        // Расширенная длина payload
-        if (payload_len == 126) {
-            if (len < 4) return false;
-            payload_len = (static_cast<uint64_t>(data[2]) << 8) | data[3];
-            offset = 4;
-        } else if (payload_len == 127) {
-            if (len < 10) return false;
-            payload_len = 0;
-            for (int i = 0; i < 8; i++) {
-                payload_len = (payload_len << 8) | data[2 + i];
+        if (dev.empty()) {
+            char* found = pcap_lookupdev(errbuf);
+            if (found == nullptr) {
+                std::cerr << "Ошибка поиска устройства: " << errbuf << std::endl;
+                return false;
             }
-            offset = 10;
+            dev = found;
+            std::cout << "Используется интерфейс: " << dev << std::endl;
         }
         
-        // Маска (4 байта, если MASK=1)
-        uint8_t mask[4] = {0, 0, 0, 0};
-        if (msg.is_masked) {
-            if (len < offset + 4) return false;
-            memcpy(mask, data + offset, 4);
-            offset += 4;
+        stop_requested = false;
+        
+        if (!openStorage()) return false;
+        decoder.setRecycle(true);
+        
+        capture_spec = filter_spec;
+        if (port > 0) capture_spec.ports.push_back(static_cast<uint16_t>(port));
+        ignored_flow_set.clear();
+        setupDecoder(decoder);
+        
+        if (opts.fanout > 0 || opts.af_packet) {
+            FilterRefresh initial;
+            std::string filter_exp = kernelFilter(AfPacketRing::linkTypeOf(dev), initial);
+            if (opts.fanout > 0) {
+                return captureFanout(dev, filter_exp, port, opts);
+            }
+            return captureAfPacket(dev, filter_exp, port, opts);
         }
         
-        // Проверяем, достаточно ли данных
-        if (len < offset + payload_len) {
-            // Фрагментированный пакет - пропускаем
+        handle = openCapture(dev.c_str(), opts);
+        if (handle == nullptr) {
             return false;
         }
         
-        // Декодирование payload
-        std::vector<uint8_t> raw_payload(payload_len);
-        for (size_t i = 0; i < payload_len; i++) {
-            if (msg.is_masked) {
-                raw_payload[i] = data[offset + i] ^ mask[i % 4];
-            } else {
-                raw_payload[i] = data[offset + i];
-            }
+        // Разбор заголовков выбирается один раз по типу канала
+        int dlt = pcap_datalink(handle);
+        if (!useLinkType(dlt)) {
+            return false;
         }
+        pcap_refresh = FilterRefresh();
+        if (!setPcapFilter(kernelFilter(dlt, pcap_refresh))) {
+            return false;
+        }
+        
+        // Кольцо, snaplen, канальный уровень и точность времени - прочитанные
+        // из handle; размер буфера и таймаут libpcap не отдает, это запрошенные
+        const char* ring_version = pcapRingVersion(handle);
+        std::cout << "⚙️  Захват: libpcap" << (*ring_version ? ", " : "") << ring_version
+                  << ", snaplen " << pcap_snapshot(handle)
+                  << ", канальный уровень " << pcap_datalink_val_to_name(pcap_datalink(handle))
+                  << ", время пакетов в " << (nano_timestamps ? "нс" : "мкс")
+                  << "; запрошены буфер " << opts.buffer_size / (1024 * 1024) << " МБ"
+                  << ", таймаут " << opts.timeout_ms << " мс"
+                  << (opts.immediate ? ", immediate" : "") << std::endl;
+        printCaptureStarted(port, opts);
         
-        // Декомпрессия, если данные сжаты
-        if (msg.is_compressed && (msg.opcode == 0x1 || msg.opcode == 0x2)) {
-            if (!decompressData(raw_payload, msg.payload)) {
-                // Если декомпрессия не удалась, используем сырые данные
-                msg.payload = raw_payload;
-                msg.is_compressed = false;
+        decoder.setNanoTimestamps(nano_timestamps);
+        console.start(display_opts);
+        if (opts.workers > 0) startPipeline(opts);
+        CaptureMetrics* pcap_metrics = captureMetrics();
+        int64_t stats_updated = 0;
+        // pcap_dispatch отдает управление раз в таймаут: между вызовами
+        // фильтр ядра догоняет набор не WebSocket соединений
+        while (!stop_requested.load(std::memory_order_relaxed)) {
+            int rc = pcap_dispatch(handle, -1, packetHandler, reinterpret_cast<u_char*>(this));
+            if (rc == -1) {
+                std::cerr << "Ошибка захвата: " << pcap_geterr(handle) << std::endl;
+                break;
             }
-        } else {
-            msg.payload = raw_payload;
+            if (rc == -2) break;  // pcap_breakloop
+            if (filterOutdated(pcap_refresh)) setPcapFilter(kernelFilter(dlt, pcap_refresh));
+            publishPcapStats(pcap_metrics, stats_updated);
+        }
+        stopPipeline();
+        publishPcapStats(pcap_metrics, stats_updated, true);
+        console.stop();
+        closeStorage();
+        
+        // Статистика после остановки
+        std::cout << "\n🛑 Захват остановлен" << std::endl;
+        std::cout << "   Всего перехвачено сообщений: " << stored_count << std::endl;
+        printDisplayStats();
+        printFlowStats();
+        printWriterStats();
+        printPipelineStats();
+        
+        struct pcap_stat stats;
+        if (pcap_stats(handle, &stats) == 0) {
+            std::cout << "   Пакетов получено: " << stats.ps_recv
+                      << ", отброшено ядром: " << stats.ps_drop
+                      << ", отброшено интерфейсом: " << stats.ps_ifdrop << std::endl;
         }
         
         return true;
     }
     
-    const char* opcodeToString(uint8_t opcode) {
-        switch(opcode) {
-            case 0x0: return "Continuation";
-            case 0x1: return "Text";
-            case 0x2: return "Binary";
-            case 0x8: return "Close";
-            case 0x9: return "Ping";
-            case 0xA: return "Pong";
-            default: return "Unknown";
+    // Захват напрямую из кольца AF_PACKET/TPACKET_V3: декодер получает
+    // пакеты пачками по блоку кольца
+    bool captureAfPacket(const std::string& dev, const std::string& filter_exp, int port,
+                         const CaptureOptions& opts) {
+        AfPacketRing ring;
+        std::string err;
+        if (!ring.open(dev, opts, filter_exp, err)) {
+            std::cerr << "Ошибка открытия AF_PACKET: " << err << std::endl;
+            return false;
         }
-    }
-    
-    static void packetHandler(u_char* user, const struct pcap_pkthdr* header, const u_char* packet) {
-        WebSocketSniffer* sniffer = reinterpret_cast<WebSocketSniffer*>(user);
-        sniffer->processPacket(header, packet);
-    }
-    
-    void printHex(const uint8_t* data, size_t len, size_t max_len = 16) {
-        for (size_t i = 0; i < std::min(len, max_len); i++) {
-            std::cout << std::hex << std::setw(2) << std::setfill('0') 
-                     << static_cast<int>(data[i]) << " ";
+        
+        std::cout << "⚙️  Захват: AF_PACKET TPACKET_V3, " << ring.blockCount() << " блоков по "
+                  << ring.blockSize() / 1024 << " КБ, таймаут блока " << ring.blockTimeout() << " мс"
+                  << std::endl;
+        printCaptureStarted(port, opts);
+        
+        nano_timestamps = true;
+        decoder.setNanoTimestamps(true);
+        if (!useLinkType(ring.linkType())) {
+            return false;
         }
-        if (len > max_len) std::cout << "...";
-        std::cout << std::dec << std::endl;
+        console.start(display_opts);
+        if (opts.workers > 0) startPipeline(opts);
+        BatchHandler handler = {this, &ring, FilterRefresh(), captureMetrics(), 0};
+        ring.run(handler, stop_requested);
+        ring.close();
+        publishRingStats(ring, handler.stats, handler.stats_updated, true);
+        stopPipeline();
+        console.stop();
+        closeStorage();
+        
+        std::cout << "\n🛑 Захват остановлен" << std::endl;
+        std::cout << "   Всего перехвачено сообщений: " << stored_count << std::endl;
+        printDisplayStats();
+        printFlowStats();
+        printWriterStats();
+        printPipelineStats();
+        std::cout << "   Пакетов получено: " << ring.packets()
+                  << ", отброшено ядром: " << ring.drops()
+                  << ", заморозок очереди: " << ring.freezes() << std::endl;
+        return true;
     }
     
-    void processPacket(const struct pcap_pkthdr* header, const u_char* packet) {
-        // Предполагаем Ethernet (14 байт заголовок)
-        if (header->caplen < 14) return;
+    // Захват через группу PACKET_FANOUT_HASH: N сокетов на одном
+    // интерфейсе, ядро делит между ними соединения, каждый сокет
+    // захватывает и декодирует в своем потоке
+    bool captureFanout(const std::string& dev, const std::string& filter_exp, int port,
+                       const CaptureOptions& opts) {
+        // Буфер ядра делится между сокетами группы
+        CaptureOptions shard_opts = opts;
+        shard_opts.buffer_size = opts.buffer_size / opts.fanout;
+        int group_id = getpid() & 0xffff;
         
-        struct ip* ip_header = (struct ip*)(packet + 14);
+        if (shards.empty()) {
+            for (int i = 0; i < opts.fanout; i++) {
+                shards.push_back(std::unique_ptr<FanoutShard>(new FanoutShard()));
+            }
+        }
+        for (size_t i = 0; i < shards.size(); i++) {
+            std::string err;
+            if (!shards[i]->ring.open(dev, shard_opts, filter_exp, err) ||
+                !shards[i]->ring.joinFanout(group_id, err)) {
+                std::cerr << "Ошибка открытия AF_PACKET (сокет " << i << "): " << err << std::endl;
+                for (size_t j = 0; j <= i; j++) shards[j]->ring.close();
+                return false;
+            }
+        }
         
-        if (ip_header->ip_p != IPPROTO_TCP) return;
+        std::cout << "⚙️  Захват: PACKET_FANOUT_HASH, " << shards.size() << " сокетов AF_PACKET TPACKET_V3, "
+                  << shards[0]->ring.blockCount() << " блоков по " << shards[0]->ring.blockSize() / 1024
+                  << " КБ на сокет, таймаут блока " << shards[0]->ring.blockTimeout() << " мс" << std::endl;
+        printCaptureStarted(port, opts);
         
-        int ip_header_len = ip_header->ip_hl * 4;
-        struct tcphdr* tcp_header = (struct tcphdr*)((u_char*)ip_header + ip_header_len);
-        int tcp_header_len = tcp_header->th_off * 4;
+        console.start(display_opts);
+        int64_t window_ns = (2 * static_cast<int64_t>(shards[0]->ring.blockTimeout()) + 50) * 1000000;
+        for (size_t i = 0; i < shards.size(); i++) {
+            shards[i]->finished = false;
+            shards[i]->decoder.setRecycle(true);
+            shards[i]->decoder.setNanoTimestamps(true);
+            shards[i]->decoder.setLinkParser(linkParserFor(shards[i]->ring.linkType()));
+            setupDecoder(shards[i]->decoder);
+            shards[i]->thread = std::thread(&WebSocketSniffer::shardLoop, this, shards[i].get(),
+                                            static_cast<uint32_t>(i));
+        }
+        output_thread = std::thread(&WebSocketSniffer::mergeLoop, this, window_ns);
         
-        const u_char* payload = (u_char*)tcp_header + tcp_header_len;
-        int payload_len = ntohs(ip_header->ip_len) - ip_header_len - tcp_header_len;
+        for (size_t i = 0; i < shards.size(); i++) {
+            shards[i]->thread.join();
+        }
+        output_thread.join();
+        console.stop();
+        closeStorage();
         
-        if (payload_len <= 0) return;
+        std::cout << "\n🛑 Захват остановлен" << std::endl;
+        std::cout << "   Всего перехвачено сообщений: " << stored_count << std::endl;
+        printDisplayStats();
+        printFlowStats();
+        printWriterStats();
+        for (size_t i = 0; i < shards.size(); i++) {
+            const FanoutShard& sh = *shards[i];
+            std::cout << "   Сокет " << i << ": пакетов " << sh.ring.packets()
+                      << ", отброшено ядром " << sh.ring.drops()
+                      << ", сообщений " << sh.message_count
+                      << ", соединений " << sh.decoder.flowCount() << std::endl;
+        }
+        return true;
+    }
+    
+    // Файлы для --read: сам путь или все файлы каталога (без скрытых) по
+    // имени - ротация tcpdump -C/-G дает имена в хронологическом порядке
+    static bool listCaptureFiles(const std::string& path, std::vector<std::string>& files) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            std::cerr << "Ошибка открытия " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            files.push_back(path);
+            return true;
+        }
+        
+        DIR* dir = opendir(path.c_str());
+        if (!dir) {
+            std::cerr << "Ошибка открытия каталога " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        while (struct dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] == '.') continue;
+            std::string file = path + "/" + entry->d_name;
+            if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                files.push_back(file);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+        return true;
+    }
+    
+    // Отдает в вывод сообщения, накопленные декодером потока
+    void flushOfflineJob(OfflineJob& job, OfflineFile& file) {
+        QueuedMessage item;
+        item.source = 0;
+        item.generation = job.decoder.currentGeneration();
+        job.decoder.takeMessages(job.decoded);
+        for (size_t i = 0; i < job.decoded.size(); i++) {
+            item.msg = job.decoded[i];
+            while (!job.output.push(item)) {
+                std::this_thread::yield();
+            }
+        }
+        file.messages += job.decoded.size();
+        job.decoder.recycleArena();
+    }
+    
+    void decodeOfflineFile(OfflineJob& job, OfflineFile& file) {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        // pcap и pcapng; время с микросекундной точностью libpcap переведет в нс
+        pcap_t* p = pcap_open_offline_with_tstamp_precision(file.path.c_str(), PCAP_TSTAMP_PRECISION_NANO, errbuf);
+        if (!p) {
+            std::cerr << "⚠️  " + file.path + ": " + errbuf + "\n";
+            return;
+        }
         
-        // Пропускаем HTTP Upgrade запросы (они не WebSocket фреймы)
-        if (isWebSocketUpgrade(payload, payload_len)) {
+        int dlt = pcap_datalink(p);
+        LinkParser parser = linkParserFor(dlt);
+        if (!parser) {
+            const char* name = pcap_datalink_val_to_name(dlt);
+            std::cerr << "⚠️  " + file.path + ": канальный уровень " +
+                         (name ? name : std::to_string(dlt)) + " не поддерживается\n";
+            pcap_close(p);
             return;
         }
+        {
+            // Сегменты без данных отсекает BPF; исключений по соединениям
+            // нет - файлы разбираются независимо
+            std::lock_guard<std::mutex> lock(filter_mutex);
+            struct bpf_program fp;
+            std::string filter_exp = captureFilter(capture_spec, dlt);
+            if (pcap_compile(p, &fp, filter_exp.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0) {
+                pcap_setfilter(p, &fp);
+                pcap_freecode(&fp);
+            }
+        }
+        job.decoder.setLinkParser(parser);
+        job.decoder.setFrameFilter(filter_spec.frames);
+        job.decoder.setMatcher(matcher.empty() ? nullptr : &matcher);
+        job.decoder.setMessageLimits(message_limits);
+        attachMetrics(job.decoder);
+        job.decoder.setNanoTimestamps(pcap_get_tstamp_precision(p) == PCAP_TSTAMP_PRECISION_NANO);
+        file.opened = true;
         
-        // Проверяем, похоже ли это на WebSocket фрейм
-        // WebSocket фрейм начинается с байта, где старший бит обычно установлен (FIN=1)
-        if (payload_len < 2) return;
-        
-        // Базовая проверка: первый байт должен иметь валидный opcode
-        uint8_t opcode = payload[0] & 0x0F;
-        if (opcode > 0x0A && opcode != 0x00) return; // Невалидный opcode
-        
-        WebSocketMessage msg;
-        
-        if (parseWebSocketFrame(payload, payload_len, msg)) {
-            msg.src_ip = inet_ntoa(ip_header->ip_src);
-            msg.dst_ip = inet_ntoa(ip_header->ip_dst);
-            msg.src_port = ntohs(tcp_header->th_sport);
-            msg.dst_port = ntohs(tcp_header->th_dport);
-            
-            time_t now = time(nullptr);
-            msg.timestamp = ctime(&now);
-            msg.timestamp.pop_back(); // Убрать \n
-            
-            captured_messages.push_back(msg);
-            
-            std::cout << "📦 Перехвачено сообщение #" << captured_messages.size() << std::endl;
-            std::cout << "   " << msg.src_ip << ":" << msg.src_port 
-                     << " -> " << msg.dst_ip << ":" << msg.dst_port << std::endl;
-            std::cout << "   Тип: " << opcodeToString(msg.opcode) 
-                     << " (0x" << std::hex << (int)msg.opcode << std::dec << ")"
-                     << ", Маска: " << (msg.is_masked ? "Да" : "Нет")
-                     << ", Сжатие: " << (msg.is_compressed ? "Да" : "Нет")
-                     << ", Размер: " << msg.payload.size() << " байт" << std::endl;
-            
-            // Вывод содержимого
-            if (msg.opcode == 0x1 && msg.payload.size() > 0) { // Text frame
-                std::string text(msg.payload.begin(), msg.payload.end());
-                std::cout << "   📝 Текст: ";
-                
-                // Проверяем, есть ли управляющие символы (кроме разрешенных)
-                // UTF-8 символы (байты > 127) - это нормально!
-                bool is_printable = true;
-                for (unsigned char c : text) {
-                    // Разрешаем: печатные ASCII (>= 32), табы, переводы строк, и все UTF-8 (>= 128)
-                    if (c < 32 && c != '\n' && c != '\r' && c != '\t') {
-                        is_printable = false;
-                        break;
-                    }
-                }
-                
-                if (is_printable) {
-                    std::cout << text.substr(0, 200);
-                    if (text.size() > 200) std::cout << "...";
-                } else {
-                    std::cout << "[Содержит управляющие символы] ";
-                    printHex(msg.payload.data(), msg.payload.size(), 32);
-                }
-                std::cout << std::endl;
-            } else if (msg.opcode == 0x2) { // Binary frame
-                std::cout << "   🔢 Бинарные данные: ";
-                printHex(msg.payload.data(), msg.payload.size(), 32);
-            } else if (msg.opcode == 0x8) { // Close frame
-                std::cout << "   👋 Закрытие соединения";
-                if (msg.payload.size() >= 2) {
-                    uint16_t code = (msg.payload[0] << 8) | msg.payload[1];
-                    std::cout << ", код: " << code;
-                    if (msg.payload.size() > 2) {
-                        std::string reason(msg.payload.begin() + 2, msg.payload.end());
-                        std::cout << ", причина: " << reason;
-                    }
-                }
-                std::cout << std::endl;
-            } else if (msg.opcode == 0x9) {
-                std::cout << "   🏓 Ping" << std::endl;
-            } else if (msg.opcode == 0xA) {
-                std::cout << "   🏓 Pong" << std::endl;
+        struct pcap_pkthdr* header;
+        const u_char* packet;
+        int rc;
+        while ((rc = pcap_next_ex(p, &header, &packet)) == 1) {
+            job.decoder.processPacket(header, packet);
+            file.bytes += header->caplen;
+            if (++file.packets % WORKER_BATCH == 0) {
+                flushOfflineJob(job, file);
+                if (stop_requested.load(std::memory_order_relaxed)) break;
             }
-            
-            std::cout << std::endl;
         }
+        flushOfflineJob(job, file);
+        if (rc == -1) {
+            // Обычно файл обрезан (кольцо tcpdump, которое еще писалось)
+            std::cerr << "⚠️  " + file.path + ": " + pcap_geterr(p) + "\n";
+        }
+        pcap_close(p);
     }
     
-public:
-    WebSocketSniffer() : handle(nullptr) {}
-    
-    ~WebSocketSniffer() {
-        if (handle) {
-            pcap_close(handle);
+    void offlineLoop(OfflineJob* job) {
+        for (;;) {
+            size_t i = next_offline_file.fetch_add(1);
+            if (i >= offline_files.size() || stop_requested.load(std::memory_order_relaxed)) break;
+            decodeOfflineFile(*job, offline_files[i]);
         }
+        job->finished.store(true, std::memory_order_release);
     }
     
-    bool startCapture(const std::string& interface = "", int port = 0) {
-        char errbuf[PCAP_ERRBUF_SIZE];
+    void offlineOutputLoop() {
+        QueuedMessage item;
+        unsigned idle = 0;
         
-        if (interface.empty()) {
-            char* dev = pcap_lookupdev(errbuf);
-            if (dev == nullptr) {
-                std::cerr << "Ошибка поиска устройства: " << errbuf << std::endl;
-                return false;
+        for (;;) {
+            bool any = false;
+            for (size_t i = 0; i < offline_jobs.size(); i++) {
+                OfflineJob& job = *offline_jobs[i];
+                for (size_t n = 0; n < WORKER_BATCH && job.output.pop(item); n++) {
+                    storeMessage(item.msg);
+                    job.decoder.acknowledge(item.generation);
+                    any = true;
+                }
             }
-            handle = pcap_open_live(dev, BUFSIZ, 1, 1000, errbuf);
-            std::cout << "Используется интерфейс: " << dev << std::endl;
-        } else {
-            handle = pcap_open_live(interface.c_str(), BUFSIZ, 1, 1000, errbuf);
+            if (any) {
+                idle = 0;
+                continue;
+            }
+            
+            bool all_done = true;
+            for (size_t i = 0; i < offline_jobs.size(); i++) {
+                if (!offline_jobs[i]->finished.load(std::memory_order_acquire) || !offline_jobs[i]->output.empty()) {
+                    all_done = false;
+                    break;
+                }
+            }
+            if (all_done) break;
+            backoff(idle);
         }
-        
-        if (handle == nullptr) {
-            std::cerr << "Ошибка открытия устройства: " << errbuf << std::endl;
+    }
+    
+    // Разбор файлов pcap/pcapng с максимальной скоростью: файлы
+    // декодируются параллельно, каждый целиком в одном потоке.
+    // Соединение, которое продолжается в следующем файле ротации,
+    // продолжится, только если файл достанется тому же потоку.
+    bool readOffline(const OfflineOptions& opts) {
+        offline_files.clear();
+        std::vector<std::string> paths;
+        if (!listCaptureFiles(opts.path, paths)) return false;
+        if (paths.empty()) {
+            std::cerr << "В " << opts.path << " нет файлов" << std::endl;
             return false;
         }
+        for (size_t i = 0; i < paths.size(); i++) {
+            OfflineFile file = {paths[i], 0, 0, 0, false};
+            offline_files.push_back(file);
+        }
         
-        struct bpf_program fp;
-        std::string filter_exp = "tcp";
-        if (port > 0) {
-            filter_exp += " port " + std::to_string(port);
+        size_t jobs = opts.jobs > 0 ? static_cast<size_t>(opts.jobs) : std::thread::hardware_concurrency();
+        if (jobs == 0) jobs = 1;
+        if (jobs > offline_files.size()) jobs = offline_files.size();
+        
+        stop_requested = false;
+        if (!openStorage()) return false;
+        
+        std::cout << "📂 Разбор " << offline_files.size() << " файл(ов) в " << jobs << " поток(а/ов)";
+        if (opts.port > 0) std::cout << ", порт " << opts.port;
+        std::cout << "..." << std::endl << std::endl;
+        
+        capture_spec = filter_spec;
+        if (opts.port > 0) capture_spec.ports.push_back(static_cast<uint16_t>(opts.port));
+        next_offline_file = 0;
+        offline_jobs.clear();
+        for (size_t i = 0; i < jobs; i++) {
+            offline_jobs.push_back(std::unique_ptr<OfflineJob>(new OfflineJob()));
         }
         
-        if (pcap_compile(handle, &fp, filter_exp.c_str(), 0, PCAP_NETMASK_UNKNOWN) == -1) {
-            std::cerr << "Ошибка компиляции фильтра" << std::endl;
-            return false;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        console.start(display_opts);
+        for (size_t i = 0; i < offline_jobs.size(); i++) {
+            offline_jobs[i]->decoder.setRecycle(true);
+            offline_jobs[i]->thread = std::thread(&WebSocketSniffer::offlineLoop, this, offline_jobs[i].get());
+        }
+        output_thread = std::thread(&WebSocketSniffer::offlineOutputLoop, this);
+        for (size_t i = 0; i < offline_jobs.size(); i++) {
+            offline_jobs[i]->thread.join();
         }
+        output_thread.join();
+        console.stop();
+        closeStorage();
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(
+            std::chrono::steady_clock::now() - started).count();
         
-        if (pcap_setfilter(handle, &fp) == -1) {
-            std::cerr << "Ошибка установки фильтра" << std::endl;
-            return false;
+        printOfflineStats(seconds);
+        printDisplayStats();
+        printFlowStats();
+        printWriterStats();
+        return true;
+    }
+    
+    void printOfflineStats(double seconds) {
+        uint64_t packets = 0, bytes = 0, messages = 0;
+        size_t opened = 0;
+        for (size_t i = 0; i < offline_files.size(); i++) {
+            const OfflineFile& f = offline_files[i];
+            packets += f.packets;
+            bytes += f.bytes;
+            messages += f.messages;
+            if (f.opened) opened++;
         }
+        if (seconds <= 0) seconds = 1e-9;
+        double mb = bytes / (1024.0 * 1024.0);
         
+        std::cout << "\n📊 Разбор завершен" << std::endl;
+        std::cout << "   Файлов: " << opened << " из " << offline_files.size()
+                  << ", пакетов: " << packets << ", сообщений: " << stored_count
+                  << ", данных: " << std::fixed << std::setprecision(1) << mb << " МБ"
+                  << " за " << std::setprecision(2) << seconds << " с" << std::endl;
+        std::cout << "   Скорость: " << std::setprecision(0) << packets / seconds << " пакетов/с, "
+                  << messages / seconds << " фреймов/с, "
+                  << std::setprecision(1) << mb / seconds << " МБ/с" << std::endl;
+    }
+    
+    void printCaptureStarted(int port, const CaptureOptions& opts) {
+        std::cout << "⚙️  Декодирование: ";
+        if (opts.fanout > 0) {
+            std::cout << "свой декодер у каждого сокета, слияние по времени пакета" << std::endl;
+        } else if (opts.workers > 0) {
+            std::cout << opts.workers << " поток(а/ов), вывод в отдельном потоке" << std::endl;
+        } else {
+            std::cout << "в потоке захвата" << std::endl;
+        }
         std::cout << "🎯 Начат перехват WebSocket сообщений";
         if (port > 0) std::cout << " на порту " << port;
         std::cout << "..." << std::endl;
         std::cout << "   (Нажмите Ctrl+C для остановки)" << std::endl << std::endl;
-        
-        pcap_loop(handle, 0, packetHandler, reinterpret_cast<u_char*>(this));
-        
-        // Статистика после остановки
-        std::cout << "\n🛑 Захват остановлен" << std::endl;
-        std::cout << "   Всего перехвачено сообщений: " << captured_messages.size() << std::endl;
-        
-        return true;
     }
     
     void stopCapture() {
+        stop_requested = true;
         if (handle) {
             pcap_breakloop(handle);
         }
     }
     
-    void saveMessages(const std::string& filename) {
-        if (captured_messages.empty()) {
+    // Сохранение в файл захвата (ws_capfile.h) через CaptureWriter: без
+    // --compress - v2, с ним - v3, блоки сжимает пул потоков
+    bool saveMessages(const std::string& filename) {
+        size_t count = messageCount();
+        if (count == 0) {
             std::cout << "⚠️  Нет сообщений для сохранения" << std::endl;
-            return;
+            return false;
         }
         
-        std::ofstream out(filename, std::ios::binary);
-        if (!out) {
-            std::cerr << "❌ Ошибка создания файла" << std::endl;
-            return;
+        WriterOptions opts;
+        opts.path = filename;
+        opts.compression = writer_opts.compression;
+        CaptureWriter out;
+        std::string err;
+        if (!out.open(opts, err)) {
+            std::cerr << "❌ Ошибка создания файла: " << err << std::endl;
+            return false;
         }
         
-        size_t count = captured_messages.size();
-        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
-        
         size_t total_size = 0;
         int text_count = 0, binary_count = 0, control_count = 0;
         
-        for (const auto& msg : captured_messages) {
-            size_t len = msg.timestamp.size();
-            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
-            out.write(msg.timestamp.c_str(), len);
-            
-            len = msg.src_ip.size();
-            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
-            out.write(msg.src_ip.c_str(), len);
-            
-            len = msg.dst_ip.size();
-            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
-            out.write(msg.dst_ip.c_str(), len);
-            
-            out.write(reinterpret_cast<const char*>(&msg.src_port), sizeof(msg.src_port));
-            out.write(reinterpret_cast<const char*>(&msg.dst_port), sizeof(msg.dst_port));
-            out.write(reinterpret_cast<const char*>(&msg.opcode), sizeof(msg.opcode));
-            out.write(reinterpret_cast<const char*>(&msg.is_masked), sizeof(msg.is_masked));
-            out.write(reinterpret_cast<const char*>(&msg.is_compressed), sizeof(msg.is_compressed));
-            
-            len = msg.payload.size();
-            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
-            out.write(reinterpret_cast<const char*>(msg.payload.data()), len);
+        WebSocketMessage msg;
+        for (size_t i = 0; i < count; i++) {
+            if (!messageAt(i, msg)) continue;
+            out.append(msg);
             
             total_size += msg.payload.size();
             if (msg.opcode == 0x1) text_count++;
             else if (msg.opcode == 0x2) binary_count++;
             else control_count++;
         }
+        out.close();
+        if (!out.ok()) {
+            std::cerr << "❌ Ошибка записи файла " << filename << std::endl;
+            return false;
+        }
         
         std::cout << "\n✅ Сохранение завершено!" << std::endl;
         std::cout << "   📁 Файл: " << filename << std::endl;
-        std::cout << "   📦 Всего сообщений: " << count << std::endl;
+        std::cout << "   📦 Всего сообщений: " << out.records() << std::endl;
         std::cout << "   📝 Текстовых: " << text_count << std::endl;
         std::cout << "   🔢 Бинарных: " << binary_count << std::endl;
         std::cout << "   ⚙️  Управляющих: " << control_count << std::endl;
@@ -401,35 +1387,77 @@ public:
             std::cout << " (" << std::fixed << std::setprecision(2) 
                      << (total_size / 1024.0) << " КБ)";
         }
-        std::cout << std::endl << std::endl;
+        std::cout << std::endl;
+        if (opts.compression.enabled()) printCompression(out, opts.compression);
+        std::cout << std::endl;
+        return true;
+    }
+    
+    static void printCompression(const CaptureWriter& w, const CompressionOptions& compression) {
+        if (w.bytesWritten() == 0) return;
+        std::cout << "   🗜  Сжатие " << blockCodecName(compression.codec) << ": " << std::fixed
+                  << std::setprecision(1) << w.rawBytes() / (1024.0 * 1024.0) << " МБ записей -> "
+                  << w.bytesWritten() / (1024.0 * 1024.0) << " МБ, в "
+                  << static_cast<double>(w.rawBytes()) / w.bytesWritten() << " раза" << std::endl;
+    }
+    
+    // Строковое поле записи: длина и байты
+    static bool readField(std::istream& in, std::string& str) {
+        size_t len;
+        if (!in.read(reinterpret_cast<char*>(&len), sizeof(len)) || len > MAX_FIELD_LEN) return false;
+        str.resize(len);
+        return static_cast<bool>(in.read(&str[0], len));
     }
     
+    // Файл v2/v3 открывается через mmap без чтения записей; файл прежнего
+    // формата читается целиком в captured_messages (без пределов)
     bool loadMessages(const std::string& filename) {
+        std::string err;
+        captured_messages.configure(RetentionOptions(), err);
+        capture_file.close();
+        
+        if (CaptureFile::isCaptureFile(filename)) {
+            if (!capture_file.open(filename, err)) {
+                std::cerr << "Ошибка открытия файла: " << err << std::endl;
+                return false;
+            }
+            if (!capture_file.isComplete()) {
+                std::cerr << "⚠️  Файл не был закрыт, индекс восстановлен по записям" << std::endl;
+            }
+            std::cout << "✅ Открыто " << capture_file.messageCount() << " сообщений из " << filename;
+            if (capture_file.isCompressed()) std::cout << " (сжатых блоков: " << capture_file.blockCount() << ")";
+            std::cout << std::endl;
+            return true;
+        }
+        
         std::ifstream in(filename, std::ios::binary);
         if (!in) {
             std::cerr << "Ошибка открытия файла" << std::endl;
             return false;
         }
         
-        captured_messages.clear();
-        size_t count;
+        size_t count = 0;
         in.read(reinterpret_cast<char*>(&count), sizeof(count));
         
-        for (size_t i = 0; i < count; i++) {
+        // Файл потоковой записи, который не был закрыт: читаем до конца
+        bool streamed = count == LEGACY_COUNT_STREAMING;
+        
+        std::string str;
+        std::vector<uint8_t> payload;
+        for (size_t i = 0; streamed || i < count; i++) {
             WebSocketMessage msg;
-            size_t len;
-            
-            in.read(reinterpret_cast<char*>(&len), sizeof(len));
-            msg.timestamp.resize(len);
-            in.read(&msg.timestamp[0], len);
+            size_t len = 0;
             
-            in.read(reinterpret_cast<char*>(&len), sizeof(len));
-            msg.src_ip.resize(len);
-            in.read(&msg.src_ip[0], len);
+            if (!readField(in, str) || str.empty()) {
+                // Конец файла или нули в хвосте последнего блока
+                if (streamed) break;
+                std::cerr << "Файл поврежден (сообщение " << i + 1 << ")" << std::endl;
+                return false;
+            }
+            msg.timestamp_ns = parseTimestamp(str) * 1000000000LL;
             
-            in.read(reinterpret_cast<char*>(&len), sizeof(len));
-            msg.dst_ip.resize(len);
-            in.read(&msg.dst_ip[0], len);
+            bool ok = readField(in, str) && parseIp(str, msg.src_ip);
+            ok = ok && readField(in, str) && parseIp(str, msg.dst_ip);
             
             in.read(reinterpret_cast<char*>(&msg.src_port), sizeof(msg.src_port));
             in.read(reinterpret_cast<char*>(&msg.dst_port), sizeof(msg.dst_port));
@@ -438,89 +1466,349 @@ public:
             in.read(reinterpret_cast<char*>(&msg.is_compressed), sizeof(msg.is_compressed));
             
             in.read(reinterpret_cast<char*>(&len), sizeof(len));
-            msg.payload.resize(len);
-            in.read(reinterpret_cast<char*>(msg.payload.data()), len);
+            ok = ok && in && len <= WebSocketDecoder::MAX_FRAME_SIZE;
+            if (ok) {
+                payload.resize(len);
+                ok = static_cast<bool>(in.read(reinterpret_cast<char*>(payload.data()), len));
+            }
+            if (!ok) {
+                if (streamed) {
+                    std::cerr << "⚠️  Запись " << i + 1 << " оборвана (файл не был закрыт)" << std::endl;
+                    break;
+                }
+                std::cerr << "Файл поврежден (сообщение " << i + 1 << ")" << std::endl;
+                return false;
+            }
+            msg.payload = makeSpan(payload.data(), len);
             
-            captured_messages.push_back(msg);
+            captured_messages.add(msg);
         }
         
-        std::cout << "✅ Загружено " << count << " сообщений из " << filename << std::endl;
+        std::cout << "✅ Загружено " << captured_messages.size() << " сообщений из " << filename << std::endl;
+        return true;
+    }
+    
+    // Файл сообщений в Arrow IPC: v2 читается через mmap по одному
+    // сообщению, так что память не зависит от размера файла
+    bool exportArrow(const std::string& from, const std::string& to) {
+        if (!loadMessages(from)) return false;
+        arrow_opts.path = to;
+        std::string err;
+        if (!arrow.open(arrow_opts, err)) {
+            std::cerr << "Ошибка открытия файла Arrow: " << err << std::endl;
+            return false;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t count = messageCount();
+        size_t damaged = 0;
+        WebSocketMessage msg;
+        for (size_t i = 0; i < count; i++) {
+            if (!messageAt(i, msg)) {
+                damaged++;
+                continue;
+            }
+            arrow.append(msg);
+        }
+        if (!arrow.close(err)) {
+            std::cerr << "❌ Ошибка экспорта Arrow: " << err << std::endl;
+            return false;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printArrowStats();
+        if (damaged > 0) std::cout << "   ⚠️  Пропущено поврежденных записей: " << damaged << std::endl;
+        std::cout << "   " << std::fixed << std::setprecision(2) << seconds << " с, "
+                  << std::setprecision(0) << (seconds > 0 ? arrow.rows() / seconds : 0.0) << " сообщ/с" << std::endl;
+        return true;
+    }
+    
+    // Файл прежнего формата - в v2 или v3; файл v2/v3 - только со
+    // сжатием, заданным явно (recompress)
+    bool convertFile(const std::string& from, const std::string& to, bool recompress) {
+        if (CaptureFile::isCaptureFile(from) && !recompress) {
+            std::cerr << from << " уже в формате v2/v3 (пересжать: --compress)" << std::endl;
+            return false;
+        }
+        return loadMessages(from) && saveMessages(to);
+    }
+    
+    void askToSave() {
+        if (captured_messages.evictedCount() > 0) {
+            std::cout << "\n   В памяти последние " << captured_messages.size() << " сообщений, "
+                      << captured_messages.evictedCount() << " более старых вытеснено" << std::endl;
+        }
+        std::cout << "\n💾 Сохранить захваченные сообщения? (y/n): ";
+        char save = 'n';
+        std::cin >> save;
+        if (save == 'y' || save == 'Y') {
+            saveMessages("captured_messages.dat");
+        }
+    }
+    
+    // Сообщения из памяти или из открытого файла v2/v3
+    size_t messageCount() const {
+        return capture_file.isOpen() ? capture_file.messageCount() : captured_messages.size();
+    }
+    
+    bool messageAt(size_t index, WebSocketMessage& msg) const {
+        if (capture_file.isOpen()) return capture_file.message(index, msg);
+        if (index >= captured_messages.size()) return false;
+        msg = captured_messages.at(index);
         return true;
     }
     
     void listMessages() {
-        if (captured_messages.empty()) {
+        if (messageCount() == 0) {
             std::cout << "Нет захваченных сообщений" << std::endl;
             return;
         }
         
         std::cout << "\n📋 Список захваченных сообщений:\n" << std::endl;
-        for (size_t i = 0; i < captured_messages.size(); i++) {
-            const auto& msg = captured_messages[i];
-            std::cout << "[" << i + 1 << "] " << msg.timestamp << std::endl;
-            std::cout << "    " << msg.src_ip << ":" << msg.src_port 
-                     << " -> " << msg.dst_ip << ":" << msg.dst_port << std::endl;
-            std::cout << "    Тип: " << opcodeToString(msg.opcode) 
-                     << ", Размер: " << msg.payload.size() << " байт" << std::endl;
-            
-            if (msg.opcode == 0x1 && msg.payload.size() > 0) {
-                std::string text(msg.payload.begin(), msg.payload.end());
-                std::cout << "    Превью: " << text.substr(0, 80);
-                if (text.size() > 80) std::cout << "...";
-                std::cout << std::endl;
-            }
+        for (size_t i = 0; i < messageCount(); i++) {
+            printStoredMessage(i);
+        }
+    }
+    
+    // Сообщение из списка или результата запроса
+    void printStoredMessage(size_t i) const {
+        WebSocketMessage msg;
+        if (!messageAt(i, msg)) {
+            std::cout << "[" << i + 1 << "] запись повреждена" << std::endl << std::endl;
+            return;
+        }
+        std::cout << "[" << i + 1 << "] " << formatTimestamp(msg.timestamp_ns) << std::endl;
+        std::cout << "    " << formatEndpoint(msg.src_ip, msg.src_port)
+                 << " -> " << formatEndpoint(msg.dst_ip, msg.dst_port) << std::endl;
+        std::cout << "    Тип: " << opcodeToString(msg.opcode) 
+                 << ", Размер: " << msg.payload.size() << " байт"
+                 << (msg.is_truncated ? " (обрезано)" : "") << std::endl;
+        
+        if (msg.opcode == 0x1 && msg.payload.size() > 0) {
+            // Из payload читается только превью - остальное не подгружается
+            size_t preview = msg.payload.size() < 80 ? msg.payload.size() : 80;
+            std::cout << "    Превью: ";
+            std::cout.write(reinterpret_cast<const char*>(msg.payload.data()), preview);
+            if (msg.payload.size() > 80) std::cout << "...";
             std::cout << std::endl;
         }
+        std::cout << std::endl;
     }
     
-    bool replayMessage(size_t index, const std::string& target_ip, uint16_t target_port) {
-        if (index >= captured_messages.size()) {
-            std::cerr << "Неверный индекс сообщения" << std::endl;
+    // Запрос к файлу v2 (--query): кандидаты берутся из индекса запросов,
+    // с диска читаются только заголовки проверяемых записей и сообщения
+    // текущей страницы. Страницы выдаются по Enter, пока не кончатся
+    // результаты или не введено q; без терминала - все сразу.
+    bool queryMessages(const std::string& filename, const std::string& expr, size_t page) {
+        CaptureQuerySpec spec;
+        std::string err;
+        if (!parseQueryExpression(expr, spec, err)) {
+            std::cerr << "Неверный запрос: " << err << std::endl;
             return false;
         }
-        
-        const auto& msg = captured_messages[index];
-        
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0) {
-            std::cerr << "Ошибка создания сокета" << std::endl;
+        if (!CaptureFile::isCaptureFile(filename) || !loadMessages(filename)) {
+            std::cerr << filename << ": запросы работают только с файлами v2/v3" << std::endl;
             return false;
         }
         
-        struct sockaddr_in addr;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(target_port);
-        inet_pton(AF_INET, target_ip.c_str(), &addr.sin_addr);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        QueryIndex index;
+        if (!openQueryIndex(filename, index)) return false;
         
-        std::cout << "🔄 Повтор сообщения #" << (index + 1) << " на " 
-                 << target_ip << ":" << target_port << "..." << std::endl;
+        CaptureQuery query(capture_file, index, spec);
+        std::cout << "🔎 Кандидатов: " << query.candidateCount() << " (" << query.driverName() << ")" << std::endl;
         
-        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-            std::cerr << "Ошибка подключения" << std::endl;
-            close(sock);
+        bool interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+        std::vector<size_t> found;
+        size_t total = 0;
+        for (;;) {
+            query.next(found, page);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            for (size_t i = 0; i < found.size(); i++) {
+                printStoredMessage(found[i]);
+            }
+            total += found.size();
+            std::cout << "📄 Найдено " << total << ", страница за " << std::fixed << std::setprecision(2)
+                     << ms << " мс" << std::endl;
+            if (found.size() < page) break;
+            if (interactive) {
+                std::cout << "Enter - следующая страница, q - выход: " << std::flush;
+                std::string line;
+                if (!std::getline(std::cin, line) || line == "q" || line == "Q") break;
+            }
+            start = std::chrono::steady_clock::now();
+        }
+        return true;
+    }
+    
+    // Индекс запросов открытого файла v2; нет в файле - строится в памяти
+    bool openQueryIndex(const std::string& filename, QueryIndex& index) {
+        std::string err;
+        const uint8_t* data;
+        size_t len;
+        if (capture_file.queryIndex(data, len) && index.attach(data, len, err)) return true;
+        if (!err.empty()) std::cerr << "⚠️  " << err << std::endl;
+        std::cerr << "⚠️  В файле нет индекса запросов, строится в памяти (" << capture_file.messageCount()
+                 << " записей; сохранить в файл: --index " << filename << ")" << std::endl;
+        if (!buildQueryIndex(capture_file, index, err)) {
+            std::cerr << "❌ " << err << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Дописывает индекс запросов в закрытый файл v2 без него (файлы
+    // прежних версий программы). Индекс смещений (в v3 - блоков) остается на месте,
+    // заголовок переписывается последним.
+    bool indexCaptureFile(const std::string& filename) {
+        std::string err;
+        CaptureFile file;
+        if (!file.open(filename, err)) {
+            std::cerr << "Ошибка открытия файла: " << err << std::endl;
+            return false;
+        }
+        if (!file.isComplete()) {
+            std::cerr << filename << ": файл не был закрыт, индекс смещений не записан" << std::endl;
             return false;
         }
+        const uint8_t* data;
+        size_t len;
+        if (file.queryIndex(data, len)) {
+            std::cout << "✅ " << filename << " уже с индексом запросов" << std::endl;
+            return true;
+        }
+        if (file.messageCount() >= 0xFFFFFFFFu) {
+            std::cerr << filename << ": слишком много записей для индекса запросов" << std::endl;
+            return false;
+        }
+        std::vector<uint8_t> bytes;
+        buildQueryIndexBytes(file, bytes);
+        CaptureFileHeader header = *file.header();
+        header.query_index = file.indexEnd();
+        file.close();
         
-        // Отправка WebSocket Upgrade handshake (упрощенная версия)
-        std::string handshake = 
-            "GET / HTTP/1.1\r\n"
-            "Host: " + target_ip + "\r\n"
-            "Upgrade: websocket\r\n"
-            "Connection: Upgrade\r\n"
-            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
-            "Sec-WebSocket-Version: 13\r\n\r\n";
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+        bool ok = fd >= 0 && ftruncate(fd, static_cast<off_t>(header.query_index)) == 0 &&
+                  pwrite(fd, &bytes[0], bytes.size(), static_cast<off_t>(header.query_index)) ==
+                      static_cast<ssize_t>(bytes.size()) &&
+                  fdatasync(fd) == 0 &&
+                  pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                  fdatasync(fd) == 0;
+        if (!ok) std::cerr << "❌ Ошибка записи " << filename << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) ::close(fd);
+        if (ok) {
+            std::cout << "✅ Индекс запросов дописан в " << filename << " (" << bytes.size() << " байт)" << std::endl;
+        }
+        return ok;
+    }
+    
+    static void printReplayStats(const ReplayStats& stats) {
+        std::cout << "\n📊 Повтор завершен за " << std::fixed << std::setprecision(2) << stats.seconds << " с" << std::endl;
+        std::cout << "   📤 Отправлено: " << stats.messages << " сообщений, " << stats.payload_bytes
+                 << " байт payload (" << stats.wire_bytes << " байт фреймов, сжато " << stats.compressed << ")" << std::endl;
+        if (stats.seconds > 0) {
+            std::cout << "   ⚡ " << static_cast<uint64_t>(stats.messages / stats.seconds) << " сообщ/с, "
+                     << std::setprecision(1) << stats.wire_bytes / stats.seconds / (1024 * 1024) << " МБ/с, "
+                     << stats.writes << " вызовов sendmsg" << std::endl;
+        }
+        std::cout << "   🔌 Соединений: " << stats.connections << ", не открылось: " << stats.failed_connections
+                 << std::endl;
+        std::cout << "   📥 От сервера: " << stats.received_frames << " фреймов, " << stats.received_bytes << " байт"
+                 << std::endl;
+        if (stats.max_lag_ns > 0) {
+            std::cout << "   ⏱  Наибольшее отставание от расписания: " << std::setprecision(2)
+                     << stats.max_lag_ns / 1e6 << " мс" << std::endl;
+        }
+        if (stats.skipped || stats.dropped) {
+            std::cout << "   ⏭  Пропущено: " << stats.skipped << " (ответы сервера, close), потеряно с соединениями: "
+                     << stats.dropped << std::endl;
+        }
+    }
+    
+    // Повтор файла (--replay): сообщения подаются движку по одному прямо
+    // из отображения файла в порядке записи; с выражением запроса -
+    // только найденные по индексу
+    bool replayMessages(const std::string& filename, const std::string& expr, const ReplayOptions& opts) {
+        CaptureQuerySpec spec;
+        std::string err;
+        if (!expr.empty() && !parseQueryExpression(expr, spec, err)) {
+            std::cerr << "Неверный запрос: " << err << std::endl;
+            return false;
+        }
+        if (!loadMessages(filename)) return false;
+        QueryIndex index;
+        if (!expr.empty()) {
+            if (!capture_file.isOpen()) {
+                std::cerr << filename << ": выбор сообщений запросом работает только с файлами v2/v3" << std::endl;
+                return false;
+            }
+            if (!openQueryIndex(filename, index)) return false;
+        }
         
-        send(sock, handshake.c_str(), handshake.size(), 0);
+        stop_requested = false;
+        ReplayEngine engine;
+        if (!engine.open(opts, &stop_requested, err)) {
+            std::cerr << "❌ " << err << std::endl;
+            return false;
+        }
+        std::cout << "🔄 Повтор на " << opts.host << ":" << opts.port << opts.path << ", ";
+        if (opts.pacing == ReplayOptions::PACE_FAST) {
+            std::cout << "как можно быстрее";
+        } else if (opts.pacing == ReplayOptions::PACE_RATE) {
+            std::cout << opts.rate << " сообщ/с";
+        } else {
+            std::cout << "исходный темп x" << opts.speed;
+        }
+        std::cout << " (Ctrl+C - остановить)" << std::endl;
         
-        char buffer[4096];
-        recv(sock, buffer, sizeof(buffer), 0);
+        WebSocketMessage msg;
+        if (expr.empty()) {
+            for (size_t i = 0; i < messageCount(); i++) {
+                if (messageAt(i, msg) && !engine.send(msg)) break;
+            }
+        } else {
+            CaptureQuery query(capture_file, index, spec);
+            std::vector<size_t> found;
+            bool running = true;
+            while (running && query.next(found, 1024)) {
+                for (size_t i = 0; i < found.size() && running; i++) {
+                    running = !messageAt(found[i], msg) || engine.send(msg);
+                }
+            }
+        }
+        printReplayStats(engine.finish());
+        return true;
+    }
+    
+    // Одно сообщение из меню: любое направление, без паузы
+    bool replayMessage(size_t index, const std::string& target_ip, uint16_t target_port) {
+        WebSocketMessage msg;
+        if (!messageAt(index, msg)) {
+            std::cerr << "Неверный индекс сообщения" << std::endl;
+            return false;
+        }
         
-        // Отправка payload
-        send(sock, reinterpret_cast<const char*>(msg.payload.data()), msg.payload.size(), 0);
+        ReplayOptions opts;
+        opts.host = target_ip;
+        opts.port = target_port;
+        opts.pacing = ReplayOptions::PACE_FAST;
+        opts.client_only = false;
+        opts.progress = false;
         
-        std::cout << "✅ Сообщение отправлено!" << std::endl;
+        std::cout << "🔄 Повтор сообщения #" << (index + 1) << " на " 
+                 << target_ip << ":" << target_port << "..." << std::endl;
         
-        close(sock);
+        ReplayEngine engine;
+        std::string err;
+        if (!engine.open(opts, nullptr, err)) {
+            std::cerr << "Ошибка подключения: " << err << std::endl;
+            return false;
+        }
+        engine.send(msg);
+        const ReplayStats& stats = engine.finish();
+        if (stats.messages == 0 || stats.dropped > 0 || stats.failed_connections > 0) {
+            std::cerr << "Ошибка подключения" << std::endl;
+            return false;
+        }
+        std::cout << "✅ Сообщение отправлено!" << std::endl;
         return true;
     }
 };
@@ -536,13 +1824,337 @@ void signalHandler(int signum) {
     }
 }
 
+void printUsage(const char* prog) {
+    std::cout << "Использование: " << prog << " [опции]" << std::endl;
+    std::cout << "  --snaplen N       байт захвата на пакет (по умолчанию 262144)" << std::endl;
+    std::cout << "  --buffer-mb N     буфер ядра в МБ, до 2047 (по умолчанию 64)" << std::endl;
+    std::cout << "  --timeout-ms N    таймаут доставки пакетов (по умолчанию 100)" << std::endl;
+    std::cout << "  --immediate       доставлять каждый пакет без задержки" << std::endl;
+    std::cout << "  --af-packet       читать кольцо AF_PACKET/TPACKET_V3 напрямую" << std::endl;
+    std::cout << "  --workers N       потоков-декодеров (по умолчанию 1, 0 - все в потоке захвата)" << std::endl;
+    std::cout << "  --fanout N        N сокетов AF_PACKET в группе PACKET_FANOUT_HASH" << std::endl;
+    std::cout << "  --output MODE     full - каждое сообщение, summary - только сводка," << std::endl;
+    std::cout << "                    quiet - без вывода (по умолчанию full)" << std::endl;
+    std::cout << "  --print-rate N    сообщений в секунду на экран, 0 - без ограничения (по умолчанию 100)" << std::endl;
+    std::cout << "  --write PREFIX    писать сообщения в файлы PREFIX-<время>-NNNN.dat во время захвата" << std::endl;
+    std::cout << "  --rotate-mb N     новый файл после N МБ, 0 - не делить (по умолчанию 1024)" << std::endl;
+    std::cout << "  --rotate-sec N    новый файл раз в N секунд, 0 - не делить (по умолчанию 3600)" << std::endl;
+    std::cout << "  --sync-sec N      интервал fdatasync (по умолчанию 1)" << std::endl;
+    std::cout << "  --direct          писать с O_DIRECT" << std::endl;
+    std::cout << "  --compress C[:L]  сжатие файлов блоками: zlib, zstd, lz4 или none (по умолчанию)"
+              << std::endl;
+    std::cout << "  --compress-threads N  потоков сжатия (по умолчанию 2)" << std::endl;
+    std::cout << "  --keep-messages N без --write: хранить в памяти последние N сообщений" << std::endl;
+    std::cout << "  --keep-mb N       без --write: не больше N МБ памяти на сообщения" << std::endl;
+    std::cout << "  --spill PREFIX    вытесненные из памяти сообщения - в файлы PREFIX-<время>-NNNN.dat" << std::endl;
+    std::cout << "  --max-payload N   хранить только первые N байт payload сообщения" << std::endl;
+    std::cout << "  --arrow PATH      вдобавок экспортировать сообщения в файл Apache Arrow IPC" << std::endl;
+    std::cout << "  --read PATH       разобрать файл pcap/pcapng или все файлы каталога вместо захвата" << std::endl;
+    std::cout << "  --jobs N          файлов параллельно для --read, 0 - по числу ядер (по умолчанию 0)" << std::endl;
+    std::cout << "  --port N          для --read: только TCP на порту N" << std::endl;
+    std::cout << "  --filter EXPR     например \"host 10.0.0.5 port 8765,8080 opcode text from client min-size 64\"" << std::endl;
+    std::cout << "  --patterns FILE   искать в payload шаблоны из файла (по одному на строку)" << std::endl;
+    std::cout << "  --latency SEC     задержка ответа сервера, отчет раз в SEC с времени пакетов (0 - только в конце)" << std::endl;
+    std::cout << "  --latency-pair P  сопоставлять по полю JSON: \"id\" - то же значение, \"type=echo\" - ответы с type echo" << std::endl;
+    std::cout << "  --max-message-mb N  предел сборки фрагментированного сообщения (по умолчанию 64)" << std::endl;
+    std::cout << "  --max-flow-mb N   предел сборки сообщений на соединение (по умолчанию 128)" << std::endl;
+    std::cout << "  --metrics-port N  метрики в формате Prometheus на http://127.0.0.1:N/metrics" << std::endl;
+    std::cout << "  --metrics-interval SEC  сводка метрик в stderr раз в SEC секунд" << std::endl;
+    std::cout << "Конвертация файла прежнего формата в v2/v3 или пересжатие файла:" << std::endl;
+    std::cout << "  " << prog << " --convert СТАРЫЙ.dat НОВЫЙ.dat [--compress C[:L]]" << std::endl;
+    std::cout << "Экспорт файла в Apache Arrow IPC (pandas, polars, DuckDB):" << std::endl;
+    std::cout << "  " << prog << " --export-arrow ФАЙЛ.dat ВЫХОД.arrow" << std::endl;
+    std::cout << "Запрос к файлу v2/v3:" << std::endl;
+    std::cout << "  " << prog << " --query ФАЙЛ.dat \"host 10.0.0.5 opcode text since 2026-10-16T10:00:00\" [--page N]" << std::endl;
+    std::cout << "  " << prog << " --index ФАЙЛ.dat   дописать индекс запросов в файл без него" << std::endl;
+    std::cout << "Повтор файла на сервер:" << std::endl;
+    std::cout << "  " << prog << " --replay ФАЙЛ.dat ХОСТ:ПОРТ [\"ВЫРАЖЕНИЕ\"] [опции повтора]" << std::endl;
+    std::cout << "  --fast            как можно быстрее" << std::endl;
+    std::cout << "  --speed F         исходные интервалы, ускоренные в F раз (по умолчанию 1)" << std::endl;
+    std::cout << "  --rate N          N сообщений в секунду" << std::endl;
+    std::cout << "  --path PATH       путь запроса Upgrade (по умолчанию /)" << std::endl;
+    std::cout << "  --connections N   не больше N соединений с сервером (по умолчанию 1024)" << std::endl;
+    std::cout << "  --all-directions  повторять и сообщения сервера" << std::endl;
+    std::cout << "  --no-deflate      не предлагать permessage-deflate" << std::endl;
+}
+
+static const int MAX_WORKERS = 64;
+
+// Разбор опций командной строки; интерактивные вопросы остаются как были
+bool parseCaptureOptions(int argc, char* argv[], CaptureOptions& opts, DisplayOptions& display,
+                         WriterOptions& writer, OfflineOptions& offline, CaptureFilterSpec& filter,
+                         std::string& patterns, LatencyOptions& latency, MetricsOptions& metrics,
+                         MessageLimits& limits, RetentionOptions& retention, ArrowExportOptions& arrow) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        
+        if (arg == "--snaplen" && has_value) {
+            opts.snaplen = atoi(argv[++i]);
+        } else if (arg == "--buffer-mb" && has_value) {
+            // Размер буфера - int (pcap_set_buffer_size): больше 2047 МБ не
+            // задать; вне диапазона - 0, его отвергает проверка ниже
+            unsigned long mb = strtoul(argv[++i], nullptr, 10);
+            opts.buffer_size = mb > 0 && mb <= static_cast<unsigned long>(INT_MAX) / (1024 * 1024)
+                                   ? static_cast<int>(mb) * 1024 * 1024 : 0;
+        } else if (arg == "--timeout-ms" && has_value) {
+            opts.timeout_ms = atoi(argv[++i]);
+        } else if (arg == "--immediate") {
+            opts.immediate = true;
+        } else if (arg == "--af-packet") {
+            opts.af_packet = true;
+        } else if (arg == "--workers" && has_value) {
+            opts.workers = atoi(argv[++i]);
+        } else if (arg == "--fanout" && has_value) {
+            opts.fanout = atoi(argv[++i]);
+        } else if (arg == "--output" && has_value) {
+            std::string mode = argv[++i];
+            if (mode == "full") {
+                display.mode = DisplayOptions::MODE_FULL;
+            } else if (mode == "summary") {
+                display.mode = DisplayOptions::MODE_SUMMARY;
+            } else if (mode == "quiet") {
+                display.mode = DisplayOptions::MODE_QUIET;
+            } else {
+                printUsage(argv[0]);
+                return false;
+            }
+        } else if (arg == "--print-rate" && has_value) {
+            int rate = atoi(argv[++i]);
+            if (rate < 0) {
+                std::cerr << "Неверные параметры вывода" << std::endl;
+                return false;
+            }
+            display.print_rate = static_cast<unsigned>(rate);
+        } else if (arg == "--write" && has_value) {
+            writer.prefix = argv[++i];
+        } else if (arg == "--rotate-mb" && has_value) {
+            writer.rotate_bytes = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--rotate-sec" && has_value) {
+            writer.rotate_seconds = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--sync-sec" && has_value) {
+            writer.sync_seconds = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--direct") {
+            writer.direct = true;
+        } else if (arg == "--compress" && has_value) {
+            std::string err;
+            if (!parseCompression(argv[++i], writer.compression, err)) {
+                std::cerr << "Неверное сжатие: " << err << std::endl;
+                return false;
+            }
+        } else if (arg == "--compress-threads" && has_value) {
+            writer.compression.threads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--keep-messages" && has_value) {
+            retention.max_messages = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--keep-mb" && has_value) {
+            retention.max_bytes = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--spill" && has_value) {
+            retention.spill_prefix = argv[++i];
+        } else if (arg == "--max-payload" && has_value) {
+            retention.max_payload = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--arrow" && has_value) {
+            arrow.path = argv[++i];
+        } else if (arg == "--read" && has_value) {
+            offline.path = argv[++i];
+        } else if (arg == "--jobs" && has_value) {
+            offline.jobs = atoi(argv[++i]);
+        } else if (arg == "--port" && has_value) {
+            offline.port = atoi(argv[++i]);
+        } else if (arg == "--patterns" && has_value) {
+            patterns = argv[++i];
+        } else if (arg == "--latency" && has_value) {
+            latency.enabled = true;
+            latency.interval = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--latency-pair" && has_value) {
+            latency.enabled = true;
+            latency.setPairing(argv[++i]);
+            if (latency.field.empty()) {
+                std::cerr << "Неверное поле для --latency-pair" << std::endl;
+                return false;
+            }
+        } else if (arg == "--max-message-mb" && has_value) {
+            limits.max_message = static_cast<size_t>(strtoull(argv[++i], nullptr, 10)) * 1024 * 1024;
+        } else if (arg == "--max-flow-mb" && has_value) {
+            limits.max_flow = static_cast<size_t>(strtoull(argv[++i], nullptr, 10)) * 1024 * 1024;
+        } else if (arg == "--metrics-port" && has_value) {
+            metrics.port = atoi(argv[++i]);
+        } else if (arg == "--metrics-interval" && has_value) {
+            metrics.interval = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--filter" && has_value) {
+            std::string err;
+            if (!parseFilterExpression(argv[++i], filter, err)) {
+                std::cerr << "Неверный фильтр: " << err << std::endl;
+                return false;
+            }
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    
+    if (opts.snaplen <= 0 || opts.buffer_size <= 0 || opts.timeout_ms < 0 ||
+        opts.workers < 0 || opts.workers > MAX_WORKERS ||
+        opts.fanout < 0 || opts.fanout > MAX_WORKERS ||
+        offline.jobs < 0 || offline.jobs > MAX_WORKERS || offline.port < 0 || offline.port > 65535 ||
+        metrics.port < 0 || metrics.port > 65535 ||
+        writer.compression.threads == 0 || writer.compression.threads > MAX_WORKERS ||
+        limits.max_message == 0 || limits.max_flow < limits.max_message) {
+        std::cerr << "Неверные параметры захвата" << std::endl;
+        return false;
+    }
+    // Пределы памяти - для сообщений в памяти; с --write там ничего не копится
+    bool retention_set = retention.bounded() || retention.max_payload > 0 || !retention.spill_prefix.empty();
+    if (!writer.prefix.empty() && retention_set) {
+        std::cerr << "--keep-messages, --keep-mb, --spill и --max-payload не сочетаются с --write" << std::endl;
+        return false;
+    }
+    if (!retention.spill_prefix.empty() && !retention.bounded()) {
+        std::cerr << "--spill нужен предел --keep-messages или --keep-mb" << std::endl;
+        return false;
+    }
+    // Файлы вытеснения сжимаются так же, как файлы --write
+    retention.spill_compression = writer.compression;
+    return true;
+}
+
 int main(int argc, char* argv[]) {
+    // Конвертер файлов прежнего формата, без интерактивного меню
+    if ((argc == 4 || argc == 6) && std::string(argv[1]) == "--convert") {
+        WriterOptions convert_opts;
+        std::string err;
+        if (argc == 6 && std::string(argv[4]) != "--compress") {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (argc == 6 && !parseCompression(argv[5], convert_opts.compression, err)) {
+            std::cerr << "Неверное сжатие: " << err << std::endl;
+            return 1;
+        }
+        WebSocketSniffer converter;
+        converter.setWriterOptions(convert_opts);
+        return converter.convertFile(argv[2], argv[3], argc == 6) ? 0 : 1;
+    }
+    if (argc == 4 && std::string(argv[1]) == "--export-arrow") {
+        WebSocketSniffer exporter;
+        return exporter.exportArrow(argv[2], argv[3]) ? 0 : 1;
+    }
+    
+    // Запросы к сохраненным файлам - тоже без меню
+    if (argc == 3 && std::string(argv[1]) == "--index") {
+        WebSocketSniffer indexer;
+        return indexer.indexCaptureFile(argv[2]) ? 0 : 1;
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--query") {
+        std::string expr;
+        int page = 20;
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--page" && i + 1 < argc) {
+                page = atoi(argv[++i]);
+            } else if (expr.empty()) {
+                expr = arg;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        if (page <= 0) {
+            std::cerr << "Неверный размер страницы" << std::endl;
+            return 1;
+        }
+        WebSocketSniffer querier;
+        return querier.queryMessages(argv[2], expr, static_cast<size_t>(page)) ? 0 : 1;
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--replay") {
+        ReplayOptions replay;
+        if (!parseReplayTarget(argv[3], replay.host, replay.port)) {
+            std::cerr << "Неверный адрес сервера: " << argv[3] << std::endl;
+            return 1;
+        }
+        std::string expr;
+        for (int i = 4; i < argc; i++) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--fast") {
+                replay.pacing = ReplayOptions::PACE_FAST;
+            } else if (arg == "--speed" && has_value) {
+                replay.pacing = ReplayOptions::PACE_ORIGINAL;
+                replay.speed = atof(argv[++i]);
+            } else if (arg == "--rate" && has_value) {
+                replay.pacing = ReplayOptions::PACE_RATE;
+                replay.rate = atof(argv[++i]);
+            } else if (arg == "--path" && has_value) {
+                replay.path = argv[++i];
+            } else if (arg == "--connections" && has_value) {
+                replay.max_connections = static_cast<size_t>(strtoul(argv[++i], nullptr, 10));
+            } else if (arg == "--all-directions") {
+                replay.client_only = false;
+            } else if (arg == "--no-deflate") {
+                replay.deflate = false;
+            } else if (expr.empty() && arg.compare(0, 2, "--") != 0) {
+                expr = arg;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        if (replay.path.empty() || replay.path[0] != '/') replay.path = "/" + replay.path;
+        WebSocketSniffer replayer;
+        g_sniffer = &replayer;
+        signal(SIGINT, signalHandler);
+        bool ok = replayer.replayMessages(argv[2], expr, replay);
+        g_sniffer = nullptr;
+        return ok ? 0 : 1;
+    }
+    
+    CaptureOptions capture_opts;
+    DisplayOptions display_opts;
+    WriterOptions writer_opts;
+    OfflineOptions offline_opts;
+    CaptureFilterSpec filter_spec;
+    std::string patterns_path;
+    LatencyOptions latency_opts;
+    MetricsOptions metrics_opts;
+    MessageLimits message_limits;
+    RetentionOptions retention_opts;
+    ArrowExportOptions arrow_opts;
+    if (!parseCaptureOptions(argc, argv, capture_opts, display_opts, writer_opts, offline_opts, filter_spec,
+                             patterns_path, latency_opts, metrics_opts, message_limits, retention_opts,
+                             arrow_opts)) {
+        return 1;
+    }
+    
     std::cout << "╔══════════════════════════════════════════╗" << std::endl;
     std::cout << "║  WebSocket Sniffer & Replay Tool v2     ║" << std::endl;
     std::cout << "╚══════════════════════════════════════════╝" << std::endl;
     std::cout << std::endl;
     
     WebSocketSniffer sniffer;
+    sniffer.setDisplayOptions(display_opts);
+    sniffer.setWriterOptions(writer_opts);
+    sniffer.setFilter(filter_spec);
+    sniffer.setLatencyOptions(latency_opts);
+    sniffer.setMessageLimits(message_limits);
+    sniffer.setRetentionOptions(retention_opts);
+    sniffer.setArrowOptions(arrow_opts);
+    if (!patterns_path.empty() && !sniffer.loadPatterns(patterns_path)) {
+        return 1;
+    }
+    if (!sniffer.setMetricsOptions(metrics_opts)) {
+        return 1;
+    }
+    
+    // Разбор файлов: без меню и без root
+    if (!offline_opts.path.empty()) {
+        g_sniffer = &sniffer;
+        signal(SIGINT, signalHandler);
+        bool ok = sniffer.readOffline(offline_opts);
+        g_sniffer = nullptr;
+        if (ok && !sniffer.isStreaming()) {
+            sniffer.askToSave();
+        }
+        return ok ? 0 : 1;
+    }
     
     std::cout << "Режимы работы:" << std::endl;
     std::cout << "1. Захват сообщений (требуются права root/admin)" << std::endl;
@@ -568,13 +2180,11 @@ int main(int argc, char* argv[]) {
         g_sniffer = &sniffer;
         signal(SIGINT, signalHandler);
         
-        sniffer.startCapture(interface, port);
+        sniffer.startCapture(interface, port, capture_opts);
         
-        std::cout << "\n💾 Сохранить захваченные сообщения? (y/n): ";
-        char save;
-        std::cin >> save;
-        if (save == 'y' || save == 'Y') {
-            sniffer.saveMessages("captured_messages.dat");
+        // При потоковой записи все уже на диске
+        if (!sniffer.isStreaming()) {
+            sniffer.askToSave();
         }
         
         g_sniffer = nullptr;
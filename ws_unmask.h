@@ -0,0 +1,141 @@
+#ifndef WS_UNMASK_H
+#define WS_UNMASK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WS_UNMASK_X86 1
+#endif
+
+// Снятие маски WebSocket: dst[i] = src[i] ^ mask[(phase + i) % 4].
+// phase - сколько байт payload уже размаскировано (маска продолжается
+// через границы сегментов). dst может совпадать с src.
+
+// Эталонная побайтовая версия
+inline void unmaskScalar(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t mask[4], size_t phase) {
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = src[i] ^ mask[(phase + i) & 3];
+    }
+}
+
+namespace ws_unmask_detail {
+
+// Маска, повернутая так, чтобы ее байт 0 соответствовал позиции phase
+inline uint32_t rotatedMask(const uint8_t mask[4], size_t phase) {
+    uint8_t m[4];
+    for (int j = 0; j < 4; j++) m[j] = mask[(phase + j) & 3];
+    uint32_t k;
+    memcpy(&k, m, 4);
+    return k;
+}
+
+// Побайтовый пролог до выравнивания dst на align; возвращает число байт
+inline size_t alignHead(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t mask[4],
+                        size_t phase, size_t align) {
+    size_t head = (align - (reinterpret_cast<uintptr_t>(dst) & (align - 1))) & (align - 1);
+    if (head > len) head = len;
+    unmaskScalar(dst, src, head, mask, phase);
+    return head;
+}
+
+} // namespace ws_unmask_detail
+
+// Версия на 64-битных словах - работает на любой архитектуре
+inline void unmaskWord(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t mask[4], size_t phase) {
+    using namespace ws_unmask_detail;
+    size_t i = alignHead(dst, src, len, mask, phase, 8);
+
+    uint32_t k = rotatedMask(mask, phase + i);
+    uint64_t k64 = (static_cast<uint64_t>(k) << 32) | k;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        w ^= k64;
+        memcpy(dst + i, &w, 8);
+    }
+    unmaskScalar(dst + i, src + i, len - i, mask, phase + i);
+}
+
+#ifdef WS_UNMASK_X86
+inline void unmaskSSE2(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t mask[4], size_t phase) {
+    using namespace ws_unmask_detail;
+    size_t i = alignHead(dst, src, len, mask, phase, 16);
+
+    __m128i k = _mm_set1_epi32(static_cast<int>(rotatedMask(mask, phase + i)));
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(a, k));
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + i + 16), _mm_xor_si128(b, k));
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + i + 32), _mm_xor_si128(c, k));
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(a, k));
+    }
+    unmaskScalar(dst + i, src + i, len - i, mask, phase + i);
+}
+
+__attribute__((target("avx2")))
+inline void unmaskAVX2(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t mask[4], size_t phase) {
+    using namespace ws_unmask_detail;
+    size_t i = alignHead(dst, src, len, mask, phase, 32);
+
+    __m256i k = _mm256_set1_epi32(static_cast<int>(rotatedMask(mask, phase + i)));
+    for (; i + 128 <= len; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 96));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(a, k));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i + 32), _mm256_xor_si256(b, k));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i + 64), _mm256_xor_si256(c, k));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i + 96), _mm256_xor_si256(d, k));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(a, k));
+    }
+    unmaskScalar(dst + i, src + i, len - i, mask, phase + i);
+}
+#endif
+
+typedef void (*UnmaskFn)(uint8_t*, const uint8_t*, size_t, const uint8_t*, size_t);
+
+// Выбор реализации по возможностям процессора (один раз за процесс)
+inline UnmaskFn selectUnmask(const char** name = nullptr) {
+#ifdef WS_UNMASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        if (name) *name = "avx2";
+        return unmaskAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        if (name) *name = "sse2";
+        return unmaskSSE2;
+    }
+#endif
+    if (name) *name = "word";
+    return unmaskWord;
+}
+
+// Короткие payload (чат, ping/pong) дешевле снять словами, чем
+// платить за косвенный вызов и пролог выравнивания под SIMD
+inline void unmaskPayload(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t mask[4], size_t phase) {
+    static const UnmaskFn impl = selectUnmask();
+    if (len < 8) {
+        unmaskScalar(dst, src, len, mask, phase);
+    } else if (len < 128) {
+        unmaskWord(dst, src, len, mask, phase);
+    } else {
+        impl(dst, src, len, mask, phase);
+    }
+}
+
+#endif // WS_UNMASK_H
@@ -0,0 +1,644 @@
+#ifndef WS_WRITER_H
+#define WS_WRITER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ws_message.h"
+#include "ws_capfile.h"
+#include "ws_codec.h"
+#include "ws_index.h"
+
+// Параметры потоковой записи
+struct WriterOptions {
+    std::string prefix;       // путь и начало имени файлов, пусто - запись выключена
+    uint64_t rotate_bytes;    // новый файл после стольких байт, 0 - без ротации по размеру
+    unsigned rotate_seconds;  // новый файл раз в столько секунд, 0 - без ротации по времени
+    unsigned sync_seconds;    // интервал сброса на диск (fdatasync)
+    bool direct;              // писать с O_DIRECT, мимо page cache
+    std::string path;         // один файл с этим именем вместо prefix-<время>-NNNN.dat
+    CompressionOptions compression;  // сжатие блоками - файлы v3
+
+    WriterOptions() : rotate_bytes(1024ull * 1024 * 1024), rotate_seconds(3600),
+                      sync_seconds(1), direct(false) {}
+};
+
+// Потоковая запись перехваченных сообщений вместо сохранения при выходе.
+// Поток сохранения только копирует запись в текущий буфер (под мьютексом,
+// без системных вызовов); полные буферы пишет на диск фоновый поток
+// большими write(), раз в sync_seconds забирая и недозаполненный буфер и
+// делая fdatasync. Буферов фиксированное число, так что память
+// ограничена; если диск не успевает, сохранение ждет свободный буфер.
+//
+// Каждый файл - файл захвата v2 (ws_capfile.h). Смещения записей
+// и индекс запросов (ws_index.h) копятся в памяти, при закрытии файла
+// фоновый поток дописывает оба индекса и проставляет счетчик в заголовке;
+// файл, который не успели закрыть, читается проходом по записям.
+//
+// Со сжатием (файл v3) записи копятся в блоки по BLOCK_SIZE; полный блок
+// ставится в очередь записи и одновременно отдается пулу потоков сжатия.
+// Фоновый поток пишет блоки в порядке очереди, дожидаясь сжатия каждого,
+// и собирает индекс блоков. Число блоков тоже фиксировано: если сжатие
+// или диск не успевают, сохранение ждет свободный блок.
+class CaptureWriter {
+private:
+    struct Block {
+        std::vector<CaptureRecord> records;
+        std::vector<uint8_t> payload;  // payload записей подряд
+        std::vector<uint8_t> packed;   // заголовок блока, сжатые записи, выравнивание
+        uint64_t first_record;
+        uint64_t raw_bytes;            // те же записи в формате v2
+        uint64_t file;                 // номер файла - для учета его размера
+        bool done;                     // сжат, можно писать
+
+        size_t size() const { return records.size() * sizeof(CaptureRecord) + payload.size(); }
+
+        void clear() {
+            records.clear();
+            payload.clear();
+            raw_bytes = 0;
+            done = false;
+        }
+    };
+
+    struct Chunk {
+        uint8_t* data;
+        size_t size;
+        Block* block;      // со сжатием - блок вместо буфера
+        bool end_of_file;  // после этого куска файл закрывается
+        CaptureFileHeader header;     // для end_of_file: счетчик и время
+        std::vector<uint64_t> index;  // для end_of_file: смещения записей
+        QueryIndexBuilder query;      // для end_of_file: индекс запросов
+    };
+
+    static const size_t BUFFER_SIZE = 4 * 1024 * 1024;
+    static const size_t BUFFER_COUNT = 8;
+    static const size_t DIRECT_ALIGN = 4096;
+    static const size_t BLOCK_SIZE = 256 * 1024;
+    static const size_t BLOCK_SLACK = 64 * 1024;  // запас под последнюю запись блока
+
+    WriterOptions opts;
+    std::thread thread;
+    std::vector<std::thread> compressors;
+    std::vector<std::unique_ptr<Block> > block_pool;
+
+    // Общее состояние под мьютексом
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable free_cv;
+    std::deque<Chunk> full;
+    std::vector<uint8_t*> free_buffers;
+    std::vector<uint8_t*> buffers;
+    Chunk current;
+    bool stopping;
+    std::condition_variable compress_cv;
+    std::condition_variable done_cv;
+    std::deque<Block*> compress_queue;
+    std::vector<Block*> free_blocks;
+    bool compress_stopping;
+    uint64_t file_serial;    // номер текущего файла с начала open()
+    uint64_t file_bytes;     // размер текущего файла (несжатые еще блоки - целиком)
+    uint64_t file_records;
+    time_t file_started;
+    std::vector<uint64_t> file_offsets;
+    QueryIndexBuilder file_query;
+    int64_t file_first_ts;
+    int64_t file_last_ts;
+
+    // Только поток сохранения
+    CaptureRecord scratch;
+
+    // Только фоновый поток
+    int fd;
+    uint64_t fd_size;
+    unsigned file_index;
+    bool failed;
+    uint8_t* direct_buf;     // O_DIRECT: выровненный буфер и его заполнение
+    size_t direct_fill;
+    uint64_t direct_offset;
+    std::vector<std::string> file_names;
+    std::vector<uint8_t> query_bytes;
+    std::vector<CaptureBlockEntry> file_blocks;
+
+    std::atomic<uint64_t> total_bytes;
+    std::atomic<uint64_t> total_raw;
+    std::atomic<uint64_t> total_records;
+    std::atomic<uint64_t> total_stalls;
+    std::atomic<bool> any_failed;
+
+    CaptureWriter(const CaptureWriter&);
+    CaptureWriter& operator=(const CaptureWriter&);
+
+    void reportError(const char* what) {
+        if (!failed) {
+            std::cerr << "❌ Ошибка записи (" << what << "): " << strerror(errno) << std::endl;
+        }
+        failed = true;
+        any_failed = true;
+    }
+
+    bool compressing() const { return opts.compression.enabled(); }
+    uint32_t fileVersion() const { return compressing() ? CAPTURE_VERSION_BLOCKS : CAPTURE_VERSION; }
+
+    uint8_t* takeFreeLocked() {
+        if (free_buffers.empty()) return nullptr;
+        uint8_t* p = free_buffers.back();
+        free_buffers.pop_back();
+        return p;
+    }
+
+    Block* takeFreeBlockLocked() {
+        if (free_blocks.empty()) return nullptr;
+        Block* b = free_blocks.back();
+        free_blocks.pop_back();
+        return b;
+    }
+
+    // Отдает текущий буфер фоновому потоку, а непустой блок - еще и на сжатие
+    void handoffLocked(bool end_of_file) {
+        full.push_back(Chunk());
+        Chunk& c = full.back();
+        c.data = current.data;
+        c.size = current.size;
+        c.block = nullptr;
+        c.end_of_file = end_of_file;
+
+        current.data = takeFreeLocked();
+        current.size = 0;
+        if (current.block && !current.block->records.empty()) {
+            c.block = current.block;
+            c.block->file = file_serial;
+            compress_queue.push_back(c.block);
+            compress_cv.notify_one();
+            current.block = takeFreeBlockLocked();
+        }
+        if (end_of_file) {
+            initCaptureHeader(c.header, fileVersion());
+            c.header.record_count = file_records;
+            c.header.first_timestamp = file_first_ts;
+            c.header.last_timestamp = file_last_ts;
+            c.index.swap(file_offsets);
+            c.query.swap(file_query);
+            startFileLocked();
+        }
+        work_cv.notify_one();
+    }
+
+    void startFileLocked() {
+        file_serial++;
+        file_bytes = sizeof(CaptureFileHeader);
+        file_records = 0;
+        file_started = time(nullptr);
+        file_offsets.clear();
+        file_query.clear();
+        file_first_ts = 0;
+        file_last_ts = 0;
+    }
+
+    void copyLocked(std::unique_lock<std::mutex>& lock, const uint8_t* data, size_t len) {
+        while (len > 0) {
+            while (!current.data) {
+                total_stalls++;
+                free_cv.wait(lock);
+                current.data = takeFreeLocked();
+            }
+            size_t take = std::min(len, BUFFER_SIZE - current.size);
+            memcpy(current.data + current.size, data, take);
+            current.size += take;
+            data += take;
+            len -= take;
+            if (current.size == BUFFER_SIZE) handoffLocked(false);
+        }
+    }
+
+    void appendBlockLocked(std::unique_lock<std::mutex>& lock, const WebSocketMessage& msg, uint64_t record_size) {
+        while (!current.block) {
+            total_stalls++;
+            free_cv.wait(lock);
+            current.block = takeFreeBlockLocked();
+        }
+        Block& b = *current.block;
+        if (b.records.empty()) b.first_record = file_records;
+        b.records.push_back(scratch);
+        b.payload.insert(b.payload.end(), msg.payload.data(), msg.payload.data() + msg.payload.size());
+        b.raw_bytes += record_size;
+    }
+
+    // --- Потоки сжатия ---
+
+    // Блок в формате v3 (ws_capfile.h): заголовки по столбцам, payload
+    // подряд; raw - буфер потока сжатия
+    void packBlock(BlockCompressor& compressor, Block& b, std::vector<uint8_t>& raw) {
+        size_t n = b.records.size();
+        raw.resize(b.size());
+        packBlockRecords(b.records.data(), n, raw.data());
+        if (!b.payload.empty()) memcpy(raw.data() + n * sizeof(CaptureRecord), b.payload.data(), b.payload.size());
+
+        CaptureBlockHeader h;
+        memset(&h, 0, sizeof(h));
+        h.mark = CAPTURE_BLOCK_MARK;
+        h.record_count = static_cast<uint32_t>(n);
+        h.first_record = b.first_record;
+        h.raw_size = static_cast<uint32_t>(raw.size());
+        h.codec = opts.compression.codec;
+        if (!compressor.compress(raw.data(), raw.size(), b.packed, sizeof(h))) {
+            // Несжимаемые данные (уже сжатый бинарный payload) - как есть
+            h.codec = BLOCK_CODEC_NONE;
+            b.packed.resize(sizeof(h) + raw.size());
+            memcpy(b.packed.data() + sizeof(h), raw.data(), raw.size());
+        }
+        h.packed_size = static_cast<uint32_t>(b.packed.size() - sizeof(h));
+        h.checksum = blockChecksum(b.packed.data() + sizeof(h), h.packed_size);
+        memcpy(b.packed.data(), &h, sizeof(h));
+        b.packed.resize(b.packed.size() + capturePadding(h.packed_size), 0);
+    }
+
+    void compressLoop() {
+        BlockCompressor compressor(opts.compression.codec, opts.compression.level);
+        std::vector<uint8_t> raw;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            while (compress_queue.empty() && !compress_stopping) compress_cv.wait(lock);
+            if (compress_queue.empty()) break;
+            Block* b = compress_queue.front();
+            compress_queue.pop_front();
+            lock.unlock();
+            packBlock(compressor, *b, raw);
+            lock.lock();
+            // Ротация по размеру - по тому, что действительно ляжет на диск
+            if (b->file == file_serial) file_bytes = file_bytes - b->raw_bytes + b->packed.size();
+            b->done = true;
+            done_cv.notify_one();
+        }
+    }
+
+    // --- Фоновый поток ---
+
+    bool writeAll(uint64_t offset, const uint8_t* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = pwrite(fd, data, len, static_cast<off_t>(offset));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                reportError("write");
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    // O_DIRECT: хвост буфера дописывается блоком с нулями в конце; смещение
+    // не сдвигается, и при следующей записи блок перезаписывается целиком
+    void flushDirectTail() {
+        if (direct_fill == 0) return;
+        size_t padded = (direct_fill + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+        memset(direct_buf + direct_fill, 0, padded - direct_fill);
+        writeAll(direct_offset, direct_buf, padded);
+    }
+
+    void writeBytes(const uint8_t* data, size_t len) {
+        if (failed) return;
+        if (!opts.direct) {
+            if (writeAll(fd_size, data, len)) fd_size += len;
+            return;
+        }
+        while (len > 0) {
+            size_t take = std::min(len, BUFFER_SIZE - direct_fill);
+            memcpy(direct_buf + direct_fill, data, take);
+            direct_fill += take;
+            data += take;
+            len -= take;
+            fd_size += take;
+            if (direct_fill == BUFFER_SIZE) {
+                writeAll(direct_offset, direct_buf, BUFFER_SIZE);
+                direct_offset += BUFFER_SIZE;
+                direct_fill = 0;
+            }
+        }
+    }
+
+    void openFile() {
+        char stamp[32];
+        time_t now = time(nullptr);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+        char index[16];
+        snprintf(index, sizeof(index), "%04u", ++file_index);
+        std::string name = opts.path.empty() ? opts.prefix + "-" + stamp + "-" + index + ".dat" : opts.path;
+
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        fd = ::open(name.c_str(), flags | (opts.direct ? O_DIRECT : 0), 0644);
+        if (fd < 0 && opts.direct && errno == EINVAL) {
+            // Файловая система без O_DIRECT (tmpfs и т.п.)
+            std::cerr << "⚠️  O_DIRECT не поддерживается для " << name << ", обычная запись" << std::endl;
+            opts.direct = false;
+            fd = ::open(name.c_str(), flags, 0644);
+        }
+        if (fd < 0) {
+            reportError(name.c_str());
+            return;
+        }
+        failed = false;
+        fd_size = 0;
+        direct_fill = 0;
+        direct_offset = 0;
+        file_names.push_back(name);
+
+        // Заголовок без счетчика и индекса - до закрытия файла
+        CaptureFileHeader header;
+        initCaptureHeader(header, fileVersion());
+        writeBytes(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    }
+
+    void syncFile() {
+        if (fd < 0) return;
+        if (opts.direct) flushDirectTail();
+        if (fdatasync(fd) != 0) reportError("fdatasync");
+    }
+
+    void finishFile(Chunk& c) {
+        if (fd < 0) return;
+        if (opts.direct) {
+            flushDirectTail();
+            // Индекс, заголовок и точный размер - уже без O_DIRECT
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            if (ftruncate(fd, static_cast<off_t>(fd_size)) != 0) reportError("ftruncate");
+        }
+        // Сначала индексы на диск, потом заголовок, который на них указывает
+        CaptureFileHeader header = c.header;
+        header.index_offset = fd_size;
+        uint64_t index_bytes = c.index.size() * sizeof(uint64_t);
+        if (compressing()) {
+            uint64_t n = file_blocks.size();
+            index_bytes = sizeof(n) + n * sizeof(CaptureBlockEntry);
+            writeAll(fd_size, reinterpret_cast<const uint8_t*>(&n), sizeof(n));
+            if (n > 0) {
+                writeAll(fd_size + sizeof(n), reinterpret_cast<const uint8_t*>(&file_blocks[0]),
+                         n * sizeof(CaptureBlockEntry));
+            }
+            file_blocks.clear();
+        } else if (!c.index.empty()) {
+            writeAll(fd_size, reinterpret_cast<const uint8_t*>(&c.index[0]), index_bytes);
+        }
+        if (!c.query.full()) {
+            c.query.serialize(query_bytes);
+            if (writeAll(fd_size + index_bytes, &query_bytes[0], query_bytes.size())) {
+                header.query_index = fd_size + index_bytes;
+            }
+        }
+        c.query.clear();
+        if (fdatasync(fd) != 0) reportError("fdatasync");
+        writeAll(0, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+        if (fdatasync(fd) != 0) reportError("fdatasync");
+        ::close(fd);
+        fd = -1;
+    }
+
+    // Блоки пишутся в порядке очереди: следующий ждет, пока его сожмут
+    void writeBlock(Block& b) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!b.done) done_cv.wait(lock);
+        }
+        if (fd < 0) openFile();
+        if (fd >= 0) {
+            CaptureBlockEntry entry = {fd_size, b.first_record};
+            file_blocks.push_back(entry);
+            writeBytes(b.packed.data(), b.packed.size());
+        }
+        total_bytes += b.packed.size();
+        total_raw += b.raw_bytes;
+    }
+
+    void writeChunk(Chunk& c) {
+        if (c.size > 0) {
+            if (fd < 0) openFile();
+            if (fd >= 0) writeBytes(c.data, c.size);
+            total_bytes += c.size;
+            total_raw += c.size;
+        }
+        if (c.block) writeBlock(*c.block);
+        if (c.end_of_file) finishFile(c);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        time_t last_sync = time(nullptr);
+        std::deque<Chunk> batch;
+
+        for (;;) {
+            if (full.empty() && !stopping) {
+                work_cv.wait_for(lock, std::chrono::milliseconds(200));
+            }
+
+            time_t now = time(nullptr);
+            bool sync_due = now - last_sync >= static_cast<time_t>(opts.sync_seconds);
+            bool rotate_due = opts.rotate_seconds > 0 && file_records > 0 &&
+                              now - file_started >= static_cast<time_t>(opts.rotate_seconds);
+            bool finish = stopping;
+
+            // Недозаполненный буфер не должен лежать в памяти дольше
+            // интервала синхронизации
+            bool pending = current.size > 0 || (current.block && !current.block->records.empty());
+            if (finish || rotate_due || (sync_due && pending)) {
+                handoffLocked(finish || rotate_due);
+            }
+
+            batch.swap(full);
+            lock.unlock();
+
+            for (size_t i = 0; i < batch.size(); i++) {
+                writeChunk(batch[i]);
+            }
+            if (sync_due) {
+                syncFile();
+                last_sync = now;
+            }
+
+            lock.lock();
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (batch[i].data) free_buffers.push_back(batch[i].data);
+                if (batch[i].block) {
+                    batch[i].block->clear();
+                    free_blocks.push_back(batch[i].block);
+                }
+            }
+            batch.clear();
+            free_cv.notify_all();
+
+            if (finish) break;
+        }
+    }
+
+public:
+    CaptureWriter() : stopping(false), compress_stopping(false), file_serial(0),
+                      file_bytes(0), file_records(0), file_started(0),
+                      file_first_ts(0), file_last_ts(0),
+                      fd(-1), fd_size(0), file_index(0), failed(false),
+                      direct_buf(nullptr), direct_fill(0), direct_offset(0),
+                      total_bytes(0), total_raw(0), total_records(0), total_stalls(0), any_failed(false) {
+        current.data = nullptr;
+        current.size = 0;
+        current.block = nullptr;
+        current.end_of_file = false;
+    }
+
+    ~CaptureWriter() {
+        close();
+        for (size_t i = 0; i < buffers.size(); i++) free(buffers[i]);
+        free(direct_buf);
+    }
+
+    bool open(const WriterOptions& options, std::string& err) {
+        opts = options;
+        if (opts.sync_seconds == 0) opts.sync_seconds = 1;
+
+        if (opts.compression.threads == 0) opts.compression.threads = 1;
+        if (!opts.path.empty()) {
+            opts.rotate_bytes = 0;
+            opts.rotate_seconds = 0;
+        }
+
+        // Без сжатия записи копятся в буферы, со сжатием - в блоки: по два
+        // на поток сжатия и столько же в очереди на диск
+        if (!compressing() && buffers.empty()) {
+            for (size_t i = 0; i < BUFFER_COUNT; i++) {
+                void* p = nullptr;
+                if (posix_memalign(&p, DIRECT_ALIGN, BUFFER_SIZE) != 0) {
+                    err = "нет памяти под буферы записи";
+                    return false;
+                }
+                buffers.push_back(static_cast<uint8_t*>(p));
+            }
+        }
+        if (!direct_buf) {
+            void* p = nullptr;
+            if (posix_memalign(&p, DIRECT_ALIGN, BUFFER_SIZE) != 0) {
+                err = "нет памяти под буферы записи";
+                return false;
+            }
+            direct_buf = static_cast<uint8_t*>(p);
+        }
+        size_t blocks_wanted = compressing() ? 4 * static_cast<size_t>(opts.compression.threads) : 0;
+        while (block_pool.size() < blocks_wanted) {
+            block_pool.push_back(std::unique_ptr<Block>(new Block()));
+            block_pool.back()->records.reserve(BLOCK_SIZE / sizeof(CaptureRecord));
+            block_pool.back()->payload.reserve(BLOCK_SIZE + BLOCK_SLACK);
+        }
+
+        // Проверяем, что каталог доступен для записи, до начала захвата
+        std::string probe = (opts.path.empty() ? opts.prefix : opts.path) + ".probe";
+        int probe_fd = ::open(probe.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (probe_fd < 0) {
+            err = probe + ": " + strerror(errno);
+            return false;
+        }
+        ::close(probe_fd);
+        unlink(probe.c_str());
+
+        free_buffers = compressing() ? std::vector<uint8_t*>() : buffers;
+        free_blocks.clear();
+        for (size_t i = 0; i < blocks_wanted; i++) {
+            block_pool[i]->clear();
+            free_blocks.push_back(block_pool[i].get());
+        }
+        full.clear();
+        compress_queue.clear();
+        current.data = takeFreeLocked();
+        current.size = 0;
+        current.block = takeFreeBlockLocked();
+        stopping = false;
+        compress_stopping = false;
+        startFileLocked();
+        file_names.clear();
+        file_blocks.clear();
+        total_bytes = 0;
+        total_raw = 0;
+        total_records = 0;
+        total_stalls = 0;
+        any_failed = false;
+
+        for (unsigned i = 0; compressing() && i < opts.compression.threads; i++) {
+            compressors.push_back(std::thread(&CaptureWriter::compressLoop, this));
+        }
+        thread = std::thread(&CaptureWriter::run, this);
+        return true;
+    }
+
+    // Вызывается из потока сохранения
+    void append(const WebSocketMessage& msg) {
+        static const uint8_t zeros[8] = {0};
+        encodeCaptureRecord(msg, scratch);
+        uint64_t record_size = captureRecordSize(msg.payload.size());
+
+        std::unique_lock<std::mutex> lock(mutex);
+        // Номера записей в индексе запросов 32-битные - ротация и по их числу
+        // (кроме записи в один файл: он остается без индекса запросов)
+        bool over_size = opts.rotate_bytes > 0 && file_bytes + record_size > opts.rotate_bytes;
+        bool index_full = file_query.full() && opts.path.empty();
+        if (file_records > 0 && (over_size || index_full)) {
+            handoffLocked(true);
+        }
+        file_query.add(scratch);
+        if (file_records == 0) file_first_ts = scratch.timestamp_ns;
+        file_last_ts = scratch.timestamp_ns;
+        if (compressing()) {
+            appendBlockLocked(lock, msg, record_size);
+        } else {
+            file_offsets.push_back(file_bytes);
+            copyLocked(lock, reinterpret_cast<const uint8_t*>(&scratch), sizeof(scratch));
+            copyLocked(lock, msg.payload.data(), msg.payload.size());
+            copyLocked(lock, zeros, capturePadding(msg.payload.size()));
+        }
+        file_bytes += record_size;
+        file_records++;
+        total_records++;
+        if (current.block && current.block->size() >= BLOCK_SIZE) handoffLocked(false);
+    }
+
+    // Дописывает все и закрывает текущий файл
+    void close() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_cv.notify_one();
+        thread.join();
+        // Потоки сжатия - после фонового: он ждет от них последние блоки
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            compress_stopping = true;
+        }
+        compress_cv.notify_all();
+        for (size_t i = 0; i < compressors.size(); i++) compressors[i].join();
+        compressors.clear();
+    }
+
+    uint64_t records() const { return total_records; }
+    uint64_t bytesWritten() const { return total_bytes; }
+    uint64_t rawBytes() const { return total_raw; }  // записи до сжатия
+    bool ok() const { return !any_failed; }          // без ошибок записи; после close()
+    uint64_t stalls() const { return total_stalls; }
+    const std::vector<std::string>& files() const { return file_names; }
+};
+
+#endif // WS_WRITER_H